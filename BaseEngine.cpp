@@ -32,6 +32,8 @@
 #define DEFAULT_SND_AUDIO_FRAME_SIZE_MS 20
 #define DEFAULT_SND_AUDIO_FRAME_BUNDLE 3
 
+#define MAX_INPUT_STREAM_DURATION 2.0 //seconds, input bundle stream is restarted so a receiver that lost track of it can recover
+
 
 #ifndef max
 #	define max(a,b) ((a) > (b) ? (a) : (b))
@@ -130,7 +132,9 @@ namespace HQRemote {
 	BaseEngine::BaseEngine(std::shared_ptr<IConnectionHandler> connHandler, std::shared_ptr<IAudioCapturer> audioCapturer)
 		: m_connHandler(connHandler), m_audioCapturer(audioCapturer), 
 		m_running(false), m_sendAudio(false),
-		m_lastDecodedAudioPacketId(0), m_totalRecvAudioPackets(0)
+		m_lastDecodedAudioPacketId(0), m_totalRecvAudioPackets(0),
+		m_inputBatchStartTime64(0), m_inputBatchWindowMs(0),
+		m_inputStreamGeneration(0), m_inputStreamStartTime64(0), m_inputStreamOverArq(false)
 	{
 		if (!m_connHandler)
 		{
@@ -144,21 +148,328 @@ namespace HQRemote {
 		m_connHandler->unregisterDelegate(this);
 	}
 
+	bool BaseEngine::remoteSupportsCompactEvents() const {
+		return m_connHandler->getRemoteProtocolVersion() >= 3;
+	}
+
+	CompressionCodec BaseEngine::negotiateCompressionCodec(CompressionCodec preferred) const {
+		if (m_connHandler->getRemoteProtocolVersion() >= 4)
+			return preferred;
+		return COMPRESSION_CODEC_ZLIB;
+	}
+
+	ConstDataRef BaseEngine::serializeEventForSending(const PlainEvent& event, uint32_t& msgFlags) const {
+		if (remoteSupportsCompactEvents())
+		{
+			msgFlags = IConnectionHandler::MSG_FLAG_COMPACT;
+			return event.serializeCompact();
+		}
+
+		msgFlags = 0;
+		return event.serialize();
+	}
+
 	void BaseEngine::sendEvent(const ConstEventRef& event) {
-		m_connHandler->sendData(*event);
+		sendEvent(*event);
 	}
 
 	void BaseEngine::sendEventUnreliable(const ConstEventRef& event) {
-		m_connHandler->sendDataUnreliable(*event);
+		sendEventUnreliable(*event);
 	}
 
 	void BaseEngine::sendEvent(const PlainEvent& event) {
-		m_connHandler->sendData(event);
+		//large messages must not hold back other events
+		if (event.event.type == MESSAGE)
+		{
+			sendEventOnStream(event, MESSAGE_EVENT_STREAM);
+			return;
+		}
+
+		uint32_t msgFlags;
+		auto data = serializeEventForSending(event, msgFlags);
+		m_connHandler->sendData(data, msgFlags);
 	}
 
 	void BaseEngine::sendEventUnreliable(const PlainEvent& event)
 	{
-		m_connHandler->sendDataUnreliable(event);
+		uint32_t msgFlags;
+		auto data = serializeEventForSending(event, msgFlags);
+		m_connHandler->sendDataUnreliable(data, msgFlags);
+	}
+
+	bool BaseEngine::sendEventOnStream(const ConstEventRef& event, unsigned int streamIdx) {
+		return sendEventOnStream(*event, streamIdx);
+	}
+
+	bool BaseEngine::sendEventOnStream(const PlainEvent& event, unsigned int streamIdx) {
+		uint32_t msgFlags;
+		auto data = serializeEventForSending(event, msgFlags);
+		return m_connHandler->sendDataOnArqStream(data, streamIdx, msgFlags);
+	}
+
+	void BaseEngine::setInputBatchWindow(uint32_t windowMs) {
+		if (windowMs == 0)
+			flushInputEvents();
+
+		m_inputBatchWindowMs = windowMs;
+
+		std::lock_guard<std::mutex> lg(m_inputBatchLock);
+		m_inputBatchCv.notify_all();
+	}
+
+	void BaseEngine::sendInputEvent(const PlainEvent& event) {
+		switch (event.event.type) {
+		case TOUCH_BEGAN: case TOUCH_MOVED: case TOUCH_ENDED: case TOUCH_CANCELLED:
+			break;
+		default:
+		{
+			//send pending touches first so that input events keep their order
+			std::lock_guard<std::mutex> lg(m_inputBatchLock);
+			if (m_pendingInputEvents.size() > 0)
+			{
+				sendInputBatch(m_pendingInputEvents);
+				m_pendingInputEvents.clear();
+			}
+
+			sendEventOnStream(event, INPUT_EVENT_STREAM);
+		}
+			return;
+		}
+
+		auto stampedEventRef = std::make_shared<PlainEvent>(event);
+		auto& stampedEvent = stampedEventRef->event;
+		stampedEvent.touchData.timestamp = (uint64_t)(timeSinceStart() * 1000000.0);
+		if (stampedEvent.touchData.timestamp == 0)//0 means unknown
+			stampedEvent.touchData.timestamp = 1;
+
+		if (m_inputBatchWindowMs == 0)
+		{
+			sendEventOnStream(stampedEventRef, INPUT_EVENT_STREAM);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lg(m_inputBatchLock);
+
+		if (stampedEvent.type == TOUCH_MOVED) {
+			//replace pending move of the same touch, unless another event of that touch came after it
+			for (auto ite = m_pendingInputEvents.rbegin(); ite != m_pendingInputEvents.rend(); ++ite) {
+				auto& pendingEvent = (*ite)->event;
+				if (pendingEvent.touchData.id != stampedEvent.touchData.id)
+					continue;
+
+				if (pendingEvent.type == TOUCH_MOVED)
+				{
+					pendingEvent.touchData = stampedEvent.touchData;
+					return;
+				}
+				break;
+			}
+		}
+
+		if (m_pendingInputEvents.empty())
+		{
+			//first event of new batch, wake up batching thread
+			m_inputBatchStartTime64 = getTimeCheckPoint64();
+			m_inputBatchCv.notify_all();
+		}
+
+		m_pendingInputEvents.push_back(stampedEventRef);
+	}
+
+	void BaseEngine::flushInputEvents() {
+		//send while holding the lock so that batches keep their order
+		std::lock_guard<std::mutex> lg(m_inputBatchLock);
+		if (m_pendingInputEvents.empty())
+			return;
+
+		sendInputBatch(m_pendingInputEvents);
+		m_pendingInputEvents.clear();
+	}
+
+	void BaseEngine::sendInputBatch(const CompressedEvents::EventList& events) {
+		//input has its own stream so that it doesn't wait behind MESSAGE events. Remote sides older than
+		//protocol version 2 don't have ARQ streams, sendEventOnStream() falls back to the reliable channel for them
+		if (events.size() == 1)
+		{
+			sendEventOnStream(events.front(), INPUT_EVENT_STREAM);
+			return;
+		}
+
+		try {
+			//consecutive batches are similar too, a zlib stream (protocol version 11+) lets them refer to the previous ones
+			if (m_connHandler->getRemoteProtocolVersion() >= 11 && sendStreamedInputBatch(events))
+				return;
+
+			//events of a batch are small & similar, preset dictionary (protocol version 5+) helps the most here
+			std::unique_ptr<CompressedEvents> bundleEvent;
+			if (m_connHandler->getRemoteProtocolVersion() >= 5)
+				bundleEvent.reset(new CompressedEvents(0, events, true, COMPRESSION_CODEC_ZLIB, true));
+			else
+				bundleEvent.reset(new CompressedEvents(-1, events, remoteSupportsCompactEvents(), negotiateCompressionCodec(COMPRESSION_CODEC_STORED)));
+
+			if (bundleEvent->event.type == COMPRESSED_EVENTS)
+			{
+				sendEventOnStream(*bundleEvent, INPUT_EVENT_STREAM);
+				return;
+			}
+		}
+		catch (...) {
+		}
+
+		//bundling failed, send individually
+		for (auto& event : events)
+			sendEventOnStream(event, INPUT_EVENT_STREAM);
+	}
+
+	bool BaseEngine::sendStreamedInputBatch(const CompressedEvents::EventList& events) {
+		//must be called with m_inputBatchLock held.
+		//Bundles switching between ARQ & reliable channel may arrive out of order, start a new stream when that happens
+		auto curTime64 = getTimeCheckPoint64();
+		bool overArq = m_connHandler->isArqAvailable();
+		bool startOfStream = m_inputStreamCompressor == nullptr || overArq != m_inputStreamOverArq ||
+			getElapsedTime64(m_inputStreamStartTime64, curTime64) >= MAX_INPUT_STREAM_DURATION;
+		if (startOfStream)
+		{
+			m_inputStreamCompressor.reset(new ZlibStreamCompressor(0, &CompressedEvents::presetDictionary()));
+			m_inputStreamGeneration++;
+			m_inputStreamStartTime64 = curTime64;
+			m_inputStreamOverArq = overArq;
+		}
+
+		CompressedEvents bundleEvent(*m_inputStreamCompressor, m_inputStreamGeneration, startOfStream, events);
+		if (bundleEvent.event.type != COMPRESSED_EVENTS)
+		{
+			//stream state is unknown after a failure
+			m_inputStreamCompressor = nullptr;
+			return false;
+		}
+
+		//remote side won't be able to follow the stream if the bundle is dropped
+		if (!sendEventOnStream(bundleEvent, INPUT_EVENT_STREAM))
+			m_inputStreamCompressor = nullptr;
+
+		return true;
+	}
+
+	bool BaseEngine::decompressInputStream(CompressedEvents& bundle) {
+		std::lock_guard<std::mutex> lg(m_inputStreamDecompressorLock);
+
+		auto generation = bundle.streamGeneration();
+		if (bundle.startsStream())
+		{
+			//keep the previous generation only, its last bundles may still be arriving on the other channel
+			auto prevGeneration = (generation - 1) & 0xff;
+			for (auto ite = m_inputStreamDecompressors.begin(); ite != m_inputStreamDecompressors.end();) {
+				if (ite->first != prevGeneration)
+					ite = m_inputStreamDecompressors.erase(ite);
+				else
+					++ite;
+			}
+
+			m_inputStreamDecompressors[generation].reset(new ZlibStreamDecompressor(&CompressedEvents::presetDictionary()));
+		}
+
+		auto ite = m_inputStreamDecompressors.find(generation);
+		if (ite == m_inputStreamDecompressors.end())
+		{
+			HQRemote::LogErr("BaseEngine: dropped input bundle of unknown stream %u\n", generation);
+			return false;
+		}
+
+		try {
+			bundle.decompressStream(*ite->second);
+		}
+		catch (...) {
+			//lost track of this stream, sender will start a new one soon
+			HQRemote::LogErr("BaseEngine: failed to decompress input bundle of stream %u\n", generation);
+			m_inputStreamDecompressors.erase(ite);
+			return false;
+		}
+
+		return true;
+	}
+
+	void BaseEngine::inputBatchProc() {
+		SetCurrentThreadName("inputBatchThread");
+
+		while (m_running) {
+			std::unique_lock<std::mutex> lk(m_inputBatchLock);
+
+			//wait until we have at least one pending input event
+			m_inputBatchCv.wait(lk, [this] {return !(m_running && m_pendingInputEvents.size() == 0); });
+
+			if (m_pendingInputEvents.size() > 0) {
+				auto elapsedMs = getElapsedTime64(m_inputBatchStartTime64, getTimeCheckPoint64()) * 1000.0;
+				auto windowMs = (double)m_inputBatchWindowMs;
+				if (elapsedMs < windowMs)
+				{
+					//wait for the rest of the batch window, then check again
+					m_inputBatchCv.wait_for(lk, std::chrono::microseconds((int64_t)((windowMs - elapsedMs) * 1000.0)));
+					continue;
+				}
+
+				//send while holding the lock so that batches keep their order
+				sendInputBatch(m_pendingInputEvents);
+				m_pendingInputEvents.clear();
+			}
+		}//while (m_running)
+	}
+
+	void BaseEngine::updateTouchState(const Event& event) {
+		std::lock_guard<std::mutex> lg(m_touchStateLock);
+
+		auto& state = m_touchStates[event.touchData.id];
+		state.id = event.touchData.id;
+		state.x = event.touchData.x;
+		state.y = event.touchData.y;
+		state.phase = event.type;
+		state.timestamp = event.touchData.timestamp;
+		state.receivedTime = timeSinceStart();
+	}
+
+	bool BaseEngine::getTouchState(int32_t id, TouchState& state) const {
+		std::lock_guard<std::mutex> lg(m_touchStateLock);
+
+		auto ite = m_touchStates.find(id);
+		if (ite == m_touchStates.end())
+			return false;
+
+		state = ite->second;
+		return true;
+	}
+
+	size_t BaseEngine::getActiveTouchStates(TouchState* states, size_t maxStates) const {
+		std::lock_guard<std::mutex> lg(m_touchStateLock);
+
+		size_t numStates = 0;
+		for (auto& entry : m_touchStates) {
+			if (numStates >= maxStates)
+				break;
+
+			auto& state = entry.second;
+			if (state.phase == TOUCH_BEGAN || state.phase == TOUCH_MOVED)
+				states[numStates++] = state;
+		}
+
+		return numStates;
+	}
+
+	size_t BaseEngine::getRecentTouchStates(TouchState* states, size_t maxStates, double maxAge) const {
+		const double now = timeSinceStart();
+
+		std::lock_guard<std::mutex> lg(m_touchStateLock);
+
+		size_t numStates = 0;
+		for (auto& entry : m_touchStates) {
+			if (numStates >= maxStates)
+				break;
+
+			auto& state = entry.second;
+			if (state.phase == TOUCH_BEGAN || state.phase == TOUCH_MOVED || now - state.receivedTime < maxAge)
+				states[numStates++] = state;
+		}
+
+		return numStates;
 	}
 
 	bool BaseEngine::start(bool preprocessEventAsync) {
@@ -177,6 +488,12 @@ namespace HQRemote {
 
 		m_audioRawPackets.clear();
 
+		m_pendingInputEvents.clear();
+		{
+			std::lock_guard<std::mutex> lg(m_touchStateLock);
+			m_touchStates.clear();
+		}
+
 		if (!m_connHandler->start())
 			return false;
 
@@ -215,6 +532,11 @@ namespace HQRemote {
 			audioSendingProc();
 		}));
 
+		//start background thread to send batched input events
+		m_inputBatchThread = std::unique_ptr<std::thread>(new std::thread([this] {
+			inputBatchProc();
+		}));
+
 		return true;
 	}
 
@@ -236,6 +558,14 @@ namespace HQRemote {
 			std::lock_guard<std::mutex> lg(m_audioSndQueueLock);
 			m_audioSndCv.notify_all();
 		}
+		{
+			std::lock_guard<std::mutex> lg(m_inputBatchLock);
+			m_inputBatchCv.notify_all();
+		}
+		{
+			std::lock_guard<std::mutex> lg(m_eventLock);
+			m_eventCv.notify_all();
+		}
 
 		//wait for all tasks to finish
 		for (auto& thread : m_taskThreads) {
@@ -253,6 +583,10 @@ namespace HQRemote {
 			m_audioSndThread->join();
 		m_audioSndThread = nullptr;
 
+		if (m_inputBatchThread && m_inputBatchThread->joinable())
+			m_inputBatchThread->join();
+		m_inputBatchThread = nullptr;
+
 #ifdef DEBUG
 		Log("BaseEngine::stop() waiting for data polling thread\n");
 #endif
@@ -279,6 +613,21 @@ namespace HQRemote {
 			m_totalSentAudioPacketsCounterReset = true;
 		}
 
+		{
+			std::lock_guard<std::mutex> lg(m_touchStateLock);
+			m_touchStates.clear();
+		}
+
+		//zlib streams of previous connection are useless now
+		{
+			std::lock_guard<std::mutex> lg(m_inputBatchLock);
+			m_inputStreamCompressor = nullptr;
+		}
+		{
+			std::lock_guard<std::mutex> lg(m_inputStreamDecompressorLock);
+			m_inputStreamDecompressors.clear();
+		}
+
 		// push event to notify user that we are connected
 		pushEvent(std::make_shared<PlainEvent>(CONNECTED_NOTIFIFACTION));
 	}
@@ -294,50 +643,96 @@ namespace HQRemote {
 	void BaseEngine::tryRecvEvent(EventType eventToDiscard, bool consumeAllAvailableData) {
 		DataRef data = nullptr;
 		bool isReliable;
+		uint32_t msgFlags;
 		do {
-			data = m_connHandler->receiveData(isReliable);
+			data = m_connHandler->receiveData(isReliable, msgFlags);
 			if (data != nullptr)
 			{
-				handleEventInternal(data, isReliable, eventToDiscard);
+				handleEventInternal(data, isReliable, msgFlags, eventToDiscard);
 			}//if (data != nullptr)
 		} while (consumeAllAvailableData && data != nullptr);
 	}
 
-	ConstEventRef BaseEngine::getEvent() {
-		if (m_dataPollingThread == nullptr)//if we don't have dedicated polling thread then retrieve the event directly here
-			tryRecvEvent();
+	void BaseEngine::waitRecvEvent(uint32_t timeoutMs) {
+		auto startTime64 = getTimeCheckPoint64();
+		while (m_running) {
+			{
+				std::lock_guard<std::mutex> lg(m_eventLock);
+				if (m_eventQueue.size() > 0)
+					return;
+			}
+
+			auto elapsedMs = getElapsedTime64(startTime64, getTimeCheckPoint64()) * 1000.0;
+			if (elapsedMs >= timeoutMs)
+				return;
+
+			bool isReliable;
+			uint32_t msgFlags;
+			auto data = m_connHandler->receiveDataBlock(isReliable, msgFlags, (uint32_t)(timeoutMs - elapsedMs) + 1);
+			if (data != nullptr)
+				handleEventInternal(data, isReliable, msgFlags, NO_EVENT);
+		}
+	}
+
+	void BaseEngine::onEventPopped(const ConstEventRef& event) {
+		switch (event->event.type) {
+		case CONNECTED_NOTIFIFACTION: // just connected
+		{
+			// attempt to tell remote side to use newer version of connection handler.
+			// We need to do on user's thread (getEvent() caller thread) to avoid deadlock.
+			PlainEvent event(COMPATIBLE_MODE);
+			event.event.compatibleMode.mode = IConnectionHandler::PROTOCOL_VERSION;
+			sendEvent(event);
+		}
+			break;
+		}
 
+#if defined DEBUG || defined _DEBUG
+		auto type = event->event.type;
+		if (type == ENDPOINT_NAME || type == DISCONNECTED_NOTIFIFACTION || type == CONNECTED_NOTIFIFACTION)
+			HQRemote::Log("event %u was popped\n", type);
+#endif
+	}
+
+	ConstEventRef BaseEngine::getEvent(uint32_t blockIfEmptyForMs) {
 		ConstEventRef event = nullptr;
-		std::unique_lock<std::mutex> lg(m_eventLock);
 
-		//query generic event
-		if (m_eventQueue.size() > 0)
+		getEvents(&event, 1, blockIfEmptyForMs);
+
+		return event;
+	}
+
+	size_t BaseEngine::getEvents(ConstEventRef* events, size_t maxEvents, uint32_t blockIfEmptyForMs) {
+		if (maxEvents == 0)
+			return 0;
+
+		if (m_dataPollingThread == nullptr)//if we don't have dedicated polling thread then retrieve the events directly here
 		{
-			event = m_eventQueue.front();
-			m_eventQueue.pop_front();
+			tryRecvEvent(NO_EVENT, true);
 
-			lg.unlock();
+			if (blockIfEmptyForMs > 0)
+				waitRecvEvent(blockIfEmptyForMs);
+		}
 
-			switch (event->event.type) {
-			case CONNECTED_NOTIFIFACTION: // just connected
-			{
-				// attempt to tell remote side to use newer version of connection handler.
-				// We need to do on user's thread (getEvent() caller thread) to avoid deadlock.
-				PlainEvent event(COMPATIBLE_MODE);
-				event.event.compatibleMode.mode = 1;
-				sendEvent(event);
-			}
-				break;
-			}
+		std::unique_lock<std::mutex> lk(m_eventLock);
 
-#if defined DEBUG || defined _DEBUG
-			auto type = event->event.type;
-			if (type == ENDPOINT_NAME || type == DISCONNECTED_NOTIFIFACTION || type == CONNECTED_NOTIFIFACTION)
-				HQRemote::Log("event %u was popped\n", type);
-#endif
+		if (blockIfEmptyForMs > 0 && m_dataPollingThread != nullptr) {
+			m_eventCv.wait_for(lk, std::chrono::milliseconds(blockIfEmptyForMs), [this] { return !m_running || m_eventQueue.size() > 0; });
 		}
 
-		return event;
+		//drain as many events as possible in one go
+		size_t numEvents = 0;
+		while (numEvents < maxEvents && m_eventQueue.size() > 0) {
+			events[numEvents++] = std::move(m_eventQueue.front());
+			m_eventQueue.pop_front();
+		}
+
+		lk.unlock();
+
+		for (size_t i = 0; i < numEvents; ++i)
+			onEventPopped(events[i]);
+
+		return numEvents;
 	}
 
 	ConstFrameEventRef BaseEngine::getAudioEvent() {
@@ -388,19 +783,22 @@ namespace HQRemote {
 	}
 
 	void BaseEngine::pushDecodedAudioPacket(uint64_t packetId, const void* data, size_t size, float duration) {
-		std::lock_guard<std::mutex> lg(m_audioDecodedPacketsLock);
-
 		auto sizeMs = duration * 1000.f;
 
 		try {
+			auto audioDecodedEventRef = std::make_shared<FrameEvent>(size, packetId, AUDIO_DECODED_PACKET);
+			memcpy(audioDecodedEventRef->event.renderedFrameData.frameData, data, size);
+
+			if (dispatchAudioPacketToDelegates(audioDecodedEventRef))
+				return;
+
+			std::lock_guard<std::mutex> lg(m_audioDecodedPacketsLock);
+
 			if (m_audioDecodedPackets.size() >= MAX_PENDING_RCV_AUDIO_PACKETS)
 			{
 				m_audioDecodedPackets.pop_front();
 			}
 
-			auto audioDecodedEventRef = std::make_shared<FrameEvent>(size, packetId, AUDIO_DECODED_PACKET);
-			memcpy(audioDecodedEventRef->event.renderedFrameData.frameData, data, size);
-
 			m_audioDecodedPackets.push_back(audioDecodedEventRef);
 
 			if (m_audioDecodedBufferInitSize < DEFAULT_RCV_AUDIO_BUFFER_SIZE_MS)
@@ -526,13 +924,14 @@ namespace HQRemote {
 		}
 	}
 
-	void BaseEngine::handleEventInternal(const DataRef& data, bool isReliable, EventType eventToDiscard) {
-		auto eventType = peekEventType(data);
+	void BaseEngine::handleEventInternal(const DataRef& data, bool isReliable, uint32_t msgFlags, EventType eventToDiscard) {
+		bool compact = (msgFlags & IConnectionHandler::MSG_FLAG_COMPACT) != 0;
+		//view shares the received data, event created from it will refer to the same data without copying
+		EventView eventView(data, compact, m_customTypeIsFrameDataCallback);
 
-		if (eventToDiscard != eventType) {
+		if (eventToDiscard != eventView.type()) {
 			auto handler = [=] {
-				auto _data = data;
-				auto event = deserializeEvent(std::move(_data), m_customTypeIsFrameDataCallback);
+				auto event = eventView.materialize();
 				if (event != nullptr) {
 					handleEventInternal(event);
 				}
@@ -547,6 +946,15 @@ namespace HQRemote {
 	}
 
 	void BaseEngine::handleEventInternal(const EventRef& eventRef) {
+		switch (eventRef->event.type) {
+		case TOUCH_BEGAN: case TOUCH_MOVED: case TOUCH_ENDED: case TOUCH_CANCELLED:
+			//peers older than protocol version 3 don't fill the timestamp
+			if (m_connHandler->getRemoteProtocolVersion() < 3)
+				eventRef->event.touchData.timestamp = 0;
+			updateTouchState(eventRef->event);
+			break;
+		}
+
 		if (handleEventInternalImpl(eventRef))
 			return;
 
@@ -588,7 +996,7 @@ namespace HQRemote {
 			}
 
 			//forward the event to user
-			pushEvent(eventRef);
+			forwardEvent(eventRef);
 		}
 		break;//AUDIO_STREAM_INFO
 		case AUDIO_ENCODED_PACKET:
@@ -621,6 +1029,8 @@ namespace HQRemote {
 		{
 			//this is events bundle
 			auto compressedEventRef = std::static_pointer_cast<CompressedEvents>(eventRef);
+			if (compressedEventRef->isStreamed() && !decompressInputStream(*compressedEventRef))
+				break;
 			for (auto &eRef : *compressedEventRef)
 			{
 				handleEventInternal(eRef);
@@ -636,32 +1046,71 @@ namespace HQRemote {
 			sendEvent(ackEvent);
 
 			//forward the event to user
-			pushEvent(eventRef);
+			forwardEvent(eventRef);
 		}
 		break;
 		case COMPATIBLE_MODE:
 		{
-			if (event.compatibleMode.mode) {
-				HQRemote::Log("BaseEngine: disable compatible mode\n");
-				// new version
-				m_connHandler->enableCompatibleMode(false);
-			}
-			else {
-				HQRemote::Log("BaseEngine: enable compatible mode\n");
-				// older version
-				m_connHandler->enableCompatibleMode(true);
-			}
+			// mode is the protocol version of remote side, 0 means the oldest version
+			HQRemote::Log("BaseEngine: remote protocol version %u\n", event.compatibleMode.mode);
+
+			m_connHandler->setRemoteProtocolVersion(event.compatibleMode.mode);
+
+			onRemoteProtocolVersion(event.compatibleMode.mode);
 		}
 		break;
 		default:
 		{
 			//generic envent is forwarded to user
-			pushEvent(eventRef);
+			forwardEvent(eventRef);
 		}
 		break;
 		}//switch (event.type)
 	}
 
+	void BaseEngine::registerEventDelegate(EventDelegate* delegate) {
+		std::lock_guard<std::mutex> lg(m_eventDelegateLock);
+		if (delegate)
+			m_eventDelegates.insert(delegate);
+	}
+
+	void BaseEngine::unregisterEventDelegate(EventDelegate* delegate) {
+		std::lock_guard<std::mutex> lg(m_eventDelegateLock);
+		m_eventDelegates.erase(delegate);
+	}
+
+	bool BaseEngine::dispatchToDelegates(const ConstEventRef& event) {
+		std::lock_guard<std::mutex> lg(m_eventDelegateLock);
+		for (auto& delegate : m_eventDelegates) {
+			if (delegate->onEvent(event))
+				return true;
+		}
+		return false;
+	}
+
+	bool BaseEngine::dispatchAudioPacketToDelegates(const ConstFrameEventRef& audioPacket) {
+		std::lock_guard<std::mutex> lg(m_eventDelegateLock);
+		for (auto& delegate : m_eventDelegates) {
+			if (delegate->onAudioPacket(audioPacket))
+				return true;
+		}
+		return false;
+	}
+
+	bool BaseEngine::dispatchFrameToDelegates(const ConstFrameEventRef& frame) {
+		std::lock_guard<std::mutex> lg(m_eventDelegateLock);
+		for (auto& delegate : m_eventDelegates) {
+			if (delegate->onFrame(frame))
+				return true;
+		}
+		return false;
+	}
+
+	void BaseEngine::forwardEvent(const EventRef& eventRef) {
+		if (!dispatchToDelegates(eventRef))
+			pushEvent(eventRef);
+	}
+
 	void BaseEngine::pushEvent(const EventRef& eventRef)
 	{
 		//envent is forwarded to user
@@ -669,6 +1118,10 @@ namespace HQRemote {
 		try {
 			m_eventQueue.push_back(eventRef);
 
+			//getEvents() only waits when the queue is empty
+			if (m_eventQueue.size() == 1)
+				m_eventCv.notify_all();
+
 			auto type = eventRef->event.type;
 
 #if defined DEBUG || defined _DEBUG
@@ -820,10 +1273,11 @@ namespace HQRemote {
 		while (m_running) {
 			m_dataPollingLock.lock();
 			bool isReliable;
-			auto data = m_connHandler->receiveDataBlock(isReliable);
+			uint32_t msgFlags;
+			auto data = m_connHandler->receiveDataBlock(isReliable, msgFlags);
 			m_dataPollingLock.unlock();
 			if (data)
-				handleEventInternal(data, isReliable, NO_EVENT);
+				handleEventInternal(data, isReliable, msgFlags, NO_EVENT);
 		}//while (m_running)
 	}
 
@@ -912,7 +1366,8 @@ namespace HQRemote {
 							packetsBundle.push_back(audioPacketEvent);
 							if (packetsBundle.size() == DEFAULT_SND_AUDIO_FRAME_BUNDLE)
 							{
-								CompressedEvents bundleEvent(-1, packetsBundle);
+								//opus packets are incompressible, don't waste time on zlib framing
+								CompressedEvents bundleEvent(-1, packetsBundle, remoteSupportsCompactEvents(), negotiateCompressionCodec(COMPRESSION_CODEC_STORED));
 								sendEventUnreliable(bundleEvent);
 
 								packetsBundle.clear();
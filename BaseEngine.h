@@ -24,6 +24,7 @@
 
 #include <list>
 #include <map>
+#include <set>
 #include <mutex>
 #include <functional>
 #include <condition_variable>
@@ -43,8 +44,36 @@ namespace HQRemote {
 		BaseEngine(std::shared_ptr<IConnectionHandler> connHandler, std::shared_ptr<IAudioCapturer> audioCapturer = nullptr);
 		virtual ~BaseEngine();
 
+		//receiver of events pushed directly from engine's internal threads, so that they skip the queues of
+		//getEvent(), getAudioEvent() & Client::getFrameEvent() and the latency of polling them.
+		//Threading rules:
+		//- callbacks run on engine's threads, never on the thread registering the delegate. They must return quickly,
+		//  a slow callback delays all subsequent data of the same kind.
+		//- callbacks may call sendEvent() & the likes, but must not call getEvent(s)(), getAudioEvent(), Client::getFrameEvent(s)()
+		//  or (un)registerEventDelegate().
+		//- each callback returns true to consume the item. Otherwise it is offered to the next delegate, then queued as usual.
+		class EventDelegate {
+		public:
+			//generic event received from remote side, in order. Called on data polling thread, or on the thread calling
+			//getEvent(s)()/getAudioEvent()/Client::getFrameEvent(s)() if engine was started without preprocessEventAsync.
+			//Local notifications such as CONNECTED_NOTIFIFACTION are always queued
+			virtual bool onEvent(const ConstEventRef& event) { return false; }
+			//decoded audio packet, in order. Called on audio processing thread as soon as the packet is decoded,
+			//without the buffering applied by getAudioEvent()
+			virtual bool onAudioPacket(const ConstFrameEventRef& audioPacket) { return false; }
+			//rendered frame (Client only). Called on the same thread as onEvent() as soon as the frame arrives,
+			//without frame pacing. Frames may arrive out of order if the remote side sends them unreliably
+			virtual bool onFrame(const ConstFrameEventRef& frame) { return false; }
+		};
+
+		void registerEventDelegate(EventDelegate* delegate);
+		void unregisterEventDelegate(EventDelegate* delegate);
+
 		//query generic event
-		ConstEventRef getEvent();
+		ConstEventRef getEvent(uint32_t blockIfEmptyForMs = 0);
+		//query up to <maxEvents> generic events at once, waiting for at most <blockIfEmptyForMs> if there is none.
+		//Return number of events written to <events>
+		size_t getEvents(ConstEventRef* events, size_t maxEvents, uint32_t blockIfEmptyForMs = 0);
 		//query audio event
 		ConstFrameEventRef getAudioEvent();
 
@@ -53,6 +82,43 @@ namespace HQRemote {
 		void sendEvent(const ConstEventRef& event);
 		void sendEventUnreliable(const ConstEventRef& event);
 
+		//send event reliably on an independent ordered ARQ stream (see IConnectionHandler::sendDataOnArqStream()),
+		//i.e. touch input can use a different stream than MESSAGE events so that it doesn't wait behind them
+		//return false if the event was dropped
+		bool sendEventOnStream(const PlainEvent& event, unsigned int streamIdx);
+		bool sendEventOnStream(const ConstEventRef& event, unsigned int streamIdx);
+
+		//ARQ streams used internally: input events sent via sendInputEvent() and MESSAGE events sent via sendEvent().
+		//Stream 0 carries reliable messages when the reliable channel is down
+		static const unsigned int INPUT_EVENT_STREAM = 1;
+		static const unsigned int MESSAGE_EVENT_STREAM = 2;
+
+		//input batching: touch events sent via sendInputEvent() are stamped with the sender's time (microseconds since start())
+		//and sent in one batch every <windowMs> milliseconds. TOUCH_MOVED events of the same touch id within a batch are
+		//coalesced into the latest one. 0 disables batching (default), input events are then sent immediately
+		void setInputBatchWindow(uint32_t windowMs);
+		uint32_t getInputBatchWindow() const { return m_inputBatchWindowMs; }
+		//non-touch events are sent immediately
+		void sendInputEvent(const PlainEvent& event);
+		//send pending batched input events now
+		void flushInputEvents();
+
+		//latest touch state received from remote side
+		struct TouchState {
+			int32_t id;
+			float x, y;
+			EventType phase;//type of last touch event
+			uint64_t timestamp;//remote side's time in microseconds, 0 if remote side doesn't send it
+			double receivedTime;//local time (see timeSinceStart()) when the state was received
+		};
+
+		//return false if no event of this touch id was received
+		bool getTouchState(int32_t id, TouchState& state) const;
+		//states of touches which haven't ended or been cancelled yet. Return number of states written to <states>
+		size_t getActiveTouchStates(TouchState* states, size_t maxStates) const;
+		//states of active touches & touches ended or cancelled less than <maxAge> seconds ago
+		size_t getRecentTouchStates(TouchState* states, size_t maxStates, double maxAge) const;
+
 		bool connected() const {
 			return m_connHandler->connected();
 		}
@@ -65,6 +131,11 @@ namespace HQRemote {
 			return m_connHandler->timeSinceStart();
 		}
 
+		//0 until remote side tells its version after connected (see IConnectionHandler::PROTOCOL_VERSION)
+		uint32_t getRemoteProtocolVersion() const {
+			return m_connHandler->getRemoteProtocolVersion();
+		}
+
 		float getReceiveRate() const {
 			return m_connHandler->getReceiveRate();
 		}
@@ -73,6 +144,10 @@ namespace HQRemote {
 			return m_connHandler->getSendRate();
 		}
 
+		float getUnreliableLossRate() const {
+			return m_connHandler->getUnreliableLossRate();
+		}
+
 		std::shared_ptr<const CString> getDesc() const {
 			return m_connHandler->getDesc();
 		}
@@ -115,14 +190,33 @@ namespace HQRemote {
 		virtual void onConnected() override;
 		virtual void onDisconnected() override;
 
+		//called on receiving thread when remote side tells its protocol version
+		virtual void onRemoteProtocolVersion(uint32_t version) {}
+
 		const std::thread* getDataPollingThread() { return m_dataPollingThread.get(); }
 
 		void tryRecvEvent(EventType eventToDiscard = NO_EVENT, bool consumeAllAvailableData = false);//try to parse & process the received data if available 
-		void handleEventInternal(const DataRef& data, bool isReliable, EventType eventToDiscard);
+		void waitRecvEvent(uint32_t timeoutMs);//receive & process data until a generic event is available or timeout
+		void onEventPopped(const ConstEventRef& event);//post processing on user's thread
+		void handleEventInternal(const DataRef& data, bool isReliable, uint32_t msgFlags, EventType eventToDiscard);
 		void handleEventInternal(const EventRef& event);
 		virtual bool handleEventInternalImpl(const EventRef& event) = 0;//subclass should implement this, return false to let base class handle the event itself
 
 		void pushEvent(const EventRef& eventRef);
+		//give received event to delegates first, queue it for getEvent() if none consumes it
+		void forwardEvent(const EventRef& eventRef);
+
+		//return true if a delegate consumed the event
+		bool dispatchToDelegates(const ConstEventRef& event);
+		bool dispatchAudioPacketToDelegates(const ConstFrameEventRef& audioPacket);
+		bool dispatchFrameToDelegates(const ConstFrameEventRef& frame);
+
+		//true if remote side understands compact encoded events (see PlainEvent::serializeCompact())
+		bool remoteSupportsCompactEvents() const;
+		//serialize using compact encoding if remote side supports it
+		ConstDataRef serializeEventForSending(const PlainEvent& event, uint32_t& msgFlags) const;
+		//return <preferred> if remote side can decompress it, zlib otherwise
+		CompressionCodec negotiateCompressionCodec(CompressionCodec preferred) const;
 
 		void runAsync(std::function<void()> task);
 
@@ -136,6 +230,12 @@ namespace HQRemote {
 		void audioProcessingProc();
 		void dataPollingProc();
 		void audioSendingProc();
+		void inputBatchProc();
+
+		void sendInputBatch(const CompressedEvents::EventList& events);
+		bool sendStreamedInputBatch(const CompressedEvents::EventList& events);
+		bool decompressInputStream(CompressedEvents& bundle);
+		void updateTouchState(const Event& event);
 
 		void pushDecodedAudioPacket(uint64_t packetId, const void* data, size_t size, float duration);
 		void flushEncodedAudioPackets();
@@ -150,6 +250,10 @@ namespace HQRemote {
 		//event queue
 		std::mutex m_eventLock;
 		std::deque<ConstEventRef> m_eventQueue;
+		std::condition_variable m_eventCv;
+
+		std::mutex m_eventDelegateLock;
+		std::set<EventDelegate*> m_eventDelegates;
 
 		//data polling thread
 		std::mutex m_dataPollingLock;
@@ -186,6 +290,28 @@ namespace HQRemote {
 		uint64_t m_totalSentAudioPackets;
 		bool m_totalSentAudioPacketsCounterReset;
 
+		//input batching
+		std::mutex m_inputBatchLock;
+		std::condition_variable m_inputBatchCv;
+		std::unique_ptr<std::thread> m_inputBatchThread;
+		CompressedEvents::EventList m_pendingInputEvents;
+		uint64_t m_inputBatchStartTime64;
+		std::atomic<uint32_t> m_inputBatchWindowMs;
+
+		//zlib stream shared by input bundles sent to remote side having protocol version 11+, guarded by m_inputBatchLock
+		std::unique_ptr<ZlibStreamCompressor> m_inputStreamCompressor;
+		uint32_t m_inputStreamGeneration;
+		uint64_t m_inputStreamStartTime64;
+		bool m_inputStreamOverArq;
+
+		//input bundle streams from remote side, keyed by generation
+		std::mutex m_inputStreamDecompressorLock;
+		std::map<uint32_t, std::unique_ptr<ZlibStreamDecompressor> > m_inputStreamDecompressors;
+
+		//remote touch states
+		mutable std::mutex m_touchStateLock;
+		std::map<int32_t, TouchState> m_touchStates;
+
 		// custom event type handling
 		EventContainsFrameDataCallback m_customTypeIsFrameDataCallback = nullptr;
 	};
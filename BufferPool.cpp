@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "BufferPool.h"
+
+#include <assert.h>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <atomic>
+
+//size classes: 64 bytes, then 4 classes per power of two up to 32MB
+#define MIN_CLASS_SIZE_LOG2 6
+#define MAX_CLASS_SIZE_LOG2 25
+#define NUM_SIZE_CLASSES (1 + (MAX_CLASS_SIZE_LOG2 - MIN_CLASS_SIZE_LOG2) * 4)
+
+//how much memory all size classes together can keep unused, see BufferPool::trim() to release it sooner
+#define MAX_CACHED_BYTES (32 * 1024 * 1024)
+
+namespace HQRemote {
+	static inline unsigned int highestBit(size_t value) {
+		unsigned int bit = 0;
+		while (value >>= 1)
+			bit++;
+		return bit;
+	}
+
+	//return NUM_SIZE_CLASSES if <size> is too big
+	static unsigned int getSizeClass(size_t size, size_t& classSize) {
+		if (size <= ((size_t)1 << MIN_CLASS_SIZE_LOG2))
+		{
+			classSize = (size_t)1 << MIN_CLASS_SIZE_LOG2;
+			return 0;
+		}
+
+		//size is in (2^log2, 2^(log2 + 1)], which is split into 4 steps
+		auto log2 = highestBit(size - 1);
+		if (log2 >= MAX_CLASS_SIZE_LOG2)
+		{
+			classSize = size;
+			return NUM_SIZE_CLASSES;
+		}
+
+		auto stepLog2 = log2 - 2;
+		auto steps = (size + ((size_t)1 << stepLog2) - 1) >> stepLog2;//5..8
+		classSize = steps << stepLog2;
+
+		return 1 + (log2 - MIN_CLASS_SIZE_LOG2) * 4 + (unsigned int)(steps - 5);
+	}
+
+	static size_t getClassSize(unsigned int sizeClass) {
+		if (sizeClass == 0)
+			return (size_t)1 << MIN_CLASS_SIZE_LOG2;
+		auto log2 = (sizeClass - 1) / 4 + MIN_CLASS_SIZE_LOG2;
+		auto steps = (sizeClass - 1) % 4 + 5;
+		return (size_t)steps << (log2 - 2);
+	}
+
+	/*------------ free lists ---------*/
+	//NOTE: no per thread cache, thread_local isn't available on all the toolchains we ship with (VS2013, old Android NDK).
+	//Each size class has its own lock, so threads only contend when they allocate the same size at the same time
+	struct FreeBlockLists {
+		FreeBlockLists() : cachedBytes(0) {}
+
+		std::mutex lock[NUM_SIZE_CLASSES];
+		std::vector<void*> blocks[NUM_SIZE_CLASSES];
+		std::atomic<size_t> cachedBytes;//of all classes
+	};
+
+	static FreeBlockLists& getFreeLists() {
+		//never destroyed, blocks may still be returned during process exit
+		static FreeBlockLists* lists = new FreeBlockLists();
+		return *lists;
+	}
+
+	/*------------ BufferPool ---------*/
+	void* BufferPool::allocate(size_t size, size_t& blockSize) {
+		auto sizeClass = getSizeClass(size, blockSize);
+		if (sizeClass < NUM_SIZE_CLASSES)
+		{
+			auto& lists = getFreeLists();
+			void* block = nullptr;
+			{
+				std::lock_guard<std::mutex> lg(lists.lock[sizeClass]);
+				auto& blocks = lists.blocks[sizeClass];
+				if (blocks.size()) {
+					block = blocks.back();
+					blocks.pop_back();
+				}
+			}
+
+			if (block) {
+				lists.cachedBytes.fetch_sub(blockSize, std::memory_order_relaxed);
+				return block;
+			}
+		}
+
+		return ::operator new(blockSize);
+	}
+
+	void BufferPool::deallocate(void* block, size_t size) {
+		if (block == nullptr)
+			return;
+
+		size_t classSize;
+		auto sizeClass = getSizeClass(size, classSize);
+		if (sizeClass < NUM_SIZE_CLASSES)
+		{
+			auto& lists = getFreeLists();
+
+			//reserve room first, the block goes back to the heap if the pool is full
+			if (lists.cachedBytes.fetch_add(classSize, std::memory_order_relaxed) + classSize <= MAX_CACHED_BYTES)
+			{
+				try {
+					std::lock_guard<std::mutex> lg(lists.lock[sizeClass]);
+					lists.blocks[sizeClass].push_back(block);
+					return;
+				}
+				catch (...) {
+				}
+			}
+
+			lists.cachedBytes.fetch_sub(classSize, std::memory_order_relaxed);
+		}
+
+		::operator delete(block);
+	}
+
+	void BufferPool::trim() {
+		auto& lists = getFreeLists();
+		for (unsigned int i = 0; i < NUM_SIZE_CLASSES; ++i) {
+			std::vector<void*> blocks;
+			{
+				std::lock_guard<std::mutex> lg(lists.lock[i]);
+				blocks.swap(lists.blocks[i]);
+			}
+
+			for (auto block : blocks)
+				::operator delete(block);
+
+			lists.cachedBytes.fetch_sub(blocks.size() * getClassSize(i), std::memory_order_relaxed);
+		}
+	}
+
+	size_t BufferPool::getCachedBytes() {
+		return getFreeLists().cachedBytes.load(std::memory_order_relaxed);
+	}
+
+	/*------------ PooledData ---------*/
+	//content starts at this offset of the block
+	static const size_t POOLED_DATA_HEADER_SIZE = (sizeof(PooledData) + 15) & ~(size_t)15;
+
+	struct PooledDataDeleter {
+		void operator()(PooledData* data) const {
+			auto blockSize = data->m_blockSize;
+			data->~PooledData();
+			BufferPool::deallocate(data, blockSize);
+		}
+	};
+
+	DataRef HQ_FASTCALL makePooledData(size_t size) {
+		size_t blockSize;
+		auto block = BufferPool::allocate(POOLED_DATA_HEADER_SIZE + size, blockSize);
+		auto data = new (block) PooledData((unsigned char*)block + POOLED_DATA_HEADER_SIZE, size, blockSize - POOLED_DATA_HEADER_SIZE, blockSize);
+
+		//deleter is invoked if control block allocation fails
+		return DataRef(data, PooledDataDeleter(), PoolAllocator<PooledData>());
+	}
+
+	DataRef HQ_FASTCALL makePooledData(const void* src, size_t size) {
+		auto data = makePooledData(size);
+		if (size)
+			memcpy(data->data(), src, size);
+		return data;
+	}
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HQREMOTE_BUFFER_POOL_H
+#define HQREMOTE_BUFFER_POOL_H
+
+#include "Data.h"
+
+#include <stddef.h>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	//size class memory pool. Freed blocks are kept in a free list of their size class, up to a total size limit,
+	//so steady state streaming reuses the same blocks instead of going to the heap.
+	//Blocks bigger than the largest size class are allocated from the heap directly
+	class HQREMOTE_API BufferPool {
+	public:
+		//return a block of at least <size> bytes. <blockSize> receives the real usable size of the block
+		static void* allocate(size_t size, size_t& blockSize);
+		static void* allocate(size_t size) {
+			size_t blockSize;
+			return allocate(size, blockSize);
+		}
+		//<size> must be either the size passed to allocate() or the returned block size
+		static void deallocate(void* block, size_t size);
+
+		//return all unused blocks to the heap, i.e. when the system is low on memory
+		static void trim();
+		//total size of the unused blocks kept by the pool
+		static size_t getCachedBytes();
+	};
+
+	//allocator for standard containers & std::shared_ptr's control blocks
+	template <class T>
+	class PoolAllocator {
+	public:
+		typedef T value_type;
+
+		PoolAllocator() {}
+		template <class U> PoolAllocator(const PoolAllocator<U>&) {}
+
+		T* allocate(size_t n) { return (T*)BufferPool::allocate(n * sizeof(T)); }
+		void deallocate(T* p, size_t n) { BufferPool::deallocate(p, n * sizeof(T)); }
+
+		template <class U> bool operator == (const PoolAllocator<U>&) const { return true; }
+		template <class U> bool operator != (const PoolAllocator<U>&) const { return false; }
+	};
+
+	//content is left uninitialized
+	HQREMOTE_API DataRef HQ_FASTCALL makePooledData(size_t size);
+	HQREMOTE_API DataRef HQ_FASTCALL makePooledData(const void* data, size_t size);
+
+	//fixed capacity data whose memory comes from BufferPool. The object itself lives in the same block as its content
+	//and the reference counter is also allocated from the pool, so creating & releasing it doesn't touch the heap.
+	//Use makePooledData() to create
+	class HQREMOTE_API PooledData : public IData {
+	public:
+		virtual unsigned char* data() override { return m_data; }
+		virtual const unsigned char* data() const override { return m_data; }
+
+		virtual size_t size() const override { return m_size; }
+		size_t capacity() const { return m_capacity; }
+
+		//<size> must not exceed capacity()
+		void resize(size_t size) {
+			if (size > m_capacity)
+				throw std::length_error("PooledData's capacity exceeded");
+			m_size = size;
+		}
+	private:
+		PooledData(unsigned char* data, size_t size, size_t capacity, size_t blockSize)
+			: m_data(data), m_size(size), m_capacity(capacity), m_blockSize(blockSize)
+		{}
+
+		friend DataRef HQ_FASTCALL makePooledData(size_t size);
+		friend struct PooledDataDeleter;
+
+		unsigned char* m_data;
+		size_t m_size;
+		size_t m_capacity;
+		size_t m_blockSize;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
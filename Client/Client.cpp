@@ -26,13 +26,18 @@
 #include <future>
 
 #define FRAME_COUNTER_INTERVAL 2.0//s
+#define RECEIVER_REPORT_INTERVAL 0.5//s
+#define TILE_CACHE_RESET_INTERVAL 0.5//s
+#define REFRESH_REQUEST_INTERVAL 0.25//s
 
 namespace HQRemote {
 	/*---------- Client ------------*/
 	Client::Client(std::shared_ptr<IConnectionHandler> connHandler, float frameInterval, std::shared_ptr<IAudioCapturer> audioCapturer, size_t maxPendingFrames)
 		: BaseEngine(connHandler, audioCapturer), m_frameInterval(frameInterval), m_lastRcvFrameTime64(0), m_lastRcvFrameId(0), m_numRcvFrames(0),
 		m_frameIntervalAlternation(false),
-		m_maxPendingFrames(maxPendingFrames)
+		m_maxPendingFrames(maxPendingFrames),
+		m_frameCapabilities(0), m_frameLayer(0),
+		m_lastReportTime64(0), m_lastArrivedFrameId(0), m_firstLostFrameId(0), m_lastTileCacheResetTime64(0), m_lastRefreshRequestTime64(0)
 	{
 	}
 
@@ -59,6 +64,12 @@ namespace HQRemote {
 		m_lastRcvFrameId = 0;
 		m_numRcvFrames = 0;
 
+		m_lastReportTime64 = 0;
+		m_lastArrivedFrameId = 0;
+		m_firstLostFrameId = 0;
+		m_lastTileCacheResetTime64 = 0;
+		m_lastRefreshRequestTime64 = 0;
+
 		return true;
 	}
 
@@ -70,6 +81,123 @@ namespace HQRemote {
 		m_frameIntervalAlternation = enable;
 	}
 
+	void Client::setFrameCapabilities(uint32_t capabilities) {
+		m_frameCapabilities = capabilities;
+
+		if (connected())
+			sendFrameCapabilities();
+	}
+
+	void Client::selectFrameLayer(uint32_t layer) {
+		m_frameLayer = layer;
+
+		if (connected())
+			sendFrameLayer();
+	}
+
+	void Client::onRemoteProtocolVersion(uint32_t version) {
+		if (m_frameCapabilities)
+			sendFrameCapabilities();
+		//host starts with layer 0
+		if (m_frameLayer)
+			sendFrameLayer();
+	}
+
+	void Client::sendFrameCapabilities() {
+		//older hosts don't know this event
+		if (getRemoteProtocolVersion() < 6)
+			return;
+
+		PlainEvent event(FRAME_CAPABILITIES);
+		event.event.uint32Value = m_frameCapabilities;
+
+		sendEvent(event);
+	}
+
+	void Client::sendFrameLayer() {
+		//older hosts don't know this event
+		if (getRemoteProtocolVersion() < 9)
+			return;
+
+		PlainEvent event(FRAME_LAYER_SELECT);
+		event.event.uint32Value = m_frameLayer;
+
+		sendEvent(event);
+	}
+
+	void Client::sendReceiverReportIfNeeded(uint64_t lastFrameId) {
+		//older hosts don't know this event
+		if (getRemoteProtocolVersion() < 7)
+			return;
+
+		std::unique_lock<std::mutex> lk(m_reportLock);
+
+		//frames skipped in arrival order are reported lost, host sends their refinements again.
+		//Frames handled by multiple threads may look skipped too, that only costs a resend
+		if (m_lastArrivedFrameId != 0 && lastFrameId > m_lastArrivedFrameId + 1 && m_firstLostFrameId == 0)
+			m_firstLostFrameId = m_lastArrivedFrameId + 1;
+		if (lastFrameId > m_lastArrivedFrameId)
+			m_lastArrivedFrameId = lastFrameId;
+
+		auto curTime64 = getTimeCheckPoint64();
+		if (m_lastReportTime64 != 0 && getElapsedTime64(m_lastReportTime64, curTime64) < RECEIVER_REPORT_INTERVAL)
+			return;
+		m_lastReportTime64 = curTime64;
+
+		//a loss after <lastFrameId> goes into next report
+		uint64_t firstLostFrameId = 0;
+		if (m_firstLostFrameId <= lastFrameId)
+			std::swap(firstLostFrameId, m_firstLostFrameId);
+
+		lk.unlock();
+
+		PlainEvent event(RECEIVER_REPORT);
+		event.event.receiverReport.lastFrameId = lastFrameId;
+		event.event.receiverReport.firstLostFrameId = firstLostFrameId;
+		event.event.receiverReport.receiveRate = getReceiveRate();
+		event.event.receiverReport.lossRate = getUnreliableLossRate();
+
+		sendEvent(event);
+	}
+
+	void Client::requestTileCacheReset() {
+		//older hosts don't know this event
+		if (getRemoteProtocolVersion() < 8)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lg(m_reportLock);
+
+			auto curTime64 = getTimeCheckPoint64();
+			if (m_lastTileCacheResetTime64 != 0 && getElapsedTime64(m_lastTileCacheResetTime64, curTime64) < TILE_CACHE_RESET_INTERVAL)
+				return;
+			m_lastTileCacheResetTime64 = curTime64;
+		}
+
+		PlainEvent event(TILE_CACHE_RESET);
+
+		sendEvent(event);
+	}
+
+	void Client::requestRefresh() {
+		//older hosts don't know this event
+		if (getRemoteProtocolVersion() < 10)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lg(m_reportLock);
+
+			auto curTime64 = getTimeCheckPoint64();
+			if (m_lastRefreshRequestTime64 != 0 && getElapsedTime64(m_lastRefreshRequestTime64, curTime64) < REFRESH_REQUEST_INTERVAL)
+				return;
+			m_lastRefreshRequestTime64 = curTime64;
+		}
+
+		PlainEvent event(REFRESH_REQUEST);
+
+		sendEvent(event);
+	}
+
 	ConstFrameEventRef Client::getFrameEvent(uint32_t blockIfEmptyForMs) {
 		ConstFrameEventRef event = nullptr;
 
@@ -101,6 +229,7 @@ namespace HQRemote {
 		}
 
 		size_t numFrames = 0;
+		bool frameLost = false;
 
 		//check if any frame can be rendered immediately
 		if (m_frameQueue.size() > 0) {
@@ -148,6 +277,12 @@ namespace HQRemote {
 					}
 #endif
 
+					//whole frame of a stateful compressor might depend on the missing ones. Partial frames only depend on
+					//their key frame, FrameCompositor reports when it is missing
+					if (m_lastRcvFrameId != 0 && m_lastRcvFrameId < frameId - 1 && !frame.isImportant
+						&& frame.frameRef->event.type == RENDERED_FRAME)
+						frameLost = true;
+
 					m_lastRcvFrameId = frameId;
 					m_numRcvFrames++;
 
@@ -160,6 +295,11 @@ namespace HQRemote {
 			}
 		}//if (m_frameQueue.size() > 0)
 
+		lk.unlock();
+
+		if (frameLost)
+			requestRefresh();
+
 		return numFrames;
 	}
 
@@ -167,10 +307,22 @@ namespace HQRemote {
 		auto& event = eventRef->event;
 		switch (event.type) {
 		case RENDERED_FRAME:
+		case PARTIAL_FRAME:
 		{
-			std::lock_guard<std::mutex> lg(m_frameQueueLock);
-
 			auto trueFrameId = event.renderedFrameData.frameId & (~UNUSED_FRAME_ID_BITS);
+			bool isImportant = (event.renderedFrameData.frameId & IMPORTANT_FRAME_ID_FLAG) != 0;
+
+			// strip the important frame id flag
+			event.renderedFrameData.frameId = trueFrameId;
+
+			// let host know how well frames are arriving, so it can adapt its bitrate
+			sendReceiverReportIfNeeded(trueFrameId);
+
+			// delegates get the frame as soon as it arrives
+			if (dispatchFrameToDelegates(std::static_pointer_cast<FrameEvent>(eventRef)))
+				break;
+
+			std::lock_guard<std::mutex> lg(m_frameQueueLock);
 
 			if (m_frameQueue.size() >= m_maxPendingFrames) {
 				if (m_frameQueue.begin()->first > trueFrameId) // this frame arrive too late
@@ -212,10 +364,7 @@ namespace HQRemote {
 			try {
 				auto & newEntry = m_frameQueue[trueFrameId];
 				newEntry.frameRef = std::static_pointer_cast<FrameEvent>(eventRef);
-				newEntry.isImportant = event.renderedFrameData.frameId & IMPORTANT_FRAME_ID_FLAG;
-				
-				// strip the important frame id flag
-				event.renderedFrameData.frameId = trueFrameId;
+				newEntry.isImportant = isImportant;
 			}
 			catch (...) {
 				//TODO
@@ -40,7 +40,8 @@ namespace HQRemote {
 
 		void setMaxPendingFrames(size_t maxPendingFrames);
 
-		//query rendered frame event
+		//query rendered frame event. If FRAME_CAPABILITY_PARTIAL_FRAMES is set, it can also be a PARTIAL_FRAME event
+		//which should be composed using FrameCompositor
 		ConstFrameEventRef getFrameEvent(uint32_t blockIfEmptyForMs = 0);
 		size_t getFrameEvents(ConstFrameEventRef* frameEvents, size_t maxFrames, uint32_t blockIfEmptyForMs = 0);
 
@@ -48,8 +49,32 @@ namespace HQRemote {
 		virtual void stop() override;
 
 		void enableFrameIntervalAlternation(bool enable);
+
+		//tell host which frame features this client can handle, combination of FrameCapability values.
+		//It is sent once host's protocol version is known, and again whenever it's changed while connected
+		void setFrameCapabilities(uint32_t capabilities);
+		uint32_t getFrameCapabilities() const { return m_frameCapabilities; }
+
+		//ask host to start its tile cache over, used when FrameCompositor misses a cached tile.
+		//Repeated requests within a short time are ignored, since frames in flight still refer to the old cache
+		void requestTileCacheReset();
+
+		//ask host for an important frame decodable on its own (see IImgCompressor::requestKeyFrame()), used when a frame the following
+		//ones depend on was lost. It is sent automatically when getFrameEvents() skips whole frames, or can be called i.e. when
+		//DeltaImgDecompressor or FrameCompositor fails. Repeated requests within a short time are ignored
+		void requestRefresh();
+
+		//pick one of host's simulcast layers (see Engine::setFrameLayers()), 0 is the best one. It is sent again on reconnection.
+		//Host switches at its next captured frame, which is an important one
+		void selectFrameLayer(uint32_t layer);
+		uint32_t getSelectedFrameLayer() const { return m_frameLayer; }
 	private:
 		virtual bool handleEventInternalImpl(const EventRef& event) override;
+		virtual void onRemoteProtocolVersion(uint32_t version) override;
+
+		void sendFrameCapabilities();
+		void sendFrameLayer();
+		void sendReceiverReportIfNeeded(uint64_t lastFrameId);
 
 		struct FrameInfo {
 			ConstFrameEventRef frameRef;
@@ -69,6 +94,16 @@ namespace HQRemote {
 		size_t m_maxPendingFrames;
 
 		bool m_frameIntervalAlternation;
+
+		std::atomic<uint32_t> m_frameCapabilities;
+		std::atomic<uint32_t> m_frameLayer;
+
+		std::mutex m_reportLock;
+		uint64_t m_lastReportTime64;
+		uint64_t m_lastArrivedFrameId;
+		uint64_t m_firstLostFrameId;//first frame found missing since last receiver report, 0 if none
+		uint64_t m_lastTileCacheResetTime64;
+		uint64_t m_lastRefreshRequestTime64;
 	};
 }
 
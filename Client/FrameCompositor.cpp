@@ -0,0 +1,196 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "FrameCompositor.h"
+#include "../BufferPool.h"
+
+namespace HQRemote {
+	FrameCompositor::FrameCompositor(unsigned int numChannels, Decoder decoder, std::function<void()> tileCacheMissHandler,
+									 std::function<void()> keyFrameMissHandler)
+		: m_numChannels(numChannels), m_decoder(decoder), m_width(0), m_height(0), m_keyFrameId(0),
+		m_tileCacheMissHandler(tileCacheMissHandler), m_keyFrameMissHandler(keyFrameMissHandler)
+	{
+	}
+
+	ConstDataRef FrameCompositor::compose(const ConstFrameEventRef& frameEvent, uint32_t& width, uint32_t& height) {
+		if (frameEvent == nullptr)
+			return nullptr;
+
+		switch (frameEvent->event.type) {
+		case RENDERED_FRAME:
+			return composeKeyFrame(*frameEvent, width, height);
+		case PARTIAL_FRAME:
+			return composePartialFrame(*frameEvent, width, height);
+		default:
+			return nullptr;
+		}
+	}
+
+	ConstDataRef FrameCompositor::composeKeyFrame(const FrameEvent& frameEvent, uint32_t& width, uint32_t& height) {
+		auto& frameData = frameEvent.event.renderedFrameData;
+
+		m_keyFrameId = 0;
+		m_composedRects.clear();
+
+		m_keyFrame = m_decoder(frameData.frameData, frameData.frameSize, m_width, m_height);
+		if (m_keyFrame == nullptr || m_keyFrame->size() < (size_t)m_width * m_height * m_numChannels)
+		{
+			m_keyFrame = nullptr;
+			return nullptr;
+		}
+
+		m_output = makePooledData(m_keyFrame->data(), m_keyFrame->size());
+		m_keyFrameId = frameData.frameId & (~UNUSED_FRAME_ID_BITS);
+
+		width = m_width;
+		height = m_height;
+
+		return m_output;
+	}
+
+	ConstDataRef FrameCompositor::composePartialFrame(const FrameEvent& frameEvent, uint32_t& width, uint32_t& height) {
+		auto& frameData = frameEvent.event.renderedFrameData;
+
+		PartialFrameReader reader(frameData.frameData, frameData.frameSize);
+		if (!reader.isValid())
+			return nullptr;
+
+		if (m_keyFrame == nullptr || reader.getBaseFrameId() > m_keyFrameId) {
+			if (m_keyFrameMissHandler)
+				m_keyFrameMissHandler();
+			return nullptr;
+		}
+
+		if (reader.getBaseFrameId() != m_keyFrameId || reader.getFrameWidth() != m_width || reader.getFrameHeight() != m_height)
+			return nullptr;
+
+		//tile data are only located here, sections following them tell what to do first
+		FrameRect rect;
+		const unsigned char* tileData;
+		size_t tileSize;
+		m_tiles.clear();
+		while (reader.nextTile(rect, tileData, tileSize))
+			m_tiles.push_back(EncodedTile{ rect, tileData, tileSize });
+
+		if (!reader.isValid() || !reader.readTileCacheCommands(m_tilePlacements, m_tileStores) || !reader.readCopyRects(m_copyRects)
+			|| !reader.readRefinedTiles())
+			return nullptr;
+
+		m_refinedTiles.clear();
+		while (reader.nextTile(rect, tileData, tileSize))
+			m_refinedTiles.push_back(EncodedTile{ rect, tileData, tileSize });
+		if (!reader.isValid())
+			return nullptr;
+
+		const size_t stride = (size_t)m_width * m_numChannels;
+
+		//regions changed by previous partial frame go back to key frame's content first
+		for (auto& rect : m_composedRects)
+			copyRect(m_output->data(), m_keyFrame->data() + rect.y * stride + (size_t)rect.x * m_numChannels, stride, rect);
+		m_composedRects.clear();
+
+		//refined regions are unchanged since key frame, so they go to both key frame & output
+		for (auto& tile : m_refinedTiles) {
+			if (!drawTile(m_keyFrame->data(), tile))
+				return nullptr;
+			copyRect(m_output->data(), m_keyFrame->data() + tile.rect.y * stride + (size_t)tile.rect.x * m_numChannels, stride, tile.rect);
+		}
+
+		//scrolled regions of key frame
+		for (auto& copy : m_copyRects) {
+			copyRect(m_output->data(), m_keyFrame->data() + copy.srcY * stride + (size_t)copy.srcX * m_numChannels, stride, copy.rect);
+			m_composedRects.push_back(copy.rect);
+		}
+
+		for (auto& tile : m_tiles) {
+			if (!drawTile(m_output->data(), tile))
+				return nullptr;
+			m_composedRects.push_back(tile.rect);
+		}
+
+		if (!applyTileCacheCommands(frameData.frameId & (~UNUSED_FRAME_ID_BITS)))
+			return nullptr;
+
+		width = m_width;
+		height = m_height;
+
+		return m_output;
+	}
+
+	bool FrameCompositor::drawTile(unsigned char* dst, const EncodedTile& tile) {
+		uint32_t tileWidth, tileHeight;
+		auto decodedTile = m_decoder(tile.data, tile.size, tileWidth, tileHeight);
+		if (decodedTile == nullptr || tileWidth != tile.rect.width || tileHeight != tile.rect.height
+			|| decodedTile->size() < (size_t)tileWidth * tileHeight * m_numChannels)
+			return false;
+
+		copyRect(dst, decodedTile->data(), (size_t)tileWidth * m_numChannels, tile.rect);
+
+		return true;
+	}
+
+	bool FrameCompositor::applyTileCacheCommands(uint64_t frameId) {
+		const size_t stride = (size_t)m_width * m_numChannels;
+
+		for (auto& placement : m_tilePlacements) {
+			auto& rect = placement.rect;
+			if (placement.slot >= m_tileCache.size() || m_tileCache[placement.slot].frameId != placement.frameId
+				|| m_tileCache[placement.slot].width != rect.width || m_tileCache[placement.slot].height != rect.height)
+			{
+				//host thinks we have it
+				if (m_tileCacheMissHandler)
+					m_tileCacheMissHandler();
+				return false;
+			}
+
+			copyRect(m_output->data(), m_tileCache[placement.slot].pixels->data(), (size_t)rect.width * m_numChannels, rect);
+			m_composedRects.push_back(rect);
+		}
+
+		for (auto& store : m_tileStores) {
+			auto& rect = store.rect;
+			if (store.slot >= m_tileCache.size())
+				m_tileCache.resize(store.slot + 1);
+
+			auto& tile = m_tileCache[store.slot];
+			const size_t tileStride = (size_t)rect.width * m_numChannels;
+			if (tile.pixels == nullptr || tile.pixels->size() != tileStride * rect.height)
+				tile.pixels = makePooledData(tileStride * rect.height);
+
+			auto src = m_output->data() + rect.y * stride + (size_t)rect.x * m_numChannels;
+			for (uint32_t y = 0; y < rect.height; ++y)
+				memcpy(tile.pixels->data() + y * tileStride, src + y * stride, tileStride);
+
+			tile.width = rect.width;
+			tile.height = rect.height;
+			tile.frameId = frameId;
+		}
+
+		return true;
+	}
+
+	void FrameCompositor::copyRect(unsigned char* dst, const unsigned char* src, size_t srcStride, const FrameRect& rect) {
+		const size_t dstStride = (size_t)m_width * m_numChannels;
+		const size_t rowSize = (size_t)rect.width * m_numChannels;
+
+		dst += rect.y * dstStride + (size_t)rect.x * m_numChannels;
+		for (uint32_t y = 0; y < rect.height; ++y)
+			memcpy(dst + y * dstStride, src + y * srcStride, rowSize);
+	}
+}
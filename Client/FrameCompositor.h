@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQ_REMOTE_FRAME_COMPOSITOR_H
+#define HQ_REMOTE_FRAME_COMPOSITOR_H
+
+#include "../Event.h"
+#include "../PartialFrame.h"
+#include "../TileCache.h"
+
+#include <functional>
+#include <vector>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	//turns frame events received with FRAME_CAPABILITY_PARTIAL_FRAMES enabled back into whole images.
+	//RENDERED_FRAME events become the key frame, PARTIAL_FRAME events are composed onto the last key frame.
+	//It also keeps the tile cache used by PARTIAL_FRAME events when FRAME_CAPABILITY_TILE_CACHE is set, and copies scrolled regions
+	//of the key frame when FRAME_CAPABILITY_COPY_RECT is set. Refined tiles sent with FRAME_CAPABILITY_PROGRESSIVE_REFINEMENT
+	//replace regions of the key frame, so they persist in subsequent partial frames.
+	//NOTE: not thread safe
+	class HQREMOTE_API FrameCompositor {
+	public:
+		//decode a compressed image (whole frame or tile) into tightly packed pixels of <numChannels> bytes, top row first.
+		//i.e. a wrapper of ZlibImgComressor::decompress() or of a JPEG decoder. Return nullptr on failure
+		typedef std::function<DataRef(const void* data, size_t size, uint32_t& width, uint32_t& height)> Decoder;
+
+		//<tileCacheMissHandler> is called when a partial frame refers to a cached tile this object doesn't have (i.e. the frame storing
+		//it was lost), it should call Client::requestTileCacheReset().
+		//<keyFrameMissHandler> is called when a partial frame refers to a key frame newer than the one this object has (i.e. it was lost),
+		//it should call Client::requestRefresh()
+		FrameCompositor(unsigned int numChannels, Decoder decoder, std::function<void()> tileCacheMissHandler = nullptr,
+						std::function<void()> keyFrameMissHandler = nullptr);
+
+		//feed frame events in the order they are rendered (i.e. as returned by Client::getFrameEvent()).
+		//Return the composed image, or nullptr if the event can't be composed (i.e. its key frame was lost).
+		//The returned data is updated in place by subsequent calls
+		ConstDataRef compose(const ConstFrameEventRef& frameEvent, uint32_t& width, uint32_t& height);
+
+		//id of current key frame, 0 if there is none
+		uint64_t getKeyFrameId() const { return m_keyFrameId; }
+
+		//drop all cached tiles, i.e. after reconnecting
+		void resetTileCache() { m_tileCache.clear(); }
+	private:
+		struct CachedTile {
+			DataRef pixels;
+			uint32_t width, height;
+			uint64_t frameId;//frame that stored it
+		};
+
+		struct EncodedTile {
+			FrameRect rect;
+			const unsigned char* data;
+			size_t size;
+		};
+
+		bool applyTileCacheCommands(uint64_t frameId);
+
+		ConstDataRef composeKeyFrame(const FrameEvent& frameEvent, uint32_t& width, uint32_t& height);
+		ConstDataRef composePartialFrame(const FrameEvent& frameEvent, uint32_t& width, uint32_t& height);
+		//decode <tile> into <dst> (key frame or output)
+		bool drawTile(unsigned char* dst, const EncodedTile& tile);
+		void copyRect(unsigned char* dst, const unsigned char* src, size_t srcStride, const FrameRect& rect);
+
+		unsigned int m_numChannels;
+		Decoder m_decoder;
+
+		DataRef m_keyFrame;//decoded key frame
+		DataRef m_output;//key frame + tiles of last partial frame
+		uint32_t m_width, m_height;
+		uint64_t m_keyFrameId;
+		std::vector<FrameRect> m_composedRects;//regions of output differing from key frame
+
+		//commands of current partial frame
+		std::vector<EncodedTile> m_tiles;
+		std::vector<TileCacheCommand> m_tilePlacements;
+		std::vector<TileCacheCommand> m_tileStores;
+		std::vector<CopyRectCommand> m_copyRects;
+		std::vector<EncodedTile> m_refinedTiles;
+
+		std::vector<CachedTile> m_tileCache;
+		std::function<void()> m_tileCacheMissHandler;
+		std::function<void()> m_keyFrameMissHandler;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
@@ -8,6 +8,8 @@
 
 #import "RemoteViewController.h"
 
+#include "../BufferPool.h"
+
 #define MAX_FRAMES_TO_PROCESS 30
 
 #define DESIRED_FRAME_INTERVAL (1 / 30.0)
@@ -64,6 +66,7 @@
 - (void)didReceiveMemoryWarning {
     [super didReceiveMemoryWarning];
     // Dispose of any resources that can be recreated.
+	HQRemote::BufferPool::trim();
 }
 
 /*
@@ -180,6 +183,9 @@
 														userInfo:nil
 														 repeats:YES];
 		
+		//coalesce touch moves within 8ms into one packet
+		_connHandler->setInputBatchWindow(8);
+		
 		auto sendFrameEvent = HQRemote::PlainEvent(HQRemote::START_SEND_FRAME);
 		_connHandler->sendEvent(sendFrameEvent);
 	}
@@ -271,7 +277,8 @@
 
 - (void) sendRemoteEvent: (HQRemote::EventRef) eventRef {
 	if (_connHandler) {
-		_connHandler->sendEvent(*eventRef);
+		//touch events are timestamped & batched
+		_connHandler->sendInputEvent(*eventRef);
 	}
 }
 
@@ -17,15 +17,19 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "ConnectionHandler.h"
+#include "BufferPool.h"
 #include "Timer.h"
+#include "WireFormat.h"
 
 #include <assert.h>
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <cmath>
 
 #define SIMULATED_MAX_UDP_PACKET_SIZE 0
 #define MAX_FRAGMEMT_SIZE (16 * 1024)
+#define MAX_STREAM_SEGMENT_SIZE (64 * 1024)
 #define MAX_PENDING_UNRELIABLE_BUF 100
 #define UNRELIABLE_PING_TIMEOUT 3
 #define UNRELIABLE_PING_RETRIES 10
@@ -33,8 +37,20 @@
 
 #define NUM_PENDING_MSGS_TO_START_DISCARD 60
 
+#define ARQ_MAX_PAYLOAD_SIZE 1200 //keep ARQ packets below typical MTU to avoid IP fragmentation
+#define ARQ_WINDOW_SIZE 256
+#define ARQ_MAX_QUEUED_PACKETS 4096
+#define ARQ_MAX_SEND_WAIT_MS 5000 //drop a message if the queue stays full this long, the peer is most likely gone
+#define ARQ_INITIAL_RTO 0.5
+#define ARQ_MIN_RTO 0.03
+#define ARQ_MAX_RTO 3.0
+#define ARQ_CLOCK_GRANULARITY 0.005
+#define ARQ_FAST_RETRANSMIT_THRESHOLD 3
+#define ARQ_UPDATE_INTERVAL_MS 5
+
 #define DATA_RATE_UPDATE_INTERVAL 1.0
 #define DATA_RATE_RESET_INTERVAL 60.0
+#define LOSS_RATE_UPDATE_INTERVAL 1.0
 
 #ifndef min
 #	define min(a,b) ((a) < (b) ? (a) : (b))
@@ -74,7 +90,24 @@ namespace HQRemote {
 
 	enum ReliableBufferState {
 		READ_NEXT_MESSAGE_SIZE,
-		READ_MESSAGE
+		READ_MESSAGE,
+		READ_STREAM_CHUNK
+	};
+
+	//set in the size prefix of a reliable message to indicate that it is a segment of a stream
+	static const uint32_t RELIABLE_STREAM_CHUNK_FLAG = 0x80000000;
+	//set in the size prefix of a reliable message to indicate that it is sent with MSG_FLAG_COMPACT
+	static const uint32_t RELIABLE_COMPACT_MSG_FLAG = 0x40000000;
+
+	enum StreamChunkFlags :uint32_t {
+		STREAM_CHUNK_ABORT = 0x1,
+	};
+
+	struct StreamChunkHeader {
+		uint32_t streamId;
+		uint32_t flags;
+		uint64_t offset;
+		uint64_t totalSize;
 	};
 	
 	enum MsgChunkType :uint32_t {
@@ -83,8 +116,15 @@ namespace HQRemote {
 		PING_MSG_CHUNK,
 		PING_REPLY_MSG_CHUNK,
 		FRAGMENT_HEADER_EX,
+		ARQ_DATA_CHUNK,
+		ARQ_ACK_CHUNK,
 	};
 
+	//ARQ chunk's <reserved> field: low byte is stream index, the rest are flags
+	static const uint32_t ARQ_STREAM_IDX_MASK = 0xff;
+	static const uint32_t ARQ_MSG_STREAM_CHUNK_FLAG = 0x100;//the message is a segment sent by sendDataStream()
+	static const uint32_t ARQ_MSG_COMPACT_FLAG = 0x200;//the message is sent with MSG_FLAG_COMPACT
+
 	union MsgChunkHeader 
 	{
 		struct {
@@ -105,12 +145,98 @@ namespace HQRemote {
 				struct {
 					uint64_t sendTime;
 				} pingInfo;
+
+				struct {
+					uint32_t seq;
+					uint32_t total_msg_size;
+				} arqDataInfo;//<id> is transmission time, echoed back by acknowledgement
+
+				struct {
+					uint32_t cumulativeAck;//all packets before this sequence number have been received
+					uint32_t selectiveAcks;//bit i is set if packet (cumulativeAck + 1 + i) has been received
+				} arqAckInfo;//<id> is the echoed transmission time of the packet triggering this ack
 			};
 		};
 
 		uint64_t unusedName[3];//this to make sure size of this header is multiple of 64 bit
 	};
 
+	//compact fragment header, used when remote side's protocol version is 3+:
+	//marker | check byte | flags | varint msg id | varint total msg size | varint offset
+	//NOTE: ping & ARQ chunks still use MsgChunkHeader. Ids in MsgChunkHeader sent by this library never
+	//start with the marker byte, the check byte guards against older remote side's headers.
+	static const unsigned char COMPACT_CHUNK_MARKER = 0xc7;
+	static const size_t MAX_COMPACT_CHUNK_HEADER_SIZE = 3 + MAX_VARINT64_SIZE + 2 * MAX_VARINT32_SIZE;
+	static const uint64_t COMPACT_CHUNK_ID_FLAG = 0x8000000000000000;//to distinguish compact fragments' ids from other ids in pending buffers
+
+	enum CompactChunkFlags :unsigned char {
+		COMPACT_CHUNK_FRAGMENT = 0x1,
+		COMPACT_CHUNK_TYPE_MASK = 0xf,
+		COMPACT_CHUNK_COMPACT_MSG = 0x10,//the message is sent with MSG_FLAG_COMPACT
+	};
+
+	struct CompactChunkHeader {
+		unsigned char flags;
+		uint64_t id;
+		uint32_t total_msg_size;
+		uint32_t offset;
+	};
+
+	static unsigned char compactChunkHeaderCheck(const unsigned char* data, size_t size) {
+		//FNV-1a folded to 8 bits
+		uint32_t hash = 0x811c9dc5;
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ data[i]) * 0x01000193;
+		return (unsigned char)(hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24));
+	}
+
+	//return header size
+	static size_t writeCompactChunkHeader(const CompactChunkHeader& header, unsigned char* dst) {
+		WireWriter writer(dst + 2);
+		writer.writeU8(header.flags);
+		writer.writeVarint(header.id);
+		writer.writeVarint(header.total_msg_size);
+		writer.writeVarint(header.offset);
+
+		dst[0] = COMPACT_CHUNK_MARKER;
+		dst[1] = compactChunkHeaderCheck(dst + 2, writer.size());
+
+		return writer.size() + 2;
+	}
+
+	//return header size, 0 if the data doesn't start with a compact header
+	static size_t parseCompactChunkHeader(const void* data, size_t size, CompactChunkHeader& header) {
+		auto bytes = (const unsigned char*)data;
+		if (size < 3 || bytes[0] != COMPACT_CHUNK_MARKER)
+			return 0;
+
+		WireReader reader(bytes + 2, size - 2);
+		header.flags = reader.readU8();
+		header.id = reader.readVarint();
+		auto totalSize = reader.readVarint();
+		auto offset = reader.readVarint();
+
+		if (reader.failed() || (header.flags & COMPACT_CHUNK_TYPE_MASK) != COMPACT_CHUNK_FRAGMENT ||
+			totalSize > 0xffffffff || offset > totalSize ||
+			bytes[1] != compactChunkHeaderCheck(bytes + 2, reader.position()))
+			return 0;
+
+		header.total_msg_size = (uint32_t)totalSize;
+		header.offset = (uint32_t)offset;
+
+		return reader.position() + 2;
+	}
+
+	static inline bool isCompactChunk(const void* data, size_t size) {
+		CompactChunkHeader header;
+		return parseCompactChunkHeader(data, size, header) != 0;
+	}
+
+	//make sure MsgChunkHeader's id doesn't start with compact header's marker
+	static inline uint64_t makeChunkId(uint64_t id) {
+		return (id & 0xff) == COMPACT_CHUNK_MARKER ? id + 1 : id;
+	}
+
 	struct IConnectionHandler::MsgChunk {
 		MsgChunk() {
 			assert(offsetHeaderToPayload() == 0);
@@ -126,12 +252,111 @@ namespace HQRemote {
 		}
 	};
 
+	static inline bool arqSeqBefore(uint32_t seq1, uint32_t seq2) {
+		return (int32_t)(seq1 - seq2) < 0;
+	}
+
+	struct IConnectionHandler::ArqState {
+		struct Packet {
+			uint32_t seq;
+			DataRef data;//header + payload
+			uint64_t lastSendTime64;
+			uint32_t numTransmissions;
+			uint32_t numAckedAfter;//number of acks reporting later packets since last transmission
+			bool acked;
+		};
+
+		struct SendStream {
+			uint32_t nextSeq;
+			std::deque<Packet> packets;//not yet acknowledged packets, only the first ARQ_WINDOW_SIZE ones may be in flight
+		};
+
+		struct RecvStream {
+			uint32_t nextExpectedSeq;
+			std::map<uint32_t, DataRef> outOfOrderPackets;
+
+			DataRef msgData;//null if current message is being discarded
+			uint32_t msgSize;
+			uint32_t msgFilledSize;
+			uint32_t msgFlags;
+			bool msgStarted;
+
+			bool ackPending;
+			uint64_t ackEchoTime64;
+		};
+
+		ArqState() {
+			reset();
+		}
+
+		void reset() {
+			for (auto& stream : sendStreams) {
+				stream.nextSeq = 0;
+				stream.packets.clear();
+			}
+
+			for (auto& stream : recvStreams) {
+				stream.nextExpectedSeq = 0;
+				stream.outOfOrderPackets.clear();
+				stream.msgData = nullptr;
+				stream.msgStarted = false;
+				stream.ackPending = false;
+			}
+
+			hasRttSample = false;
+			srtt = rttvar = 0;
+			rto = ARQ_INITIAL_RTO;
+		}
+
+		//RFC 6298, except that the bounds are much lower to suit real time traffic
+		void updateRto(double rtt) {
+			if (!hasRttSample) {
+				srtt = rtt;
+				rttvar = rtt / 2;
+				hasRttSample = true;
+			}
+			else {
+				rttvar = 0.75 * rttvar + 0.25 * fabs(srtt - rtt);
+				srtt = 0.875 * srtt + 0.125 * rtt;
+			}
+
+			rto = srtt + (std::max)(ARQ_CLOCK_GRANULARITY, 4 * rttvar);
+			rto = (std::min)((std::max)(rto, ARQ_MIN_RTO), ARQ_MAX_RTO);
+		}
+
+		void transmit(Packet& packet, uint64_t time64, std::vector<DataRef>& packetsToSend) {
+			MsgChunkHeader header;
+			memcpy(&header, packet.data->data(), sizeof(header));
+			header.id = makeChunkId(time64);
+			memcpy(packet.data->data(), &header, sizeof(header));
+
+			packet.lastSendTime64 = time64;
+			packet.numTransmissions++;
+			packet.numAckedAfter = 0;
+
+			packetsToSend.push_back(packet.data);
+		}
+
+		SendStream sendStreams[NUM_ARQ_STREAMS];
+		RecvStream recvStreams[NUM_ARQ_STREAMS];
+
+		bool hasRttSample;
+		double srtt, rttvar, rto;
+
+		mutable std::mutex lock;
+		std::condition_variable sendCv;//signaled when packets are acknowledged
+	};
+
 	/*--------------- IConnectionHandler -----------*/
 	IConnectionHandler::IConnectionHandler()
 	: m_running(false),
 		m_maxMsgSize(50 * 1024 * 1024),
 		m_recvRate(0), m_tag(0), m_sentRate(0),
-		m_compatibleMode(true)
+		m_remoteProtocolVersion(0),
+		m_numReliableSendersWaiting(0), m_nextStreamId(1),
+		m_nextUnreliableMsgId(1),
+		m_lossWindowFirstId(0), m_lossWindowLastId(0), m_lossWindowNumReceived(0), m_unreliableLossRate(0),
+		m_arq(new ArqState())
 	{
 	}
 	
@@ -162,6 +387,11 @@ namespace HQRemote {
 		m_internalError = nullptr;
 		
 		invalidateUnusedReliableData();
+
+		{
+			std::lock_guard<std::mutex> lg(m_arq->lock);
+			m_arq->reset();
+		}
 		
 		m_numLastestDataReceived = 0;
 		m_recvRate = 0;
@@ -182,6 +412,12 @@ namespace HQRemote {
 			m_dataCv.notify_all();
 			m_dataLock.unlock();
 		}
+
+		//wake any user thread blocked when sending on ARQ stream
+		{
+			std::lock_guard<std::mutex> lg(m_arq->lock);
+			m_arq->sendCv.notify_all();
+		}
 		
 #ifdef DEBUG
 		Log("IConnectionHandler::stop() finished\n");
@@ -202,30 +438,69 @@ namespace HQRemote {
 		return getElapsedTime(m_startTime, curTime);
 	}
 	
-	void IConnectionHandler::sendData(ConstDataRef data) {
+	void IConnectionHandler::sendData(ConstDataRef data, uint32_t msgFlags) {
 		if (data == nullptr)
 			return;
-		sendData(data->data(), data->size());
+		sendData(data->data(), data->size(), msgFlags);
 	}
 
-	void IConnectionHandler::sendDataUnreliable(ConstDataRef data) {
+	void IConnectionHandler::sendDataUnreliable(ConstDataRef data, uint32_t msgFlags) {
 		if (data == nullptr)
 			return;
-		sendDataUnreliable(data->data(), data->size());
+		sendDataUnreliable(data->data(), data->size(), msgFlags);
 	}
 	
-	inline void IConnectionHandler::sendRawDataAtomic(const void* data, size_t size)
+	inline bool IConnectionHandler::sendRawDataAtomic(const void* data, size_t size)
 	{
 		_ssize_t re;
 		
 		size_t offset = 0;
 		do {
 			re = sendRawDataImpl((const char*)data + offset, size - offset);
-			offset += re;
+			if (re > 0)
+				offset += re;
 		} while (re > 0 && offset < size);
+
+		return offset == size;
+	}
+
+	bool IConnectionHandler::sendReliableMessage(const void* data, size_t size, uint32_t sizeFlags)
+	{
+		if (!reliableChannelConnected() && isArqAvailable())
+		{
+			//don't let the data become lossy, use ARQ in place of reliable channel
+			uint32_t arqFlags = 0;
+			if (sizeFlags & RELIABLE_STREAM_CHUNK_FLAG)
+				arqFlags |= ARQ_MSG_STREAM_CHUNK_FLAG;
+			if (sizeFlags & RELIABLE_COMPACT_MSG_FLAG)
+				arqFlags |= ARQ_MSG_COMPACT_FLAG;
+			return sendArqMessage(data, size, arqFlags, 0);
+		}
+
+		bool re;
+		uint32_t sizeToSend = (uint32_t)size | sizeFlags;
+
+		{
+			//size & message pair must not be interleaved with other threads' messages
+			std::lock_guard<std::mutex> lg(m_reliableSendLock);
+
+			//send size of message first
+			re = sendRawDataAtomic(&sizeToSend, sizeof(sizeToSend));
+
+			//send message itself
+			if (re)
+				re = sendRawDataAtomic(data, size);
+
+			flushRawDataImpl();
+		}
+
+		// assume all data successfully sent. It doesn't need to be accurate anyway
+		updateDataSentRate(size + sizeof(sizeToSend));
+
+		return re;
 	}
 	
-	void IConnectionHandler::sendData(const void* data, size_t size)
+	void IConnectionHandler::sendData(const void* data, size_t size, uint32_t msgFlags)
 	{
 		assert(size <= 0xffffffff);
 
@@ -234,22 +509,106 @@ namespace HQRemote {
 			HQRemote::LogErr("Data size (%zu) exceed maximum allowed size (%u)\n", size, m_maxMsgSize);
 			return;
 		}
-		
-		//send size of message first
-		uint32_t sizeToSend = (uint32_t)size;
-		sendRawDataAtomic(&sizeToSend, sizeof(sizeToSend));
-		
-		
-		//send message itself
-		sendRawDataAtomic(data, size);
-		
-		flushRawDataImpl();
 
-		// assume all data successfully sent. It doesn't need to be accurate anyway
-		updateDataSentRate(size + sizeof(sizeToSend));
+		//let any on-going stream know that it should yield to us
+		{
+			std::lock_guard<std::mutex> lg(m_reliableWaitLock);
+			m_numReliableSendersWaiting++;
+		}
+
+		sendReliableMessage(data, size, (msgFlags & MSG_FLAG_COMPACT) ? RELIABLE_COMPACT_MSG_FLAG : 0);
+
+		{
+			std::lock_guard<std::mutex> lg(m_reliableWaitLock);
+			if (--m_numReliableSendersWaiting == 0)
+				m_reliableWaitCv.notify_all();
+		}
+	}
+
+	uint32_t IConnectionHandler::sendDataStream(const void* data, uint64_t size)
+	{
+		return sendDataStream(size, [data](void* dst, uint64_t offset, size_t maxSize) -> size_t {
+			memcpy(dst, (const unsigned char*)data + offset, maxSize);
+			return maxSize;
+		});
+	}
+
+	uint32_t IConnectionHandler::sendDataStream(uint64_t size, StreamReader reader)
+	{
+		uint32_t streamId;
+		while ((streamId = m_nextStreamId.fetch_add(1, std::memory_order_relaxed)) == 0);//0 is reserved for error
+
+		if (m_remoteProtocolVersion < 2)
+		{
+			//older remote side doesn't understand stream chunks, send the whole message at once
+			if (size > m_maxMsgSize)
+			{
+				HQRemote::LogErr("Stream size (%llu) exceed maximum allowed size (%u) in compatible mode\n", (unsigned long long)size, m_maxMsgSize);
+				return 0;
+			}
+
+			try {
+				auto data = makePooledData((size_t)size);
+				uint64_t offset = 0;
+				while (offset < size) {
+					auto re = reader(data->data() + offset, offset, (size_t)(size - offset));
+					if (re == 0)
+						return 0;
+					offset += re;
+				}
+
+				sendData(data);
+			}
+			catch (...) {
+				return 0;//memory failed
+			}
+
+			return streamId;
+		}
+
+		CData chunk(sizeof(StreamChunkHeader) + MAX_STREAM_SEGMENT_SIZE);
+		StreamChunkHeader header;
+		header.streamId = streamId;
+		header.flags = 0;
+		header.offset = 0;
+		header.totalSize = size;
+
+		auto payload = chunk.data() + sizeof(header);
+
+		do {
+			auto segmentSize = (size_t)min((uint64_t)MAX_STREAM_SEGMENT_SIZE, size - header.offset);
+			size_t filledSize = 0;
+			while (filledSize < segmentSize)
+			{
+				auto re = reader(payload + filledSize, header.offset + filledSize, segmentSize - filledSize);
+				if (re == 0)
+				{
+					//cancelled by user, tell the receiver to discard what it has got so far
+					header.flags = STREAM_CHUNK_ABORT;
+					memcpy(chunk.data(), &header, sizeof(header));
+					sendReliableMessage(chunk.data(), sizeof(header), RELIABLE_STREAM_CHUNK_FLAG);
+					return 0;
+				}
+				filledSize += re;
+			}
+
+			//let small messages waiting to be sent go first
+			{
+				std::unique_lock<std::mutex> lk(m_reliableWaitLock);
+				m_reliableWaitCv.wait(lk, [this] { return m_numReliableSendersWaiting == 0; });
+			}
+
+			memcpy(chunk.data(), &header, sizeof(header));
+			if (!sendReliableMessage(chunk.data(), sizeof(header) + segmentSize, RELIABLE_STREAM_CHUNK_FLAG))
+				return 0;
+
+			header.offset += segmentSize;
+		} while (header.offset < size);
+
+		return streamId;
 	}
 	
-	void IConnectionHandler::sendDataUnreliable(const void* data, size_t size) {
+	void IConnectionHandler::sendDataUnreliable(const void* data, size_t size, uint32_t msgFlags) {
 		_ssize_t re = 0;
 		assert(size <= 0xffffffff);
 
@@ -258,16 +617,22 @@ namespace HQRemote {
 			HQRemote::LogErr("Data size (%zu) exceed maximum allowed size (%u)\n", size, m_maxMsgSize);
 			return;
 		}
+
+		if (m_remoteProtocolVersion >= 3)
+		{
+			sendCompactFragments(data, size, msgFlags);
+			return;
+		}
 		
 		//TODO: assume all sides use the same byte order for now
 		uint32_t headerSize = sizeof(MsgChunkHeader);
 		
 		MsgChunk chunk;
-		chunk.header.id = generateIDFromTime();
+		chunk.header.id = makeChunkId(generateIDFromTime());
 
 		uint32_t maxFragmentSize = sizeof(chunk.payload);
 
-		if (m_compatibleMode) {
+		if (m_remoteProtocolVersion == 0) {
 			chunk.header.type = MSG_HEADER;
 			chunk.header.wholeMsgInfo.msg_size = (uint32_t)size;//whole message size
 
@@ -320,6 +685,45 @@ namespace HQRemote {
 			
 		} while (re > 0 && chunk.header.fragmentInfo.offset < size);
 	}
+
+	void IConnectionHandler::sendCompactFragments(const void* data, size_t size, uint32_t msgFlags) {
+		_ssize_t re = 0;
+		unsigned char chunk[MAX_COMPACT_CHUNK_HEADER_SIZE + MAX_FRAGMEMT_SIZE];
+
+		CompactChunkHeader header;
+		header.flags = COMPACT_CHUNK_FRAGMENT;
+		if (msgFlags & MSG_FLAG_COMPACT)
+			header.flags |= COMPACT_CHUNK_COMPACT_MSG;
+		header.id = m_nextUnreliableMsgId.fetch_add(1, std::memory_order_relaxed) & ~COMPACT_CHUNK_ID_FLAG;
+		header.total_msg_size = (uint32_t)size;
+		header.offset = 0;
+
+		uint32_t maxFragmentSize = MAX_FRAGMEMT_SIZE;
+
+		do {
+			auto headerSize = writeCompactChunkHeader(header, chunk);
+			auto chunkPayloadSize = min(maxFragmentSize, (uint32_t)size - header.offset);
+
+			//fill chunk's data
+			memcpy(chunk + headerSize, (const char*)data + header.offset, chunkPayloadSize);
+
+			//send chunk
+			re = sendRawDataUnreliableImpl(chunk, headerSize + chunkPayloadSize);
+
+			if (re > 0) {
+				updateDataSentRate(re);
+
+				if ((size_t)re < headerSize)
+					re = -1;//not even able to send the header data. Treat as error
+				else {
+					uint32_t sentPayloadSize = (uint32_t)(re - headerSize);
+					if (sentPayloadSize < chunkPayloadSize)//partially sent, reduce max payload size for next fragment
+						maxFragmentSize = sentPayloadSize;
+					header.offset += sentPayloadSize;//next fragment
+				}
+			}//if (re > 0)
+		} while (re > 0 && header.offset < size);
+	}
 	
 	inline void IConnectionHandler::fillReliableBuffer(const void* &data, size_t& size)
 	{
@@ -346,7 +750,7 @@ namespace HQRemote {
 					//we are expecting message size
 					if (m_reliableBuffer.data == nullptr)
 					{
-						m_reliableBuffer.data = std::make_shared<CData>(sizeof(uint32_t));
+						m_reliableBuffer.data = makePooledData(sizeof(uint32_t));
 						m_reliableBuffer.filledSize = 0;
 					}
 					
@@ -359,14 +763,32 @@ namespace HQRemote {
 						
 						//initialize placeholder for message data
 						m_reliableBuffer.data = nullptr;
+						m_reliableBuffer.msgFlags = (messageSize & RELIABLE_COMPACT_MSG_FLAG) ? (uint32_t)MSG_FLAG_COMPACT : 0u;
+						messageSize &= ~RELIABLE_COMPACT_MSG_FLAG;
 
-						if (messageSize > m_maxMsgSize) //abnormal size
+						if (messageSize & RELIABLE_STREAM_CHUNK_FLAG)
+						{
+							//a segment of a stream, its size is always bounded
+							messageSize &= ~RELIABLE_STREAM_CHUNK_FLAG;
+							if (messageSize < sizeof(StreamChunkHeader) || messageSize > sizeof(StreamChunkHeader) + MAX_STREAM_SEGMENT_SIZE)
+							{
+								HQRemote::LogErr("Illegal stream chunk size=%u\n", messageSize);
+							}
+							else
+							{
+								m_reliableBuffer.data = makePooledData(messageSize);
+								m_reliableBuffer.filledSize = 0;
+
+								m_reliableBufferState = READ_STREAM_CHUNK;
+							}
+						}
+						else if (messageSize > m_maxMsgSize) //abnormal size
 						{
 							HQRemote::LogErr("Illegal message size=%u (max=%u)\n", messageSize, m_maxMsgSize);
 						}
 						else
 						try {
-							m_reliableBuffer.data = std::make_shared<CData>(messageSize);
+							m_reliableBuffer.data = makePooledData(messageSize);
 							m_reliableBuffer.filledSize = 0;
 							
 							m_reliableBufferState = READ_MESSAGE;
@@ -385,22 +807,131 @@ namespace HQRemote {
 					if (m_reliableBuffer.data->size() == m_reliableBuffer.filledSize)//full
 					{
 						//copy message's data to queue for user to read
-						pushDataToQueue(m_reliableBuffer.data, true, false);
+						pushDataToQueue(m_reliableBuffer.data, true, false, m_reliableBuffer.msgFlags);
 						
 						m_reliableBufferState = READ_NEXT_MESSAGE_SIZE;//waiting for next message
 						m_reliableBuffer.data = nullptr;
 					}
 				}
 					break;
+				case READ_STREAM_CHUNK:
+				{
+					fillReliableBuffer(data, size);
+
+					if (m_reliableBuffer.data->size() == m_reliableBuffer.filledSize)//full
+					{
+						auto chunkData = m_reliableBuffer.data;
+
+						m_reliableBufferState = READ_NEXT_MESSAGE_SIZE;//waiting for next message
+						m_reliableBuffer.data = nullptr;
+
+						onReceivedStreamChunk(chunkData);
+					}
+				}
+					break;
 			}
 		}//while (size > 0)
 	}
+
+	void IConnectionHandler::onReceivedStreamChunk(const DataRef& chunkData)
+	{
+		StreamChunkHeader header;
+		memcpy(&header, chunkData->data(), sizeof(header));
+		auto segmentSize = chunkData->size() - sizeof(header);
+
+		std::lock_guard<std::mutex> lg(m_streamLock);
+
+		if (header.flags & STREAM_CHUNK_ABORT)
+		{
+			m_reassembledStreams.erase(header.streamId);
+			if (m_incomingStreams.erase(header.streamId))
+			{
+				for (auto& delegate : m_streamDelegates)
+					delegate->onStreamAborted(header.streamId);
+			}
+			return;
+		}
+
+		if (header.offset > header.totalSize || segmentSize > header.totalSize - header.offset) // overflow
+		{
+			HQRemote::LogErr("discarded an overflow stream segment (%llu sz=%zu)\n", (unsigned long long)header.offset, segmentSize);
+			return;
+		}
+
+		bool lastSegment = header.offset + segmentSize == header.totalSize;
+
+		if (m_streamDelegates.size())
+		{
+			//deliver the segment right away, no need to buffer anything
+			if (lastSegment)
+				m_incomingStreams.erase(header.streamId);
+			else
+				m_incomingStreams.insert(header.streamId);
+
+			auto segment = std::make_shared<DataSegment>(chunkData, sizeof(header), segmentSize);
+			for (auto& delegate : m_streamDelegates)
+				delegate->onStreamSegment(header.streamId, header.offset, header.totalSize, segment);
+			return;
+		}
+
+		//no one consumes the stream incrementally, reassemble it as a normal message
+		auto ite = m_reassembledStreams.find(header.streamId);
+		if (ite == m_reassembledStreams.end())
+		{
+			if (header.totalSize > m_maxMsgSize)
+			{
+#if defined DEBUG || defined _DEBUG
+				HQRemote::LogErr("discarded a stream segment, stream size=%llu exceeds max message size\n", (unsigned long long)header.totalSize);
+#endif
+				return;
+			}
+
+			try {
+				MsgBuf newBuf;
+				newBuf.data = makePooledData((size_t)header.totalSize);
+				newBuf.filledSize = 0;
+				newBuf.msgFlags = 0;
+
+				ite = m_reassembledStreams.insert(std::pair<uint32_t, MsgBuf>(header.streamId, newBuf)).first;
+			}
+			catch (...) {
+				return;//memory failed
+			}
+		}
+
+		auto& buffer = ite->second;
+		memcpy(buffer.data->data() + header.offset, chunkData->data() + sizeof(header), segmentSize);
+		buffer.filledSize += (uint32_t)segmentSize;
+
+		if (lastSegment)
+		{
+			pushDataToQueue(buffer.data, true, false);
+
+			m_reassembledStreams.erase(ite);
+		}
+	}
+
+	void IConnectionHandler::abortIncomingStreams()
+	{
+		std::lock_guard<std::mutex> lg(m_streamLock);
+
+		for (auto streamId : m_incomingStreams) {
+			for (auto& delegate : m_streamDelegates)
+				delegate->onStreamAborted(streamId);
+		}
+
+		m_incomingStreams.clear();
+		m_reassembledStreams.clear();
+	}
 	
 	void IConnectionHandler::invalidateUnusedReliableData()
 	{
 		m_reliableBufferState = READ_NEXT_MESSAGE_SIZE;
 		m_reliableBuffer.data = nullptr;
 		m_reliableBuffer.filledSize = 0;
+		m_reliableBuffer.msgFlags = 0;
+
+		abortIncomingStreams();
 	}
 	
 	IConnectionHandler::UnreliableBuffers::iterator IConnectionHandler::getOrCreateUnreliableBuffer(uint64_t id, size_t size) {
@@ -409,7 +940,7 @@ namespace HQRemote {
 		if (ite != m_unreliableBuffers.end())
 			return ite;
 
-		auto data = std::make_shared<CData>(size);
+		auto data = makePooledData(size);
 		//initialize a placeholder for upcoming message
 		if (m_unreliableBuffers.size() == MAX_PENDING_UNRELIABLE_BUF)//discard oldest pending message
 		{
@@ -424,14 +955,97 @@ namespace HQRemote {
 		MsgBuf newBuf;
 		newBuf.data = data;
 		newBuf.filledSize = 0;
+		newBuf.msgFlags = 0;
 
 		auto re = m_unreliableBuffers.insert(std::pair<uint64_t, MsgBuf>(id, newBuf));
 
 		return re.first;
 	}
 
+	bool IConnectionHandler::fillUnreliableBuffer(UnreliableBuffers::iterator pendingBufIte, uint32_t offset, const void* payload, size_t payloadSize)
+	{
+		auto& buffer = pendingBufIte->second;
+
+		if (offset + payloadSize > buffer.data->size()) // overflow
+		{
+#if defined DEBUG || defined _DEBUG
+			HQRemote::LogErr("discarded a fragment due to oveflow segment (%u sz=%u)\n", offset, payloadSize);
+#endif
+			return false;
+		}
+
+		memcpy(buffer.data->data() + offset, payload, payloadSize);
+		buffer.filledSize += payloadSize;
+
+		//message is complete, push to data queue for comsuming
+		if (buffer.filledSize >= buffer.data->size()) {
+			pushDataToQueue(buffer.data, false, true, buffer.msgFlags);
+
+			//remove from pending list
+			m_unreliableBuffers.erase(pendingBufIte);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	void IConnectionHandler::updateUnreliableLossRate(uint64_t receivedMsgId) {
+		time_checkpoint_t curTime;
+		getTimeCheckPoint(curTime);
+
+		if (m_lossWindowFirstId == 0)
+		{
+			//start measuring from first received message
+			m_lossWindowFirstId = m_lossWindowLastId = receivedMsgId;
+			m_lossWindowNumReceived = 1;
+			m_lossWindowStartTime = curTime;
+			return;
+		}
+
+		if (receivedMsgId < m_lossWindowFirstId)//arrived too late, it was already counted as lost
+			return;
+
+		m_lossWindowNumReceived++;
+		if (receivedMsgId > m_lossWindowLastId)
+			m_lossWindowLastId = receivedMsgId;
+
+		if (getElapsedTime(m_lossWindowStartTime, curTime) >= LOSS_RATE_UPDATE_INTERVAL)
+		{
+			auto numExpected = m_lossWindowLastId - m_lossWindowFirstId + 1;
+			float lossRate = m_lossWindowNumReceived >= numExpected ? 0.f : 1.f - (float)m_lossWindowNumReceived / numExpected;
+			m_unreliableLossRate.store(lossRate, std::memory_order_relaxed);
+
+			//next window continues right after last received message
+			m_lossWindowFirstId = m_lossWindowLastId + 1;
+			m_lossWindowNumReceived = 0;
+			m_lossWindowStartTime = curTime;
+		}
+	}
+
 	void IConnectionHandler::onReceivedUnreliableDataFragment(const void* recv_data, size_t recv_size)
 	{
+		//only peers having protocol version 3+ send compact headers, older ones' fragments might look like one
+		CompactChunkHeader compactHeader;
+		auto compactHeaderSize = m_remoteProtocolVersion >= 3 ? parseCompactChunkHeader(recv_data, recv_size, compactHeader) : 0;
+		if (compactHeaderSize)
+		{
+			if (compactHeader.total_msg_size > m_maxMsgSize)
+				return;
+
+			try {
+				auto pendingBufIte = getOrCreateUnreliableBuffer(compactHeader.id | COMPACT_CHUNK_ID_FLAG, compactHeader.total_msg_size);
+				pendingBufIte->second.msgFlags = (compactHeader.flags & COMPACT_CHUNK_COMPACT_MSG) ? (uint32_t)MSG_FLAG_COMPACT : 0u;
+
+				if (fillUnreliableBuffer(pendingBufIte, compactHeader.offset, (const unsigned char*)recv_data + compactHeaderSize, recv_size - compactHeaderSize))
+					updateUnreliableLossRate(compactHeader.id);
+			} catch (...)
+			{
+				//memory failed
+			}
+			return;
+		}
+
 		if (recv_size < sizeof(MsgChunkHeader))
 			return;
 		MsgChunkHeader chunkHeader;
@@ -462,29 +1076,10 @@ namespace HQRemote {
 					}
 
 					if (pendingBufIte != m_unreliableBuffers.end()) {
-						auto& buffer = pendingBufIte->second;
-
 						auto payload = (unsigned char*)recv_data + sizeof(chunkHeader);
 						auto payloadSize = recv_size - sizeof(chunkHeader);
 
-						if (chunkHeader.fragmentInfo.offset + payloadSize > buffer.data->size()) // overflow
-						{
-#if defined DEBUG || defined _DEBUG
-							HQRemote::LogErr("discarded a fragment due to oveflow segment (%u sz=%u)\n", chunkHeader.fragmentInfo.offset, payloadSize);
-#endif
-							break;
-						}
-					
-						memcpy(buffer.data->data() + chunkHeader.fragmentInfo.offset, payload, payloadSize);
-						buffer.filledSize += payloadSize;
-						
-						//message is complete, push to data queue for comsuming
-						if (buffer.filledSize >= buffer.data->size()) {
-							pushDataToQueue(buffer.data, false, true);
-							
-							//remove from pending list
-							m_unreliableBuffers.erase(pendingBufIte);
-						}
+						fillUnreliableBuffer(pendingBufIte, chunkHeader.fragmentInfo.offset, payload, payloadSize);
 					}
 	#if defined DEBUG || defined _DEBUG
 					else {
@@ -493,12 +1088,321 @@ namespace HQRemote {
 	#endif
 				}
 					break;
+				case ARQ_DATA_CHUNK:
+				case ARQ_ACK_CHUNK:
+					onReceivedArqChunk(recv_data, recv_size);
+					break;
 			}//switch (chunkHeader.type)
 		} catch (...)
 		{
 			//TODO
 		}
 	}
+
+	/*-------- ARQ over unreliable channel ---------*/
+	bool IConnectionHandler::isArqAvailable() const {
+		return m_remoteProtocolVersion >= 2 && unreliableChannelConnected();
+	}
+
+	bool IConnectionHandler::sendDataOnArqStream(ConstDataRef data, unsigned int streamIdx, uint32_t msgFlags) {
+		if (data == nullptr)
+			return false;
+		return sendDataOnArqStream(data->data(), data->size(), streamIdx, msgFlags);
+	}
+
+	bool IConnectionHandler::sendDataOnArqStream(const void* data, size_t size, unsigned int streamIdx, uint32_t msgFlags) {
+		assert(streamIdx < NUM_ARQ_STREAMS);
+
+		if (size > m_maxMsgSize)
+		{
+			HQRemote::LogErr("Data size (%zu) exceed maximum allowed size (%u)\n", size, m_maxMsgSize);
+			return false;
+		}
+
+		if (!isArqAvailable())
+		{
+			sendData(data, size, msgFlags);
+			return true;
+		}
+
+		return sendArqMessage(data, size, (msgFlags & MSG_FLAG_COMPACT) ? ARQ_MSG_COMPACT_FLAG : 0, streamIdx % NUM_ARQ_STREAMS);
+	}
+
+	bool IConnectionHandler::sendArqMessage(const void* data, size_t size, uint32_t msgFlags, unsigned int streamIdx) {
+		std::vector<DataRef> packetsToSend;
+		auto time64 = getTimeCheckPoint64();
+
+		{
+			std::unique_lock<std::mutex> lk(m_arq->lock);
+			auto& stream = m_arq->sendStreams[streamIdx];
+
+			//flow control: don't let unacknowledged packets pile up indefinitely
+			auto numPacketsNeeded = (size + ARQ_MAX_PAYLOAD_SIZE - 1) / ARQ_MAX_PAYLOAD_SIZE;
+			auto waitStartTime64 = time64;
+			while (stream.packets.size() > 0 && stream.packets.size() + numPacketsNeeded > ARQ_MAX_QUEUED_PACKETS)
+			{
+				if (!m_running || !unreliableChannelConnected() || getElapsedTime64(waitStartTime64, time64) * 1000 >= ARQ_MAX_SEND_WAIT_MS)
+				{
+					HQRemote::LogErr("ARQ stream %u is full, dropping message of %zu bytes\n", streamIdx, size);
+					return false;
+				}
+				m_arq->sendCv.wait_for(lk, std::chrono::milliseconds(100));
+				time64 = getTimeCheckPoint64();
+			}
+
+			MsgChunkHeader header;
+			header.type = ARQ_DATA_CHUNK;
+			header.reserved = streamIdx | msgFlags;
+			header.arqDataInfo.total_msg_size = (uint32_t)size;
+
+			size_t offset = 0;
+			do {
+				auto payloadSize = min((size_t)ARQ_MAX_PAYLOAD_SIZE, size - offset);
+
+				header.id = 0;
+				header.arqDataInfo.seq = stream.nextSeq++;
+
+				ArqState::Packet packet;
+				packet.seq = header.arqDataInfo.seq;
+				packet.data = makePooledData(sizeof(header) + payloadSize);
+				packet.lastSendTime64 = 0;
+				packet.numTransmissions = 0;
+				packet.numAckedAfter = 0;
+				packet.acked = false;
+
+				memcpy(packet.data->data(), &header, sizeof(header));
+				memcpy(packet.data->data() + sizeof(header), (const unsigned char*)data + offset, payloadSize);
+
+				stream.packets.push_back(packet);
+
+				//send right away if it is within the window
+				if (stream.packets.size() <= ARQ_WINDOW_SIZE)
+					m_arq->transmit(stream.packets.back(), time64, packetsToSend);
+
+				offset += payloadSize;
+			} while (offset < size);
+		}
+
+		sendArqPackets(packetsToSend);
+
+		return true;
+	}
+
+	void IConnectionHandler::sendArqPackets(const std::vector<DataRef>& packets) {
+		//NOTE: must not be called with ARQ lock held
+		if (!unreliableChannelConnected())
+			return;//will be retransmitted later
+
+		for (auto& packet : packets) {
+			auto re = sendRawDataUnreliableImpl(packet->data(), packet->size());
+			if (re > 0)
+				updateDataSentRate(re);
+		}
+	}
+
+	void IConnectionHandler::onReceivedArqChunk(const void* recv_data, size_t recv_size) {
+		MsgChunkHeader header;
+		memcpy(&header, recv_data, sizeof(header));
+
+		auto streamIdx = header.reserved & ARQ_STREAM_IDX_MASK;
+		if (streamIdx >= NUM_ARQ_STREAMS)
+			return;
+
+		std::vector<DataRef> packetsToSend;
+		std::vector<std::pair<DataRef, uint32_t> > completedMsgs;
+
+		{
+			std::lock_guard<std::mutex> lg(m_arq->lock);
+
+			if (header.type == ARQ_ACK_CHUNK)
+			{
+				auto& stream = m_arq->sendStreams[streamIdx];
+				auto curTime64 = getTimeCheckPoint64();
+				auto cumulativeAck = header.arqAckInfo.cumulativeAck;
+				auto selectiveAcks = header.arqAckInfo.selectiveAcks;
+
+				//echoed transmission time gives unambiguous rtt even for retransmitted packets
+				if (header.id != 0)
+					m_arq->updateRto(getElapsedTime64(header.id, curTime64));
+
+				size_t numPrevPackets = stream.packets.size();
+				while (stream.packets.size() && arqSeqBefore(stream.packets.front().seq, cumulativeAck))
+					stream.packets.pop_front();
+
+				//find the latest packet known to be received
+				int lastAckedIdx = -1;
+				for (size_t i = 0; i < stream.packets.size() && i < ARQ_WINDOW_SIZE; ++i) {
+					auto& packet = stream.packets[i];
+					auto distance = packet.seq - cumulativeAck - 1;
+					if (packet.seq != cumulativeAck && distance < 32 && (selectiveAcks & (1u << distance)))
+					{
+						packet.acked = true;
+						lastAckedIdx = (int)i;
+					}
+				}
+
+				//fast retransmit packets that later packets have overtaken several times
+				for (int i = 0; i < lastAckedIdx; ++i) {
+					auto& packet = stream.packets[i];
+					if (!packet.acked && packet.numTransmissions > 0 && ++packet.numAckedAfter >= ARQ_FAST_RETRANSMIT_THRESHOLD)
+						m_arq->transmit(packet, curTime64, packetsToSend);
+				}
+
+				//window has moved, send the new packets
+				for (size_t i = 0; i < stream.packets.size() && i < ARQ_WINDOW_SIZE; ++i) {
+					auto& packet = stream.packets[i];
+					if (packet.numTransmissions == 0)
+						m_arq->transmit(packet, curTime64, packetsToSend);
+				}
+
+				if (numPrevPackets != stream.packets.size())
+					m_arq->sendCv.notify_all();
+			}//if (header.type == ARQ_ACK_CHUNK)
+			else {
+				auto& stream = m_arq->recvStreams[streamIdx];
+				auto seq = header.arqDataInfo.seq;
+
+				//always acknowledge, even duplicated packets, since previous ack might be lost
+				stream.ackPending = true;
+				stream.ackEchoTime64 = header.id;
+
+				if (arqSeqBefore(seq, stream.nextExpectedSeq) || seq - stream.nextExpectedSeq >= ARQ_WINDOW_SIZE)
+					return;//duplicated or out of window
+
+				if (stream.outOfOrderPackets.find(seq) == stream.outOfOrderPackets.end())
+					stream.outOfOrderPackets[seq] = makePooledData(recv_data, recv_size);
+
+				//consume in order packets
+				std::map<uint32_t, DataRef>::iterator ite;
+				while ((ite = stream.outOfOrderPackets.find(stream.nextExpectedSeq)) != stream.outOfOrderPackets.end())
+				{
+					auto packet = ite->second;
+					stream.outOfOrderPackets.erase(ite);
+					stream.nextExpectedSeq++;
+
+					MsgChunkHeader packetHeader;
+					memcpy(&packetHeader, packet->data(), sizeof(packetHeader));
+					auto payload = packet->data() + sizeof(packetHeader);
+					auto payloadSize = (uint32_t)(packet->size() - sizeof(packetHeader));
+
+					if (!stream.msgStarted)
+					{
+						//first packet of a new message
+						stream.msgStarted = true;
+						stream.msgSize = packetHeader.arqDataInfo.total_msg_size;
+						stream.msgFilledSize = 0;
+						stream.msgFlags = packetHeader.reserved & ~ARQ_STREAM_IDX_MASK;
+						stream.msgData = nullptr;
+
+						if (stream.msgSize > m_maxMsgSize)
+							HQRemote::LogErr("Illegal ARQ message size=%u (max=%u)\n", stream.msgSize, m_maxMsgSize);
+						else try {
+							stream.msgData = makePooledData(stream.msgSize);
+						} catch (...) {
+							//memory failed, discard this message
+						}
+					}
+
+					payloadSize = min(payloadSize, stream.msgSize - stream.msgFilledSize);
+					if (stream.msgData)
+						memcpy(stream.msgData->data() + stream.msgFilledSize, payload, payloadSize);
+					stream.msgFilledSize += payloadSize;
+
+					if (stream.msgFilledSize == stream.msgSize)
+					{
+						if (stream.msgData)
+							completedMsgs.push_back(std::make_pair(stream.msgData, stream.msgFlags));
+
+						stream.msgStarted = false;
+						stream.msgData = nullptr;
+					}
+				}//while ((ite = stream.outOfOrderPackets.find(stream.nextExpectedSeq)) != stream.outOfOrderPackets.end())
+			}//else of if (header.type == ARQ_ACK_CHUNK)
+		}
+
+		//acknowledgements are sent by updateArq() since we might be called with socket's lock held
+		sendArqPackets(packetsToSend);
+
+		for (auto& msg : completedMsgs)
+			deliverReliableMessage(msg.first, msg.second);
+	}
+
+	void IConnectionHandler::deliverReliableMessage(const DataRef& data, uint32_t msgFlags) {
+		if (msgFlags & ARQ_MSG_STREAM_CHUNK_FLAG)
+		{
+			if (data->size() >= sizeof(StreamChunkHeader) && data->size() <= sizeof(StreamChunkHeader) + MAX_STREAM_SEGMENT_SIZE)
+				onReceivedStreamChunk(data);
+		}
+		else
+			pushDataToQueue(data, true, false, (msgFlags & ARQ_MSG_COMPACT_FLAG) ? (uint32_t)MSG_FLAG_COMPACT : 0u);
+	}
+
+	void IConnectionHandler::updateArq() {
+		std::vector<DataRef> packetsToSend;
+
+		{
+			std::lock_guard<std::mutex> lg(m_arq->lock);
+			auto curTime64 = getTimeCheckPoint64();
+			bool timedOut = false;
+
+			//retransmit timed out packets
+			for (auto& stream : m_arq->sendStreams) {
+				for (size_t i = 0; i < stream.packets.size() && i < ARQ_WINDOW_SIZE; ++i) {
+					auto& packet = stream.packets[i];
+					if (packet.acked)
+						continue;
+					if (packet.numTransmissions == 0 || getElapsedTime64(packet.lastSendTime64, curTime64) >= m_arq->rto)
+					{
+						timedOut = timedOut || packet.numTransmissions > 0;
+						m_arq->transmit(packet, curTime64, packetsToSend);
+					}
+				}
+			}
+
+			//exponential backoff
+			if (timedOut)
+				m_arq->rto = (std::min)(m_arq->rto * 2, ARQ_MAX_RTO);
+
+			//send pending acknowledgements
+			for (unsigned int i = 0; i < NUM_ARQ_STREAMS; ++i) {
+				auto& stream = m_arq->recvStreams[i];
+				if (!stream.ackPending)
+					continue;
+
+				MsgChunkHeader header;
+				header.id = stream.ackEchoTime64;
+				header.type = ARQ_ACK_CHUNK;
+				header.reserved = i;
+				header.arqAckInfo.cumulativeAck = stream.nextExpectedSeq;
+				header.arqAckInfo.selectiveAcks = 0;
+				for (auto& packetEntry : stream.outOfOrderPackets) {
+					auto distance = packetEntry.first - stream.nextExpectedSeq - 1;
+					if (distance < 32)
+						header.arqAckInfo.selectiveAcks |= 1u << distance;
+				}
+
+				packetsToSend.push_back(makePooledData(&header, sizeof(header)));
+
+				stream.ackPending = false;
+			}
+		}
+
+		sendArqPackets(packetsToSend);
+	}
+
+	bool IConnectionHandler::hasPendingArqData() const {
+		std::lock_guard<std::mutex> lg(m_arq->lock);
+		for (auto& stream : m_arq->sendStreams) {
+			if (stream.packets.size())
+				return true;
+		}
+		for (auto& stream : m_arq->recvStreams) {
+			if (stream.ackPending)
+				return true;
+		}
+
+		return false;
+	}
 	
 
 	void IConnectionHandler::onConnected(bool reconnected)
@@ -509,11 +1413,23 @@ namespace HQRemote {
 		invalidateUnusedReliableData();
 
 		// reset to compatible mode
-		m_compatibleMode = true;
+		m_remoteProtocolVersion = 0;
 		
 		if (!reconnected)
 		{
 			//we only do these if this is a fresh connection (not reconnection)
+
+			//reset ARQ streams
+			{
+				std::lock_guard<std::mutex> lg(m_arq->lock);
+				m_arq->reset();
+				m_arq->sendCv.notify_all();
+			}
+
+			//new remote side might reuse compact fragments' ids
+			m_unreliableBuffers.clear();
+			m_lossWindowFirstId = 0;
+			m_unreliableLossRate = 0;
 			
 			//reset data rate counter
 			getTimeCheckPoint(m_lastRecvTime);
@@ -564,8 +1480,31 @@ namespace HQRemote {
 			m_delegates.erase(ite);
 	}
 
+	void IConnectionHandler::registerStreamDelegate(StreamDelegate* d) {
+		std::lock_guard<std::mutex> lg(m_streamLock);
+		if (d)
+			m_streamDelegates.insert(d);
+	}
+
+	void IConnectionHandler::unregisterStreamDelegate(StreamDelegate* d) {
+		std::lock_guard<std::mutex> lg(m_streamLock);
+		m_streamDelegates.erase(d);
+	}
+
 	//return data to user
 	DataRef IConnectionHandler::receiveData(bool &isReliable)
+	{
+		uint32_t msgFlags;
+		return receiveData(isReliable, msgFlags);
+	}
+
+	DataRef IConnectionHandler::receiveDataBlock(bool &isReliable)
+	{
+		uint32_t msgFlags;
+		return receiveDataBlock(isReliable, msgFlags);
+	}
+
+	DataRef IConnectionHandler::receiveData(bool &isReliable, uint32_t& msgFlags)
 	{
 		DataRef data = nullptr;
 		
@@ -576,6 +1515,7 @@ namespace HQRemote {
 				
 				data = dataEntry.data;
 				isReliable = dataEntry.isReliable;
+				msgFlags = dataEntry.msgFlags;
 
 				m_dataQueue.pop_front();
 			}
@@ -586,7 +1526,7 @@ namespace HQRemote {
 		return data;
 	}
 	
-	DataRef IConnectionHandler::receiveDataBlock(bool &isReliable) {
+	DataRef IConnectionHandler::receiveDataBlock(bool &isReliable, uint32_t& msgFlags) {
 		std::unique_lock<std::mutex> lk(m_dataLock);
 		
 		m_dataCv.wait(lk, [this] { return !m_running || m_dataQueue.size() > 0; });
@@ -597,6 +1537,26 @@ namespace HQRemote {
 
 			auto re = dataEntry.data;
 			isReliable = dataEntry.isReliable;
+			msgFlags = dataEntry.msgFlags;
+
+			m_dataQueue.pop_front();
+			return re;
+		}
+		return nullptr;
+	}
+
+	DataRef IConnectionHandler::receiveDataBlock(bool &isReliable, uint32_t& msgFlags, uint32_t timeoutMs) {
+		std::unique_lock<std::mutex> lk(m_dataLock);
+
+		m_dataCv.wait_for(lk, std::chrono::milliseconds(timeoutMs), [this] { return !m_running || m_dataQueue.size() > 0; });
+
+		if (m_dataQueue.size())
+		{
+			auto &dataEntry = m_dataQueue.front();
+
+			auto re = dataEntry.data;
+			isReliable = dataEntry.isReliable;
+			msgFlags = dataEntry.msgFlags;
 
 			m_dataQueue.pop_front();
 			return re;
@@ -604,7 +1564,7 @@ namespace HQRemote {
 		return nullptr;
 	}
 	
-	void IConnectionHandler::pushDataToQueue(DataRef data, bool reliable, bool discardIfFull) {
+	void IConnectionHandler::pushDataToQueue(DataRef data, bool reliable, bool discardIfFull, uint32_t msgFlags) {
 		std::lock_guard<std::mutex> lg(m_dataLock);
 		
 		//calculate data rate
@@ -643,7 +1603,7 @@ namespace HQRemote {
 			return;//ignore
 		}
 		
-		m_dataQueue.push_back(ReceivedData(data, reliable));
+		m_dataQueue.push_back(ReceivedData(data, reliable, msgFlags));
 		
 		m_dataCv.notify_all();
 	}
@@ -804,6 +1764,14 @@ namespace HQRemote {
 		
 	}
 
+	bool SocketConnectionHandler::reliableChannelConnected() const {
+		return m_connSocket.load(std::memory_order_relaxed) != INVALID_SOCKET;
+	}
+
+	bool SocketConnectionHandler::unreliableChannelConnected() const {
+		return m_connLessSocket.load(std::memory_order_relaxed) != INVALID_SOCKET && m_connLessSocketDestAddr != nullptr;
+	}
+
 	_ssize_t SocketConnectionHandler::sendRawDataUnreliableImpl(const void* data, size_t size)
 	{
 		_ssize_t re = 0;
@@ -923,6 +1891,12 @@ namespace HQRemote {
 			return handleUnwantedDataFromImpl(srcAddr, &chunk, re);
 		}
 
+		if (getRemoteProtocolVersion() >= 3 && isCompactChunk(&chunk, re))
+		{
+			onReceivedUnreliableDataFragment(&chunk, re);
+			return re;
+		}
+
 		switch (chunk.header.type) {
 		case PING_MSG_CHUNK:
 		{
@@ -962,7 +1936,7 @@ namespace HQRemote {
 		//ping remote host
 		MsgChunk pingChunk;
 		pingChunk.header.type = PING_MSG_CHUNK;
-		pingChunk.header.id = generateIDFromTime(sendTime);
+		pingChunk.header.id = makeChunkId(generateIDFromTime(sendTime));
 		
 		pingChunk.header.pingInfo.sendTime = convertToTimeCheckPoint64(sendTime);
 		
@@ -1046,7 +2020,8 @@ namespace HQRemote {
 
 				//read data sent via unreliable socket
 				if (l_connLessSocket != INVALID_SOCKET) {
-					timeout.tv_usec = 30000;
+					//wake up more often if ARQ needs to retransmit or acknowledge packets
+					timeout.tv_usec = hasPendingArqData() ? (ARQ_UPDATE_INTERVAL_MS * 1000) : 30000;
 
 					FD_ZERO(&sset);
 					FD_SET(l_connLessSocket, &sset);
@@ -1091,6 +2066,8 @@ namespace HQRemote {
 
 				addtionalRcvThreadHandlerImpl();
 
+				updateArq();
+
 			}//if (l_connected)
 			else if (connectedAtleastOnce && !m_enableReconnect) {
 				//stop
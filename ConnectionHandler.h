@@ -39,6 +39,7 @@
 #include <list>
 #include <deque>
 #include <vector>
+#include <algorithm>
 #include <functional>
 #include <mutex>
 #include <thread>
@@ -71,12 +72,41 @@ namespace HQRemote {
 	//interface
 	class HQREMOTE_API IConnectionHandler {
 	public:
+		//protocol version implemented by this library. 0 = oldest version, 1 = extended fragment header,
+		//2 = reliable streams & ARQ over unreliable channel, 3 = compact fragment header & compact messages,
+		//4 = compression codecs other than zlib, 5 = preset dictionary for compressed event bundles,
+		//6 = reserved range of predefined event types (i.e. PARTIAL_FRAME), 7 = receiver reports (RECEIVER_REPORT event),
+		//8 = tile cache (TILE_CACHE_RESET event), 9 = simulcast layers (FRAME_LAYER_SELECT event),
+		//10 = refresh requests (REFRESH_REQUEST event), 11 = zlib streamed event bundles
+		static const uint32_t PROTOCOL_VERSION = 11;
+		//number of independent ordered streams usable by sendDataOnArqStream()
+		static const unsigned int NUM_ARQ_STREAMS = 4;
+
+		//flags attached to a message by sender, receiver gets them along with the data
+		enum MsgFlags : uint32_t {
+			MSG_FLAG_COMPACT = 0x1,//data is compact encoded. Only send it to remote side having protocol version 3+
+		};
+
 		class Delegate {
 		public:
 			virtual void onConnected() = 0;
 			virtual void onDisconnected() {}
 		};
 
+		//receiver of messages sent via sendDataStream()
+		class StreamDelegate {
+		public:
+			//called on the receiving thread for each segment of an incoming stream, in order.
+			//<segment> is bounded in size, the whole message is never buffered on receiver side.
+			virtual void onStreamSegment(uint32_t streamId, uint64_t offset, uint64_t totalSize, ConstDataRef segment) = 0;
+			//the stream was cancelled by sender or interrupted by connection loss before completed
+			virtual void onStreamAborted(uint32_t streamId) {}
+		};
+
+		//fill <dst> with at most <maxSize> bytes of the stream starting at <offset>.
+		//Return number of bytes written, 0 to cancel the stream.
+		typedef std::function<size_t(void* dst, uint64_t offset, size_t maxSize)> StreamReader;
+
 		virtual ~IConnectionHandler();
 
 		bool start();
@@ -91,16 +121,42 @@ namespace HQRemote {
 		//return obtained data to user
 		DataRef receiveData(bool &isReliable);
 		DataRef receiveDataBlock(bool &isReliable);//this function will block until there is some data available
+		DataRef receiveData(bool &isReliable, uint32_t& msgFlags);
+		DataRef receiveDataBlock(bool &isReliable, uint32_t& msgFlags);
+		DataRef receiveDataBlock(bool &isReliable, uint32_t& msgFlags, uint32_t timeoutMs);//block for at most <timeoutMs>
+
+		//<msgFlags> is combination of MsgFlags values
+		void sendData(ConstDataRef data, uint32_t msgFlags = 0);
+		void sendDataUnreliable(ConstDataRef data, uint32_t msgFlags = 0);
+		void sendData(const void* data, size_t size, uint32_t msgFlags = 0);
+		void sendDataUnreliable(const void* data, size_t size, uint32_t msgFlags = 0);
+
+		//send a large message on reliable channel as a sequence of bounded segments. Messages sent by other
+		//threads in the meantime are interleaved between the segments instead of waiting for the whole stream.
+		//Receiver gets the segments via StreamDelegate, or the whole message via receiveData() if it
+		//has no StreamDelegate registered. Return the stream's id, 0 if failed.
+		uint32_t sendDataStream(const void* data, uint64_t size);
+		uint32_t sendDataStream(uint64_t size, StreamReader reader);
+
+		//send data reliably using acknowledgements & retransmissions over the unreliable channel. Each stream
+		//delivers its messages in order but independently from the other streams, so a lost packet only stalls
+		//the stream it belongs to. Remote side receives the data via receiveData() with isReliable = true.
+		//Fall back to sendData() if the remote side or the unreliable channel doesn't support it.
+		//NOTE: stream 0 is also used to carry sendData()'s messages while the reliable channel is unavailable.
+		//Return false if the message was dropped, i.e. too big or remote side stopped acknowledging
+		bool sendDataOnArqStream(ConstDataRef data, unsigned int streamIdx, uint32_t msgFlags = 0);
+		bool sendDataOnArqStream(const void* data, size_t size, unsigned int streamIdx, uint32_t msgFlags = 0);
+		bool isArqAvailable() const;
 
-		void sendData(ConstDataRef data);
-		void sendDataUnreliable(ConstDataRef data);
-		void sendData(const void* data, size_t size);
-		void sendDataUnreliable(const void* data, size_t size);
-		
 		float getReceiveRate() const;
 
 		float getSendRate() const;
 
+		//fraction of unreliable messages sent in compact fragments that didn't arrive, measured over the last second
+		float getUnreliableLossRate() const {
+			return m_unreliableLossRate.load(std::memory_order_relaxed);
+		}
+
 		// return true if our sending rate is limited by max sending bandwidth
 		virtual bool isLimitedBySendingBandwidth() const {
 			return false;
@@ -122,15 +178,21 @@ namespace HQRemote {
 
 		size_t getTag() { return m_tag; }
 
-		void enableCompatibleMode(bool e) { m_compatibleMode = e; }
+		void enableCompatibleMode(bool e) { m_remoteProtocolVersion = e ? 0 : 1; }
+		void setRemoteProtocolVersion(uint32_t version) { m_remoteProtocolVersion = version; }
+		uint32_t getRemoteProtocolVersion() const { return m_remoteProtocolVersion; }
 
-		// Default max  message size = 50 MB
+		// Default max  message size = 50 MB. Cannot exceed 1 GB since top bits of reliable message's size are used as flags
 		uint32_t getMaxMsgSize() const { return m_maxMsgSize; }
-		void setMaxMsgSize(uint32_t size) { m_maxMsgSize = size; }
+		void setMaxMsgSize(uint32_t size) { m_maxMsgSize = (std::min)(size, 0x3fffffffu); }
 
 		void registerDelegate(Delegate* delegate);
 		void unregisterDelegate(Delegate* delegate);
-		
+
+		//NOTE: don't call these inside StreamDelegate's callbacks
+		void registerStreamDelegate(StreamDelegate* delegate);
+		void unregisterStreamDelegate(StreamDelegate* delegate);
+
 	protected:
 		IConnectionHandler();
 		
@@ -141,12 +203,17 @@ namespace HQRemote {
 		virtual _ssize_t sendRawDataImpl(const void* data, size_t size) = 0;
 		virtual void flushRawDataImpl() = 0;
 		virtual _ssize_t sendRawDataUnreliableImpl(const void* data, size_t size) = 0;
+
+		//tell whether each channel is usable at the moment
+		virtual bool reliableChannelConnected() const { return true; }
+		virtual bool unreliableChannelConnected() const { return false; }
 		
 		struct MsgChunk;
 		
 		struct MsgBuf {
 			DataRef data;
 			uint32_t filledSize;
+			uint32_t msgFlags;
 		};
 		
 		
@@ -158,6 +225,11 @@ namespace HQRemote {
 		void onConnected(bool reconnected = false);
 
 		void onDisconnected();
+
+		//this should be called frequently by receiving thread to retransmit lost ARQ packets and send acknowledgements
+		void updateArq();
+		//return true if there are ARQ packets waiting to be acknowledged
+		bool hasPendingArqData() const;
 		
 		void setInternalError(const char* msg);
 		
@@ -165,23 +237,41 @@ namespace HQRemote {
 		uint32_t m_maxMsgSize;
 	private:
 		typedef std::map<uint64_t, MsgBuf> UnreliableBuffers;
+		typedef std::map<uint32_t, MsgBuf> StreamBuffers;
+
+		struct ArqState;
 
 		struct ReceivedData {
-			ReceivedData(const DataRef& _data, bool reliable)
-				:data(_data), isReliable(reliable)
+			ReceivedData(const DataRef& _data, bool reliable, uint32_t flags)
+				:data(_data), isReliable(reliable), msgFlags(flags)
 			{}
 
 			DataRef data;
 			bool isReliable;
+			uint32_t msgFlags;
 		};
 
-		void sendRawDataAtomic(const void* data, size_t size);
+		bool sendRawDataAtomic(const void* data, size_t size);
+		bool sendReliableMessage(const void* data, size_t size, uint32_t sizeFlags);
 		void fillReliableBuffer(const void* &data, size_t& size);
 		void invalidateUnusedReliableData();
 
+		void onReceivedStreamChunk(const DataRef& chunkData);
+		void abortIncomingStreams();
+
+		bool sendArqMessage(const void* data, size_t size, uint32_t msgFlags, unsigned int streamIdx);
+		void sendArqPackets(const std::vector<DataRef>& packets);
+		void onReceivedArqChunk(const void* data, size_t size);
+		void deliverReliableMessage(const DataRef& data, uint32_t msgFlags);
+
+		void sendCompactFragments(const void* data, size_t size, uint32_t msgFlags);
+
 		UnreliableBuffers::iterator getOrCreateUnreliableBuffer(uint64_t id, size_t size);
+		//return true if the message is complete
+		bool fillUnreliableBuffer(UnreliableBuffers::iterator pendingBufIte, uint32_t offset, const void* payload, size_t payloadSize);
+		void updateUnreliableLossRate(uint64_t receivedMsgId);
 		
-		void pushDataToQueue(DataRef data, bool reliable, bool discardIfFull);
+		void pushDataToQueue(DataRef data, bool reliable, bool discardIfFull, uint32_t msgFlags = 0);
 
 		void updateDataSentRate(size_t sentSize);
 		
@@ -190,10 +280,18 @@ namespace HQRemote {
 
 		std::atomic<size_t> m_tag;
 		
-		bool m_compatibleMode;
+		std::atomic<uint32_t> m_remoteProtocolVersion;
 		int m_reliableBufferState;
 		MsgBuf m_reliableBuffer;
 		UnreliableBuffers m_unreliableBuffers;
+		std::atomic<uint64_t> m_nextUnreliableMsgId;//id of messages sent in compact fragments
+
+		//loss of compact unreliable messages, measured by gaps in their sequential ids
+		uint64_t m_lossWindowFirstId;//0 if no message received yet
+		uint64_t m_lossWindowLastId;
+		uint64_t m_lossWindowNumReceived;
+		time_checkpoint_t m_lossWindowStartTime;
+		std::atomic<float> m_unreliableLossRate;
 		std::deque<ReceivedData> m_dataQueue;
 		std::mutex m_dataLock;
 		std::condition_variable m_dataCv;
@@ -209,7 +307,22 @@ namespace HQRemote {
 		std::atomic<float> m_sentRate;
 
 		std::set<Delegate*> m_delegates;
-		
+
+		//streaming
+		std::mutex m_reliableSendLock;
+		std::mutex m_reliableWaitLock;
+		std::condition_variable m_reliableWaitCv;//signaled when m_numReliableSendersWaiting drops to zero
+		uint32_t m_numReliableSendersWaiting;
+		std::atomic<uint32_t> m_nextStreamId;
+
+		std::set<StreamDelegate*> m_streamDelegates;
+		std::set<uint32_t> m_incomingStreams;
+		StreamBuffers m_reassembledStreams;//incoming streams buffered for receiveData() when no StreamDelegate is registered
+		std::mutex m_streamLock;
+
+		//ARQ over unreliable channel
+		std::unique_ptr<ArqState> m_arq;
+
 		time_checkpoint_t m_startTime;
 	};
 
@@ -254,6 +367,8 @@ namespace HQRemote {
 		virtual _ssize_t sendRawDataImpl(const void* data, size_t size) override;
 		virtual void flushRawDataImpl() override;
 		virtual _ssize_t sendRawDataUnreliableImpl(const void* data, size_t size) override;
+		virtual bool reliableChannelConnected() const override;
+		virtual bool unreliableChannelConnected() const override;
 
 		//required
 		virtual bool socketInitImpl() = 0;
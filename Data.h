@@ -107,11 +107,11 @@ namespace HQRemote {
 		
 		virtual size_t size() const override { return m_data.size(); }
 		
+		//amortized growth, unlike reserve() which allocates exactly what is asked
 		void push_back(const void* _data, size_t _size)
 		{
-			m_data.reserve(m_data.size() + _size);
-			for (size_t i = 0; i < _size; ++i)
-				m_data.push_back(((unsigned char*)_data)[i]);
+			auto begin = (const unsigned char*)_data;
+			m_data.insert(m_data.end(), begin, begin + _size);
 		}
 		
 		void push_back(ConstDataRef _data){
@@ -134,6 +134,65 @@ namespace HQRemote {
 		std::vector<unsigned char> m_data;
 	};
 	
+	//growable data having reserved space (headroom) in front of its content. A producer can write its output here,
+	//then a consumer can claim the headroom to prepend its header without moving the content (e.g. FrameEvent)
+	class HQREMOTE_API HeadroomData: public IData {
+	public:
+		HeadroomData(size_t headroom, size_t initialCapacity = 0)
+			: m_capacity(headroom + initialCapacity), m_headroom(headroom), m_size(0)
+		{
+			m_buffer.reset(new unsigned char[m_capacity]);
+		}
+
+		virtual unsigned char* data() override { return m_buffer.get() + m_headroom; }
+		virtual const unsigned char* data() const override { return m_buffer.get() + m_headroom; }
+
+		virtual size_t size() const override { return m_size; }
+
+		size_t headroom() const { return m_headroom; }
+
+		//new content is left uninitialized
+		void resize(size_t size) {
+			reserve(size);
+			m_size = size;
+		}
+
+		void reserve(size_t cap) {
+			if (m_headroom + cap <= m_capacity)
+				return;
+
+			auto newCapacity = m_capacity * 2;
+			if (newCapacity < m_headroom + cap)
+				newCapacity = m_headroom + cap;
+			std::unique_ptr<unsigned char[]> newBuffer(new unsigned char[newCapacity]);
+			memcpy(newBuffer.get(), m_buffer.get(), m_headroom + m_size);
+
+			m_buffer = std::move(newBuffer);
+			m_capacity = newCapacity;
+		}
+
+		void push_back(const void* _data, size_t _size) {
+			auto offset = m_size;
+			resize(m_size + _size);
+			memcpy(data() + offset, _data, _size);
+		}
+
+		//move the start of content <size> bytes backward, the caller then owns these bytes.
+		//Return false if there is not enough headroom
+		bool claimHeadroom(size_t size) {
+			if (size > m_headroom)
+				return false;
+			m_headroom -= size;
+			m_size += size;
+			return true;
+		}
+	private:
+		std::unique_ptr<unsigned char[]> m_buffer;
+		size_t m_capacity;
+		size_t m_headroom;
+		size_t m_size;
+	};
+
 	template <class T>
 	class HQREMOTE_API TDataSegment: public T {
 	public:
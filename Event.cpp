@@ -20,10 +20,13 @@
 #include <stdexcept>
 #include <limits>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include "ZlibUtils.h"
+#include "BufferPool.h"
 #include "Event.h"
 #include "Common.h"
+#include "WireFormat.h"
 
 #ifdef max
 #	undef max
@@ -31,9 +34,169 @@
 
 
 namespace HQRemote {
+	/*---------- compact encoding --------*/
+	//compact layout:
+	//varint type | type specific fields | additional data (DataEvent only)
+	static const size_t MAX_COMPACT_EVENT_HEADER_SIZE = 32;
+	static_assert(MAX_COMPACT_EVENT_HEADER_SIZE <= sizeof(Event), "compact header must fit in the space of generic event data");
+
+	//COMPRESSED_EVENTS's <reserved> field: bit 0 = bundled events are compact encoded, bit 1 = zlib preset dictionary is used,
+	//bit 2 = bundle is part of a zlib stream, bit 3 = bundle starts a new zlib stream, bits 8-15 = compression codec,
+	//bits 16-23 = stream generation
+	static const int32_t COMPACT_BUNDLED_EVENTS_FLAG = 0x1;
+	static const int32_t PRESET_DICTIONARY_FLAG = 0x2;
+	static const int32_t STREAMED_BUNDLE_FLAG = 0x4;
+	static const int32_t STREAM_START_FLAG = 0x8;
+	static const int32_t BUNDLE_CODEC_SHIFT = 8;
+	static const int32_t BUNDLE_CODEC_MASK = 0xff;
+	static const int32_t STREAM_GENERATION_SHIFT = 16;
+	static const int32_t STREAM_GENERATION_MASK = 0xff;
+
+	static inline bool isCustomEventType(EventType type) {
+		return type > NO_EVENT && type < FIRST_RESERVED_EVENT_TYPE;
+	}
+
+	static size_t encodeCompactEventHeader(const Event& event, bool frameDataLayout, void* dst) {
+		WireWriter writer(dst);
+		writer.writeVarint(event.type);
+
+		if (frameDataLayout) {
+			//frame size is implied by total size
+			writer.writeVarint(event.renderedFrameData.frameId);
+			writer.writeFloat(event.renderedFrameData.intervalAlternaionOffset);
+			return writer.size();
+		}
+
+		switch (event.type) {
+		case TOUCH_BEGAN: case TOUCH_MOVED: case TOUCH_ENDED: case TOUCH_CANCELLED:
+			writer.writeVarint(zigzagEncode(event.touchData.id));
+			writer.writeFloat(event.touchData.x);
+			writer.writeFloat(event.touchData.y);
+			//optional trailing field, older versions ignore it
+			if (event.touchData.timestamp)
+				writer.writeVarint(event.touchData.timestamp);
+			break;
+		case HOST_INFO:
+			writer.writeVarint(event.hostInfo.width);
+			writer.writeVarint(event.hostInfo.height);
+			break;
+		case FRAME_INTERVAL:
+			writer.writeDouble(event.frameInterval);
+			break;
+		case AUDIO_STREAM_INFO:
+			writer.writeVarint(zigzagEncode(event.audioStreamInfo.sampleRate));
+			writer.writeVarint(zigzagEncode(event.audioStreamInfo.numChannels));
+			writer.writeVarint(zigzagEncode(event.audioStreamInfo.framesBundleSize));
+			writer.writeVarint(zigzagEncode(event.audioStreamInfo.frameSizeMs));
+			break;
+		case COMPRESSED_EVENTS:
+			writer.writeVarint(event.compressedEvents.numEvents);
+			writer.writeVarint((uint32_t)event.reserved);
+			break;
+		case MESSAGE_ACK:
+			writer.writeVarint(event.messageAck.messageId);
+			break;
+		case COMPATIBLE_MODE:
+			writer.writeVarint(event.compatibleMode.mode);
+			break;
+		case FRAME_CAPABILITIES:
+		case FRAME_LAYER_SELECT:
+			writer.writeVarint(event.uint32Value);
+			break;
+		case RECEIVER_REPORT:
+			writer.writeVarint(event.receiverReport.lastFrameId);
+			writer.writeFloat(event.receiverReport.receiveRate);
+			writer.writeFloat(event.receiverReport.lossRate);
+			//optional trailing field, older versions ignore it
+			if (event.receiverReport.firstLostFrameId)
+				writer.writeVarint(event.receiverReport.firstLostFrameId);
+			break;
+		default:
+			if (isCustomEventType(event.type)) {
+				//layout of custom event is unknown, send the used part of generic data as is
+				size_t size = sizeof(event.customData);
+				while (size > 0 && event.customData[size - 1] == 0)
+					size--;
+				writer.writeVarint(size);
+				writer.writeBytes(event.customData, size);
+			}
+			//other predefined events have no payload
+			break;
+		}
+
+		return writer.size();
+	}
+
+	static bool decodeCompactEventHeader(WireReader& reader, bool frameDataLayout, Event& event) {
+		memset(event.customData, 0, sizeof(event.customData));
+		event.reserved = 0;
+		event.type = (EventType)reader.readVarint();
+
+		if (frameDataLayout) {
+			event.renderedFrameData.frameId = reader.readVarint();
+			event.renderedFrameData.intervalAlternaionOffset = reader.readFloat();
+			event.renderedFrameData.frameSize = (uint32_t)reader.remainSize();
+			return !reader.failed();
+		}
+
+		switch (event.type) {
+		case TOUCH_BEGAN: case TOUCH_MOVED: case TOUCH_ENDED: case TOUCH_CANCELLED:
+			event.touchData.id = zigzagDecode((uint32_t)reader.readVarint());
+			event.touchData.x = reader.readFloat();
+			event.touchData.y = reader.readFloat();
+			if (reader.remainSize())
+				event.touchData.timestamp = reader.readVarint();
+			break;
+		case HOST_INFO:
+			event.hostInfo.width = (uint32_t)reader.readVarint();
+			event.hostInfo.height = (uint32_t)reader.readVarint();
+			break;
+		case FRAME_INTERVAL:
+			event.frameInterval = reader.readDouble();
+			break;
+		case AUDIO_STREAM_INFO:
+			event.audioStreamInfo.sampleRate = zigzagDecode((uint32_t)reader.readVarint());
+			event.audioStreamInfo.numChannels = zigzagDecode((uint32_t)reader.readVarint());
+			event.audioStreamInfo.framesBundleSize = zigzagDecode((uint32_t)reader.readVarint());
+			event.audioStreamInfo.frameSizeMs = zigzagDecode((uint32_t)reader.readVarint());
+			break;
+		case COMPRESSED_EVENTS:
+			event.compressedEvents.numEvents = (uint32_t)reader.readVarint();
+			event.reserved = (int32_t)reader.readVarint();
+			break;
+		case MESSAGE_ACK:
+			event.messageAck.messageId = reader.readVarint();
+			break;
+		case COMPATIBLE_MODE:
+			event.compatibleMode.mode = (uint32_t)reader.readVarint();
+			break;
+		case FRAME_CAPABILITIES:
+		case FRAME_LAYER_SELECT:
+			event.uint32Value = (uint32_t)reader.readVarint();
+			break;
+		case RECEIVER_REPORT:
+			event.receiverReport.lastFrameId = reader.readVarint();
+			event.receiverReport.receiveRate = reader.readFloat();
+			event.receiverReport.lossRate = reader.readFloat();
+			if (reader.remainSize())
+				event.receiverReport.firstLostFrameId = reader.readVarint();
+			break;
+		default:
+			if (isCustomEventType(event.type)) {
+				auto size = reader.readVarint();
+				if (size > sizeof(event.customData))
+					return false;
+				reader.readBytes(event.customData, (size_t)size);
+			}
+			break;
+		}
+
+		return !reader.failed();
+	}
+
 	/*----------- PlainEvent -------------*/
 	DataRef PlainEvent::serialize() const {
-		auto data = std::make_shared<CData>(sizeof(this->event));
+		auto data = makePooledData(sizeof(this->event));
 		//TODO: assume all sides use the same byte order for now
 		memcpy(data->data(), &this->event, sizeof(this->event));
 
@@ -56,13 +219,20 @@ namespace HQRemote {
 		data = nullptr;
 	}
 
+	DataRef PlainEvent::serializeCompact() const {
+		unsigned char header[MAX_COMPACT_EVENT_HEADER_SIZE];
+		auto size = encodeCompactEventHeader(this->event, false, header);
+
+		return makePooledData(header, size);
+	}
+
 	/*------------- DataEvent --------------*/
 	DataEvent::DataEvent(EventType type)
-		: PlainEvent(type)
+		: PlainEvent(type), payloadOffset(sizeof(event))
 	{}
 
 	DataEvent::DataEvent(uint32_t addtionalStorageSize, EventType type)
-		: PlainEvent(type), storage(std::make_shared<CData>(sizeof(event) + addtionalStorageSize))
+		: PlainEvent(type), storage(makePooledData(sizeof(event) + addtionalStorageSize)), payloadOffset(sizeof(event))
 	{}
 
 	DataRef DataEvent::serialize() const {
@@ -70,6 +240,17 @@ namespace HQRemote {
 		{
 			return PlainEvent::serialize();
 		}
+
+		if (this->payloadOffset != sizeof(this->event))
+		{
+			//storage is compact encoded, there is no room for generic event data
+			auto payloadSize = this->storage->size() - this->payloadOffset;
+			auto data = makePooledData(sizeof(this->event) + payloadSize);
+			memcpy(data->data(), &this->event, sizeof(this->event));
+			memcpy(data->data() + sizeof(this->event), this->storage->data() + this->payloadOffset, payloadSize);
+
+			return data;
+		}
 		
 		//serialize generic event data
 		//TODO: assume all sides use the same byte order for now
@@ -80,13 +261,14 @@ namespace HQRemote {
 	
 	void DataEvent::deserialize(const DataRef& data) {
 		//copy data
-		this->storage = std::make_shared<CData>(data->size());
+		this->storage = makePooledData(data->size());
 		memcpy(this->storage->data(), data->data(), data->size());
 		
 		//deserialize
 		
 		//TODO: assume all sides use the same byte order for now
 		memcpy(&this->event, this->storage->data(), sizeof(this->event));
+		this->payloadOffset = sizeof(this->event);
 		
 		deserializeFromStorage();
 	}
@@ -97,11 +279,118 @@ namespace HQRemote {
 		
 		//TODO: assume all sides use the same byte order for now
 		memcpy(&this->event, this->storage->data(), sizeof(this->event));
+		this->payloadOffset = sizeof(this->event);
 		
 		deserializeFromStorage();
 	}
+
+	DataRef DataEvent::serializeCompact() const {
+		return serializeCompactImpl(false);
+	}
+
+	DataRef DataEvent::serializeCompactImpl(bool frameDataLayout) const {
+		if (this->storage == nullptr)
+			return PlainEvent::serializeCompact();
+
+		unsigned char header[MAX_COMPACT_EVENT_HEADER_SIZE];
+		auto headerSize = encodeCompactEventHeader(this->event, frameDataLayout, header);
+
+		if (headerSize > this->payloadOffset)
+		{
+			//not enough room in front of additional data, copy to new data
+			auto payloadSize = this->storage->size() - this->payloadOffset;
+			auto data = makePooledData(headerSize + payloadSize);
+			memcpy(data->data(), header, headerSize);
+			memcpy(data->data() + headerSize, this->storage->data() + this->payloadOffset, payloadSize);
+
+			return data;
+		}
+
+		//write the header right in front of additional data, no copy needed
+		auto headerOffset = this->payloadOffset - headerSize;
+		memcpy(this->storage->data() + headerOffset, header, headerSize);
+
+		return std::allocate_shared<DataSegment>(PoolAllocator<DataSegment>(), this->storage, headerOffset);
+	}
+
+	void DataEvent::deserializeCompact(const Event& header, DataRef&& data, size_t headerSize) {
+		this->event = header;
+		this->storage = data;
+		this->payloadOffset = headerSize;
+		data = nullptr;
+
+		deserializeFromStorage();
+	}
 	
 	/*---------- CompressedEvents --------*/
+	//preset dictionary made of typical event headers. Both sides generate the exact same bytes so it must never change,
+	//zlib rejects a bundle compressed with a different dictionary since its adler32 checksum is stored in the stream.
+	//Most frequent headers are placed last since zlib prefers closer matches
+	static const ZlibDictionary& getEventBundleDictionary() {
+		static const ZlibDictionary dictionary([] {
+			auto data = std::make_shared<GrowableData>();
+			unsigned char buffer[sizeof(Event)];
+
+			//generic event layout (protocol version 2-): 24 bytes generic data | type | reserved
+			auto writeV1Header = [&](EventType type, uint64_t frameId, uint32_t frameSize, int32_t touchId, float x, float y) {
+				WireWriter writer(buffer);
+				if (type == AUDIO_ENCODED_PACKET || type == RENDERED_FRAME) {
+					writer.writeU64(frameId);
+					writer.writeU64(0);
+					writer.writeU32(frameSize);
+					writer.writeFloat(0.f);
+				}
+				else {
+					writer.writeU32((uint32_t)touchId);
+					writer.writeFloat(x);
+					writer.writeFloat(y);
+					writer.writeU32(0); writer.writeU64(0);
+				}
+				writer.writeU32(type);
+				writer.writeU32(0);
+				data->push_back(buffer, writer.size());
+			};
+
+			//compact layout (protocol version 3+)
+			auto writeCompactTouch = [&](EventType type, int32_t touchId, float x, float y) {
+				WireWriter writer(buffer);
+				writer.writeVarint(type);
+				writer.writeVarint(zigzagEncode(touchId));
+				writer.writeFloat(x);
+				writer.writeFloat(y);
+				data->push_back(buffer, writer.size());
+			};
+
+			auto writeCompactPacket = [&](EventType type, uint64_t frameId) {
+				WireWriter writer(buffer);
+				writer.writeVarint(type);
+				writer.writeVarint(frameId);
+				writer.writeFloat(0.f);
+				data->push_back(buffer, writer.size());
+			};
+
+			for (uint64_t i = 1; i <= 4; ++i) {
+				writeV1Header(AUDIO_ENCODED_PACKET, i, 160, 0, 0, 0);
+				writeCompactPacket(AUDIO_ENCODED_PACKET, i + 0x80);
+			}
+
+			const float coords[] = { 0.f, 120.f, 240.5f, 360.f, 480.25f, 640.f, 720.75f, 1080.f };
+			for (int i = 0; i < 8; ++i) {
+				writeV1Header(TOUCH_BEGAN + (i % 4), 0, 0, i % 2, coords[i], coords[7 - i]);
+			}
+
+			for (int i = 0; i < 8; ++i) {
+				writeCompactTouch(TOUCH_BEGAN, i % 2, coords[i], coords[7 - i]);
+				writeCompactTouch(TOUCH_ENDED, i % 2, coords[7 - i], coords[i]);
+				writeCompactTouch(TOUCH_MOVED, i % 2, coords[i], coords[i]);
+			}
+
+			return ConstDataRef(data);
+		}());
+
+		return dictionary;
+	}
+
 	CompressedEvents::CompressedEvents(int zlibCompressLevel, const EventRef* event1, ...)
 	: DataEvent(COMPRESSED_EVENTS)
 	{
@@ -125,10 +414,10 @@ namespace HQRemote {
 		
 	}
 	
-	CompressedEvents::CompressedEvents(int zlibCompressLevel, const EventList& events)
+	CompressedEvents::CompressedEvents(int zlibCompressLevel, const EventList& events, bool compactEncoding, CompressionCodec codec, bool usePresetDictionary)
 	: DataEvent(COMPRESSED_EVENTS), m_events(events)
 	{
-		init(zlibCompressLevel);
+		init(zlibCompressLevel, compactEncoding, codec, usePresetDictionary);
 	}
 
 	CompressedEvents::CompressedEvents(int zlibCompressLevel, const_iterator eventListBegin, const_iterator eventListEnd)
@@ -140,12 +429,46 @@ namespace HQRemote {
 
 		init(zlibCompressLevel);
 	}
+
+	CompressedEvents::CompressedEvents(ZlibStreamCompressor& stream, uint32_t streamGeneration, bool startOfStream, const EventList& events)
+	: DataEvent(COMPRESSED_EVENTS), m_events(events)
+	{
+		this->event.reserved = STREAMED_BUNDLE_FLAG | ((int32_t)(streamGeneration & STREAM_GENERATION_MASK) << STREAM_GENERATION_SHIFT);
+		if (startOfStream)
+			this->event.reserved |= STREAM_START_FLAG;
+
+		init(0, true, COMPRESSION_CODEC_ZLIB, false, &stream);
+	}
+
+	bool CompressedEvents::isStreamed() const {
+		return (this->event.reserved & STREAMED_BUNDLE_FLAG) != 0;
+	}
+
+	uint32_t CompressedEvents::streamGeneration() const {
+		return (uint32_t)((this->event.reserved >> STREAM_GENERATION_SHIFT) & STREAM_GENERATION_MASK);
+	}
+
+	bool CompressedEvents::startsStream() const {
+		return (this->event.reserved & STREAM_START_FLAG) != 0;
+	}
+
+	const ZlibDictionary& CompressedEvents::presetDictionary() {
+		return getEventBundleDictionary();
+	}
 	
-	void CompressedEvents::init(int zlibCompressLevel) {
+	void CompressedEvents::init(int zlibCompressLevel, bool compactEncoding, CompressionCodec codec, bool usePresetDictionary, ZlibStreamCompressor* stream) {
 		try {
-			//init generic info
+			//init generic info, stream flags are set by caller
 			assert(m_events.size() <= std::numeric_limits<uint32_t>::max());
 			this->event.compressedEvents.numEvents = (uint32_t)m_events.size();
+			this->event.reserved &= stream ? (STREAMED_BUNDLE_FLAG | STREAM_START_FLAG | (STREAM_GENERATION_MASK << STREAM_GENERATION_SHIFT)) : 0;
+			this->event.reserved |= compactEncoding ? COMPACT_BUNDLED_EVENTS_FLAG : 0;
+			this->event.reserved |= (int32_t)codec << BUNDLE_CODEC_SHIFT;
+
+			//dictionary only makes sense for zlib codec
+			usePresetDictionary = usePresetDictionary && codec == COMPRESSION_CODEC_ZLIB;
+			if (usePresetDictionary)
+				this->event.reserved |= PRESET_DICTIONARY_FLAG;
 			
 			//init storage
 			auto storage = std::make_shared<GrowableData>();
@@ -172,14 +495,18 @@ namespace HQRemote {
 			
 			//combine the event's serialized data into one single data
 			for (auto &event: m_events) {
-				auto eventData = event->serialize();
+				auto eventData = compactEncoding ? event->serializeCompact() : event->serialize();
 				
 				offsetTable[i++] = uncompresedData.size();
 				uncompresedData.push_back(eventData);
 			}
 			
 			//compress the combined data
-			zlibCompress(uncompresedData, zlibCompressLevel, *growableStorage);
+			if (stream)
+				stream->compress(uncompresedData.data(), uncompresedData.size(), *growableStorage);
+			else
+				compressData(codec, uncompresedData.data(), uncompresedData.size(), zlibCompressLevel, *growableStorage,
+							 usePresetDictionary ? &getEventBundleDictionary() : nullptr);
 			
 			uint64_t *pOffsetTable = (uint64_t*)(growableStorage->data() + offsetTableOff);
 			memcpy(pOffsetTable, offsetTable.data(), offsetTable.size() * sizeof(offsetTable[0]));
@@ -194,26 +521,53 @@ namespace HQRemote {
 	}
 	
 	void CompressedEvents::deserializeFromStorage() {
+		//streamed bundle needs the stream's history, see decompressStream()
+		if (isStreamed())
+			return;
+
+		deserializeEvents(nullptr);
+	}
+
+	void CompressedEvents::decompressStream(ZlibStreamDecompressor& stream) {
+		if (!isStreamed() || m_events.size() || this->storage == nullptr)
+			return;
+
+		deserializeEvents(&stream);
+	}
+
+	void CompressedEvents::deserializeEvents(ZlibStreamDecompressor* stream) {
 		//storage layout:
 		//event's generic info | offset table | compressed data
-		auto offsetTableOff = sizeof(this->event);
+		//(if compact encoded, offset table might be unaligned)
+		auto offsetTableOff = this->payloadOffset;
+		auto numEvents = this->event.compressedEvents.numEvents;
+		if (this->storage->size() < offsetTableOff + numEvents * sizeof(uint64_t))
+			throw std::runtime_error("data is too small");
 		
-		uint64_t *offsetTable = (uint64_t*)(this->storage->data() + offsetTableOff);
-		DataSegment compressedData(this->storage, offsetTableOff + this->event.compressedEvents.numEvents * sizeof(offsetTable[0]));
-		auto decompressedData = zlibDecompress(compressedData);
+		std::vector<uint64_t> offsetTable(numEvents);
+		memcpy(offsetTable.data(), this->storage->data() + offsetTableOff, numEvents * sizeof(uint64_t));
+		DataSegment compressedData(this->storage, offsetTableOff + numEvents * sizeof(uint64_t));
+		auto codec = (CompressionCodec)((this->event.reserved >> BUNDLE_CODEC_SHIFT) & BUNDLE_CODEC_MASK);
+		auto dictionary = (this->event.reserved & PRESET_DICTIONARY_FLAG) ? &getEventBundleDictionary() : nullptr;
+		auto decompressedData = stream
+			? stream->decompress(compressedData.data(), compressedData.size())
+			: decompressData(codec, compressedData.data(), compressedData.size(), dictionary);
 		auto uncompressedSize = decompressedData->size();
+		bool compactBundledEvents = (this->event.reserved & COMPACT_BUNDLED_EVENTS_FLAG) != 0;
 		
 		//deserialize individual events
-		for (uint32_t i = 0; i < this->event.compressedEvents.numEvents; ++i) {
+		for (uint32_t i = 0; i < numEvents; ++i) {
 			size_t offset = offsetTable[i];
 			size_t size;
-			if (i < this->event.compressedEvents.numEvents - 1)
+			if (i < numEvents - 1)
 				size = offsetTable[i + 1] - offset;
 			else
 				size = uncompressedSize - offset;
 			
-			auto dataSegement = std::make_shared<DataSegment>(decompressedData, offset, size);
-			auto event = deserializeEvent(std::move(dataSegement), m_customTypeCallback);
+			auto dataSegement = std::allocate_shared<DataSegment>(PoolAllocator<DataSegment>(), decompressedData, offset, size);
+			auto event = compactBundledEvents
+				? deserializeCompactEvent(std::move(dataSegement), m_customTypeCallback)
+				: deserializeEvent(std::move(dataSegement), m_customTypeCallback);
 			
 			m_events.push_back(event);
 		}
@@ -253,73 +607,159 @@ namespace HQRemote {
 		memcpy(event.renderedFrameData.frameData, frameData->data(), frameData->size());
 	}
 
+	FrameEvent::FrameEvent(DataRef&& frameData, uint64_t frameId, EventType type)
+		:DataEvent(type)
+	{
+		assert(frameData->size() <= std::numeric_limits<uint32_t>::max());
+
+		auto frameSize = (uint32_t)frameData->size();
+		auto headroomData = dynamic_cast<HeadroomData*>(frameData.get());
+		if (headroomData && frameData.use_count() == 1 && headroomData->claimHeadroom(sizeof(event)))
+		{
+			//generic event data will be written to the headroom, frame data stays where it is
+			this->storage = std::move(frameData);
+		}
+		else
+		{
+			//copy frame data
+			this->storage = makePooledData(sizeof(event) + frameSize);
+			memcpy(this->storage->data() + sizeof(event), frameData->data(), frameSize);
+			frameData = nullptr;
+		}
+
+		event.renderedFrameData.frameId = frameId;
+		event.renderedFrameData.frameSize = frameSize;
+		event.renderedFrameData.frameData = storage->data() + sizeof(event);
+	}
+
+	DataRef FrameEvent::serializeCompact() const {
+		return serializeCompactImpl(true);
+	}
+
 	void FrameEvent::deserializeFromStorage() {
 		//deserialize frame data
-		event.renderedFrameData.frameData = this->storage->data() + sizeof(this->event);
+		event.renderedFrameData.frameData = this->storage->data() + this->payloadOffset;
 	}
 
-	EventType HQ_FASTCALL peekEventType(const DataRef& data) {
-		try {
-			PlainEvent plainEvent;
-			plainEvent.deserialize(data);
+	/*----------- EventView -------------*/
+	EventView::EventView(const DataRef& data, bool compact, EventContainsFrameDataCallback callback)
+		: m_data(data), m_callback(callback), m_type(NO_EVENT), m_compact(compact), m_containsFrameData(false),
+		m_header(NO_EVENT), m_headerSize(0), m_headerState(0)
+	{
+		if (m_data == nullptr)
+			return;
 
-			return plainEvent.event.type;
+		//only read the type here, the rest of the header is decoded on demand
+		if (m_compact) {
+			WireReader reader(m_data->data(), m_data->size());
+			auto type = (EventType)reader.readVarint();
+			if (!reader.failed())
+				m_type = type;
 		}
-		catch (...) {
-			return NO_EVENT;
+		else if (m_data->size() >= sizeof(Event)) {
+			//TODO: assume all sides use the same byte order for now
+			memcpy(&m_type, m_data->data() + offsetof(Event, type), sizeof(m_type));
+		}
+
+		switch (m_type) {
+		case RENDERED_FRAME: case AUDIO_ENCODED_PACKET: case ENDPOINT_NAME: case MESSAGE: case PARTIAL_FRAME:
+			m_containsFrameData = true;
+			break;
+		default:
+			m_containsFrameData = isCustomEventType(m_type) && m_callback && m_callback(m_type);
 		}
 	}
 
-	//factory function
-	EventRef HQ_FASTCALL deserializeEvent(DataRef&& data, EventContainsFrameDataCallback isFrameDataCallback) {
-		try {
-			//inspect event type first
-			auto& dataRefCopy = data;
+	bool EventView::decodeHeader() const {
+		if (m_headerState == 0) {
+			bool ok;
+			if (m_compact) {
+				WireReader reader(m_data->data(), m_data->size());
+				ok = decodeCompactEventHeader(reader, m_containsFrameData, m_header);
+				m_headerSize = reader.position();
+			}
+			else {
+				//size was already checked when reading type
+				memcpy(&m_header, m_data->data(), sizeof(Event));
+				m_headerSize = sizeof(Event);
+				ok = true;
+			}
+
+			m_headerState = ok ? 1 : -1;
+		}
+
+		return m_headerState > 0;
+	}
+
+	const Event* EventView::header() const {
+		if (!isValid() || !decodeHeader())
+			return nullptr;
+		return &m_header;
+	}
 
-			PlainEvent plainEvent;
-			plainEvent.deserialize(dataRefCopy);
+	const unsigned char* EventView::payload() const {
+		if (!isValid() || !decodeHeader())
+			return nullptr;
+		return m_data->data() + m_headerSize;
+	}
 
-			bool forceIsFrameData = false;
-			if (plainEvent.event.type > NO_EVENT
-				&& plainEvent.event.type < COMPATIBLE_MODE
-				&& isFrameDataCallback)
-				forceIsFrameData = isFrameDataCallback(plainEvent.event.type);
+	size_t EventView::payloadSize() const {
+		if (!isValid() || !decodeHeader())
+			return 0;
+		return m_data->size() - m_headerSize;
+	}
+
+	EventRef EventView::materialize() const {
+		if (!isValid() || !decodeHeader())
+			return nullptr;
 
-			switch (plainEvent.event.type) {
-			case RENDERED_FRAME: case AUDIO_ENCODED_PACKET: case ENDPOINT_NAME: case MESSAGE:
-			{
+		try {
+			if (m_containsFrameData) {
 				//this is non-plain event
-				auto frameEvent = std::make_shared<FrameEvent>(plainEvent.event.type);
-				frameEvent->deserialize(std::forward<DataRef>(data));
+				auto frameEvent = std::allocate_shared<FrameEvent>(PoolAllocator<FrameEvent>(), m_type);
+				frameEvent->deserializeCompact(m_header, DataRef(m_data), m_headerSize);
 
 				return frameEvent;
 			}
-				break;
-			case COMPRESSED_EVENTS:
-			{
+
+			if (m_type == COMPRESSED_EVENTS) {
 				//this is non-plain event
-				auto compressedEvents = std::make_shared<CompressedEvents>(isFrameDataCallback);
-				compressedEvents->deserialize(std::forward<DataRef>(data));
-				
+				auto compressedEvents = std::allocate_shared<CompressedEvents>(PoolAllocator<CompressedEvents>(), m_callback);
+				compressedEvents->deserializeCompact(m_header, DataRef(m_data), m_headerSize);
+
 				return compressedEvents;
 			}
-				break;
-			default: {
-				if (forceIsFrameData) {
-					// this event is treated as frame data according to callback,
-					// so deserialize it using FrameEvent class
-					auto frameEvent = std::make_shared<FrameEvent>(plainEvent.event.type);
-					frameEvent->deserialize(std::forward<DataRef>(data));
-
-					return frameEvent;
-				}
 
-				return std::make_shared<PlainEvent>(plainEvent);
-			}
-			}//switch (plain.event.type)
+			auto plainEvent = std::allocate_shared<PlainEvent>(PoolAllocator<PlainEvent>(), m_type);
+			plainEvent->event = m_header;
+
+			return plainEvent;
 		} catch (...)
 		{
 			return nullptr;
 		}
 	}
+
+	EventType HQ_FASTCALL peekEventType(const DataRef& data) {
+		return EventView(data, false).type();
+	}
+
+	//factory function
+	EventRef HQ_FASTCALL deserializeEvent(DataRef&& data, EventContainsFrameDataCallback isFrameDataCallback) {
+		EventView view(data, false, isFrameDataCallback);
+		data = nullptr;
+
+		return view.materialize();
+	}
+
+	EventType HQ_FASTCALL peekCompactEventType(const DataRef& data) {
+		return EventView(data, true).type();
+	}
+
+	EventRef HQ_FASTCALL deserializeCompactEvent(DataRef&& data, EventContainsFrameDataCallback isFrameDataCallback) {
+		EventView view(data, true, isFrameDataCallback);
+		data = nullptr;
+
+		return view.materialize();
+	}
 }
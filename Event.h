@@ -20,8 +20,10 @@
 #define REMOTE_EVENT_H
 
 #include "Data.h"
+#include "ZlibUtils.h"
 
 #include <stdint.h>
+#include <string.h>
 #include <memory>
 #include <list>
 #include <vector>
@@ -72,19 +74,41 @@ namespace HQRemote {
 		DISCONNECTED_NOTIFIFACTION,
 
 		COMPATIBLE_MODE = CONNECTED_NOTIFIFACTION - 1, // this event is not meant for direct use outside  Engine modules
+
+		// predefined events added after custom events were introduced. They are allocated downward from COMPATIBLE_MODE,
+		// so that values of custom event types (NO_EVENT + 1 onward) stay the same between versions.
+		// Only send them to remote side having protocol version 6+
+		FRAME_CAPABILITIES = COMPATIBLE_MODE - 1,//client tells host which frame features it can handle. uint32Value is combination of FrameCapability values
+		PARTIAL_FRAME = COMPATIBLE_MODE - 2,//changed regions of a frame (see PartialFrame.h). This uses renderedFrameData field in Event struct
+		RECEIVER_REPORT = COMPATIBLE_MODE - 3,//client reports its reception quality to host periodically. This uses receiverReport field. Protocol version 7+
+		TILE_CACHE_RESET = COMPATIBLE_MODE - 4,//client's tile cache is out of sync, host should forget what it holds (see TileCacheMirror). Protocol version 8+
+		FRAME_LAYER_SELECT = COMPATIBLE_MODE - 5,//client picks one of host's simulcast layers (see Engine::setFrameLayers()). uint32Value is the layer's index. Protocol version 9+
+		REFRESH_REQUEST = COMPATIBLE_MODE - 6,//client lost a frame the following ones depend on, host should send a self-contained important frame next. Protocol version 10+
+
+		FIRST_RESERVED_EVENT_TYPE = COMPATIBLE_MODE - 0x100,//values from here on are reserved for predefined events
+	};
+
+	enum FrameCapability : uint32_t {
+		FRAME_CAPABILITY_PARTIAL_FRAMES = 0x1,//client can compose PARTIAL_FRAME events (see FrameCompositor)
+		FRAME_CAPABILITY_TILE_CACHE = 0x2,//client keeps a tile cache & can handle tile cache commands of PARTIAL_FRAME events
+		FRAME_CAPABILITY_COPY_RECT = 0x4,//client can handle copy rect commands of PARTIAL_FRAME events (scrolled regions)
+		FRAME_CAPABILITY_PROGRESSIVE_REFINEMENT = 0x8,//client can apply refined tiles of PARTIAL_FRAME events to its key frame
 	};
 
 	const uint64_t IMPORTANT_FRAME_ID_FLAG = 0x8000000000000000; // bitwise or the frame id with this flag to indicate the frame shouldn't be dropped
 	const uint64_t UNUSED_FRAME_ID_BITS = (IMPORTANT_FRAME_ID_FLAG);
 
 	struct HQREMOTE_API Event {
-		Event(EventType _type) : type(_type)
-		{}
+		Event(EventType _type) : type(_type), reserved(0)
+		{
+			memset(customData, 0, sizeof(customData));
+		}
 		union {
 			struct {
 				int32_t id;
 				float x;
 				float y;
+				uint64_t timestamp;//sender's time in microseconds (see BaseEngine::sendInputEvent()), 0 if not available
 			} touchData;
 
 			struct {
@@ -121,6 +145,13 @@ namespace HQRemote {
 			struct {
 				uint32_t mode;
 			} compatibleMode;
+
+			struct {
+				uint64_t lastFrameId;//id of the frame received right before this report was sent, for host to measure round trip time
+				float receiveRate;//bytes per second
+				float lossRate;//fraction of unreliable messages lost in [0, 1]
+				uint64_t firstLostFrameId;//first frame found missing since previous report, 0 if none or not available
+			} receiverReport;
 			
 			double frameInterval;
 
@@ -151,6 +182,10 @@ namespace HQRemote {
 		virtual void deserialize(const DataRef& data);
 		virtual void deserialize(DataRef&& data);
 
+		//compact & byte order independent encoding, only understood by remote side having protocol version 3+.
+		//Use deserializeCompactEvent() to decode.
+		virtual DataRef serializeCompact() const;
+
 		//cast to data
 		operator DataRef() const{
 			return serialize();
@@ -172,10 +207,16 @@ namespace HQRemote {
 		virtual void deserialize(const DataRef& data) override;
 		virtual void deserialize(DataRef&& data) override;
 
+		virtual DataRef serializeCompact() const override;
+		//<header> is the already decoded header occupying first <headerSize> bytes of <data> (either layout)
+		void deserializeCompact(const Event& header, DataRef&& data, size_t headerSize);
+
 	protected:
 		virtual void deserializeFromStorage() = 0;
+		DataRef serializeCompactImpl(bool frameDataLayout) const;
 		
 		mutable DataRef storage;//this storage will hold both generic event data and additional data
+		mutable size_t payloadOffset;//offset of additional data in storage. Equal to sizeof(event) unless the storage is compact encoded
 	};
 	
 	struct HQREMOTE_API CompressedEvents : public DataEvent {
@@ -190,8 +231,27 @@ namespace HQRemote {
 		}
 		// these constructor for serialization
 		CompressedEvents(int zlibCompressLevel, const EventRef* event1, ...);//last argument should be nullptr
-		CompressedEvents(int zlibCompressLevel, const EventList& events);
+		//if <compactEncoding> is true, the bundled events are compact encoded, so remote side must have protocol version 3+.
+		//<codec> other than zlib requires remote side to have protocol version 4+.
+		//<usePresetDictionary> compresses using a built-in dictionary of typical event headers, it improves ratio of small bundles such as
+		//touch & audio events. Only used by zlib codec & requires remote side to have protocol version 5+
+		CompressedEvents(int zlibCompressLevel, const EventList& events, bool compactEncoding = false, CompressionCodec codec = COMPRESSION_CODEC_ZLIB,
+						 bool usePresetDictionary = false);
 		CompressedEvents(int zlibCompressLevel, const_iterator eventListBegin, const_iterator eventListEnd);
+		//streamed bundle, compressed by <stream> which is shared by all bundles of the same <streamGeneration>. <startOfStream> must be
+		//true for the first bundle compressed by <stream>. Bundled events are compact encoded. Requires remote side to have protocol version 11+,
+		//bundles of a stream must arrive in the order they were created (see BaseEngine::sendInputEvent())
+		CompressedEvents(ZlibStreamCompressor& stream, uint32_t streamGeneration, bool startOfStream, const EventList& events);
+
+		//streamed bundle isn't decompressed when deserialized since it needs the stream's history. Receiver must pass
+		//the bundles to decompressStream() in their arrival order. Throws if the bundle doesn't belong to <stream>
+		bool isStreamed() const;
+		uint32_t streamGeneration() const;
+		bool startsStream() const;
+		void decompressStream(ZlibStreamDecompressor& stream);
+
+		//dictionary used by <usePresetDictionary> & by streamed bundles
+		static const ZlibDictionary& presetDictionary();
 		
 		iterator begin() { return m_events.begin(); }
 		const_iterator begin() const { return m_events.begin(); }
@@ -202,18 +262,28 @@ namespace HQRemote {
 		const_iterator cend() const { return m_events.cend(); }
 		
 	private:
-		void init(int zlibCompressLevel);
+		void init(int zlibCompressLevel, bool compactEncoding = false, CompressionCodec codec = COMPRESSION_CODEC_ZLIB, bool usePresetDictionary = false,
+				  ZlibStreamCompressor* stream = nullptr);
 		virtual void deserializeFromStorage() override;
+		void deserializeEvents(ZlibStreamDecompressor* stream);
 		
 		EventList m_events;
 		EventContainsFrameDataCallback m_customTypeCallback = nullptr;
 	};
 
+	//headroom needed by FrameEvent to wrap a HeadroomData in place
+	const size_t FRAME_EVENT_HEADROOM = sizeof(Event);
+
 	struct HQREMOTE_API FrameEvent : public DataEvent {
 		explicit FrameEvent(EventType type = RENDERED_FRAME);
 		explicit FrameEvent(uint32_t frameSize, uint64_t frameId, EventType type = RENDERED_FRAME);
 		explicit FrameEvent(const void* frameData, uint32_t frameSize, uint64_t frameId, EventType type = RENDERED_FRAME);
 		explicit FrameEvent(ConstDataRef frameData, uint64_t frameId, EventType type = RENDERED_FRAME);
+		//if <frameData> is a HeadroomData with at least FRAME_EVENT_HEADROOM bytes of headroom & not shared with anyone else,
+		//the event will be created in place without copying the frame data. Otherwise the data is copied
+		explicit FrameEvent(DataRef&& frameData, uint64_t frameId, EventType type = RENDERED_FRAME);
+
+		virtual DataRef serializeCompact() const override;
 
 	private:
 		virtual void deserializeFromStorage() override;
@@ -225,9 +295,53 @@ namespace HQRemote {
 	typedef HQREMOTE_API_TYPEDEF std::shared_ptr<FrameEvent> FrameEventRef;
 	typedef HQREMOTE_API_TYPEDEF std::shared_ptr<const FrameEvent> ConstFrameEventRef;
 
+	//read-only view of a serialized event. Fields are read in place from the data, nothing is copied until
+	//materialize() is called, and even then the resulting event shares the same data.
+	//NOTE: not thread safe, header is decoded lazily on first access
+	class HQREMOTE_API EventView {
+	public:
+		//<compact> tells whether <data> is compact encoded (see PlainEvent::serializeCompact()).
+		//<callback> is only invoked for custom event type (value > NO_EVENT)
+		EventView(const DataRef& data, bool compact, EventContainsFrameDataCallback callback = nullptr);
+
+		//NO_EVENT if the data is malformed
+		EventType type() const { return m_type; }
+		bool isValid() const { return m_type != NO_EVENT; }
+		bool isCompact() const { return m_compact; }
+		//event uses renderedFrameData field & has additional data
+		bool containsFrameData() const { return m_containsFrameData; }
+
+		//decoded generic event data. Pointer fields are not valid. Return nullptr if the data is malformed
+		const Event* header() const;
+		//additional data following the generic event data
+		const unsigned char* payload() const;
+		size_t payloadSize() const;
+
+		const DataRef& data() const { return m_data; }
+
+		//create owning event sharing the viewed data. Return nullptr if the data is malformed
+		EventRef materialize() const;
+	private:
+		bool decodeHeader() const;
+
+		DataRef m_data;
+		EventContainsFrameDataCallback m_callback;
+		EventType m_type;
+		bool m_compact;
+		bool m_containsFrameData;
+
+		mutable Event m_header;
+		mutable size_t m_headerSize;
+		mutable int m_headerState;//0 = not decoded, 1 = decoded, -1 = malformed
+	};
+
 	// the callback only invoked for custom event type (value > NO_EVENT)
 	HQREMOTE_API  EventRef HQ_FASTCALL deserializeEvent(DataRef&& data, EventContainsFrameDataCallback callback);
 	HQREMOTE_API  EventType HQ_FASTCALL peekEventType(const DataRef& data);
+
+	// compact encoding counterparts of the above functions (see PlainEvent::serializeCompact())
+	HQREMOTE_API  EventRef HQ_FASTCALL deserializeCompactEvent(DataRef&& data, EventContainsFrameDataCallback callback);
+	HQREMOTE_API  EventType HQ_FASTCALL peekCompactEventType(const DataRef& data);
 }
 
 #if defined WIN32 || defined _MSC_VER
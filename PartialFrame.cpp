@@ -0,0 +1,263 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "PartialFrame.h"
+#include "Event.h"
+#include "WireFormat.h"
+#include "TileCache.h"
+
+namespace HQRemote {
+	/*------------ PartialFrameWriter ---------*/
+	PartialFrameWriter::PartialFrameWriter(uint64_t baseFrameId, uint32_t frameWidth, uint32_t frameHeight, uint32_t numTiles, size_t sizeHint)
+		: m_data(std::make_shared<HeadroomData>(FRAME_EVENT_HEADROOM, 4 * MAX_VARINT64_SIZE + numTiles * 6 * MAX_VARINT32_SIZE + sizeHint))
+	{
+		unsigned char header[4 * MAX_VARINT64_SIZE];
+		WireWriter writer(header);
+		writer.writeVarint(baseFrameId);
+		writer.writeVarint(frameWidth);
+		writer.writeVarint(frameHeight);
+		writer.writeVarint(numTiles);
+
+		m_data->push_back(header, writer.size());
+	}
+
+	void PartialFrameWriter::addTile(const FrameRect& rect, const void* compressedData, size_t size) {
+		unsigned char header[5 * MAX_VARINT64_SIZE];
+		WireWriter writer(header);
+		writer.writeVarint(rect.x);
+		writer.writeVarint(rect.y);
+		writer.writeVarint(rect.width);
+		writer.writeVarint(rect.height);
+		writer.writeVarint(size);
+
+		m_data->push_back(header, writer.size());
+		m_data->push_back(compressedData, size);
+	}
+
+	void PartialFrameWriter::addTileCacheCommands(const std::vector<TileCacheCommand>& placements, const std::vector<TileCacheCommand>& stores) {
+		std::vector<unsigned char> buffer(2 * MAX_VARINT64_SIZE + (placements.size() + stores.size()) * 6 * MAX_VARINT64_SIZE);
+		WireWriter writer(buffer.data());
+
+		writer.writeVarint(placements.size());
+		for (auto& placement : placements) {
+			writer.writeVarint(placement.slot);
+			writer.writeVarint(placement.frameId);
+			writer.writeVarint(placement.rect.x);
+			writer.writeVarint(placement.rect.y);
+			writer.writeVarint(placement.rect.width);
+			writer.writeVarint(placement.rect.height);
+		}
+
+		writer.writeVarint(stores.size());
+		for (auto& store : stores) {
+			writer.writeVarint(store.slot);
+			writer.writeVarint(store.rect.x);
+			writer.writeVarint(store.rect.y);
+			writer.writeVarint(store.rect.width);
+			writer.writeVarint(store.rect.height);
+		}
+
+		m_data->push_back(buffer.data(), writer.size());
+	}
+
+	void PartialFrameWriter::addCopyRects(const std::vector<CopyRectCommand>& copies) {
+		std::vector<unsigned char> buffer(MAX_VARINT64_SIZE + copies.size() * 6 * MAX_VARINT32_SIZE);
+		WireWriter writer(buffer.data());
+
+		writer.writeVarint(copies.size());
+		for (auto& copy : copies) {
+			writer.writeVarint(copy.srcX);
+			writer.writeVarint(copy.srcY);
+			writer.writeVarint(copy.rect.x);
+			writer.writeVarint(copy.rect.y);
+			writer.writeVarint(copy.rect.width);
+			writer.writeVarint(copy.rect.height);
+		}
+
+		m_data->push_back(buffer.data(), writer.size());
+	}
+
+	void PartialFrameWriter::addRefinedTiles(uint32_t numTiles) {
+		unsigned char header[MAX_VARINT32_SIZE];
+		WireWriter writer(header);
+		writer.writeVarint(numTiles);
+
+		m_data->push_back(header, writer.size());
+	}
+
+	/*------------ PartialFrameReader ---------*/
+	PartialFrameReader::PartialFrameReader(const void* payload, size_t size)
+		: m_ptr((const unsigned char*)payload), m_end((const unsigned char*)payload + size),
+		m_baseFrameId(0), m_frameWidth(0), m_frameHeight(0), m_numTiles(0), m_numReadTiles(0), m_valid(false)
+	{
+		WireReader reader(payload, size);
+		m_baseFrameId = reader.readVarint();
+		auto width = reader.readVarint();
+		auto height = reader.readVarint();
+		auto numTiles = reader.readVarint();
+
+		if (reader.failed() || width > 0xffffffff || height > 0xffffffff || numTiles > 0xffffffff)
+			return;
+
+		m_frameWidth = (uint32_t)width;
+		m_frameHeight = (uint32_t)height;
+		m_numTiles = (uint32_t)numTiles;
+		m_ptr += reader.position();
+		m_valid = true;
+	}
+
+	bool PartialFrameReader::nextTile(FrameRect& rect, const unsigned char*& compressedData, size_t& size) {
+		if (!m_valid || m_numReadTiles >= m_numTiles)
+			return false;
+
+		WireReader reader(m_ptr, m_end - m_ptr);
+		bool rectValid = readRect(reader, rect);
+		auto dataSize = reader.readVarint();
+
+		if (!rectValid || reader.failed() || dataSize > reader.remainSize())
+		{
+			m_valid = false;
+			return false;
+		}
+
+		compressedData = reader.current();
+		size = (size_t)dataSize;
+
+		m_ptr = reader.current() + size;
+		m_numReadTiles++;
+
+		return true;
+	}
+
+	bool PartialFrameReader::readTileCacheCommands(std::vector<TileCacheCommand>& placements, std::vector<TileCacheCommand>& stores) {
+		placements.clear();
+		stores.clear();
+
+		if (!m_valid || m_numReadTiles < m_numTiles)
+			return false;
+
+		//older hosts don't write this section
+		if (m_ptr == m_end)
+			return true;
+
+		WireReader reader(m_ptr, m_end - m_ptr);
+		for (int list = 0; list < 2; ++list) {
+			auto& commands = list == 0 ? placements : stores;
+			auto numCommands = reader.readVarint();
+			//each command takes at least 5 bytes
+			if (reader.failed() || numCommands > reader.remainSize() / 5) {
+				m_valid = false;
+				return false;
+			}
+
+			commands.resize((size_t)numCommands);
+			for (auto& command : commands) {
+				auto slot = reader.readVarint();
+				command.frameId = list == 0 ? reader.readVarint() : 0;
+				if (!readRect(reader, command.rect) || slot >= MAX_TILE_CACHE_SLOTS) {
+					m_valid = false;
+					return false;
+				}
+				command.slot = (uint32_t)slot;
+			}
+		}
+
+		m_ptr = reader.current();
+
+		return true;
+	}
+
+	bool PartialFrameReader::readCopyRects(std::vector<CopyRectCommand>& copies) {
+		copies.clear();
+
+		if (!m_valid || m_numReadTiles < m_numTiles)
+			return false;
+
+		//this section is optional
+		if (m_ptr == m_end)
+			return true;
+
+		WireReader reader(m_ptr, m_end - m_ptr);
+		auto numCopies = reader.readVarint();
+		//each copy takes at least 6 bytes
+		if (reader.failed() || numCopies > reader.remainSize() / 6) {
+			m_valid = false;
+			return false;
+		}
+
+		copies.resize((size_t)numCopies);
+		for (auto& copy : copies) {
+			auto srcX = reader.readVarint();
+			auto srcY = reader.readVarint();
+			//source must lie inside the frame too
+			if (!readRect(reader, copy.rect) || srcX > m_frameWidth - copy.rect.width || srcY > m_frameHeight - copy.rect.height) {
+				m_valid = false;
+				return false;
+			}
+			copy.srcX = (uint32_t)srcX;
+			copy.srcY = (uint32_t)srcY;
+		}
+
+		m_ptr = reader.current();
+
+		return true;
+	}
+
+	bool PartialFrameReader::readRefinedTiles() {
+		if (!m_valid || m_numReadTiles < m_numTiles)
+			return false;
+
+		m_numTiles = m_numReadTiles = 0;
+
+		//this section is optional
+		if (m_ptr == m_end)
+			return true;
+
+		WireReader reader(m_ptr, m_end - m_ptr);
+		auto numTiles = reader.readVarint();
+		//each tile takes at least 5 bytes
+		if (reader.failed() || numTiles > reader.remainSize() / 5) {
+			m_valid = false;
+			return false;
+		}
+
+		m_numTiles = (uint32_t)numTiles;
+		m_ptr = reader.current();
+
+		return true;
+	}
+
+	bool PartialFrameReader::readRect(WireReader& reader, FrameRect& rect) {
+		auto x = reader.readVarint();
+		auto y = reader.readVarint();
+		auto width = reader.readVarint();
+		auto height = reader.readVarint();
+
+		//rect must lie inside the frame
+		if (reader.failed() || x >= m_frameWidth || y >= m_frameHeight || width > m_frameWidth - x || height > m_frameHeight - y)
+			return false;
+
+		rect.x = (uint32_t)x;
+		rect.y = (uint32_t)y;
+		rect.width = (uint32_t)width;
+		rect.height = (uint32_t)height;
+
+		return true;
+	}
+}
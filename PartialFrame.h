@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_PARTIAL_FRAME_H
+#define HQREMOTE_PARTIAL_FRAME_H
+
+#include "Common.h"
+#include "Data.h"
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	class WireReader;
+
+	struct FrameRect {
+		uint32_t x, y;
+		uint32_t width, height;
+	};
+
+	//payload of PARTIAL_FRAME event: changed tiles of a frame relative to a previously sent full frame (base frame).
+	//Layout (varints):
+	//base frame id | frame width | frame height | number of tiles | tiles.
+	//Each tile: x | y | width | height | compressed size | compressed image.
+	//Tiles' coordinates are in the decoded image space of the base frame, origin at top-left.
+	//Regions not covered by any tile are the same as the base frame.
+	//Optional tile cache section after the tiles (see TileCacheMirror):
+	//number of placements | placements | number of stores | stores.
+	//Each placement: slot | store frame id | x | y | width | height. Each store: slot | x | y | width | height.
+	//Placements are drawn after the tiles, stores copy regions of the composed frame into the cache afterwards.
+	//Optional copy rect section after tile cache section: number of copies | copies.
+	//Each copy: source x | source y | x | y | width | height. Copies are done before drawing the tiles.
+	//Optional refined tile section after copy rect section: number of refined tiles | tiles, same layout as above.
+	//Refined tiles are higher quality versions of the base frame's regions, they replace these regions of the base frame itself
+	//before anything else is done.
+	struct TileCacheCommand {
+		FrameRect rect;
+		uint32_t slot;
+		uint64_t frameId;//placement: id of the frame that stored the slot's content. Unused by stores
+	};
+
+	//copy region of the base frame at (<srcX>, <srcY>) to <rect>, i.e. scrolled content
+	struct CopyRectCommand {
+		FrameRect rect;
+		uint32_t srcX, srcY;
+	};
+
+	class HQREMOTE_API PartialFrameWriter {
+	public:
+		//<sizeHint> is the expected total size of compressed tiles
+		PartialFrameWriter(uint64_t baseFrameId, uint32_t frameWidth, uint32_t frameHeight, uint32_t numTiles, size_t sizeHint = 0);
+
+		//exactly <numTiles> tiles must be added
+		void addTile(const FrameRect& rect, const void* compressedData, size_t size);
+		//optional, after all tiles were added
+		void addTileCacheCommands(const std::vector<TileCacheCommand>& placements, const std::vector<TileCacheCommand>& stores);
+		//optional, after addTileCacheCommands() which is needed even with empty lists
+		void addCopyRects(const std::vector<CopyRectCommand>& copies);
+		//optional, after addCopyRects() which is needed even with empty list. Exactly <numTiles> tiles must be added by addTile() afterwards
+		void addRefinedTiles(uint32_t numTiles);
+
+		//returned data is a HeadroomData suitable for FrameEvent(DataRef&&, ...) to wrap in place.
+		//The writer can't be used afterwards
+		DataRef releaseData() { return std::move(m_data); }
+	private:
+		std::shared_ptr<HeadroomData> m_data;
+	};
+
+	class HQREMOTE_API PartialFrameReader {
+	public:
+		//<payload> must stay valid while reading
+		PartialFrameReader(const void* payload, size_t size);
+
+		//false if the header is malformed
+		bool isValid() const { return m_valid; }
+
+		uint64_t getBaseFrameId() const { return m_baseFrameId; }
+		uint32_t getFrameWidth() const { return m_frameWidth; }
+		uint32_t getFrameHeight() const { return m_frameHeight; }
+		uint32_t getNumTiles() const { return m_numTiles; }
+
+		//read next tile, return false if there is no more tile or the data is malformed
+		bool nextTile(FrameRect& rect, const unsigned char*& compressedData, size_t& size);
+		//read tile cache section after all tiles were read. Return false if the data is malformed, empty lists if there is no such section
+		bool readTileCacheCommands(std::vector<TileCacheCommand>& placements, std::vector<TileCacheCommand>& stores);
+		//read copy rect section after tile cache section. Same return value as readTileCacheCommands()
+		bool readCopyRects(std::vector<CopyRectCommand>& copies);
+		//start reading refined tile section after copy rect section, then read its tiles by nextTile(). Same return value as
+		//readTileCacheCommands(), getNumTiles() returns 0 if there is no such section
+		bool readRefinedTiles();
+	private:
+		bool readRect(WireReader& reader, FrameRect& rect);
+
+		const unsigned char* m_ptr;
+		const unsigned char* m_end;
+		uint64_t m_baseFrameId;
+		uint32_t m_frameWidth;
+		uint32_t m_frameHeight;
+		uint32_t m_numTiles;
+		uint32_t m_numReadTiles;
+		bool m_valid;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
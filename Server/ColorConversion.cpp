@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "ColorConversion.h"
+
+#include <string.h>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#	define COLOR_CONVERSION_SSE2
+#	include <emmintrin.h>
+#elif defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM || defined _M_ARM64
+#	define COLOR_CONVERSION_NEON
+#	include <arm_neon.h>
+#endif
+
+//15 bits fixed point coefficients, matching libjpeg's RGB->YCbCr conversion.
+//Chroma is computed from the sum of 2x2 pixels, hence 2 more bits of scale
+#define Y_SCALE_BITS 15
+#define C_SCALE_BITS (Y_SCALE_BITS + 2)
+#define Y_ROUNDING (1 << (Y_SCALE_BITS - 1))
+//rounding is 1/2 - 1 like libjpeg's CBCR_OFFSET + ONE_HALF - 1, so that fully saturated blue/red doesn't round up to 256
+#define C_BIAS ((128 << C_SCALE_BITS) + (1 << (C_SCALE_BITS - 1)) - 1)
+
+namespace HQRemote {
+	static const int16_t Y_R = 9798, Y_G = 19235, Y_B = 3736;
+	static const int16_t CB_R = -5529, CB_G = -10855, CB_B = 16384;
+	static const int16_t CR_R = 16384, CR_G = -13720, CR_B = -2664;
+
+	static inline unsigned char computeY(int r, int g, int b) {
+		return (unsigned char)((Y_R * r + Y_G * g + Y_B * b + Y_ROUNDING) >> Y_SCALE_BITS);
+	}
+
+	//<r>, <g>, <b> are sums of 2x2 pixels
+	static inline unsigned char computeChroma(int r, int g, int b, int coeffR, int coeffG, int coeffB) {
+		return (unsigned char)((coeffR * r + coeffG * g + coeffB * b + C_BIAS) >> C_SCALE_BITS);
+	}
+
+	//convert pixels starting from <x> (must be even)
+	static void convertRGBToYCbCr420Scalar(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t x, uint32_t width,
+										   unsigned char* y0, unsigned char* y1, unsigned char* cb, unsigned char* cr)
+	{
+		for (; x < width; x += 2) {
+			//last column of odd width image is used twice
+			auto p00 = row0 + x * numChannels;
+			auto p10 = row1 + x * numChannels;
+			auto p01 = x + 1 < width ? p00 + numChannels : p00;
+			auto p11 = x + 1 < width ? p10 + numChannels : p10;
+
+			y0[x] = computeY(p00[0], p00[1], p00[2]);
+			y1[x] = computeY(p10[0], p10[1], p10[2]);
+			if (x + 1 < width) {
+				y0[x + 1] = computeY(p01[0], p01[1], p01[2]);
+				y1[x + 1] = computeY(p11[0], p11[1], p11[2]);
+			}
+
+			int r = p00[0] + p01[0] + p10[0] + p11[0];
+			int g = p00[1] + p01[1] + p10[1] + p11[1];
+			int b = p00[2] + p01[2] + p10[2] + p11[2];
+			cb[x / 2] = computeChroma(r, g, b, CB_R, CB_G, CB_B);
+			cr[x / 2] = computeChroma(r, g, b, CR_R, CR_G, CR_B);
+		}
+	}
+
+#if defined COLOR_CONVERSION_SSE2
+	static inline __m128i load32(const unsigned char* src) {
+		int32_t value;
+		memcpy(&value, src, sizeof(value));
+		return _mm_cvtsi32_si128(value);
+	}
+
+	//load 4 pixels as RGBX. 3 channels version reads 1 byte past the 4th pixel
+	static inline __m128i loadRGBX4(const unsigned char* src, unsigned int numChannels) {
+		if (numChannels == 4)
+			return _mm_loadu_si128((const __m128i*)src);
+
+		return _mm_unpacklo_epi64(_mm_unpacklo_epi32(load32(src), load32(src + 3)),
+								  _mm_unpacklo_epi32(load32(src + 6), load32(src + 9)));
+	}
+
+	//deinterleave 16 pixels into 16 bits R, G, B of pixels 0-7 (lo) & 8-15 (hi)
+	static inline void loadRGB16(const unsigned char* src, unsigned int numChannels,
+								 __m128i& rLo, __m128i& gLo, __m128i& bLo, __m128i& rHi, __m128i& gHi, __m128i& bHi)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		auto v0 = loadRGBX4(src, numChannels);
+		auto v1 = loadRGBX4(src + 4 * numChannels, numChannels);
+		auto v2 = loadRGBX4(src + 8 * numChannels, numChannels);
+		auto v3 = loadRGBX4(src + 12 * numChannels, numChannels);
+
+		//3 rounds of byte interleaving transpose 4x4 pixels blocks into planar form
+		auto t0 = _mm_unpacklo_epi8(v0, v1);
+		auto t1 = _mm_unpackhi_epi8(v0, v1);
+		auto t2 = _mm_unpacklo_epi8(v2, v3);
+		auto t3 = _mm_unpackhi_epi8(v2, v3);
+
+		auto u0 = _mm_unpacklo_epi8(t0, t1);
+		auto u1 = _mm_unpackhi_epi8(t0, t1);
+		auto u2 = _mm_unpacklo_epi8(t2, t3);
+		auto u3 = _mm_unpackhi_epi8(t2, t3);
+
+		auto rg0 = _mm_unpacklo_epi8(u0, u1);//r0-7 g0-7
+		auto bx0 = _mm_unpackhi_epi8(u0, u1);//b0-7 x0-7
+		auto rg1 = _mm_unpacklo_epi8(u2, u3);//r8-15 g8-15
+		auto bx1 = _mm_unpackhi_epi8(u2, u3);//b8-15 x8-15
+
+		rLo = _mm_unpacklo_epi8(rg0, zero);
+		gLo = _mm_unpackhi_epi8(rg0, zero);
+		bLo = _mm_unpacklo_epi8(bx0, zero);
+		rHi = _mm_unpacklo_epi8(rg1, zero);
+		gHi = _mm_unpackhi_epi8(rg1, zero);
+		bHi = _mm_unpacklo_epi8(bx1, zero);
+	}
+
+	//r * coeffRG.r + g * coeffRG.g + b * coeffB + bias, shifted. Returns 8 16 bits values
+	static inline __m128i dotProduct8(__m128i r, __m128i g, __m128i b, __m128i coeffRG, __m128i coeffB, __m128i bias, int shift) {
+		const __m128i zero = _mm_setzero_si128();
+		auto lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coeffRG), _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), coeffB));
+		auto hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coeffRG), _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), coeffB));
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), shift);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), shift);
+
+		return _mm_packs_epi32(lo, hi);
+	}
+
+	//sum of each 2 horizontally adjacent 16 bits values of <lo> & <hi>
+	static inline __m128i pairwiseSum16(__m128i lo, __m128i hi) {
+		const __m128i ones = _mm_set1_epi16(1);
+		return _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+	}
+
+	static uint32_t convertRGBToYCbCr420SIMD(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t width,
+											 unsigned char* y0, unsigned char* y1, unsigned char* cb, unsigned char* cr)
+	{
+		const __m128i yRG = _mm_setr_epi16(Y_R, Y_G, Y_R, Y_G, Y_R, Y_G, Y_R, Y_G);
+		const __m128i yB = _mm_setr_epi16(Y_B, 0, Y_B, 0, Y_B, 0, Y_B, 0);
+		const __m128i cbRG = _mm_setr_epi16(CB_R, CB_G, CB_R, CB_G, CB_R, CB_G, CB_R, CB_G);
+		const __m128i cbB = _mm_setr_epi16(CB_B, 0, CB_B, 0, CB_B, 0, CB_B, 0);
+		const __m128i crRG = _mm_setr_epi16(CR_R, CR_G, CR_R, CR_G, CR_R, CR_G, CR_R, CR_G);
+		const __m128i crB = _mm_setr_epi16(CR_B, 0, CR_B, 0, CR_B, 0, CR_B, 0);
+		const __m128i yRounding = _mm_set1_epi32(Y_ROUNDING);
+		const __m128i cBias = _mm_set1_epi32(C_BIAS);
+
+		//3 channels loads read 1 byte past the last pixel of the block
+		const uint32_t readPastEnd = numChannels == 3 ? 1 : 0;
+
+		uint32_t x = 0;
+		for (; x + 16 + readPastEnd <= width; x += 16) {
+			__m128i r0Lo, g0Lo, b0Lo, r0Hi, g0Hi, b0Hi;
+			__m128i r1Lo, g1Lo, b1Lo, r1Hi, g1Hi, b1Hi;
+			loadRGB16(row0 + x * numChannels, numChannels, r0Lo, g0Lo, b0Lo, r0Hi, g0Hi, b0Hi);
+			loadRGB16(row1 + x * numChannels, numChannels, r1Lo, g1Lo, b1Lo, r1Hi, g1Hi, b1Hi);
+
+			//luma
+			auto yLo = dotProduct8(r0Lo, g0Lo, b0Lo, yRG, yB, yRounding, Y_SCALE_BITS);
+			auto yHi = dotProduct8(r0Hi, g0Hi, b0Hi, yRG, yB, yRounding, Y_SCALE_BITS);
+			_mm_storeu_si128((__m128i*)(y0 + x), _mm_packus_epi16(yLo, yHi));
+
+			yLo = dotProduct8(r1Lo, g1Lo, b1Lo, yRG, yB, yRounding, Y_SCALE_BITS);
+			yHi = dotProduct8(r1Hi, g1Hi, b1Hi, yRG, yB, yRounding, Y_SCALE_BITS);
+			_mm_storeu_si128((__m128i*)(y1 + x), _mm_packus_epi16(yLo, yHi));
+
+			//chroma from 2x2 sums
+			auto sumR = pairwiseSum16(_mm_add_epi16(r0Lo, r1Lo), _mm_add_epi16(r0Hi, r1Hi));
+			auto sumG = pairwiseSum16(_mm_add_epi16(g0Lo, g1Lo), _mm_add_epi16(g0Hi, g1Hi));
+			auto sumB = pairwiseSum16(_mm_add_epi16(b0Lo, b1Lo), _mm_add_epi16(b0Hi, b1Hi));
+
+			auto cb8 = dotProduct8(sumR, sumG, sumB, cbRG, cbB, cBias, C_SCALE_BITS);
+			auto cr8 = dotProduct8(sumR, sumG, sumB, crRG, crB, cBias, C_SCALE_BITS);
+			_mm_storel_epi64((__m128i*)(cb + x / 2), _mm_packus_epi16(cb8, cb8));
+			_mm_storel_epi64((__m128i*)(cr + x / 2), _mm_packus_epi16(cr8, cr8));
+		}
+
+		return x;
+	}
+#elif defined COLOR_CONVERSION_NEON
+	static inline uint8x8_t dotProduct8(uint16x8_t r, uint16x8_t g, uint16x8_t b, int16_t coeffR, int16_t coeffG, int16_t coeffB, int32_t bias, bool luma) {
+		auto sr = vreinterpretq_s16_u16(r);
+		auto sg = vreinterpretq_s16_u16(g);
+		auto sb = vreinterpretq_s16_u16(b);
+		auto biasVec = vdupq_n_s32(bias);
+
+		auto lo = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(biasVec, vget_low_s16(sr), coeffR), vget_low_s16(sg), coeffG), vget_low_s16(sb), coeffB);
+		auto hi = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(biasVec, vget_high_s16(sr), coeffR), vget_high_s16(sg), coeffG), vget_high_s16(sb), coeffB);
+
+		int16x8_t result;
+		if (luma)
+			result = vcombine_s16(vshrn_n_s32(lo, Y_SCALE_BITS), vshrn_n_s32(hi, Y_SCALE_BITS));
+		else
+			result = vcombine_s16(vmovn_s32(vshrq_n_s32(lo, C_SCALE_BITS)), vmovn_s32(vshrq_n_s32(hi, C_SCALE_BITS)));
+		return vqmovun_s16(result);
+	}
+
+	static inline void loadRGB(const unsigned char* src, unsigned int numChannels, uint8x16_t& r, uint8x16_t& g, uint8x16_t& b) {
+		if (numChannels == 4) {
+			auto pixels = vld4q_u8(src);
+			r = pixels.val[0]; g = pixels.val[1]; b = pixels.val[2];
+		}
+		else {
+			auto pixels = vld3q_u8(src);
+			r = pixels.val[0]; g = pixels.val[1]; b = pixels.val[2];
+		}
+	}
+
+	static uint32_t convertRGBToYCbCr420SIMD(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t width,
+											 unsigned char* y0, unsigned char* y1, unsigned char* cb, unsigned char* cr)
+	{
+		uint32_t x = 0;
+		for (; x + 16 <= width; x += 16) {
+			uint8x16_t r0, g0, b0, r1, g1, b1;
+			loadRGB(row0 + x * numChannels, numChannels, r0, g0, b0);
+			loadRGB(row1 + x * numChannels, numChannels, r1, g1, b1);
+
+			//luma
+			vst1q_u8(y0 + x, vcombine_u8(
+				dotProduct8(vmovl_u8(vget_low_u8(r0)), vmovl_u8(vget_low_u8(g0)), vmovl_u8(vget_low_u8(b0)), Y_R, Y_G, Y_B, Y_ROUNDING, true),
+				dotProduct8(vmovl_u8(vget_high_u8(r0)), vmovl_u8(vget_high_u8(g0)), vmovl_u8(vget_high_u8(b0)), Y_R, Y_G, Y_B, Y_ROUNDING, true)));
+			vst1q_u8(y1 + x, vcombine_u8(
+				dotProduct8(vmovl_u8(vget_low_u8(r1)), vmovl_u8(vget_low_u8(g1)), vmovl_u8(vget_low_u8(b1)), Y_R, Y_G, Y_B, Y_ROUNDING, true),
+				dotProduct8(vmovl_u8(vget_high_u8(r1)), vmovl_u8(vget_high_u8(g1)), vmovl_u8(vget_high_u8(b1)), Y_R, Y_G, Y_B, Y_ROUNDING, true)));
+
+			//chroma from 2x2 sums
+			auto sumR = vpadalq_u8(vpaddlq_u8(r0), r1);
+			auto sumG = vpadalq_u8(vpaddlq_u8(g0), g1);
+			auto sumB = vpadalq_u8(vpaddlq_u8(b0), b1);
+
+			vst1_u8(cb + x / 2, dotProduct8(sumR, sumG, sumB, CB_R, CB_G, CB_B, C_BIAS, false));
+			vst1_u8(cr + x / 2, dotProduct8(sumR, sumG, sumB, CR_R, CR_G, CR_B, C_BIAS, false));
+		}
+
+		return x;
+	}
+#endif//COLOR_CONVERSION_NEON
+
+	void HQ_FASTCALL convertRGBToYCbCr420(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t width,
+										  unsigned char* y0, unsigned char* y1, unsigned char* cb, unsigned char* cr)
+	{
+		uint32_t x = 0;
+#if defined COLOR_CONVERSION_SSE2 || defined COLOR_CONVERSION_NEON
+		x = convertRGBToYCbCr420SIMD(row0, row1, numChannels, width, y0, y1, cb, cr);
+#endif
+
+		//remaining pixels
+		convertRGBToYCbCr420Scalar(row0, row1, numChannels, x, width, y0, y1, cb, cr);
+	}
+}
@@ -0,0 +1,36 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_COLOR_CONVERSION_H
+#define HQREMOTE_COLOR_CONVERSION_H
+
+#include "../Common.h"
+
+#include <stdint.h>
+
+namespace HQRemote {
+	//convert a pair of RGB(X) rows into 2 luma rows & 1 row of each 4:2:0 subsampled chroma planes, using JPEG's full range BT.601 formula.
+	//<numChannels> is 3 or 4, 4th channel is ignored. <row1> can be the same as <row0> for the last row of odd height image.
+	//<y0> & <y1> receive <width> samples, <cb> & <cr> receive (<width> + 1) / 2 samples.
+	//Uses SSE2 or NEON when available
+	void HQ_FASTCALL convertRGBToYCbCr420(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t width,
+										  unsigned char* y0, unsigned char* y1, unsigned char* cb, unsigned char* cr);
+}
+
+#endif
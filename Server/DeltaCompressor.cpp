@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "ImgCompressor.h"
+#include "../BufferPool.h"
+
+#include <string.h>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#	define DELTA_COMPRESSOR_SSE2
+#	include <emmintrin.h>
+#elif defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM || defined _M_ARM64
+#	define DELTA_COMPRESSOR_NEON
+#	include <arm_neon.h>
+#endif
+
+namespace HQRemote {
+	enum DeltaFrameType : uint32_t {
+		DELTA_KEY_FRAME,
+		DELTA_RESIDUAL_FRAME,
+	};
+
+	//metadata preceding compressed data, the first 4 fields have the same layout as ZlibImgComressor's
+	struct DeltaFrameHeader {
+		uint32_t width;
+		uint32_t height;
+		uint32_t numChannels;
+		CompressionCodec codec;
+		uint64_t sequence;
+		DeltaFrameType type;
+		uint32_t padding;//keep compressed data 64 bits aligned
+	};
+
+	/*------------- residual kernels ---------*/
+	//dst = a - b, byte wise modulo 256
+	static void subtractBytes(const unsigned char* a, const unsigned char* b, size_t size, unsigned char* dst) {
+		size_t i = 0;
+#if defined DELTA_COMPRESSOR_SSE2
+		for (; i + 16 <= size; i += 16) {
+			auto va = _mm_loadu_si128((const __m128i*)(a + i));
+			auto vb = _mm_loadu_si128((const __m128i*)(b + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi8(va, vb));
+		}
+#elif defined DELTA_COMPRESSOR_NEON
+		for (; i + 16 <= size; i += 16)
+			vst1q_u8(dst + i, vsubq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+#endif
+		for (; i < size; ++i)
+			dst[i] = (unsigned char)(a[i] - b[i]);
+	}
+
+	//dst += residual, byte wise modulo 256
+	static void addBytes(unsigned char* dst, const unsigned char* residual, size_t size) {
+		size_t i = 0;
+#if defined DELTA_COMPRESSOR_SSE2
+		for (; i + 16 <= size; i += 16) {
+			auto vd = _mm_loadu_si128((const __m128i*)(dst + i));
+			auto vr = _mm_loadu_si128((const __m128i*)(residual + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(vd, vr));
+		}
+#elif defined DELTA_COMPRESSOR_NEON
+		for (; i + 16 <= size; i += 16)
+			vst1q_u8(dst + i, vaddq_u8(vld1q_u8(dst + i), vld1q_u8(residual + i)));
+#endif
+		for (; i < size; ++i)
+			dst[i] = (unsigned char)(dst[i] + residual[i]);
+	}
+
+	/*------------- DeltaImgCompressor ---------*/
+	DeltaImgCompressor::DeltaImgCompressor(unsigned int keyFrameInterval, CompressionCodec codec, int level)
+		: m_keyFrameInterval(keyFrameInterval > 0 ? keyFrameInterval : 1), m_codec(codec), m_level(level),
+		m_prevWidth(0), m_prevHeight(0), m_prevNumChannels(0), m_sequence(0), m_framesSinceKeyFrame(0),
+		m_keyFrameRequested(false)
+	{
+	}
+
+	DataRef DeltaImgCompressor::compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) {
+		const size_t frameSize = (size_t)info.width * info.height * info.numChannels;
+		if (src == nullptr || src->size() < frameSize)
+			return nullptr;
+
+		bool keyFrame = m_prevFrame == nullptr || m_prevWidth != info.width || m_prevHeight != info.height
+			|| m_prevNumChannels != info.numChannels || m_framesSinceKeyFrame + 1 >= m_keyFrameInterval
+			|| m_keyFrameRequested;
+
+		DeltaFrameHeader header;
+		header.width = info.width;
+		header.height = info.height;
+		header.numChannels = info.numChannels;
+		header.codec = m_codec;
+		header.sequence = m_sequence + 1;
+		header.type = keyFrame ? DELTA_KEY_FRAME : DELTA_RESIDUAL_FRAME;
+		header.padding = 0;
+
+		auto compressedData = std::make_shared<GrowableData>();
+		compressedData->push_back(&header, sizeof(header));
+
+		try {
+			if (keyFrame)
+				compressData(m_codec, src->data(), frameSize, m_level, *compressedData);
+			else {
+				if (m_residual == nullptr || m_residual->size() != frameSize)
+					m_residual = makePooledData(frameSize);
+
+				subtractBytes(src->data(), m_prevFrame->data(), frameSize, m_residual->data());
+
+				compressData(m_codec, m_residual->data(), frameSize, m_level, *compressedData);
+			}
+		}
+		catch (...) {
+			return nullptr;
+		}
+
+		//lossless, so the decoder's reconstructed frame is the source frame itself
+		m_prevFrame = src;
+		m_prevWidth = info.width;
+		m_prevHeight = info.height;
+		m_prevNumChannels = info.numChannels;
+		m_sequence = header.sequence;
+		m_framesSinceKeyFrame = keyFrame ? 0 : m_framesSinceKeyFrame + 1;
+		m_keyFrameRequested = false;
+
+		info.outImportantFrame = keyFrame;
+
+		return compressedData;
+	}
+
+	/*------------- DeltaImgDecompressor ---------*/
+	DeltaImgDecompressor::DeltaImgDecompressor()
+		: m_width(0), m_height(0), m_numChannels(0), m_sequence(0)
+	{
+	}
+
+	void DeltaImgDecompressor::reset() {
+		m_frame = nullptr;
+		m_sequence = 0;
+	}
+
+	ConstDataRef DeltaImgDecompressor::decompress(ConstDataRef src, uint32_t& width, uint32_t &height, unsigned int& numChannels) {
+		return decompress(src->data(), src->size(), width, height, numChannels);
+	}
+
+	ConstDataRef DeltaImgDecompressor::decompress(const void* src, size_t srcSize, uint32_t& width, uint32_t &height, unsigned int& numChannels) {
+		DeltaFrameHeader header;
+		if (srcSize < sizeof(header))
+			return nullptr;
+		memcpy(&header, src, sizeof(header));
+
+		auto compressedData = (const unsigned char*)src + sizeof(header);
+		auto compressedSize = srcSize - sizeof(header);
+		const size_t frameSize = (size_t)header.width * header.height * header.numChannels;
+
+		if (header.type != DELTA_KEY_FRAME) {
+			//residual frame must directly follow our reference frame
+			if (header.type != DELTA_RESIDUAL_FRAME || m_frame == nullptr || header.sequence != m_sequence + 1
+				|| header.width != m_width || header.height != m_height || header.numChannels != m_numChannels)
+			{
+				m_frame = nullptr;
+				return nullptr;
+			}
+		}
+
+		DataRef decompressedData;
+		try {
+			decompressedData = decompressData(header.codec, compressedData, compressedSize);
+		}
+		catch (...) {
+		}
+
+		if (decompressedData == nullptr || decompressedData->size() < frameSize) {
+			m_frame = nullptr;
+			return nullptr;
+		}
+
+		if (header.type == DELTA_KEY_FRAME) {
+			m_frame = decompressedData;
+			m_width = header.width;
+			m_height = header.height;
+			m_numChannels = header.numChannels;
+		}
+		else
+			addBytes(m_frame->data(), decompressedData->data(), frameSize);
+
+		m_sequence = header.sequence;
+
+		width = m_width;
+		height = m_height;
+		numChannels = m_numChannels;
+
+		return m_frame;
+	}
+}
@@ -19,11 +19,13 @@
 #include "Engine.h"
 #include "ImgCompressor.h"
 #include "../Event.h"
+#include "../BufferPool.h"
 
 #include <opus.h>
 #include <opus_defines.h>
 
 #include <assert.h>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
@@ -37,6 +39,18 @@
 
 #define DEFAULT_FRAME_SEND_INTERVAL (1 / 30.0)
 
+#define PARTIAL_FRAME_TILE_ALIGNMENT 16//JPEG's largest MCU size
+
+#define MAX_FRAME_SEND_TIME_HISTORY 64
+#define RATE_CONTROL_FEEDBACK_TIMEOUT 2.0//s. Client reports every 0.5s while it receives frames
+
+#define MAX_TOUCH_REGIONS 10
+
+//compression queue & screenshot queue (MAX_PENDING_FRAMES each, +1 while a new frame is pushed or being saved), one frame per
+//compression thread, key frame of partial frames & reference frame of stateful compressors
+static_assert((MAX_PENDING_FRAMES + 1) * 2 + MAX_NUM_COMPRESS_THREADS + 2 <= HQRemote::IFrameCapturer::DEFAULT_FRAME_POOL_SIZE,
+			  "default frame buffer pool is too small for frames Engine may hold");
+
 #ifndef max
 #	define max(a,b) ((a) > (b) ? (a) : (b))
 #endif
@@ -70,7 +84,17 @@ namespace HQRemote {
 			m_frameCaptureInterval(0), m_intendedFrameInterval(DEFAULT_FRAME_SEND_INTERVAL),
 			m_videoRecording(false), m_saveNextFrame(false),
 		    m_frameIntervalAlternation(false),
-			m_supportScreenshot(supportScreenshot), m_supportVideoRecord(supportVideoRecord)
+			m_supportScreenshot(supportScreenshot), m_supportVideoRecord(supportVideoRecord),
+			m_keyFrameWidth(0), m_keyFrameHeight(0), m_keyFrameId(0), m_partialFramesSinceKeyFrame(0),
+			m_partialFrameTileSize(64), m_maxKeyFrameInterval(60),
+			m_partialFramesEnabled(false), m_remoteFrameCapabilities(0), m_ackedFrameId(0),
+			m_scrollDetectionEnabled(false), m_maxScrollShift(512),
+			m_refinementEnabled(false), m_refinementStaticFrames(10), m_maxRefinementBytesPerFrame(32 * 1024),
+			m_refinementCursor(0), m_avgRefinementTileSize(0),
+			m_touchROIEnabled(false), m_touchROIRadius(96), m_touchROIHoldTime(1.0f),
+			m_activeFrameLayer(0), m_requestedFrameLayer(0), m_forceImportantFrame(false),
+			m_refreshRequested(false),
+			m_bandwidthEstimator(32 * 1024, 8 * 1024 * 1024), m_lastFeedbackTime64(0), m_rateControlEnabled(false)
 	{
 		if (m_frameCapturer == nullptr) {
 			throw std::runtime_error("Null frame capturer is not allowed");
@@ -101,6 +125,11 @@ namespace HQRemote {
 		m_frameBundles.clear();
 		m_sendingFrames.clear();
 
+		{
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+			m_keyFrameData = nullptr;
+		}
+
 		m_frameCaptureInterval = m_intendedFrameInterval;
 		m_firstCapturedFrameTime64 = 0;
 		m_numCapturedFrames = 0;
@@ -189,10 +218,74 @@ namespace HQRemote {
 #ifdef DEBUG
 		Log("Engine::setImageCompressor()\n");
 #endif
+		{
+			std::lock_guard<std::mutex> lg(m_frameLayerLock);
+			m_frameLayers.clear();
+			m_activeFrameLayer = 0;
+		}
+
+		applyImageCompressor(imgCompressor);
+	}
+
+	void Engine::setFrameLayers(const std::vector<std::shared_ptr<IImgCompressor> >& layers) {
+		if (layers.empty())
+			return;
+
+		std::shared_ptr<IImgCompressor> imgCompressor;
+		{
+			std::lock_guard<std::mutex> lg(m_frameLayerLock);
+			m_frameLayers = layers;
+			m_activeFrameLayer = min(m_requestedFrameLayer.load(), (uint32_t)m_frameLayers.size() - 1);
+			imgCompressor = m_frameLayers[m_activeFrameLayer];
+		}
+
+		applyImageCompressor(imgCompressor);
+	}
+
+	void Engine::switchFrameLayerIfNeeded() {
+		std::shared_ptr<IImgCompressor> imgCompressor;
+		uint32_t layer;
+		{
+			std::lock_guard<std::mutex> lg(m_frameLayerLock);
+			if (m_frameLayers.empty())
+				return;
+
+			layer = min(m_requestedFrameLayer.load(), (uint32_t)m_frameLayers.size() - 1);
+			if (layer == m_activeFrameLayer)
+				return;
+			m_activeFrameLayer = layer;
+			imgCompressor = m_frameLayers[layer];
+		}
+
+		HQRemote::Log("Engine: switching to frame layer %u\n", layer);
+
+		applyImageCompressor(imgCompressor);
+	}
+
+	void Engine::applyImageCompressor(std::shared_ptr<IImgCompressor> imgCompressor) {
+		std::lock_guard<std::mutex> switchLg(m_imgCompressorSwitchLock);
+
 		stopFrameCompressionThreads();
 		stopFrameSendingThread();
 
-		m_imgCompressor = imgCompressor;
+		{
+			std::lock_guard<std::mutex> lg(m_imgCompressorLock);
+			m_imgCompressor = imgCompressor;
+		}
+		//a layer compressor used before still has its old reference frame
+		m_imgCompressor->requestKeyFrame();
+
+		//client can't compose new compressor's frames on top of old one's
+		{
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+			m_keyFrameData = nullptr;
+		}
+		m_forceImportantFrame = true;
+
+		if (m_rateControlEnabled) {
+			std::lock_guard<std::mutex> lg(m_rateControlLock);
+			m_imgCompressor->setTargetBitrate(m_bandwidthEstimator.getTarget(), (float)(1.0 / m_intendedFrameInterval));
+		}
 
 		// restart frame compression threads
 		if (m_running) {
@@ -201,6 +294,147 @@ namespace HQRemote {
 		}
 	}
 
+	std::shared_ptr<IImgCompressor> Engine::getImgCompressor() {
+		std::lock_guard<std::mutex> lg(m_imgCompressorLock);
+		return m_imgCompressor;
+	}
+
+	void Engine::enablePartialFrames(bool enable, uint32_t tileSize, uint32_t maxKeyFrameInterval) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		tileSize = max(tileSize, (uint32_t)PARTIAL_FRAME_TILE_ALIGNMENT);
+		m_partialFrameTileSize = (tileSize + PARTIAL_FRAME_TILE_ALIGNMENT - 1) / PARTIAL_FRAME_TILE_ALIGNMENT * PARTIAL_FRAME_TILE_ALIGNMENT;
+		m_maxKeyFrameInterval = maxKeyFrameInterval;
+		m_partialFramesEnabled = enable;
+
+		//start over with a key frame
+		m_keyFrameData = nullptr;
+	}
+
+	void Engine::enableTileCache(bool enable, uint32_t numSlots) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		if (enable)
+			m_tileCache.reset(new TileCacheMirror(numSlots));
+		else
+			m_tileCache = nullptr;
+	}
+
+	void Engine::enableScrollDetection(bool enable, uint32_t maxShift) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		m_scrollDetectionEnabled = enable;
+		m_maxScrollShift = maxShift;
+	}
+
+	void Engine::enableProgressiveRefinement(bool enable, uint32_t staticFrames, uint32_t maxBytesPerFrame) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		m_refinementEnabled = enable;
+		m_refinementStaticFrames = staticFrames;
+		m_maxRefinementBytesPerFrame = maxBytesPerFrame;
+		m_tileRefinements.clear();
+	}
+
+	void Engine::enableTouchROI(bool enable, uint32_t radius, float holdTime) {
+		m_touchROIRadius = radius;
+		m_touchROIHoldTime = holdTime;
+		m_touchROIEnabled = enable;
+	}
+
+	void Engine::enableRateControl(bool enable, float minBytesPerSec, float maxBytesPerSec) {
+		std::lock_guard<std::mutex> lg(m_rateControlLock);
+
+		m_bandwidthEstimator.reset(minBytesPerSec, maxBytesPerSec);
+		m_frameSendTimes.clear();
+		m_lastFeedbackTime64 = 0;
+		m_rateControlEnabled = enable;
+
+		auto imgCompressor = getImgCompressor();
+		if (enable)
+			imgCompressor->setTargetBitrate(m_bandwidthEstimator.getTarget(), (float)(1.0 / m_intendedFrameInterval));
+		else
+			imgCompressor->setTargetBitrate(0, 0);
+	}
+
+	void Engine::resetRateControl() {
+		std::lock_guard<std::mutex> lg(m_rateControlLock);
+		if (!m_rateControlEnabled)
+			return;
+
+		//start over from initial target for next client
+		m_bandwidthEstimator.reset(m_bandwidthEstimator.getMinTarget(), m_bandwidthEstimator.getMaxTarget());
+		m_frameSendTimes.clear();
+		m_lastFeedbackTime64 = 0;
+
+		auto imgCompressor = getImgCompressor();
+		imgCompressor->setTargetBitrate(m_bandwidthEstimator.getTarget(), (float)(1.0 / m_intendedFrameInterval));
+	}
+
+	void Engine::recordFrameSendTime(uint64_t frameId) {
+		if (!m_rateControlEnabled.load(std::memory_order_relaxed))
+			return;
+
+		auto time64 = getTimeCheckPoint64();
+		float timeoutTarget = 0;
+
+		{
+			std::lock_guard<std::mutex> lg(m_rateControlLock);
+			m_frameSendTimes.push_back(std::make_pair(frameId, time64));
+			if (m_frameSendTimes.size() > MAX_FRAME_SEND_TIME_HISTORY)
+				m_frameSendTimes.pop_front();
+
+			//client only reports when frames arrive, so silence means they are being lost. Older clients never report
+			if (m_lastFeedbackTime64 == 0)
+				m_lastFeedbackTime64 = time64;
+			else if (getElapsedTime64(m_lastFeedbackTime64, time64) >= RATE_CONTROL_FEEDBACK_TIMEOUT && getRemoteProtocolVersion() >= 7)
+			{
+				m_lastFeedbackTime64 = time64;
+				timeoutTarget = m_bandwidthEstimator.onFeedbackTimeout();
+			}
+		}
+
+		if (timeoutTarget > 0) {
+			auto imgCompressor = getImgCompressor();
+			imgCompressor->setTargetBitrate(timeoutTarget, (float)(1.0 / m_intendedFrameInterval));
+
+#if defined DEBUG || defined _DEBUG
+			HQRemote::Log("Engine: no receiver report, target Bps=%.1f\n", timeoutTarget);
+#endif
+		}
+	}
+
+	void Engine::onReceiverReport(const Event& report) {
+		if (!m_rateControlEnabled)
+			return;
+
+		auto curTime64 = getTimeCheckPoint64();
+		//frame was reported as soon as it arrived, so the time since it was sent is the round trip time including queuing delay
+		double rtt = -1;
+		float target;
+		{
+			std::lock_guard<std::mutex> lg(m_rateControlLock);
+			for (auto& frameSendTime : m_frameSendTimes) {
+				if (frameSendTime.first == report.receiverReport.lastFrameId) {
+					rtt = getElapsedTime64(frameSendTime.second, curTime64);
+					break;
+				}
+			}
+
+			target = m_bandwidthEstimator.onReceiverReport(report.receiverReport.receiveRate, report.receiverReport.lossRate, rtt);
+			m_lastFeedbackTime64 = curTime64;
+		}
+
+		auto frameInterval = m_frameCaptureInterval > 0 ? m_frameCaptureInterval : m_intendedFrameInterval;
+		auto imgCompressor = getImgCompressor();
+		imgCompressor->setTargetBitrate(target, (float)(1.0 / frameInterval));
+
+#if defined DEBUG || defined _DEBUG
+		HQRemote::Log("Engine: receiver report rcv Bps=%.1f loss=%.3f rtt=%.3f -> target Bps=%.1f\n",
+					  report.receiverReport.receiveRate, report.receiverReport.lossRate, rtt, target);
+#endif
+	}
+
 	unsigned int Engine::startFrameCompressionThreads() {
 #ifdef DEBUG
 		Log("Engine::startFrameCompressionThreads()\n");
@@ -301,6 +535,8 @@ namespace HQRemote {
 
 	//capture current frame and send to remote controller
 	void Engine::captureAndSendFrame() {
+		switchFrameLayerIfNeeded();
+
 		auto frameRef = m_frameCapturer->beginCaptureFrame();
 		if (frameRef != nullptr) {
 			uint64_t time64 = getTimeCheckPoint64();
@@ -387,6 +623,19 @@ namespace HQRemote {
 
 	void Engine::onDisconnected() {
 		m_sendFrame = false;
+		m_remoteFrameCapabilities = 0;
+		m_requestedFrameLayer = 0;
+		//next client has none of the previous frames
+		m_refreshRequested = true;
+
+		{
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+			if (m_tileCache)
+				m_tileCache->clear();
+			m_ackedFrameId = 0;
+		}
+
+		resetRateControl();
 
 		BaseEngine::onDisconnected();
 	}
@@ -436,6 +685,55 @@ namespace HQRemote {
 			pushEvent(event);
 		}
 			break;
+		case FRAME_CAPABILITIES:
+			m_remoteFrameCapabilities = event->event.uint32Value;
+
+			HQRemote::Log("Engine: remote frame capabilities %x\n", event->event.uint32Value);
+			//fall through
+		case TILE_CACHE_RESET:
+		{
+			//client's cache might have started over
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+			if (m_tileCache)
+				m_tileCache->clear();
+		}
+			break;
+		case FRAME_LAYER_SELECT:
+			//switched by capturing thread, compression threads must be restarted
+			m_requestedFrameLayer = event->event.uint32Value;
+
+			HQRemote::Log("Engine: remote selected frame layer %u\n", event->event.uint32Value);
+			break;
+		case REFRESH_REQUEST:
+		{
+			//partial frames can't be composed without a new key frame
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+			m_keyFrameData = nullptr;
+		}
+			m_refreshRequested = true;
+
+			HQRemote::Log("Engine: remote requested refresh\n");
+			break;
+		case RECEIVER_REPORT:
+		{
+			//a frame storing tiles may be lost even though later frames are acknowledged,
+			//forget its tiles before the acknowledgement below makes them usable
+			if (event->event.receiverReport.firstLostFrameId != 0)
+			{
+				std::lock_guard<std::mutex> lg(m_keyFrameLock);
+				if (m_tileCache)
+					m_tileCache->forgetStores(event->event.receiverReport.firstLostFrameId, event->event.receiverReport.lastFrameId);
+			}
+
+			auto ackedFrameId = m_ackedFrameId.load();
+			while (ackedFrameId < event->event.receiverReport.lastFrameId
+				&& !m_ackedFrameId.compare_exchange_weak(ackedFrameId, event->event.receiverReport.lastFrameId))
+			{}
+
+			onRefinementsReported(event->event);
+			onReceiverReport(event->event);
+		}
+			break;
 		case FRAME_INTERVAL:
 			//change frame interval
 			m_frameCaptureInterval = m_intendedFrameInterval = event->event.frameInterval;
@@ -468,11 +766,12 @@ namespace HQRemote {
 	void Engine::frameCompressionProc() {
 		SetCurrentThreadName("frameCompressionThread");
 		
-		uint64_t l_compressedFrames = 0;
 		uint64_t l_receivedFrames = 0;
 		uint64_t frameIdForCompress;
 		uint64_t frameIdForSending;
 		const bool isMultiThreads = m_imgCompressor->canSupportMultiThreads();
+		std::vector<FrameRect> dirtyRects;
+		PartialFrameCommands partialFrameCommands;
 
 		while (!m_forceStopFrameCompression) {
 			std::unique_lock<std::mutex> lk(m_frameCompressLock);
@@ -483,7 +782,9 @@ namespace HQRemote {
 			if (m_capturedFramesForCompress.size() > 0) {
 				auto frame = m_capturedFramesForCompress.front();
 				m_capturedFramesForCompress.pop_front();
-				auto multithreadId = ++m_processedCapturedFrames; // this is synchronized between multiple compression threads
+				//in multithreads mode, each captured frame gets its id here, synchronized between compression threads.
+				//Otherwise ids are given to compressor's outputs, which can lag behind its inputs
+				auto multithreadId = isMultiThreads ? ++m_processedCapturedFrames : 0;
 
 				l_receivedFrames++; // this is only local counter for this thread
 
@@ -495,31 +796,56 @@ namespace HQRemote {
 				info.numChannels = m_frameCapturer->getNumColorChannels();
 				info.timeStamp = 0;
 				info.outImportantFrame = false;
+				if (m_touchROIEnabled.load(std::memory_order_relaxed))
+					getTouchRegions(frame.width, frame.height, info.regionsOfInterest);
 
 				if (isMultiThreads)
 					frameIdForCompress = multithreadId;
 				else
 					frameIdForCompress = l_receivedFrames;
 
-				auto compressedFrame = m_imgCompressor->compress2(
+				//stateful compressor's next frame must not depend on what client lost
+				if (m_refreshRequested.exchange(false))
+					m_imgCompressor->requestKeyFrame();
+
+				//partial frames need independent compression of each frame
+				uint64_t keyFrameId = 0;
+				auto frameKind = isMultiThreads ?
+									classifyFrame(frame, info.numChannels, multithreadId, keyFrameId, dirtyRects, partialFrameCommands) :
+									WHOLE_FRAME;
+
+				DataRef compressedFrame;
+				if (frameKind == PARTIAL_FRAME_KIND)
+					compressedFrame = compressPartialFrame(frame, info, frameIdForCompress, keyFrameId, dirtyRects, partialFrameCommands);
+				else
+					compressedFrame = m_imgCompressor->compress2(
 													 frame.rawFrameDataRef,
 													 frameIdForCompress,
 													 info);
 
+				if (compressedFrame == nullptr && frameKind == KEY_FRAME)
+					invalidateKeyFrame(multithreadId);
+
+				//first frame of a newly selected layer, client must not drop it
+				if (compressedFrame != nullptr && m_forceImportantFrame.exchange(false))
+					info.outImportantFrame = true;
+
 				while (compressedFrame != nullptr) {
 					try {
-						l_compressedFrames++;
-
 						if (isMultiThreads)
 							frameIdForSending = multithreadId;
 						else
-							frameIdForSending = l_compressedFrames;
+							frameIdForSending = ++m_processedCapturedFrames;//only this thread is running
 
-						if (info.outImportantFrame)
+						recordFrameSendTime(frameIdForSending);
+
+						//client needs key frame to compose subsequent partial frames
+						if (info.outImportantFrame || frameKind == KEY_FRAME)
 							frameIdForSending |= IMPORTANT_FRAME_ID_FLAG;
 
-						//convert to frame event
-						auto frameEvent = std::make_shared<FrameEvent>((ConstDataRef)compressedFrame, frameIdForSending);
+						//convert to frame event, compressed data is wrapped in place if compressor reserved headroom for it
+						auto frameEvent = std::make_shared<FrameEvent>(std::move(compressedFrame), frameIdForSending,
+																	   frameKind == PARTIAL_FRAME_KIND ? PARTIAL_FRAME : RENDERED_FRAME);
 						frameEvent->event.renderedFrameData.intervalAlternaionOffset = frame.intervalAlternaionOffset;
 
 						compressedFrame = nullptr; // to break loop in multithreads case
@@ -527,14 +853,14 @@ namespace HQRemote {
 						if (m_frameBundleSize <= 1)
 						{
 							if (isMultiThreads) {
-								//send to frame sending thread
-								pushFrameDataForSending(frameIdForSending, *frameEvent);
+								//send to frame sending thread, ordered by the true id since important flag is the highest bit
+								pushFrameDataForSending(frameIdForSending & (~UNUSED_FRAME_ID_BITS), frameEvent);
 							}
 							else {
 								// single thread compression
 								// send to network directly
 								if (m_sendFrame.load(std::memory_order_relaxed))
-									getConnHandler()->sendDataUnreliable(*frameEvent);
+									sendEventUnreliable(*frameEvent);
 							}
 						}
 						else {
@@ -555,6 +881,611 @@ namespace HQRemote {
 		}//while (m_running)
 	}
 	
+	//compare <frame> with <refFrame> in tiles, changed tiles are merged into rectangles. Return total changed area
+	static size_t findChangedTiles(const unsigned char* frame, const unsigned char* refFrame, uint32_t width, uint32_t height, unsigned int numChannels,
+								   uint32_t tileSize, std::vector<unsigned char>& dirtyFlags, std::vector<FrameRect>& rects)
+	{
+		const size_t stride = (size_t)width * numChannels;
+		const uint32_t numTileCols = (width + tileSize - 1) / tileSize;
+		size_t changedArea = 0;
+
+		rects.clear();
+		dirtyFlags.resize(numTileCols);
+
+		for (uint32_t tileY = 0; tileY < height; tileY += tileSize) {
+			const uint32_t tileHeight = min(tileSize, height - tileY);
+			uint32_t numDirtyTiles = 0;
+			std::fill(dirtyFlags.begin(), dirtyFlags.end(), 0);
+
+			//compare row by row (memcmp is vectorized by the C library), tiles already known to be changed are skipped
+			for (uint32_t y = tileY; y < tileY + tileHeight && numDirtyTiles < numTileCols; ++y) {
+				auto row = frame + y * stride;
+				auto refRow = refFrame + y * stride;
+				for (uint32_t col = 0; col < numTileCols; ++col) {
+					if (dirtyFlags[col])
+						continue;
+					auto offset = (size_t)col * tileSize * numChannels;
+					auto tileWidth = min(tileSize, width - col * tileSize);
+					if (memcmp(row + offset, refRow + offset, (size_t)tileWidth * numChannels))
+					{
+						dirtyFlags[col] = 1;
+						numDirtyTiles++;
+					}
+				}
+			}
+
+			//merge horizontally adjacent changed tiles, then extend the rectangle right above if it has the same span
+			const size_t prevRowRectsEnd = rects.size();
+			for (uint32_t col = 0; col < numTileCols; ) {
+				if (!dirtyFlags[col]) {
+					++col;
+					continue;
+				}
+
+				auto firstCol = col;
+				while (col < numTileCols && dirtyFlags[col])
+					++col;
+
+				FrameRect rect;
+				rect.x = firstCol * tileSize;
+				rect.y = tileY;
+				rect.width = min(col * tileSize, width) - rect.x;
+				rect.height = tileHeight;
+
+				changedArea += (size_t)rect.width * rect.height;
+
+				bool extended = false;
+				for (size_t i = 0; i < prevRowRectsEnd && !extended; ++i) {
+					auto& prevRect = rects[i];
+					if (prevRect.x == rect.x && prevRect.width == rect.width && prevRect.y + prevRect.height == tileY)
+					{
+						prevRect.height += tileHeight;
+						extended = true;
+					}
+				}
+
+				if (!extended)
+					rects.push_back(rect);
+			}
+		}
+
+		return changedArea;
+	}
+
+	//look for scrolled region in <dirtyRects>, if copying it leaves less area to compress, return the new changed area & the regions
+	//still differing after the copy (<scrolledDirtyRects>). Otherwise return <changedArea>
+	static size_t detectKeyFrameScroll(const unsigned char* frame, const unsigned char* keyFrame, uint32_t width, uint32_t height, unsigned int numChannels,
+									   uint32_t tileSize, uint32_t maxShift, size_t changedArea, const std::vector<FrameRect>& dirtyRects,
+									   std::vector<unsigned char>& dirtyTileFlags, std::vector<FrameRect>& scrolledDirtyRects, CopyRectCommand& copy)
+	{
+		//scroll is searched within the bounding box of changed regions
+		FrameRect region = dirtyRects[0];
+		for (auto& rect : dirtyRects) {
+			auto right = max(region.x + region.width, rect.x + rect.width);
+			auto bottom = max(region.y + region.height, rect.y + rect.height);
+			region.x = min(region.x, rect.x);
+			region.y = min(region.y, rect.y);
+			region.width = right - region.x;
+			region.height = bottom - region.y;
+		}
+
+		if (!detectScroll(frame, keyFrame, width, height, numChannels, region, maxShift, copy))
+			return changedArea;
+
+		//what the client will have after the copy
+		const size_t stride = (size_t)width * numChannels;
+		const size_t frameSize = stride * height;
+		auto scrolledKeyFrame = makePooledData(frameSize);
+
+		memcpy(scrolledKeyFrame->data(), keyFrame, frameSize);
+		for (uint32_t y = 0; y < copy.rect.height; ++y)
+			memcpy(scrolledKeyFrame->data() + (copy.rect.y + y) * stride + (size_t)copy.rect.x * numChannels,
+				   keyFrame + (copy.srcY + y) * stride + (size_t)copy.srcX * numChannels,
+				   (size_t)copy.rect.width * numChannels);
+
+		auto scrolledChangedArea = findChangedTiles(frame, scrolledKeyFrame->data(), width, height, numChannels,
+													tileSize, dirtyTileFlags, scrolledDirtyRects);
+		return min(scrolledChangedArea, changedArea);
+	}
+
+	Engine::FrameKind Engine::classifyFrame(const CapturedFrame& frame, unsigned int numChannels, uint64_t frameId, uint64_t& keyFrameId, std::vector<FrameRect>& dirtyRects,
+											PartialFrameCommands& commands)
+	{
+		const size_t frameSize = (size_t)frame.width * frame.height * numChannels;
+		std::vector<unsigned char> dirtyTileFlags;
+		std::vector<FrameRect> scrolledDirtyRects;
+
+		//the frame is compared to key frame outside the lock, start over if another thread replaced the key frame meanwhile
+		for (;;) {
+			commands.clear();
+
+			ConstDataRef keyFrame;
+			uint32_t tileSize;
+			bool detectScrolling;
+			uint32_t maxScrollShift;
+			bool needKeyFrame;
+			{
+				std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+				if (!m_partialFramesEnabled || !(m_remoteFrameCapabilities & FRAME_CAPABILITY_PARTIAL_FRAMES)
+					|| getRemoteProtocolVersion() < 6 || !m_imgCompressor->supportsPartialFrames())
+				{
+					m_keyFrameData = nullptr;
+					return WHOLE_FRAME;
+				}
+
+				//this frame was overtaken by a newer key frame in another compression thread, client will keep the newer one anyway
+				if (m_keyFrameData != nullptr && frameId < m_keyFrameId)
+					return WHOLE_FRAME;
+
+				needKeyFrame = m_keyFrameData == nullptr || frame.rawFrameDataRef == nullptr
+					|| m_keyFrameWidth != frame.width || m_keyFrameHeight != frame.height
+					|| m_keyFrameData->size() < frameSize || frame.rawFrameDataRef->size() < frameSize
+					|| m_partialFramesSinceKeyFrame >= m_maxKeyFrameInterval;
+
+				//key frame data is never modified, only replaced
+				keyFrame = m_keyFrameData;
+				tileSize = m_partialFrameTileSize;
+				detectScrolling = m_scrollDetectionEnabled && (m_remoteFrameCapabilities & FRAME_CAPABILITY_COPY_RECT);
+				maxScrollShift = m_maxScrollShift;
+			}
+
+			size_t changedArea = 0;
+			size_t scrolledChangedArea = 0;
+			CopyRectCommand copy;
+			if (!needKeyFrame) {
+				changedArea = findChangedTiles(frame.rawFrameDataRef->data(), keyFrame->data(), frame.width, frame.height, numChannels,
+											   tileSize, dirtyTileFlags, dirtyRects);
+
+				scrolledChangedArea = changedArea;
+				if (detectScrolling && changedArea > 0)
+					scrolledChangedArea = detectKeyFrameScroll(frame.rawFrameDataRef->data(), keyFrame->data(), frame.width, frame.height, numChannels,
+															   tileSize, maxScrollShift, changedArea, dirtyRects, dirtyTileFlags, scrolledDirtyRects, copy);
+			}
+
+			std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+			if (m_keyFrameData != keyFrame)
+				continue;
+
+			const bool useTileCache = tileCacheUsable();
+			const bool useRefinement = refinementUsable();
+
+			if (!needKeyFrame) {
+				if (useRefinement)
+					updateTileRefinements(frame, dirtyRects);
+
+				if (scrolledChangedArea < changedArea) {
+					dirtyRects.swap(scrolledDirtyRects);
+					commands.copyRects.push_back(copy);
+					changedArea = scrolledChangedArea;
+				}
+
+				//cached tiles cost next to nothing
+				if (useTileCache)
+					changedArea -= placeCachedTiles(frame, numChannels, dirtyRects, commands.tilePlacements);
+
+				//whole frame compresses better if most of it changed
+				needKeyFrame = changedArea * 2 > (size_t)frame.width * frame.height;
+			}
+
+			if (needKeyFrame) {
+				m_keyFrameData = frame.rawFrameDataRef;
+				m_keyFrameWidth = frame.width;
+				m_keyFrameHeight = frame.height;
+				m_keyFrameId = frameId;
+				m_partialFramesSinceKeyFrame = 0;
+
+				//client's key frame is back to normal quality
+				m_tileRefinements.clear();
+
+				return KEY_FRAME;
+			}
+
+			m_partialFramesSinceKeyFrame++;
+			keyFrameId = m_keyFrameId;
+
+			//client will store the tiles compressed in this frame
+			if (useTileCache) {
+				for (auto& tile : m_uncachedTiles) {
+					if (m_tileCache->contains(tile.second))
+						continue;
+
+					TileCacheCommand store;
+					store.rect = tile.first;
+					store.slot = m_tileCache->insert(tile.second, frameId);
+					store.frameId = 0;
+					commands.tileStores.push_back(store);
+				}
+			}
+
+			if (useRefinement)
+				pickRefinementTiles(frame, frameId, commands.refinements);
+
+			return PARTIAL_FRAME_KIND;
+		}//for (;;)
+	}
+
+	bool Engine::tileCacheUsable() const {
+		return m_tileCache != nullptr && (m_remoteFrameCapabilities & FRAME_CAPABILITY_TILE_CACHE) && getRemoteProtocolVersion() >= 8;
+	}
+
+	size_t Engine::placeCachedTiles(const CapturedFrame& frame, unsigned int numChannels, std::vector<FrameRect>& dirtyRects,
+									std::vector<TileCacheCommand>& placements)
+	{
+		const size_t stride = (size_t)frame.width * numChannels;
+		const uint32_t tileSize = m_partialFrameTileSize;
+		const uint64_t ackedFrameId = m_ackedFrameId;
+		const size_t numDirtyRects = dirtyRects.size();
+		std::vector<unsigned char> cached;
+		size_t cachedArea = 0;
+
+		m_uncachedTiles.clear();
+
+		//dirty rects are made of whole tiles, except at the right & bottom edges of the frame
+		for (size_t i = 0; i < numDirtyRects; ++i) {
+			const auto dirtyRect = dirtyRects[i];
+			const uint32_t numCols = (dirtyRect.width + tileSize - 1) / tileSize;
+			const uint32_t numRows = (dirtyRect.height + tileSize - 1) / tileSize;
+			const size_t firstUncachedTile = m_uncachedTiles.size();
+			bool anyCached = false;
+
+			cached.assign((size_t)numCols * numRows, 0);
+
+			for (uint32_t row = 0; row < numRows; ++row) {
+				for (uint32_t col = 0; col < numCols; ++col) {
+					FrameRect tile;
+					tile.x = dirtyRect.x + col * tileSize;
+					tile.y = dirtyRect.y + row * tileSize;
+					tile.width = min(tileSize, dirtyRect.x + dirtyRect.width - tile.x);
+					tile.height = min(tileSize, dirtyRect.y + dirtyRect.height - tile.y);
+
+					auto hash = hashTile(frame.rawFrameDataRef->data() + tile.y * stride + (size_t)tile.x * numChannels, stride,
+										 tile.width, tile.height, numChannels);
+
+					TileCacheCommand placement;
+					if (m_tileCache->find(hash, ackedFrameId, placement.slot, placement.frameId)) {
+						placement.rect = tile;
+						placements.push_back(placement);
+
+						cached[row * numCols + col] = 1;
+						cachedArea += (size_t)tile.width * tile.height;
+						anyCached = true;
+					}
+					else
+						m_uncachedTiles.push_back(std::make_pair(tile, hash));
+				}
+			}
+
+			if (!anyCached)
+				continue;
+
+			//replace the dirty rect by horizontal runs of uncached tiles
+			bool first = true;
+			auto tileIte = m_uncachedTiles.begin() + firstUncachedTile;
+			for (uint32_t row = 0; row < numRows; ++row) {
+				for (uint32_t col = 0; col < numCols; ) {
+					if (cached[row * numCols + col]) {
+						++col;
+						continue;
+					}
+
+					auto rect = tileIte->first;
+					++tileIte;
+					++col;
+					while (col < numCols && !cached[row * numCols + col]) {
+						rect.width += tileIte->first.width;
+						++tileIte;
+						++col;
+					}
+
+					if (first)
+						dirtyRects[i] = rect;
+					else
+						dirtyRects.push_back(rect);
+					first = false;
+				}
+			}
+
+			//whole rect is cached
+			if (first) {
+				dirtyRects[i].width = 0;
+			}
+		}
+
+		//remove fully cached rects
+		dirtyRects.erase(std::remove_if(dirtyRects.begin(), dirtyRects.end(), [](const FrameRect& rect) { return rect.width == 0; }),
+						 dirtyRects.end());
+
+		return cachedArea;
+	}
+
+	void Engine::invalidateKeyFrame(uint64_t frameId) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+		if (m_keyFrameId == frameId)
+			m_keyFrameData = nullptr;
+	}
+
+	bool Engine::refinementUsable() const {
+		return m_refinementEnabled && (m_remoteFrameCapabilities & FRAME_CAPABILITY_PROGRESSIVE_REFINEMENT)
+			&& m_imgCompressor->getNumRefinementLevels() > 0;
+	}
+
+	void Engine::updateTileRefinements(const CapturedFrame& frame, const std::vector<FrameRect>& dirtyRects) {
+		const uint32_t tileSize = m_partialFrameTileSize;
+		const uint32_t numCols = (frame.width + tileSize - 1) / tileSize;
+		const uint32_t numRows = (frame.height + tileSize - 1) / tileSize;
+
+		if (m_tileRefinements.size() != (size_t)numCols * numRows) {
+			TileRefinementState initState = { 0, 0, 0, 0 };
+			m_tileRefinements.assign((size_t)numCols * numRows, initState);
+			m_refinementCursor = 0;
+		}
+
+		for (auto& tile : m_tileRefinements)
+			tile.staticFrames++;
+
+		//dirty rects are made of whole tiles, except at the right & bottom edges of the frame
+		for (auto& rect : dirtyRects) {
+			for (uint32_t row = rect.y / tileSize; row * tileSize < rect.y + rect.height; ++row)
+				for (uint32_t col = rect.x / tileSize; col * tileSize < rect.x + rect.width; ++col)
+					m_tileRefinements[row * numCols + col].staticFrames = 0;
+		}
+	}
+
+	void Engine::onRefinementsReported(const Event& report) {
+		const uint64_t lastFrameId = report.receiverReport.lastFrameId;
+		const uint64_t firstLostFrameId = report.receiverReport.firstLostFrameId;
+
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		for (auto& tile : m_tileRefinements) {
+			if (tile.sentLevel == tile.level || tile.sentFrameId > lastFrameId)
+				continue;
+
+			if (firstLostFrameId != 0 && tile.sentFrameId >= firstLostFrameId)
+				tile.sentLevel = tile.level;//lost, can be picked again
+			else
+				tile.level = tile.sentLevel;
+		}
+	}
+
+	void Engine::pickRefinementTiles(const CapturedFrame& frame, uint64_t frameId, std::vector<RefinementTile>& refinements) {
+		const unsigned int numLevels = m_imgCompressor->getNumRefinementLevels();
+		const uint32_t numTiles = (uint32_t)m_tileRefinements.size();
+		unsigned int minLevel = numLevels;
+
+		//refine the lowest level first, so that the whole static area gets better before some parts become lossless.
+		//Tiles having a refinement in flight wait for client's acknowledgement
+		for (auto& tile : m_tileRefinements) {
+			if (tile.staticFrames >= m_refinementStaticFrames && tile.sentLevel == tile.level && tile.level < minLevel)
+				minLevel = tile.level;
+		}
+		if (minLevel >= numLevels)
+			return;
+
+		//guess how many tiles fit in the budget, unsent ones are given back by onRefinementTilesSent()
+		const size_t maxTiles = m_avgRefinementTileSize ? m_maxRefinementBytesPerFrame / m_avgRefinementTileSize + 1 : 4;
+
+		const uint32_t tileSize = m_partialFrameTileSize;
+		const uint32_t numCols = (frame.width + tileSize - 1) / tileSize;
+		uint32_t index = m_refinementCursor % numTiles;
+		for (uint32_t i = 0; i < numTiles && refinements.size() < maxTiles; ++i, index = (index + 1) % numTiles) {
+			auto& tile = m_tileRefinements[index];
+			if (tile.staticFrames < m_refinementStaticFrames || tile.sentLevel != tile.level || tile.level != minLevel)
+				continue;
+
+			RefinementTile refinement;
+			refinement.rect.x = (index % numCols) * tileSize;
+			refinement.rect.y = (index / numCols) * tileSize;
+			refinement.rect.width = min(tileSize, frame.width - refinement.rect.x);
+			refinement.rect.height = min(tileSize, frame.height - refinement.rect.y);
+			refinement.index = index;
+			refinement.level = tile.sentLevel = tile.level + 1;
+			tile.sentFrameId = frameId;
+
+			refinements.push_back(refinement);
+		}
+
+		m_refinementCursor = index;
+	}
+
+	void Engine::onRefinementTilesSent(uint64_t keyFrameId, const std::vector<RefinementTile>& refinements, size_t numSent, size_t sentSize) {
+		std::lock_guard<std::mutex> lg(m_keyFrameLock);
+
+		if (numSent) {
+			auto avgSize = sentSize / numSent;
+			m_avgRefinementTileSize = m_avgRefinementTileSize ? (3 * m_avgRefinementTileSize + avgSize) / 4 : avgSize;
+		}
+
+		if (keyFrameId != m_keyFrameId)
+			return;
+
+		for (size_t i = numSent; i < refinements.size(); ++i) {
+			auto& refinement = refinements[i];
+			if (refinement.index < m_tileRefinements.size() && m_tileRefinements[refinement.index].sentLevel == refinement.level)
+				m_tileRefinements[refinement.index].sentLevel = m_tileRefinements[refinement.index].level;
+		}
+
+		//try them again first
+		if (numSent < refinements.size())
+			m_refinementCursor = refinements[numSent].index;
+	}
+
+	size_t Engine::getRefinementBudget(size_t frameSize) {
+		size_t budget = m_maxRefinementBytesPerFrame;
+
+		//spare part of rate control's target
+		if (m_rateControlEnabled) {
+			std::lock_guard<std::mutex> lg(m_rateControlLock);
+			auto frameInterval = m_frameCaptureInterval > 0 ? m_frameCaptureInterval : m_intendedFrameInterval;
+			auto targetFrameSize = (size_t)(m_bandwidthEstimator.getTarget() * frameInterval);
+
+			budget = targetFrameSize > frameSize ? min(budget, targetFrameSize - frameSize) : 0;
+		}
+
+		return budget;
+	}
+
+	void Engine::getTouchRegions(uint32_t frameWidth, uint32_t frameHeight, std::vector<FrameRect>& regions) {
+		TouchState touches[MAX_TOUCH_REGIONS];
+		auto numTouches = getRecentTouchStates(touches, MAX_TOUCH_REGIONS, m_touchROIHoldTime);
+		const float radius = (float)m_touchROIRadius;
+
+		regions.clear();
+		for (size_t i = 0; i < numTouches; ++i) {
+			//clamp the square to the frame, touches outside of it are ignored
+			float left = max(touches[i].x - radius, 0.f), top = max(touches[i].y - radius, 0.f);
+			float right = min(touches[i].x + radius, (float)frameWidth), bottom = min(touches[i].y + radius, (float)frameHeight);
+			if (left >= right || top >= bottom)
+				continue;
+
+			FrameRect region;
+			region.x = (uint32_t)left;
+			region.y = (uint32_t)top;
+			region.width = (uint32_t)right - region.x;
+			region.height = (uint32_t)bottom - region.y;
+			if (region.width && region.height)
+				regions.push_back(region);
+		}
+	}
+
+	//<regions> overlapping <rect>, relative to <rect>. An empty region is output if none overlaps, so that <rect> is still
+	//encoded as the part of a frame having regions of interest
+	static void clipRegions(const std::vector<FrameRect>& regions, const FrameRect& rect, std::vector<FrameRect>& clippedRegions) {
+		clippedRegions.clear();
+		for (auto& region : regions) {
+			auto left = max(region.x, rect.x), top = max(region.y, rect.y);
+			auto right = min(region.x + region.width, rect.x + rect.width), bottom = min(region.y + region.height, rect.y + rect.height);
+			if (left >= right || top >= bottom)
+				continue;
+
+			FrameRect clippedRegion;
+			clippedRegion.x = left - rect.x;
+			clippedRegion.y = top - rect.y;
+			clippedRegion.width = right - left;
+			clippedRegion.height = bottom - top;
+			clippedRegions.push_back(clippedRegion);
+		}
+
+		if (clippedRegions.empty()) {
+			FrameRect emptyRegion = { 0, 0, 0, 0 };
+			clippedRegions.push_back(emptyRegion);
+		}
+	}
+
+	DataRef Engine::compressPartialFrame(const CapturedFrame& frame, const IImgCompressor::CompressArgs& info, uint64_t compressId,
+										 uint64_t keyFrameId, const std::vector<FrameRect>& dirtyRects, const PartialFrameCommands& commands)
+	{
+		const size_t stride = (size_t)frame.width * info.numChannels;
+		std::vector<DataRef> compressedTiles;
+		size_t totalSize = 0;
+
+		compressedTiles.reserve(dirtyRects.size());
+
+		for (auto& rect : dirtyRects) {
+			//copy the tile into a contiguous image
+			const size_t tileStride = (size_t)rect.width * info.numChannels;
+			auto tileData = makePooledData(tileStride * rect.height);
+			auto src = frame.rawFrameDataRef->data() + rect.y * stride + (size_t)rect.x * info.numChannels;
+			for (uint32_t y = 0; y < rect.height; ++y)
+				memcpy(tileData->data() + y * tileStride, src + y * stride, tileStride);
+
+			auto tileInfo = info;
+			tileInfo.width = rect.width;
+			tileInfo.height = rect.height;
+			if (info.regionsOfInterest.size())
+				clipRegions(info.regionsOfInterest, rect, tileInfo.regionsOfInterest);
+
+			auto compressedTile = m_imgCompressor->compress2(tileData, compressId, tileInfo);
+			if (compressedTile == nullptr)
+				return nullptr;
+
+			totalSize += compressedTile->size();
+			compressedTiles.push_back(compressedTile);
+		}
+
+		//refined tiles take what is left of the frame's budget
+		size_t numRefinedTiles = 0;
+		size_t refinedSize = 0;
+		if (commands.refinements.size()) {
+			const size_t budget = getRefinementBudget(totalSize);
+
+			for (auto& refinement : commands.refinements) {
+				if (refinedSize >= budget)
+					break;
+
+				auto& rect = refinement.rect;
+				const size_t tileStride = (size_t)rect.width * info.numChannels;
+				auto tileData = makePooledData(tileStride * rect.height);
+				auto src = frame.rawFrameDataRef->data() + rect.y * stride + (size_t)rect.x * info.numChannels;
+				for (uint32_t y = 0; y < rect.height; ++y)
+					memcpy(tileData->data() + y * tileStride, src + y * stride, tileStride);
+
+				auto tileInfo = info;
+				tileInfo.width = rect.width;
+				tileInfo.height = rect.height;
+				tileInfo.regionsOfInterest.clear();//refined tiles are detailed anyway
+
+				auto compressedTile = m_imgCompressor->compressRefinement(tileData, compressId, tileInfo, refinement.level);
+				if (compressedTile == nullptr)
+					break;
+
+				refinedSize += compressedTile->size();
+				compressedTiles.push_back(compressedTile);
+				numRefinedTiles++;
+			}
+
+			onRefinementTilesSent(keyFrameId, commands.refinements, numRefinedTiles, refinedSize);
+		}
+
+		const bool flipped = m_imgCompressor->isOutputFlipped();
+		PartialFrameWriter writer(keyFrameId, frame.width, frame.height, (uint32_t)dirtyRects.size(), totalSize + refinedSize);
+		for (size_t i = 0; i < dirtyRects.size(); ++i) {
+			//tile's position in the decoded image
+			auto rect = dirtyRects[i];
+			if (flipped)
+				rect.y = frame.height - rect.y - rect.height;
+
+			writer.addTile(rect, compressedTiles[i]->data(), compressedTiles[i]->size());
+		}
+
+		if (commands.tilePlacements.size() || commands.tileStores.size() || commands.copyRects.size() || numRefinedTiles) {
+			if (flipped) {
+				auto flippedCommands = commands;
+				for (auto& placement : flippedCommands.tilePlacements)
+					placement.rect.y = frame.height - placement.rect.y - placement.rect.height;
+				for (auto& store : flippedCommands.tileStores)
+					store.rect.y = frame.height - store.rect.y - store.rect.height;
+				for (auto& copy : flippedCommands.copyRects) {
+					copy.rect.y = frame.height - copy.rect.y - copy.rect.height;
+					copy.srcY = frame.height - copy.srcY - copy.rect.height;
+				}
+
+				writer.addTileCacheCommands(flippedCommands.tilePlacements, flippedCommands.tileStores);
+				writer.addCopyRects(flippedCommands.copyRects);
+			}
+			else {
+				writer.addTileCacheCommands(commands.tilePlacements, commands.tileStores);
+				writer.addCopyRects(commands.copyRects);
+			}
+		}
+
+		if (numRefinedTiles) {
+			writer.addRefinedTiles((uint32_t)numRefinedTiles);
+			for (size_t i = 0; i < numRefinedTiles; ++i) {
+				auto rect = commands.refinements[i].rect;
+				if (flipped)
+					rect.y = frame.height - rect.y - rect.height;
+
+				auto& compressedTile = compressedTiles[dirtyRects.size() + i];
+				writer.addTile(rect, compressedTile->data(), compressedTile->size());
+			}
+		}
+
+		return writer.releaseData();
+	}
+
 	void Engine::frameBundleProc() {
 		SetCurrentThreadName("frameBundleThread");
 		
@@ -572,11 +1503,12 @@ namespace HQRemote {
 				lk.unlock();
 				
 				if (m_sendFrame.load(std::memory_order_relaxed)) {
-					auto bundleEvent = std::make_shared<CompressedEvents>(0, *bundle);
+					//frames are mostly compressed already, LZ4 skips over incompressible data quickly
+					auto bundleEvent = std::make_shared<CompressedEvents>(0, *bundle, remoteSupportsCompactEvents(), negotiateCompressionCodec(COMPRESSION_CODEC_LZ4));
 					if (bundleEvent->event.type == COMPRESSED_EVENTS)
 					{
 						//send to frame sending thread
-						pushFrameDataForSending(bundleId, *bundleEvent);
+						pushFrameDataForSending(bundleId, bundleEvent);
 					}
 				}//if (m_sendFrame)
 				
@@ -618,14 +1550,14 @@ namespace HQRemote {
 							sendEventUnreliable(frameIntervalEvent);
 						}
 						
-						getConnHandler()->sendDataUnreliable(frame);
+						sendEventUnreliable(frame);
 
 						m_lastSentFrameId = frameId;
 					}//if (m_sendFrame)
 					
 #if DEBUG_CAPTURED_FRAMES > 0
 					if (m_frameBundleSize <= 1)//no frame bundle, so we can debug individual frame here
-						debugFrame(frameId, frame->data(), frame->size());
+						debugFrame(frameId, frame->event.renderedFrameData.frameData, frame->event.renderedFrameData.frameSize);
 #endif//#if DEBUG_CAPTURED_FRAMES > 0
 				}//if (frameId > m_lastSentFrameId)
 			}//if (m_sendingFrames() > 0)
@@ -680,9 +1612,9 @@ namespace HQRemote {
 		m_frameBundleLock.unlock();
 	}
 	
-	void Engine::pushFrameDataForSending(uint64_t id, const DataRef& data) {
+	void Engine::pushFrameDataForSending(uint64_t id, const ConstEventRef& frameEvent) {
 		m_frameSendingLock.lock();
-		m_sendingFrames.insert(std::pair<uint64_t, DataRef>(id, data));
+		m_sendingFrames.insert(std::pair<uint64_t, ConstEventRef>(id, frameEvent));
 		if (m_sendingFrames.size() > MAX_PENDING_FRAMES)
 		{
 			//too many pending frames. remove the first one
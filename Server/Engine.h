@@ -25,6 +25,9 @@
 #include "../Timer.h"
 #include "FrameCapturer.h"
 #include "ImgCompressor.h"
+#include "MotionDetector.h"
+#include "../PartialFrame.h"
+#include "../TileCache.h"
 
 #include <stdint.h>
 
@@ -70,6 +73,53 @@ namespace HQRemote {
 		double getFrameInterval() const { return m_intendedFrameInterval; }
 
 		void setImageCompressor(std::shared_ptr<IImgCompressor> imgCompressor);
+
+		// simulcast layers: image compressors of decreasing resolution/quality (i.e. HybridImgCompressor, JpegImgCompressor,
+		// low res JpegImgCompressor), client picks one with Client::selectFrameLayer(). Layer 0 is used until then, and again
+		// after client disconnects. Captured frames & their comparison with the key frame are shared by all layers, since one
+		// client is served at a time only the selected layer encodes frames. The switch is done by the next captureAndSendFrame()
+		// call and starts with an important frame (a key frame if partial frames are used).
+		// setImageCompressor() drops the layers
+		void setFrameLayers(const std::vector<std::shared_ptr<IImgCompressor> >& layers);
+		uint32_t getSelectedFrameLayer() const { return m_requestedFrameLayer; }
+
+		// partial frames: each captured frame is compared in tiles of <tileSize> pixels (rounded up to multiple of 16) with the
+		// last whole frame sent (key frame), and only the changed tiles are compressed & sent as a PARTIAL_FRAME event.
+		// A new key frame is sent when more than half of the frame changed, or after <maxKeyFrameInterval> partial frames so that
+		// a lost key frame doesn't stall the client for too long.
+		// Only used if the image compressor supports it (see IImgCompressor::supportsPartialFrames()) and the client has
+		// FRAME_CAPABILITY_PARTIAL_FRAMES (see Client::setFrameCapabilities()).
+		void enablePartialFrames(bool enable, uint32_t tileSize = 64, uint32_t maxKeyFrameInterval = 60);
+
+		// tile cache: changed tiles of partial frames are hashed, a tile whose content was sent before is replaced by a reference
+		// to the client's copy in one of its <numSlots> cache slots (see TileCacheMirror), instead of being compressed again.
+		// Only tiles of frames the client reported as received are referenced. Only used along with partial frames, and if the
+		// client has FRAME_CAPABILITY_TILE_CACHE & protocol version 8+
+		void enableTileCache(bool enable, uint32_t numSlots = 512);
+
+		// scroll detection: when a region of the frame is the key frame's content moved vertically or horizontally by at most
+		// <maxShift> pixels (i.e. a list or map being panned), it is sent as a copy rect command, only the newly exposed parts
+		// are compressed. Only used along with partial frames, and if the client has FRAME_CAPABILITY_COPY_RECT
+		void enableScrollDetection(bool enable, uint32_t maxShift = 512);
+
+		// progressive refinement: tiles of the key frame left unchanged for <staticFrames> frames are re-sent along with partial frames
+		// at increasing quality levels (see IImgCompressor::getNumRefinementLevels()), client replaces its key frame's regions with them.
+		// They only use spare bandwidth: what is left of the rate control target (see enableRateControl()) after the frame's own tiles,
+		// at most <maxBytesPerFrame>. Refinement starts over at each key frame, a larger maxKeyFrameInterval (see enablePartialFrames())
+		// keeps static content sharp for longer. Only used along with partial frames, and if the client has
+		// FRAME_CAPABILITY_PROGRESSIVE_REFINEMENT
+		void enableProgressiveRefinement(bool enable, uint32_t staticFrames = 10, uint32_t maxBytesPerFrame = 32 * 1024);
+
+		// touch region of interest: squares of 2 * <radius> pixels around active touches and touches ended less than <holdTime> seconds ago
+		// are given to the image compressor as regions of interest (see IImgCompressor::CompressArgs). Lossy compressors spend less on
+		// the rest of the frame so that these regions get a higher quality at the same bitrate.
+		// Touch coordinates are expected in captured frame's pixels, first row of captured data at y = 0
+		void enableTouchROI(bool enable, uint32_t radius = 96, float holdTime = 1.0f);
+
+		// rate control: bitrate the link can carry is estimated from client's reception reports (RECEIVER_REPORT event) and
+		// round trip time of frames, then given to the image compressor as its target (see IImgCompressor::setTargetBitrate()).
+		// The target is kept in [<minBytesPerSec>, <maxBytesPerSec>]. Only works with clients having protocol version 7+
+		void enableRateControl(bool enable, float minBytesPerSec = 32 * 1024, float maxBytesPerSec = 8 * 1024 * 1024);
 	private:
 		struct CapturedFrame {
 			CapturedFrame(uint32_t width, uint32_t height, float intervalOffset, ConstDataRef rawFrameRef)
@@ -102,6 +152,60 @@ namespace HQRemote {
 			ConstDataRef rawFrameDataRef;
 		};
 
+		enum FrameKind {
+			WHOLE_FRAME,//partial frames not in use
+			KEY_FRAME,
+			PARTIAL_FRAME_KIND,
+		};
+
+		// key frame's tile to be sent at higher quality <level>
+		struct RefinementTile {
+			FrameRect rect;
+			uint32_t index;//in raster order of tiles
+			unsigned int level;
+		};
+
+		// commands of a partial frame other than compressed tiles
+		struct PartialFrameCommands {
+			std::vector<TileCacheCommand> tilePlacements;
+			std::vector<TileCacheCommand> tileStores;
+			std::vector<CopyRectCommand> copyRects;
+			std::vector<RefinementTile> refinements;//sent in this order as long as there is spare bandwidth
+
+			void clear() { tilePlacements.clear(); tileStores.clear(); copyRects.clear(); refinements.clear(); }
+		};
+
+		// decide how to send the frame. Return PARTIAL_FRAME_KIND with the changed regions in <dirtyRects> if only some
+		// parts of the frame changed since key frame <keyFrameId>.
+		// <commands> receive the other commands of the partial frame, regions they cover are excluded from <dirtyRects>
+		FrameKind classifyFrame(const CapturedFrame& frame, unsigned int numChannels, uint64_t frameId, uint64_t& keyFrameId, std::vector<FrameRect>& dirtyRects,
+								PartialFrameCommands& commands);
+		DataRef compressPartialFrame(const CapturedFrame& frame, const IImgCompressor::CompressArgs& info, uint64_t compressId,
+									 uint64_t keyFrameId, const std::vector<FrameRect>& dirtyRects, const PartialFrameCommands& commands);
+		// split <dirtyRects> into tiles found in tile cache (<placements>) and the rest. Return the area of cached tiles
+		size_t placeCachedTiles(const CapturedFrame& frame, unsigned int numChannels, std::vector<FrameRect>& dirtyRects,
+								std::vector<TileCacheCommand>& placements);
+		bool tileCacheUsable() const;
+		bool refinementUsable() const;
+		// count frames each key frame's tile has been unchanged for, <dirtyRects> are the tiles changed in this frame
+		void updateTileRefinements(const CapturedFrame& frame, const std::vector<FrameRect>& dirtyRects);
+		// refinements sent up to the reported frame are on client, unless they were in a frame reported lost
+		void onRefinementsReported(const Event& report);
+		// pick static tiles to refine in frame <frameId>. They are not picked again until client reports that frame
+		void pickRefinementTiles(const CapturedFrame& frame, uint64_t frameId, std::vector<RefinementTile>& refinements);
+		// only the first <numSent> of <refinements> fit in the frame, the rest can be picked again
+		void onRefinementTilesSent(uint64_t keyFrameId, const std::vector<RefinementTile>& refinements, size_t numSent, size_t sentSize);
+		size_t getRefinementBudget(size_t frameSize);
+		void getTouchRegions(uint32_t frameWidth, uint32_t frameHeight, std::vector<FrameRect>& regions);
+		void invalidateKeyFrame(uint64_t frameId);//next frame will be a key frame if <frameId> is current key frame
+		void applyImageCompressor(std::shared_ptr<IImgCompressor> imgCompressor);//restart compression threads with new compressor
+		void switchFrameLayerIfNeeded();
+		std::shared_ptr<IImgCompressor> getImgCompressor();//for threads other than compression threads
+
+		void recordFrameSendTime(uint64_t frameId);
+		void onReceiverReport(const Event& report);
+		void resetRateControl();
+
 		void platformConstruct();
 		void platformDestruct();
 		std::string platformGetWritableFolder();
@@ -129,19 +233,21 @@ namespace HQRemote {
 		void frameSavingProc();
 		
 		void pushCompressedFrameForBundling(const FrameEventRef& frame);
-		void pushFrameDataForSending(uint64_t id, const DataRef& data);
+		void pushFrameDataForSending(uint64_t id, const ConstEventRef& frameEvent);
 		void debugFrame(const FrameEventRef& frameEvent);
 		void debugFrame(uint64_t id, const void* data, size_t size);
 
 		std::shared_ptr<IFrameCapturer> m_frameCapturer;
-		std::shared_ptr<IImgCompressor> m_imgCompressor;
+		std::shared_ptr<IImgCompressor> m_imgCompressor;//compression threads use it directly, they are stopped while it is replaced
+		std::mutex m_imgCompressorLock;//guards m_imgCompressor for other threads
+		std::mutex m_imgCompressorSwitchLock;//serializes applyImageCompressor() calls from capturing & app threads
 
 		//frame compression & sending thread
 		typedef std::shared_ptr<CompressedEvents::EventList> FrameBundleRef;
 		std::deque<CapturedFrame> m_capturedFramesForCompress;
 		std::map<uint64_t, FrameBundleRef> m_incompleteFrameBundles;
 		std::map<uint64_t, FrameBundleRef> m_frameBundles;
-		std::map<uint64_t, DataRef> m_sendingFrames;
+		std::map<uint64_t, ConstEventRef> m_sendingFrames;
 		std::mutex m_frameCompressLock;
 		std::mutex m_frameBundleLock;
 		std::mutex m_frameSendingLock;
@@ -155,7 +261,7 @@ namespace HQRemote {
 		
 		const bool m_supportScreenshot, m_supportVideoRecord;
 		size_t m_frameBundleSize;
-		uint64_t m_processedCapturedFrames;
+		uint64_t m_processedCapturedFrames;//id of last frame sent to client, it keeps growing across compressor switches
 		uint64_t m_lastSentFrameId;
 		uint64_t m_numCapturedFrames;
 		uint64_t m_firstCapturedFrameTime64;
@@ -166,6 +272,61 @@ namespace HQRemote {
 		std::atomic<bool> m_forceStopFrameCompression;
 		std::atomic<bool> m_forceStopFrameSending;
 
+		//partial frames
+		std::mutex m_keyFrameLock;
+		ConstDataRef m_keyFrameData;//raw data of last key frame
+		uint32_t m_keyFrameWidth, m_keyFrameHeight;
+		uint64_t m_keyFrameId;
+		uint32_t m_partialFramesSinceKeyFrame;
+		uint32_t m_partialFrameTileSize;
+		uint32_t m_maxKeyFrameInterval;
+		std::atomic<bool> m_partialFramesEnabled;
+		std::atomic<uint32_t> m_remoteFrameCapabilities;
+
+		//tile cache, guarded by m_keyFrameLock
+		std::unique_ptr<TileCacheMirror> m_tileCache;
+		std::vector<std::pair<FrameRect, uint64_t> > m_uncachedTiles;//tiles of current partial frame to be compressed & their hashes
+		std::atomic<uint64_t> m_ackedFrameId;//latest frame reported by client
+
+		//scroll detection, guarded by m_keyFrameLock
+		bool m_scrollDetectionEnabled;
+		uint32_t m_maxScrollShift;
+
+		//progressive refinement, guarded by m_keyFrameLock
+		struct TileRefinementState {
+			uint32_t staticFrames;//number of frames the tile has been the same as key frame
+			unsigned int level;//refinement level client has acknowledged
+			unsigned int sentLevel;//refinement level in flight, same as <level> if there is none
+			uint64_t sentFrameId;//frame carrying <sentLevel>
+		};
+		bool m_refinementEnabled;
+		uint32_t m_refinementStaticFrames;
+		std::atomic<uint32_t> m_maxRefinementBytesPerFrame;
+		std::vector<TileRefinementState> m_tileRefinements;//key frame's tiles in raster order
+		uint32_t m_refinementCursor;//tile to start looking for refinement candidates from
+		size_t m_avgRefinementTileSize;
+
+		//touch region of interest
+		std::atomic<bool> m_touchROIEnabled;
+		std::atomic<uint32_t> m_touchROIRadius;
+		std::atomic<float> m_touchROIHoldTime;
+
+		//simulcast layers
+		std::mutex m_frameLayerLock;
+		std::vector<std::shared_ptr<IImgCompressor> > m_frameLayers;
+		uint32_t m_activeFrameLayer;//layer m_imgCompressor belongs to
+		std::atomic<uint32_t> m_requestedFrameLayer;//layer client selected
+		std::atomic<bool> m_forceImportantFrame;//first frame of a newly selected layer
+
+		std::atomic<bool> m_refreshRequested;//client lost a frame (REFRESH_REQUEST event)
+
+		//rate control
+		std::mutex m_rateControlLock;
+		BandwidthEstimator m_bandwidthEstimator;
+		std::deque<std::pair<uint64_t, uint64_t> > m_frameSendTimes;//frame id & time it was handed to sending
+		uint64_t m_lastFeedbackTime64;//time of last receiver report or feedback timeout, 0 if no frame sent yet
+		std::atomic<bool> m_rateControlEnabled;
+
 		//video recording thread
 		std::map<time_checkpoint_t, CapturedFrame, TimeCompare> m_capturedFramesForVideo;
 		std::unique_ptr<std::thread> m_videoThread;
@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "FrameBufferPool.h"
+#include "../BufferPool.h"
+
+#include <chrono>
+#include <new>
+#include <stdexcept>
+
+#if defined __linux__ || defined __ANDROID__
+#	include <sys/mman.h>
+#	define FRAME_BUFFER_POOL_MMAP
+#endif
+
+//buffers start at multiple of cache line size
+#define FRAME_BUFFER_ALIGNMENT 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+namespace HQRemote {
+	struct FrameBufferPool::BufferReleaser {
+		std::shared_ptr<FrameBufferPool> pool;
+
+		void operator()(Buffer* buffer) const {
+			pool->release(buffer);
+		}
+	};
+
+	std::shared_ptr<FrameBufferPool> FrameBufferPool::create(size_t bufferSize, size_t numBuffers, bool useHugePages) {
+		return std::shared_ptr<FrameBufferPool>(new FrameBufferPool(bufferSize, numBuffers, useHugePages));
+	}
+
+	FrameBufferPool::FrameBufferPool(size_t bufferSize, size_t numBuffers, bool useHugePages)
+		: m_memory(nullptr), m_memorySize(0), m_hugePages(false), m_mapped(false), m_bufferSize(bufferSize)
+	{
+		if (numBuffers == 0)
+			throw std::runtime_error("Frame buffer pool needs at least one buffer");
+
+		size_t stride = (bufferSize + FRAME_BUFFER_ALIGNMENT - 1) & ~(size_t)(FRAME_BUFFER_ALIGNMENT - 1);
+		if (stride == 0)
+			stride = FRAME_BUFFER_ALIGNMENT;
+		m_memorySize = stride * numBuffers;
+
+#ifdef FRAME_BUFFER_POOL_MMAP
+		if (useHugePages) {
+			auto mapSize = (m_memorySize + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+			void* memory = MAP_FAILED;
+#	ifdef MAP_HUGETLB
+			//explicit huge pages, only available if the system reserved some
+			memory = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			m_hugePages = memory != MAP_FAILED;
+#	endif
+			//otherwise ask for transparent huge pages
+			if (memory == MAP_FAILED) {
+				memory = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#	ifdef MADV_HUGEPAGE
+				if (memory != MAP_FAILED)
+					m_hugePages = madvise(memory, mapSize, MADV_HUGEPAGE) == 0;
+#	endif
+			}
+
+			if (memory != MAP_FAILED) {
+				m_memory = (unsigned char*)memory;
+				m_memorySize = mapSize;
+				m_mapped = true;
+			}
+		}
+#endif//#ifdef FRAME_BUFFER_POOL_MMAP
+
+		unsigned char* alignedMemory = m_memory;
+		if (m_memory == nullptr) {
+			m_memory = (unsigned char*)::operator new(m_memorySize + FRAME_BUFFER_ALIGNMENT);
+			alignedMemory = (unsigned char*)(((uintptr_t)m_memory + FRAME_BUFFER_ALIGNMENT - 1) & ~(uintptr_t)(FRAME_BUFFER_ALIGNMENT - 1));
+		}
+
+		m_buffers.reserve(numBuffers);
+		m_freeBuffers.reserve(numBuffers);
+		for (size_t i = 0; i < numBuffers; ++i) {
+			m_buffers.push_back(Buffer(alignedMemory + i * stride, bufferSize));
+			m_freeBuffers.push_back(&m_buffers.back());
+		}
+	}
+
+	FrameBufferPool::~FrameBufferPool() {
+#ifdef FRAME_BUFFER_POOL_MMAP
+		if (m_mapped) {
+			munmap(m_memory, m_memorySize);
+			return;
+		}
+#endif
+		::operator delete(m_memory);
+	}
+
+	DataRef FrameBufferPool::acquire(uint32_t waitMs) {
+		Buffer* buffer;
+		{
+			std::unique_lock<std::mutex> lk(m_lock);
+			if (m_freeBuffers.empty() && waitMs > 0)
+				m_cv.wait_for(lk, std::chrono::milliseconds(waitMs), [this] { return !m_freeBuffers.empty(); });
+
+			if (m_freeBuffers.empty())
+				return nullptr;
+
+			//most recently released buffer is likely still in cache
+			buffer = m_freeBuffers.back();
+			m_freeBuffers.pop_back();
+		}
+
+		//the buffer keeps its pool alive, reference counter is allocated from BufferPool
+		return DataRef(buffer, BufferReleaser{ shared_from_this() }, PoolAllocator<Buffer>());
+	}
+
+	size_t FrameBufferPool::getNumFreeBuffers() {
+		std::lock_guard<std::mutex> lg(m_lock);
+		return m_freeBuffers.size();
+	}
+
+	void FrameBufferPool::release(Buffer* buffer) {
+		std::lock_guard<std::mutex> lg(m_lock);
+		m_freeBuffers.push_back(buffer);
+
+		m_cv.notify_one();
+	}
+}
@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef REMOTE_FRAME_BUFFER_POOL_H
+#define REMOTE_FRAME_BUFFER_POOL_H
+
+#include "../Common.h"
+#include "../Data.h"
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	//fixed set of <numBuffers> buffers of <bufferSize> bytes in one memory region, for raw captured frames (see
+	//IFrameCapturer::enableFrameBufferPool()). A buffer goes back to the pool when its last reference is released, the pool itself
+	//is kept alive until then. If <useHugePages> is true, the region is backed by huge pages when the platform allows it
+	//(linux & android only for now), otherwise by normal pages.
+	//Use create() to create
+	class HQREMOTE_API FrameBufferPool : public std::enable_shared_from_this<FrameBufferPool> {
+	public:
+		static std::shared_ptr<FrameBufferPool> create(size_t bufferSize, size_t numBuffers, bool useHugePages = false);
+		~FrameBufferPool();
+
+		//take a free buffer, its content is what the previous user left. If all buffers are in use, wait up to <waitMs> for one to
+		//be released. Return nullptr if none was
+		DataRef acquire(uint32_t waitMs = 0);
+
+		size_t getBufferSize() const { return m_bufferSize; }
+		size_t getNumBuffers() const { return m_buffers.size(); }
+		size_t getNumFreeBuffers();
+		bool usesHugePages() const { return m_hugePages; }
+	private:
+		class Buffer : public IData {
+		public:
+			Buffer(unsigned char* data, size_t size) : m_data(data), m_size(size) {}
+
+			virtual unsigned char* data() override { return m_data; }
+			virtual const unsigned char* data() const override { return m_data; }
+
+			virtual size_t size() const override { return m_size; }
+		private:
+			unsigned char* m_data;
+			size_t m_size;
+		};
+
+		struct BufferReleaser;
+
+		FrameBufferPool(size_t bufferSize, size_t numBuffers, bool useHugePages);
+
+		void release(Buffer* buffer);
+
+		unsigned char* m_memory;
+		size_t m_memorySize;
+		bool m_hugePages;
+		bool m_mapped;//m_memory comes from mmap() rather than the heap
+
+		size_t m_bufferSize;
+		std::vector<Buffer> m_buffers;
+
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		std::vector<Buffer*> m_freeBuffers;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
@@ -17,6 +17,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "FrameCapturer.h"
+#include "../BufferPool.h"
 
 namespace HQRemote {
 	IFrameCapturer::IFrameCapturer(size_t queueSize, uint32_t frameWidth, uint32_t frameHeight)
@@ -24,18 +25,46 @@ namespace HQRemote {
 		m_currentFrameIdx(0),
 		m_totalFrames(0),
 		m_frameWidth(frameWidth),
-		m_frameHeight(frameHeight)
+		m_frameHeight(frameHeight),
+		m_framePoolSize(0),
+		m_framePoolWaitMs(0),
+		m_framePoolHugePages(false)
 	{
 	}
 
 	IFrameCapturer::~IFrameCapturer() {
 	}
 
+	void IFrameCapturer::enableFrameBufferPool(bool enable, size_t numBuffers, uint32_t waitMs, bool useHugePages) {
+		std::lock_guard<std::mutex> lg(m_framePoolLock);
+
+		m_framePool = nullptr;
+		m_framePoolSize = enable ? numBuffers : 0;
+		m_framePoolWaitMs = waitMs;
+		m_framePoolHugePages = useHugePages;
+	}
+
 	//capture current frame
 	ConstDataRef IFrameCapturer::beginCaptureFrame() {
+		const size_t frameSize = getFrameSize();
 		DataRef frameptr;
 		try {
-			frameptr = std::make_shared<CData>(getFrameSize());
+			std::shared_ptr<FrameBufferPool> framePool;
+			uint32_t framePoolWaitMs;
+			{
+				std::lock_guard<std::mutex> lg(m_framePoolLock);
+				if (m_framePoolSize && (m_framePool == nullptr || m_framePool->getBufferSize() != frameSize))
+					m_framePool = FrameBufferPool::create(frameSize, m_framePoolSize, m_framePoolHugePages);
+
+				framePool = m_framePool;
+				framePoolWaitMs = m_framePoolWaitMs;
+			}
+
+			//nullptr if all buffers are in use, the frame is dropped
+			if (framePool != nullptr)
+				frameptr = framePool->acquire(framePoolWaitMs);
+			else
+				frameptr = makePooledData(frameSize);
 		}
 		catch (...) {
 			frameptr = nullptr;
@@ -46,7 +75,7 @@ namespace HQRemote {
 		{
 			//if total frames rendered so far is less than 3 we won't read frame data directly from capturer since the frame capturer may not finish its capture of the frame yet
 			if (frameptr != nullptr)
-				memset(frameptr->data(), 0, getFrameSize());
+				memset(frameptr->data(), 0, frameSize);
 			captureFrameImpl(nullptr);
 		}
 		else
@@ -22,11 +22,13 @@
 #include "../Common.h"
 #include "../Data.h"
 #include "../Event.h"
+#include "FrameBufferPool.h"
 
 #include <vector>
 #include <stdint.h>
 #include <memory>
 #include <functional>
+#include <mutex>
 
 #if defined WIN32 || defined _MSC_VER
 #	pragma warning(push)
@@ -61,6 +63,17 @@ namespace HQRemote {
 		// Note: if you override this method, then captureFrameImpl() doesn't need to be implemented.
 		// Since the default implementation just call captureFrameImpl() internally.
 		virtual ConstDataRef beginCaptureFrame();
+
+		//frames Engine may hold at once: compression & screenshot queues, one per compression thread, the key frame of partial
+		//frames and the reference frame of stateful compressors (checked in Engine.cpp). Video recording holds more while it lags behind
+		static const size_t DEFAULT_FRAME_POOL_SIZE = 16;
+
+		//recycled frame buffers: frames are taken from a fixed pool of <numBuffers> buffers (see FrameBufferPool) instead of being
+		//allocated for each capture. When all of them are still referenced (i.e. queued by Engine), beginCaptureFrame() waits up to
+		//<waitMs> for one to be released, then drops the frame. Fewer than DEFAULT_FRAME_POOL_SIZE buffers can drop frames under load.
+		//Can be called while capturing, buffers of the previous pool stay valid until released.
+		//Only used by the default implementation of beginCaptureFrame()
+		void enableFrameBufferPool(bool enable, size_t numBuffers = DEFAULT_FRAME_POOL_SIZE, uint32_t waitMs = 0, bool useHugePages = false);
 	protected:
 		IFrameCapturer(size_t queueSize, uint32_t frameWidth, uint32_t frameHeight);
 
@@ -73,6 +86,12 @@ namespace HQRemote {
 		size_t m_queueSize;
 		size_t m_currentFrameIdx;
 		uint64_t m_totalFrames;
+
+		std::mutex m_framePoolLock;//guards m_framePool & its settings
+		std::shared_ptr<FrameBufferPool> m_framePool;//created at first capture, and again whenever frame size changes
+		size_t m_framePoolSize;//0 if disabled
+		uint32_t m_framePoolWaitMs;
+		bool m_framePoolHugePages;
 	};
 }
 
@@ -0,0 +1,353 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "ImgCompressor.h"
+#include "../BufferPool.h"
+
+#include <string.h>
+#include <vector>
+
+#ifndef MIN
+#	define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#	define MAX(a,b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define HYBRID_TILE_ALIGNMENT 16//JPEG's MCU size, so that JPEG tiles are not affected by their neighbors
+#define MAX_PALETTE_COLORS 256
+#define PALETTE_HASH_SIZE 1024//must be power of 2 & larger than MAX_PALETTE_COLORS
+#define SMOOTH_GRADIENT_THRESHOLD 48//max difference of channels' sum between 2 neighbor pixels to be a smooth gradient
+#define JPEG_FILL_VALUE 128
+#define REFINEMENT_JPEG_QUALITY 95
+#define ROI_JPEG_QUALITY (DEFAULT_JPEG_QUALITY + 5)
+
+namespace HQRemote {
+	enum HybridTileType : unsigned char {
+		HYBRID_TILE_JPEG,
+		HYBRID_TILE_PALETTE,
+		HYBRID_TILE_RAW,
+	};
+
+	//metadata preceding compressed data. Followed by lossless data (<losslessSize> bytes) then JPEG image (<jpegSize> bytes).
+	//Lossless data, once decompressed: tile map (type of each tile in raster order) | content of each lossless tile in the same order.
+	//Palette tile: number of colors - 1 (1 byte) | colors | 1 byte index per pixel. Raw tile: pixels
+	struct HybridFrameHeader {
+		uint32_t width;
+		uint32_t height;
+		uint32_t numChannels;
+		uint32_t tileSize;
+		CompressionCodec losslessCodec;
+		uint32_t losslessSize;
+		uint32_t jpegSize;
+		uint32_t padding;
+	};
+
+	static inline uint32_t readPixel(const unsigned char* pixel, unsigned int numChannels) {
+		uint32_t value = 0;
+		memcpy(&value, pixel, numChannels);
+		return value;
+	}
+
+	//collect distinct colors of a tile into <palette> & index of each pixel into <indices>.
+	//Return false if there are more than MAX_PALETTE_COLORS colors
+	static bool buildPalette(const unsigned char* tile, size_t stride, uint32_t width, uint32_t height, unsigned int numChannels,
+							 std::vector<uint32_t>& palette, std::vector<unsigned char>& indices)
+	{
+		uint32_t hashKeys[PALETTE_HASH_SIZE];
+		int16_t hashValues[PALETTE_HASH_SIZE];
+		memset(hashValues, -1, sizeof(hashValues));
+
+		palette.clear();
+		indices.resize((size_t)width * height);
+
+		auto index = indices.data();
+		for (uint32_t y = 0; y < height; ++y) {
+			auto pixel = tile + y * stride;
+			for (uint32_t x = 0; x < width; ++x, pixel += numChannels) {
+				auto color = readPixel(pixel, numChannels);
+				auto slot = (color * 0x9E3779B1u) >> 22;//top 10 bits
+				while (hashValues[slot] >= 0 && hashKeys[slot] != color)
+					slot = (slot + 1) & (PALETTE_HASH_SIZE - 1);
+
+				if (hashValues[slot] < 0) {
+					if (palette.size() == MAX_PALETTE_COLORS)
+						return false;
+					hashKeys[slot] = color;
+					hashValues[slot] = (int16_t)palette.size();
+					palette.push_back(color);
+				}
+
+				*index++ = (unsigned char)hashValues[slot];
+			}
+		}
+
+		return true;
+	}
+
+	//true if most neighbor pixels differ slightly, which is typical of natural images. Text & UI are mostly flat with sharp edges
+	static bool isSmoothTile(const unsigned char* tile, size_t stride, uint32_t width, uint32_t height, unsigned int numChannels) {
+		const unsigned int numColorChannels = numChannels < 3 ? numChannels : 3;
+		size_t numSmooth = 0, numPairs = 0;
+
+		for (uint32_t y = 0; y < height; ++y) {
+			auto pixel = tile + y * stride;
+			for (uint32_t x = 1; x < width; ++x, pixel += numChannels) {
+				int diff = 0;
+				for (unsigned int c = 0; c < numColorChannels; ++c) {
+					int d = (int)pixel[numChannels + c] - (int)pixel[c];
+					diff += d >= 0 ? d : -d;
+				}
+
+				if (diff > 0 && diff <= SMOOTH_GRADIENT_THRESHOLD)
+					numSmooth++;
+			}
+			numPairs += width - 1;
+		}
+
+		return numSmooth * 2 > numPairs;
+	}
+
+	HybridImgCompressor::HybridImgCompressor(uint32_t tileSize, CompressionCodec losslessCodec)
+		: m_losslessCodec(losslessCodec)
+	{
+		tileSize = tileSize > HYBRID_TILE_ALIGNMENT ? tileSize : HYBRID_TILE_ALIGNMENT;
+		m_tileSize = (tileSize + HYBRID_TILE_ALIGNMENT - 1) / HYBRID_TILE_ALIGNMENT * HYBRID_TILE_ALIGNMENT;
+	}
+
+	void HybridImgCompressor::setTargetBitrate(float bytesPerSecond, float framesPerSecond) {
+		m_qualityController.setTarget(bytesPerSecond, framesPerSecond);
+	}
+
+	DataRef HybridImgCompressor::compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) {
+		return compressTiles(src, width, height, numChannels, 0);
+	}
+
+	DataRef HybridImgCompressor::compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) {
+		return compressTiles(src, info.width, info.height, info.numChannels, 0, &info.regionsOfInterest);
+	}
+
+	DataRef HybridImgCompressor::compressRefinement(ConstDataRef src, uint64_t id, const CompressArgs& info, unsigned int level) {
+		switch (level) {
+		case 1:
+			return compressTiles(src, info.width, info.height, info.numChannels, REFINEMENT_JPEG_QUALITY);
+		case 2:
+			return compressTiles(src, info.width, info.height, info.numChannels, -1);
+		default:
+			return nullptr;
+		}
+	}
+
+	DataRef HybridImgCompressor::compressTiles(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, int jpegQuality,
+											   const std::vector<FrameRect>* regionsOfInterest)
+	{
+		const size_t stride = (size_t)width * numChannels;
+		if (src == nullptr || src->size() < stride * height || numChannels == 0 || numChannels > 4)
+			return nullptr;
+
+		const uint32_t numCols = (width + m_tileSize - 1) / m_tileSize;
+		const uint32_t numRows = (height + m_tileSize - 1) / m_tileSize;
+		const size_t numPixels = (size_t)width * height;
+
+		std::vector<unsigned char> lossless(numCols * numRows);//tile map first
+		std::vector<uint32_t> palette;
+		std::vector<unsigned char> indices;
+		DataRef jpegInput;
+
+		for (uint32_t row = 0; row < numRows; ++row) {
+			for (uint32_t col = 0; col < numCols; ++col) {
+				const uint32_t x = col * m_tileSize, y = row * m_tileSize;
+				const uint32_t tileWidth = MIN(m_tileSize, width - x), tileHeight = MIN(m_tileSize, height - y);
+				const size_t tileRowSize = (size_t)tileWidth * numChannels;
+				auto tile = src->data() + y * stride + (size_t)x * numChannels;
+				auto& tileType = lossless[row * numCols + col];
+
+				if (buildPalette(tile, stride, tileWidth, tileHeight, numChannels, palette, indices)) {
+					tileType = HYBRID_TILE_PALETTE;
+					lossless.push_back((unsigned char)(palette.size() - 1));
+					for (auto color : palette)
+						lossless.insert(lossless.end(), (unsigned char*)&color, (unsigned char*)&color + numChannels);
+					lossless.insert(lossless.end(), indices.begin(), indices.end());
+				}
+				else if (jpegQuality < 0 || !isSmoothTile(tile, stride, tileWidth, tileHeight, numChannels)) {
+					tileType = HYBRID_TILE_RAW;
+					for (uint32_t ty = 0; ty < tileHeight; ++ty)
+						lossless.insert(lossless.end(), tile + ty * stride, tile + ty * stride + tileRowSize);
+				}
+				else {
+					tileType = HYBRID_TILE_JPEG;
+					if (jpegInput == nullptr) {
+						//lossless tiles are left flat in JPEG image
+						jpegInput = makePooledData(stride * height);
+						memset(jpegInput->data(), JPEG_FILL_VALUE, jpegInput->size());
+					}
+
+					for (uint32_t ty = 0; ty < tileHeight; ++ty)
+						memcpy(jpegInput->data() + (y + ty) * stride + (size_t)x * numChannels, tile + ty * stride, tileRowSize);
+				}
+			}
+		}
+
+		const bool rateControlled = jpegQuality == 0 && m_qualityController.enabled();
+		if (regionsOfInterest && regionsOfInterest->empty())
+			regionsOfInterest = nullptr;
+		//without rate control, detail taken from the rest of JPEG tiles is given to regions of interest by raising quality
+		if (jpegQuality == 0 && regionsOfInterest)
+			jpegQuality = ROI_JPEG_QUALITY;
+		int quality = rateControlled ? m_qualityController.pickQuality(numPixels, DEFAULT_JPEG_QUALITY) : MAX(jpegQuality, 0);
+
+		HybridFrameHeader header;
+		header.width = width;
+		header.height = height;
+		header.numChannels = numChannels;
+		header.tileSize = m_tileSize;
+		header.losslessCodec = m_losslessCodec;
+		header.padding = 0;
+
+		auto compressedData = std::make_shared<GrowableData>();
+		compressedData->push_back(&header, sizeof(header));
+
+		try {
+			compressData(m_losslessCodec, lossless.data(), lossless.size(), 0, *compressedData);
+		}
+		catch (...) {
+			return nullptr;
+		}
+		header.losslessSize = (uint32_t)(compressedData->size() - sizeof(header));
+		header.jpegSize = 0;
+
+		if (jpegInput != nullptr) {
+			auto jpeg = convertToJpeg(jpegInput, width, height, numChannels, false, false, quality, regionsOfInterest);
+			if (jpeg == nullptr)
+				return nullptr;
+
+			header.jpegSize = (uint32_t)jpeg->size();
+			compressedData->push_back(jpeg->data(), jpeg->size());
+		}
+
+		memcpy(compressedData->data(), &header, sizeof(header));
+
+		if (rateControlled)
+			m_qualityController.onCompressed(quality, numPixels, compressedData->size());
+
+		return compressedData;
+	}
+
+	DataRef HybridImgCompressor::decompress(const void* src, size_t srcSize, uint32_t& width, uint32_t &height, unsigned int& numChannels,
+											const JpegDecoder& jpegDecoder)
+	{
+		HybridFrameHeader header;
+		if (srcSize < sizeof(header))
+			return nullptr;
+		memcpy(&header, src, sizeof(header));
+
+		if (header.numChannels == 0 || header.numChannels > 4 || header.tileSize == 0
+			|| (size_t)header.losslessSize + header.jpegSize > srcSize - sizeof(header))
+			return nullptr;
+
+		auto losslessData = (const unsigned char*)src + sizeof(header);
+		auto jpegData = losslessData + header.losslessSize;
+		const size_t stride = (size_t)header.width * header.numChannels;
+		const uint32_t numCols = (header.width + header.tileSize - 1) / header.tileSize;
+		const uint32_t numRows = (header.height + header.tileSize - 1) / header.tileSize;
+		const size_t numTiles = (size_t)numCols * numRows;
+
+		DataRef lossless;
+		try {
+			lossless = decompressData(header.losslessCodec, losslessData, header.losslessSize);
+		}
+		catch (...) {
+			return nullptr;
+		}
+		if (lossless == nullptr || lossless->size() < numTiles)
+			return nullptr;
+
+		DataRef frame;
+		if (header.jpegSize) {
+			uint32_t jpegWidth, jpegHeight;
+			frame = jpegDecoder ? jpegDecoder(jpegData, header.jpegSize, jpegWidth, jpegHeight) : nullptr;
+			if (frame == nullptr || jpegWidth != header.width || jpegHeight != header.height || frame->size() < stride * header.height)
+				return nullptr;
+		}
+		else {
+			//every pixel then comes from lossless data, taking at least 1 byte each. This also bounds the allocation below
+			if ((uint64_t)header.width * header.height > lossless->size() - numTiles)
+				return nullptr;
+			frame = makePooledData(stride * header.height);
+		}
+
+		auto tileMap = lossless->data();
+		auto ptr = tileMap + numTiles;
+		auto end = lossless->data() + lossless->size();
+
+		for (uint32_t row = 0; row < numRows; ++row) {
+			for (uint32_t col = 0; col < numCols; ++col) {
+				const uint32_t x = col * header.tileSize, y = row * header.tileSize;
+				const uint32_t tileWidth = MIN(header.tileSize, header.width - x), tileHeight = MIN(header.tileSize, header.height - y);
+				const size_t tileRowSize = (size_t)tileWidth * header.numChannels;
+				auto tile = frame->data() + y * stride + (size_t)x * header.numChannels;
+
+				switch (tileMap[row * numCols + col]) {
+				case HYBRID_TILE_JPEG:
+					if (!header.jpegSize)
+						return nullptr;
+					break;
+				case HYBRID_TILE_PALETTE:
+				{
+					if (ptr == end)
+						return nullptr;
+					const size_t numColors = (size_t)*ptr++ + 1;
+					auto colors = ptr;
+					auto indices = colors + numColors * header.numChannels;
+					if ((size_t)(end - ptr) < numColors * header.numChannels + (size_t)tileWidth * tileHeight)
+						return nullptr;
+
+					for (uint32_t ty = 0; ty < tileHeight; ++ty) {
+						auto pixel = tile + ty * stride;
+						for (uint32_t tx = 0; tx < tileWidth; ++tx, pixel += header.numChannels) {
+							auto index = *indices++;
+							if (index >= numColors)
+								return nullptr;
+							memcpy(pixel, colors + index * header.numChannels, header.numChannels);
+						}
+					}
+
+					ptr = indices;
+				}
+					break;
+				case HYBRID_TILE_RAW:
+					if ((size_t)(end - ptr) < tileRowSize * tileHeight)
+						return nullptr;
+
+					for (uint32_t ty = 0; ty < tileHeight; ++ty, ptr += tileRowSize)
+						memcpy(tile + ty * stride, ptr, tileRowSize);
+					break;
+				default:
+					return nullptr;
+				}
+			}
+		}
+
+		width = header.width;
+		height = header.height;
+		numChannels = header.numChannels;
+
+		return frame;
+	}
+}
@@ -0,0 +1,368 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "ImageScaler.h"
+#include "../BufferPool.h"
+
+#include <string.h>
+#include <vector>
+
+#ifndef MIN
+#	define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#	define IMAGE_SCALER_SSE2
+#	include <emmintrin.h>
+#elif defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM || defined _M_ARM64
+#	define IMAGE_SCALER_NEON
+#	include <arm_neon.h>
+#endif
+
+//7 bits fixed point bilinear weights, so that horizontally interpolated values & weights fit in signed 16 bits SIMD lanes
+#define BILINEAR_WEIGHT_BITS 7
+#define BILINEAR_WEIGHT_ONE (1 << BILINEAR_WEIGHT_BITS)
+
+namespace HQRemote {
+	void getLowResDimensions(uint32_t width, uint32_t height, uint32_t& lowResWidth, uint32_t& lowResHeight) {
+		lowResWidth = width > 1 ? width / 2 : width;
+		lowResHeight = height > 1 ? height / 2 : height;
+	}
+
+	/*------------- 2x2 box filter -----------*/
+	//average 2x2 pixels of <row0> & <row1> into <dst> starting from destination pixel <x>
+	static void halveRowScalar(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t x, uint32_t dstWidth, unsigned char* dst) {
+		for (; x < dstWidth; ++x) {
+			auto p0 = row0 + 2 * x * numChannels;
+			auto p1 = row1 + 2 * x * numChannels;
+			auto out = dst + x * numChannels;
+			for (unsigned int c = 0; c < numChannels; ++c)
+				out[c] = (unsigned char)((p0[c] + p0[c + numChannels] + p1[c] + p1[c + numChannels] + 2) >> 2);
+		}
+	}
+
+#if defined IMAGE_SCALER_SSE2
+	//sum of 2 adjacent RGBX pixels held in 16 bits lanes, result is in the lower 4 lanes
+	static inline __m128i sumPixelPair(__m128i pair) {
+		return _mm_add_epi16(pair, _mm_srli_si128(pair, 8));
+	}
+
+	//return number of destination pixels done
+	static uint32_t halveRowSIMD(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t dstWidth, unsigned char* dst) {
+		//3 channels pixels don't fit nicely in SSE registers, leave them to scalar version
+		if (numChannels != 4)
+			return 0;
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+		uint32_t x = 0;
+		//8 source pixels of each row -> 4 destination pixels
+		for (; x + 4 <= dstWidth; x += 4) {
+			auto a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+			auto b0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+			auto a1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+			auto b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+
+			//vertical sums, 2 pixels per register
+			auto p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(a1, zero));
+			auto p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(a1, zero));
+			auto p45 = _mm_add_epi16(_mm_unpacklo_epi8(b0, zero), _mm_unpacklo_epi8(b1, zero));
+			auto p67 = _mm_add_epi16(_mm_unpackhi_epi8(b0, zero), _mm_unpackhi_epi8(b1, zero));
+
+			//horizontal sums
+			auto d01 = _mm_unpacklo_epi64(sumPixelPair(p01), sumPixelPair(p23));
+			auto d23 = _mm_unpacklo_epi64(sumPixelPair(p45), sumPixelPair(p67));
+
+			d01 = _mm_srli_epi16(_mm_add_epi16(d01, rounding), 2);
+			d23 = _mm_srli_epi16(_mm_add_epi16(d23, rounding), 2);
+
+			_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(d01, d23));
+		}
+
+		return x;
+	}
+#elif defined IMAGE_SCALER_NEON
+	//return number of destination pixels done
+	static uint32_t halveRowSIMD(const unsigned char* row0, const unsigned char* row1, unsigned int numChannels, uint32_t dstWidth, unsigned char* dst) {
+		uint32_t x = 0;
+		//16 source pixels of each row -> 8 destination pixels, channels are deinterleaved by the loads
+		if (numChannels == 4) {
+			for (; x + 8 <= dstWidth; x += 8) {
+				auto p0 = vld4q_u8(row0 + x * 8);
+				auto p1 = vld4q_u8(row1 + x * 8);
+				uint8x8x4_t out;
+				for (int c = 0; c < 4; ++c)
+					out.val[c] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[c]), p1.val[c]), 2);
+				vst4_u8(dst + x * 4, out);
+			}
+		}
+		else {
+			for (; x + 8 <= dstWidth; x += 8) {
+				auto p0 = vld3q_u8(row0 + x * 6);
+				auto p1 = vld3q_u8(row1 + x * 6);
+				uint8x8x3_t out;
+				for (int c = 0; c < 3; ++c)
+					out.val[c] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(p0.val[c]), p1.val[c]), 2);
+				vst3_u8(dst + x * 3, out);
+			}
+		}
+
+		return x;
+	}
+#endif//IMAGE_SCALER_NEON
+
+	//<dst> has (<srcWidth> / 2) x (<srcHeight> / 2) pixels. Last column & row of odd dimensions are dropped
+	static void halveImage(const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight, unsigned int numChannels, unsigned char* dst) {
+		const uint32_t dstWidth = srcWidth / 2;
+		const uint32_t dstHeight = srcHeight / 2;
+		const size_t srcStride = (size_t)srcWidth * numChannels;
+		const size_t dstStride = (size_t)dstWidth * numChannels;
+
+		for (uint32_t y = 0; y < dstHeight; ++y) {
+			auto row0 = src + 2 * y * srcStride;
+			auto row1 = row0 + srcStride;
+			auto dstRow = dst + y * dstStride;
+
+			uint32_t x = 0;
+#if defined IMAGE_SCALER_SSE2 || defined IMAGE_SCALER_NEON
+			x = halveRowSIMD(row0, row1, numChannels, dstWidth, dstRow);
+#endif
+			//remaining pixels
+			halveRowScalar(row0, row1, numChannels, x, dstWidth, dstRow);
+		}
+	}
+
+	/*------------- bilinear filter -----------*/
+	//source position of each destination pixel's center, as index of left/top pixel & weight of the next one
+	static void computeBilinearTaps(uint32_t srcSize, uint32_t dstSize, std::vector<uint32_t>& indices, std::vector<uint32_t>& weights) {
+		indices.resize(dstSize);
+		weights.resize(dstSize);
+		for (uint32_t i = 0; i < dstSize; ++i) {
+			int64_t pos = ((int64_t)(2 * i + 1) * srcSize * BILINEAR_WEIGHT_ONE) / (2 * dstSize) - BILINEAR_WEIGHT_ONE / 2;
+			if (pos < 0)
+				pos = 0;
+			uint32_t index = (uint32_t)(pos >> BILINEAR_WEIGHT_BITS);
+			uint32_t weight = (uint32_t)(pos & (BILINEAR_WEIGHT_ONE - 1));
+			if (index >= srcSize - 1) {
+				index = srcSize - 1;
+				weight = 0;
+			}
+
+			indices[i] = index;
+			weights[i] = weight;
+		}
+	}
+
+	//horizontal pass of one source row starting from destination pixel <x>, results keep BILINEAR_WEIGHT_BITS bits of fraction
+	static void interpolateRowScalar(const unsigned char* row, uint32_t srcWidth, unsigned int numChannels, uint32_t x, uint32_t dstWidth,
+									 const uint32_t* xIndices, const uint32_t* xWeights, int16_t* out)
+	{
+		out += x * numChannels;
+		for (; x < dstWidth; ++x) {
+			auto p0 = row + xIndices[x] * numChannels;
+			auto p1 = xIndices[x] + 1 < srcWidth ? p0 + numChannels : p0;
+			const uint32_t wx = xWeights[x];
+			for (unsigned int c = 0; c < numChannels; ++c)
+				*out++ = (int16_t)(p0[c] * (BILINEAR_WEIGHT_ONE - wx) + p1[c] * wx);
+		}
+	}
+
+	//vertical pass of <count> values starting from <i>
+	static void blendRowsScalar(const int16_t* row0, const int16_t* row1, uint32_t wy, size_t i, size_t count, unsigned char* out) {
+		for (; i < count; ++i)
+			out[i] = (unsigned char)((row0[i] * (BILINEAR_WEIGHT_ONE - wy) + row1[i] * wy + (1 << (2 * BILINEAR_WEIGHT_BITS - 1))) >> (2 * BILINEAR_WEIGHT_BITS));
+	}
+
+#if defined IMAGE_SCALER_SSE2
+	static inline __m128i load32(const unsigned char* src) {
+		int32_t value;
+		memcpy(&value, src, sizeof(value));
+		return _mm_cvtsi32_si128(value);
+	}
+
+	//RGBX only. Return number of destination pixels done
+	static uint32_t interpolateRowSIMD(const unsigned char* row, uint32_t srcWidth, unsigned int numChannels, uint32_t dstWidth,
+									   const uint32_t* xIndices, const uint32_t* xWeights, int16_t* out)
+	{
+		if (numChannels != 4)
+			return 0;
+
+		const __m128i zero = _mm_setzero_si128();
+		uint32_t x = 0;
+		for (; x + 2 <= dstWidth; x += 2) {
+			__m128i sums[2];
+			for (int i = 0; i < 2; ++i) {
+				auto index = xIndices[x + i];
+				auto p0 = load32(row + index * 4);
+				auto p1 = index + 1 < srcWidth ? load32(row + index * 4 + 4) : p0;
+				//(p0, p1) pairs of each channel dot (1 - w, w)
+				auto pairs = _mm_unpacklo_epi8(_mm_unpacklo_epi8(p0, p1), zero);
+				auto weights = _mm_set1_epi32((int)((xWeights[x + i] << 16) | (BILINEAR_WEIGHT_ONE - xWeights[x + i])));
+				sums[i] = _mm_madd_epi16(pairs, weights);
+			}
+
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packs_epi32(sums[0], sums[1]));
+		}
+
+		return x;
+	}
+
+	//return number of values done
+	static size_t blendRowsSIMD(const int16_t* row0, const int16_t* row1, uint32_t wy, size_t count, unsigned char* out) {
+		const __m128i weights = _mm_set1_epi32((int)((wy << 16) | (BILINEAR_WEIGHT_ONE - wy)));
+		const __m128i rounding = _mm_set1_epi32(1 << (2 * BILINEAR_WEIGHT_BITS - 1));
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			auto a = _mm_loadu_si128((const __m128i*)(row0 + i));
+			auto b = _mm_loadu_si128((const __m128i*)(row1 + i));
+			auto lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights);
+			auto hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights);
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, rounding), 2 * BILINEAR_WEIGHT_BITS);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, rounding), 2 * BILINEAR_WEIGHT_BITS);
+
+			auto values = _mm_packs_epi32(lo, hi);
+			_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(values, values));
+		}
+
+		return i;
+	}
+#elif defined IMAGE_SCALER_NEON
+	//return number of values done
+	static size_t blendRowsSIMD(const int16_t* row0, const int16_t* row1, uint32_t wy, size_t count, unsigned char* out) {
+		//interpolated values are never negative
+		const uint16x4_t w0 = vdup_n_u16((uint16_t)(BILINEAR_WEIGHT_ONE - wy));
+		const uint16x4_t w1 = vdup_n_u16((uint16_t)wy);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			auto a = vreinterpretq_u16_s16(vld1q_s16(row0 + i));
+			auto b = vreinterpretq_u16_s16(vld1q_s16(row1 + i));
+			auto lo = vmlal_u16(vmull_u16(vget_low_u16(a), w0), vget_low_u16(b), w1);
+			auto hi = vmlal_u16(vmull_u16(vget_high_u16(a), w0), vget_high_u16(b), w1);
+			auto values = vcombine_u16(vrshrn_n_u32(lo, 2 * BILINEAR_WEIGHT_BITS), vrshrn_n_u32(hi, 2 * BILINEAR_WEIGHT_BITS));
+			vst1_u8(out + i, vqmovn_u16(values));
+		}
+
+		return i;
+	}
+#endif//IMAGE_SCALER_NEON
+
+	static void interpolateRow(const unsigned char* row, uint32_t srcWidth, unsigned int numChannels, uint32_t dstWidth,
+							   const uint32_t* xIndices, const uint32_t* xWeights, int16_t* out)
+	{
+		uint32_t x = 0;
+#if defined IMAGE_SCALER_SSE2
+		x = interpolateRowSIMD(row, srcWidth, numChannels, dstWidth, xIndices, xWeights, out);
+#endif
+		interpolateRowScalar(row, srcWidth, numChannels, x, dstWidth, xIndices, xWeights, out);
+	}
+
+	static void blendRows(const int16_t* row0, const int16_t* row1, uint32_t wy, size_t count, unsigned char* out) {
+		size_t i = 0;
+#if defined IMAGE_SCALER_SSE2 || defined IMAGE_SCALER_NEON
+		i = blendRowsSIMD(row0, row1, wy, count, out);
+#endif
+		blendRowsScalar(row0, row1, wy, i, count, out);
+	}
+
+	static void resizeBilinear(const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight, unsigned int numChannels,
+							   unsigned char* dst, uint32_t dstWidth, uint32_t dstHeight)
+	{
+		std::vector<uint32_t> xIndices, xWeights, yIndices, yWeights;
+		computeBilinearTaps(srcWidth, dstWidth, xIndices, xWeights);
+		computeBilinearTaps(srcHeight, dstHeight, yIndices, yWeights);
+
+		//separable filter: each source row is horizontally interpolated once, then consecutive destination rows reuse it
+		const size_t srcStride = (size_t)srcWidth * numChannels;
+		const size_t dstStride = (size_t)dstWidth * numChannels;
+		std::vector<int16_t> rowBuffers[2] = { std::vector<int16_t>(dstStride), std::vector<int16_t>(dstStride) };
+		int64_t bufferedRows[2] = { -1, -1 };
+
+		for (uint32_t y = 0; y < dstHeight; ++y) {
+			const uint32_t srcRows[2] = { yIndices[y], MIN(yIndices[y] + 1, srcHeight - 1) };
+			const int16_t* rows[2];
+			int firstSlot = -1;
+			for (int i = 0; i < 2; ++i) {
+				int slot;
+				if (bufferedRows[0] == srcRows[i])
+					slot = 0;
+				else if (bufferedRows[1] == srcRows[i])
+					slot = 1;
+				else {
+					//replace the older row, unless it is used by this destination row
+					slot = bufferedRows[0] < bufferedRows[1] ? 0 : 1;
+					if (slot == firstSlot)
+						slot = 1 - slot;
+					interpolateRow(src + srcRows[i] * srcStride, srcWidth, numChannels, dstWidth, xIndices.data(), xWeights.data(), rowBuffers[slot].data());
+					bufferedRows[slot] = srcRows[i];
+				}
+				rows[i] = rowBuffers[slot].data();
+				firstSlot = slot;
+			}
+
+			blendRows(rows[0], rows[1], yWeights[y], dstStride, dst + y * dstStride);
+		}
+	}
+
+	DataRef HQ_FASTCALL downscaleImage(const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight, unsigned int numChannels,
+									   uint32_t dstWidth, uint32_t dstHeight)
+	{
+		if (dstWidth == 0 || dstHeight == 0 || dstWidth > srcWidth || dstHeight > srcHeight)
+			return nullptr;
+
+		//halve while possible, like mipmapping, so that the bilinear step never skips source pixels
+		DataRef level;
+		auto levelData = src;
+		uint32_t width = srcWidth, height = srcHeight;
+		while (width / 2 >= dstWidth && height / 2 >= dstHeight) {
+			auto halfLevel = makePooledData((size_t)(width / 2) * (height / 2) * numChannels);
+			halveImage(levelData, width, height, numChannels, halfLevel->data());
+
+			level = halfLevel;
+			levelData = level->data();
+			width /= 2;
+			height /= 2;
+		}
+
+		if (width == dstWidth && height == dstHeight) {
+			if (level)
+				return level;
+			return makePooledData(src, (size_t)srcWidth * srcHeight * numChannels);
+		}
+
+		auto output = makePooledData((size_t)dstWidth * dstHeight * numChannels);
+		resizeBilinear(levelData, width, height, numChannels, output->data(), dstWidth, dstHeight);
+
+		return output;
+	}
+
+	ConstDataRef HQ_FASTCALL downscaleToLowRes(const ConstDataRef& src, uint32_t& width, uint32_t& height, unsigned int numChannels) {
+		uint32_t lowResWidth, lowResHeight;
+		getLowResDimensions(width, height, lowResWidth, lowResHeight);
+		if (lowResWidth == width && lowResHeight == height)
+			return src;
+
+		auto lowResFrame = downscaleImage(src->data(), width, height, numChannels, lowResWidth, lowResHeight);
+		if (lowResFrame) {
+			width = lowResWidth;
+			height = lowResHeight;
+		}
+
+		return lowResFrame;
+	}
+}
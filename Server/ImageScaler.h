@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_IMAGE_SCALER_H
+#define HQREMOTE_IMAGE_SCALER_H
+
+#include "../Common.h"
+#include "../Data.h"
+
+#include <stdint.h>
+
+namespace HQRemote {
+	//dimensions of frames compressed with outputLowRes flag: half of the original frame in each direction
+	HQREMOTE_API void getLowResDimensions(uint32_t width, uint32_t height, uint32_t& lowResWidth, uint32_t& lowResHeight);
+
+	//downscale a RGB(X) image to <dstWidth> x <dstHeight>, which must not exceed the source's dimensions.
+	//Each halving step uses a 2x2 box filter (SSE2 or NEON when available), the remaining ratio below 2 uses bilinear filter.
+	//So 2x & 4x reductions are pure box filtering. Return nullptr if the dimensions are invalid
+	HQREMOTE_API DataRef HQ_FASTCALL downscaleImage(const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight, unsigned int numChannels,
+													uint32_t dstWidth, uint32_t dstHeight);
+	//downscale a frame to low res dimensions (see getLowResDimensions()). <width> & <height> are updated to the new dimensions.
+	//Return <src> itself if it is too small to be downscaled
+	HQREMOTE_API ConstDataRef HQ_FASTCALL downscaleToLowRes(const ConstDataRef& src, uint32_t& width, uint32_t& height, unsigned int numChannels);
+}
+
+#endif
@@ -22,27 +22,183 @@
 #include "../ZlibUtils.h"
 #include "ImgCompressor.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
 namespace HQRemote {
 	/*-------------- JpegImgCompressor ----------------*/
-	JpegImgCompressor::JpegImgCompressor(bool outputLowRes, bool outputFlipped)
+	//above rate controlled qualities. 100 is as close to lossless as JPEG gets, chroma is still subsampled
+	static const int JPEG_REFINEMENT_QUALITIES[] = { 95, 100 };
+	//quality of images having regions of interest when there is no rate control.
+	//ImageIO encoder (see apple/ImgCompressorApple.cpp) ignores regions of interest, so it would only make the whole image bigger
+#ifdef __APPLE__
+#	define JPEG_ROI_QUALITY_BOOST 0
+#else
+#	define JPEG_ROI_QUALITY_BOOST 1
+	static const int ROI_JPEG_QUALITY = DEFAULT_JPEG_QUALITY + 5;
+#endif
+
+	//threads encoding bands of frames. They are shared by all compression threads of the engine
+	struct JpegImgCompressor::SliceWorkers {
+		SliceWorkers(unsigned int _numSlices)
+			: numSlices(_numSlices), stop(false)
+		{
+			//calling thread encodes one band itself
+			for (unsigned int i = 1; i < numSlices; ++i) {
+				threads.push_back(std::unique_ptr<std::thread>(new std::thread([this] {
+					threadProc();
+				})));
+			}
+		}
+
+		~SliceWorkers() {
+			{
+				std::lock_guard<std::mutex> lg(lock);
+				stop = true;
+				cv.notify_all();
+			}
+
+			for (auto& thread : threads)
+				thread->join();
+		}
+
+		void run(std::function<void()>&& task) {
+			std::lock_guard<std::mutex> lg(lock);
+			tasks.push_back(std::move(task));
+			cv.notify_one();
+		}
+
+		void threadProc() {
+			SetCurrentThreadName("JpegImgCompressor's slice thread");
+
+			while (true) {
+				std::unique_lock<std::mutex> lk(lock);
+				cv.wait(lk, [this] { return stop || tasks.size() > 0; });
+				if (tasks.size() == 0)
+					break;//stopped
+
+				auto task = std::move(tasks.front());
+				tasks.pop_front();
+				lk.unlock();
+
+				task();
+			}
+		}
+
+		const unsigned int numSlices;
+		std::vector<std::unique_ptr<std::thread>> threads;
+		std::deque<std::function<void()>> tasks;
+		std::mutex lock;
+		std::condition_variable cv;
+		bool stop;
+	};
+
+	JpegImgCompressor::JpegImgCompressor(bool outputLowRes, bool outputFlipped, unsigned int numSlices)
 		:m_outputLowRes(outputLowRes), m_flip(outputFlipped)
 	{
+		if (numSlices == 0)
+			numSlices = std::thread::hardware_concurrency();
+		if (numSlices > 1)
+			m_sliceWorkers = std::unique_ptr<SliceWorkers>(new SliceWorkers(numSlices));
+	}
+
+	JpegImgCompressor::~JpegImgCompressor() {
+	}
+
+	void JpegImgCompressor::setTargetBitrate(float bytesPerSecond, float framesPerSecond) {
+		m_qualityController.setTarget(bytesPerSecond, framesPerSecond);
 	}
 
 	DataRef JpegImgCompressor::compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) {
+		CompressArgs info;
+		info.width = width;
+		info.height = height;
+		info.numChannels = numChannels;
+		info.timeStamp = 0;
+		info.outImportantFrame = false;
+
+		return compress2(src, id, info);
+	}
+
+	DataRef JpegImgCompressor::compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) {
 #ifndef HQREMOTE_NO_JPEG
-		return convertToJpeg(src, width, height, numChannels, m_outputLowRes, m_flip);
+		//quality is predicted for the pixels actually encoded
+		uint32_t encodedWidth = info.width, encodedHeight = info.height;
+		if (m_outputLowRes)
+			getLowResDimensions(info.width, info.height, encodedWidth, encodedHeight);
+
+		const size_t numPixels = (size_t)encodedWidth * encodedHeight;
+		const bool rateControlled = m_qualityController.enabled();
+		const bool hasRegionsOfInterest = info.regionsOfInterest.size() && !m_outputLowRes;
+		int quality = rateControlled ? m_qualityController.pickQuality(numPixels, DEFAULT_JPEG_QUALITY) : 0;
+#if JPEG_ROI_QUALITY_BOOST
+		//without rate control, detail taken from the rest of the image is given to regions of interest by raising quality
+		if (!rateControlled && hasRegionsOfInterest)
+			quality = ROI_JPEG_QUALITY;
+#endif
+		auto regionsOfInterest = hasRegionsOfInterest ? &info.regionsOfInterest : nullptr;
+
+		DataRef compressedFrame;
+		if (m_sliceWorkers) {
+			auto workers = m_sliceWorkers.get();
+			compressedFrame = convertToJpeg(src, info.width, info.height, info.numChannels, m_outputLowRes, m_flip, quality, workers->numSlices,
+											[workers](std::function<void()>&& task) {
+				workers->run(std::move(task));
+			}, regionsOfInterest);
+		}
+		else
+			compressedFrame = convertToJpeg(src, info.width, info.height, info.numChannels, m_outputLowRes, m_flip, quality, regionsOfInterest);
+
+		if (rateControlled && compressedFrame)
+			m_qualityController.onCompressed(quality, numPixels, compressedFrame->size());
+
+		return compressedFrame;
+#else
+		return nullptr;
+#endif
+	}
+
+	unsigned int JpegImgCompressor::getNumRefinementLevels() const {
+		return m_outputLowRes ? 0 : sizeof(JPEG_REFINEMENT_QUALITIES) / sizeof(JPEG_REFINEMENT_QUALITIES[0]);
+	}
+
+	DataRef JpegImgCompressor::compressRefinement(ConstDataRef src, uint64_t id, const CompressArgs& info, unsigned int level) {
+#ifndef HQREMOTE_NO_JPEG
+		if (level == 0 || level > getNumRefinementLevels() || m_outputLowRes)
+			return nullptr;
+
+		//refined tiles are small, slice encoding isn't worth it
+		return convertToJpeg(src, info.width, info.height, info.numChannels, false, m_flip, JPEG_REFINEMENT_QUALITIES[level - 1]);
 #else
 		return nullptr;
 #endif
 	}
 
 	/*-------------- ZlibImgComressor ----------------*/
-	ZlibImgComressor::ZlibImgComressor(int level) {
+	ZlibImgComressor::ZlibImgComressor(int level)
+		: ZlibImgComressor(level, COMPRESSION_CODEC_ZLIB)
+	{
+	}
+
+	ZlibImgComressor::ZlibImgComressor(int level, CompressionCodec codec, bool outputLowRes) {
 		m_level = level;
+		m_codec = codec;
+		m_outputLowRes = outputLowRes;
 	}
 
 	DataRef ZlibImgComressor::compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) {
+		if (m_outputLowRes) {
+			try {
+				src = downscaleToLowRes(src, width, height, numChannels);
+			}
+			catch (...) {
+				return nullptr;
+			}
+		}
+
 		return compress(src->data(), src->size(), width, height, numChannels);
 	}
 
@@ -53,10 +209,10 @@ namespace HQRemote {
 		compressedData->push_back(&width, sizeof(width));
 		compressedData->push_back(&height, sizeof(height));
 		compressedData->push_back(&numChannels, sizeof(numChannels));
-		compressedData->expand(4);//padding
+		compressedData->push_back(&m_codec, sizeof(m_codec));//used to be zero padding, which is zlib codec
 
 		try {
-			zlibCompress(src, size, m_level, *compressedData);
+			compressData(m_codec, src, size, m_level, *compressedData);
 		}
 		catch (...)
 		{
@@ -78,12 +234,15 @@ namespace HQRemote {
 		memcpy(&height, csrc + sizeof(width), sizeof(height));
 		memcpy(&numChannels, csrc + (sizeof(width) + sizeof(height)), sizeof(numChannels));
 
-		auto compressedDataOffset = (sizeof(width) + sizeof(height) + sizeof(numChannels) + 4);
+		CompressionCodec codec;
+		memcpy(&codec, csrc + (sizeof(width) + sizeof(height) + sizeof(numChannels)), sizeof(codec));
+
+		auto compressedDataOffset = (sizeof(width) + sizeof(height) + sizeof(numChannels) + sizeof(codec));
 		auto compressedData = (csrc + compressedDataOffset);
 		auto compressedSize = srcSize - compressedDataOffset;
 
 		try {
-			return zlibDecompress(compressedData, compressedSize);
+			return decompressData(codec, compressedData, compressedSize);
 		}
 		catch (...) {
 			return nullptr;
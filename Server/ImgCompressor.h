@@ -21,6 +21,13 @@
 
 #include "../Common.h"
 #include "../Data.h"
+#include "../Event.h"
+#include "../ZlibUtils.h"
+#include "../PartialFrame.h"
+#include "RateControl.h"
+#include "ImageScaler.h"
+
+#include <functional>
 
 namespace HQRemote {
 	class HQREMOTE_API IImgCompressor {
@@ -30,10 +37,16 @@ namespace HQRemote {
 			unsigned int numChannels;
 			uint64_t timeStamp; // millisecond
 			bool outImportantFrame; // write true to this upon return to indicate the frame is important
+			// regions the user is looking at (see Engine::enableTouchROI()), in src image's space. Lossy compressors may spend less
+			// on the rest of the image in favor of them. Empty means the whole image matters equally. Regions may have zero size,
+			// i.e. a partial frame's tile away from the frame's regions of interest
+			std::vector<FrameRect> regionsOfInterest;
 		};
 
 		virtual ~IImgCompressor() {}
 
+		// returned data (of compress2() too) can be a HeadroomData having at least FRAME_EVENT_HEADROOM bytes of headroom,
+		// in that case the engine will send it without copying
 		virtual DataRef compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) {
 			return nullptr;
 		}
@@ -47,32 +60,182 @@ namespace HQRemote {
 		virtual DataRef anyMoreCompressedOutput(bool& important) { return nullptr; }
 
 		virtual bool canSupportMultiThreads() const { return true; }
+
+		// make the next output an important frame decodable on its own, i.e. after client lost a frame (see REFRESH_REQUEST event).
+		// Called by a compression thread before compressing the frame. Compressors whose frames are all self-contained can ignore it
+		virtual void requestKeyFrame() {}
+
+		// partial frames (see Engine::enablePartialFrames()). The compressor must be able to compress any sub image of a frame
+		// independently, and the decoded sub image must be placeable at the same position in the decoded whole frame
+		virtual bool supportsPartialFrames() const { return false; }
+		// true if decoded image is vertically flipped compared to the source frame
+		virtual bool isOutputFlipped() const { return false; }
+
+		// rate control (see Engine::enableRateControl()): compressor should adapt its output so that frames produced at
+		// <framesPerSecond> fit in <bytesPerSecond>. <bytesPerSecond> = 0 means no limit
+		virtual void setTargetBitrate(float bytesPerSecond, float framesPerSecond) {}
+
+		// progressive refinement (see Engine::enableProgressiveRefinement()): number of quality levels above the compressor's
+		// normal output, the last one being lossless or as close as the codec gets. 0 means refinement is not supported
+		virtual unsigned int getNumRefinementLevels() const { return 0; }
+		// compress a sub image at refinement <level> in [1, getNumRefinementLevels()], it must be decodable the same way as
+		// output of compress2()
+		virtual DataRef compressRefinement(ConstDataRef src, uint64_t id, const CompressArgs& info, unsigned int level) { return nullptr; }
 	};
 
 	class HQREMOTE_API JpegImgCompressor : public IImgCompressor {
 	public:
-		JpegImgCompressor(bool outputLowRes, bool outputFlipped);
+		//<outputLowRes> downscales frames to half of their dimensions before compression (see getLowResDimensions()), client can
+		//upscale them to host's frame dimensions (see HOST_INFO event). Partial frames are not supported in that case.
+		//<numSlices> > 1 enables slice parallel encoding: each frame is split into horizontal bands encoded concurrently by
+		//this compressor's worker threads, then stitched into one JPEG image using restart markers. This reduces the latency
+		//of a single frame rather than throughput. Pass 0 to use one band per CPU core
+		JpegImgCompressor(bool outputLowRes, bool outputFlipped, unsigned int numSlices = 1);
+		~JpegImgCompressor();
 
 		virtual DataRef compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) override;
+		//MCUs outside regions of interest have their luma resolution halved, rate control then raises quality of the whole image
+		//with the saved bits. Regions of interest are ignored with <outputLowRes>
+		virtual DataRef compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) override;
 
+		virtual bool supportsPartialFrames() const override { return !m_outputLowRes; }
+		virtual bool isOutputFlipped() const override { return m_flip; }
+
+		//quality of each frame is picked by JpegQualityController while a target is set. Otherwise it is DEFAULT_JPEG_QUALITY
+		virtual void setTargetBitrate(float bytesPerSecond, float framesPerSecond) override;
+
+		//refinement levels are JPEG qualities above the rate controlled range, up to 100
+		virtual unsigned int getNumRefinementLevels() const override;
+		virtual DataRef compressRefinement(ConstDataRef src, uint64_t id, const CompressArgs& info, unsigned int level) override;
 	private:
+		struct SliceWorkers;
+
 		bool m_outputLowRes;
 		bool m_flip;
+		std::unique_ptr<SliceWorkers> m_sliceWorkers;
+		JpegQualityController m_qualityController;
 	};
 
 	class HQREMOTE_API ZlibImgComressor : public IImgCompressor{
 	public:
 		ZlibImgComressor(int level = 0);//pass 0 to use default compression level, -1 to disable compression
+		//<level> is only used by zlib codec. NOTE: decompress() of older versions only understands zlib codec.
+		//<outputLowRes> downscales frames before compression, see JpegImgCompressor
+		ZlibImgComressor(int level, CompressionCodec codec, bool outputLowRes = false);
 
 		virtual DataRef compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) override;
 		DataRef compress(const void* src, size_t size, uint32_t width, uint32_t height, unsigned int numChannels);
 		static DataRef decompress(ConstDataRef src, uint32_t& width, uint32_t &height, unsigned int& numChannels);
 		static DataRef decompress(const void* src, size_t srcSize, uint32_t& width, uint32_t &height, unsigned int& numChannels);
+
+		virtual bool supportsPartialFrames() const override { return !m_outputLowRes; }
 	private:
 		int m_level;
+		CompressionCodec m_codec;
+		bool m_outputLowRes;
+	};
+
+	//lossless inter frame compressor: each frame is encoded as its byte wise difference from the previous frame, which is
+	//mostly zeros for static or slowly changing content, then compressed by <codec>. Every <keyFrameInterval> frames
+	//(or when frame dimensions change) a key frame holding the whole image is emitted and flagged as important.
+	//Frames must be decoded in order by DeltaImgDecompressor, a lost frame makes the following ones undecodable until next key frame
+	//(see requestKeyFrame()).
+	//Only operates in pipeline mode (see canSupportMultiThreads())
+	class HQREMOTE_API DeltaImgCompressor : public IImgCompressor {
+	public:
+		//<level> is only used by zlib codec
+		DeltaImgCompressor(unsigned int keyFrameInterval = 60, CompressionCodec codec = COMPRESSION_CODEC_LZ4, int level = 0);
+
+		virtual DataRef compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) override;
+
+		virtual bool canSupportMultiThreads() const override { return false; }
+
+		virtual void requestKeyFrame() override { m_keyFrameRequested = true; }
+	private:
+		unsigned int m_keyFrameInterval;
+		CompressionCodec m_codec;
+		int m_level;
+
+		ConstDataRef m_prevFrame;
+		uint32_t m_prevWidth, m_prevHeight;
+		unsigned int m_prevNumChannels;
+		uint64_t m_sequence;//sequence number of last compressed frame
+		unsigned int m_framesSinceKeyFrame;
+		bool m_keyFrameRequested;
+		DataRef m_residual;
 	};
 
+	//content adaptive compressor: the frame is split into tiles of <tileSize> pixels (rounded up to multiple of 16, JPEG's MCU size),
+	//each tile is classified by its number of colors & gradients:
+	//- few colors (text, UI): palette + indices, lossless.
+	//- many colors but mostly flat or sharp edges (anti-aliased text, UI with shading): raw pixels, lossless.
+	//- mostly smooth gradients (photos, video): JPEG.
+	//Lossless tiles & the tile map are compressed together by <losslessCodec>. JPEG tiles are encoded as one JPEG image of the whole
+	//frame, in which lossless tiles are flat & cost next to nothing. Use decompress() to decode
+	class HQREMOTE_API HybridImgCompressor : public IImgCompressor {
+	public:
+		//decode a JPEG image into tightly packed pixels of the same number of channels as the frame, top row first
+		typedef std::function<DataRef(const void* data, size_t size, uint32_t& width, uint32_t& height)> JpegDecoder;
+
+		HybridImgCompressor(uint32_t tileSize = 32, CompressionCodec losslessCodec = COMPRESSION_CODEC_ZLIB);
+
+		virtual DataRef compress(ConstDataRef src, uint64_t id, uint32_t width, uint32_t height, unsigned int numChannels) override;
+		//regions of interest are handled by JPEG tiles the same way as JpegImgCompressor does
+		virtual DataRef compress2(ConstDataRef src, const uint64_t id, CompressArgs& info) override;
+		static DataRef decompress(const void* src, size_t srcSize, uint32_t& width, uint32_t &height, unsigned int& numChannels,
+								  const JpegDecoder& jpegDecoder);
+
+		virtual bool supportsPartialFrames() const override { return true; }
+
+		//quality of JPEG tiles is picked by JpegQualityController while a target is set
+		virtual void setTargetBitrate(float bytesPerSecond, float framesPerSecond) override;
+
+		//level 1 encodes JPEG tiles at high quality, level 2 encodes every tile losslessly
+		virtual unsigned int getNumRefinementLevels() const override { return 2; }
+		virtual DataRef compressRefinement(ConstDataRef src, uint64_t id, const CompressArgs& info, unsigned int level) override;
+	private:
+		//<jpegQuality> = 0 means rate controlled quality, < 0 means no JPEG tile
+		DataRef compressTiles(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, int jpegQuality,
+							  const std::vector<FrameRect>* regionsOfInterest = nullptr);
+
+		uint32_t m_tileSize;
+		CompressionCodec m_losslessCodec;
+		JpegQualityController m_qualityController;
+	};
+
+	//decoder of DeltaImgCompressor's output.
+	//NOTE: not thread safe
+	class HQREMOTE_API DeltaImgDecompressor {
+	public:
+		DeltaImgDecompressor();
+
+		//feed compressed frames in the order they are rendered. Return the reconstructed frame, or nullptr if the frame can't
+		//be decoded (i.e. a preceding frame was lost), decoding resumes at next key frame.
+		//The returned data is updated in place by subsequent calls
+		ConstDataRef decompress(const void* src, size_t srcSize, uint32_t& width, uint32_t &height, unsigned int& numChannels);
+		ConstDataRef decompress(ConstDataRef src, uint32_t& width, uint32_t &height, unsigned int& numChannels);
+
+		//drop current reference frame, i.e. after reconnecting
+		void reset();
+	private:
+		DataRef m_frame;
+		uint32_t m_width, m_height;
+		unsigned int m_numChannels;
+		uint64_t m_sequence;
+	};
+
+	const int DEFAULT_JPEG_QUALITY = 80;
+
+	//<outputlowRes> downscales the frame to low res dimensions first (see getLowResDimensions())
 	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip);
+	//<quality> is in [1, 100], pass 0 to use the default quality.
+	//Outside of <regionsOfInterest> (in src image's space, see IImgCompressor::CompressArgs) the image is encoded with less detail
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  const std::vector<FrameRect>* regionsOfInterest = nullptr);
+	//slice parallel version. <runAsync> is used to encode all bands except the first one, which is encoded by the calling thread
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  unsigned int numSlices, const std::function<void(std::function<void()>&&)>& runAsync,
+						  const std::vector<FrameRect>* regionsOfInterest = nullptr);
 	DataRef convertToPng(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip);
 }
 
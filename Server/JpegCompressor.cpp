@@ -18,8 +18,15 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 #include "ImgCompressor.h"
+#include "ColorConversion.h"
+#include "../BufferPool.h"
 
 #include "jpeglib.h"
 
@@ -27,69 +34,365 @@
 #	define MIN(a,b) (a) < (b)? (a) : (b)
 #endif
 
+#ifndef MAX
+#	define MAX(a,b) ((a) > (b)? (a) : (b))
+#endif
+
+#define JPEG_MCU_SIZE (2 * DCTSIZE)//4:2:0 subsampling
+#define ROI_BLUR_PASSES 3//outside of regions of interest
+
 namespace HQRemote {
-	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip) {
-		//TODO: deal with <outputlowRes>
+	//libjpeg destination writing directly to a HeadroomData, so the output can be wrapped by FrameEvent in place
+	struct HeadroomDestination {
+		jpeg_destination_mgr pub;
+		HeadroomData* buffer;
+	};
+
+	static void initHeadroomDestination(j_compress_ptr cinfo) {
+		auto dest = (HeadroomDestination*)cinfo->dest;
+		dest->pub.next_output_byte = dest->buffer->data();
+		dest->pub.free_in_buffer = dest->buffer->size();
+	}
+
+	static boolean emptyHeadroomDestination(j_compress_ptr cinfo) {
+		auto dest = (HeadroomDestination*)cinfo->dest;
+		auto oldSize = dest->buffer->size();
+		dest->buffer->resize(oldSize * 2);
+
+		dest->pub.next_output_byte = dest->buffer->data() + oldSize;
+		dest->pub.free_in_buffer = dest->buffer->size() - oldSize;
+		return TRUE;
+	}
+
+	static void termHeadroomDestination(j_compress_ptr cinfo) {
+		auto dest = (HeadroomDestination*)cinfo->dest;
+		dest->buffer->resize(dest->buffer->size() - dest->pub.free_in_buffer);
+	}
+
+	//1 for each MCU of the output image overlapping one of <regions>, which are in source image's space
+	static std::vector<unsigned char> makeDetailMask(uint32_t width, uint32_t height, bool flip, const std::vector<FrameRect>& regions) {
+		const uint32_t numMCUCols = (width + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE;
+		const uint32_t numMCURows = (height + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE;
+		std::vector<unsigned char> mask((size_t)numMCUCols * numMCURows, 0);
+
+		for (auto& region : regions) {
+			if (region.x >= width || region.y >= height || region.width == 0 || region.height == 0)
+				continue;
+
+			uint32_t right = MIN(region.x + region.width, width);
+			uint32_t top = region.y, bottom = MIN(region.y + region.height, height);
+			if (flip) {
+				top = height - bottom;
+				bottom = height - region.y;
+			}
+
+			for (uint32_t row = top / JPEG_MCU_SIZE; row * JPEG_MCU_SIZE < bottom; ++row)
+				for (uint32_t col = region.x / JPEG_MCU_SIZE; col * JPEG_MCU_SIZE < right; ++col)
+					mask[row * numMCUCols + col] = 1;
+		}
+
+		return mask;
+	}
+
+	//blur luma of the MCUs of current MCU row not in <rowDetailMask>. With less high frequencies they cost much less at the same quality
+	static void reduceMCURowDetail(JSAMPROW* yRows, uint32_t numMCUCols, const unsigned char* rowDetailMask) {
+		int horizontal[JPEG_MCU_SIZE][JPEG_MCU_SIZE];
+
+		for (uint32_t col = 0; col < numMCUCols; ++col) {
+			if (rowDetailMask[col])
+				continue;
+
+			//separable [1 2 1] filter, repeated to get a wider kernel. Pixels outside of the MCU are replaced by the nearest edge
+			for (int pass = 0; pass < ROI_BLUR_PASSES; ++pass) {
+				for (int y = 0; y < JPEG_MCU_SIZE; ++y) {
+					auto row = yRows[y] + col * JPEG_MCU_SIZE;
+					for (int x = 0; x < JPEG_MCU_SIZE; ++x)
+						horizontal[y][x] = row[MAX(x - 1, 0)] + 2 * row[x] + row[MIN(x + 1, JPEG_MCU_SIZE - 1)];
+				}
+
+				for (int y = 0; y < JPEG_MCU_SIZE; ++y) {
+					auto row = yRows[y] + col * JPEG_MCU_SIZE;
+					for (int x = 0; x < JPEG_MCU_SIZE; ++x)
+						row[x] = (JSAMPLE)((horizontal[MAX(y - 1, 0)][x] + 2 * horizontal[y][x] + horizontal[MIN(y + 1, JPEG_MCU_SIZE - 1)][x] + 8) >> 4);
+				}
+			}
+		}
+	}
+
+	//encode rows [<firstRow>, <firstRow> + <numRows>) of the frame as a standalone JPEG image. <firstRow> must be a multiple of MCU height.
+	//With <restartEachMCURow>, a restart marker is emitted after each MCU row so that separately encoded bands can be stitched together.
+	//<detailMask> (see makeDetailMask()) tells which MCUs keep their full detail, nullptr means all of them
+	static void encodeJpegRows(const unsigned char* src, uint32_t width, uint32_t height, unsigned int numChannels, int quality, bool flip,
+							   uint32_t firstRow, uint32_t numRows, bool restartEachMCURow, const unsigned char* detailMask, HeadroomData* output)
+	{
+		//initial guess of compressed size, it will grow if needed
+		output->resize(MAX((size_t)width * numRows * numChannels / 8, (size_t)4096));
+
+		HeadroomDestination dest;
+		dest.pub.init_destination = initHeadroomDestination;
+		dest.pub.empty_output_buffer = emptyHeadroomDestination;
+		dest.pub.term_destination = termHeadroomDestination;
+		dest.buffer = output;
 
-		unsigned char* compressedFrameData = NULL;
-		unsigned long compressedFrameSize = 0;
 		//compress the frame using JPEG lib
 		jpeg_compress_struct cinfo;
 		jpeg_error_mgr jerr;
 
-		JSAMPROW row_pointer[1];
 		cinfo.err = jpeg_std_error(&jerr);
 		jpeg_create_compress(&cinfo);
-		jpeg_mem_dest(&cinfo, &compressedFrameData, &compressedFrameSize);
+		cinfo.dest = &dest.pub;
 
 		/* Setting the parameters of the output file here */
-		//TODO: only support 3 color channels for now
-		assert(numChannels == 3);
+		assert(numChannels == 3 || numChannels == 4);
 		cinfo.image_width = width;
-		cinfo.image_height = height;
-		cinfo.input_components = numChannels;
-		cinfo.in_color_space = JCS_RGB;
+		cinfo.image_height = numRows;
+		cinfo.input_components = 3;
+		cinfo.in_color_space = JCS_YCbCr;
 		/* default compression parameters, we shouldn't be worried about these */
 
-		jpeg_set_defaults(&cinfo);
+		jpeg_set_defaults(&cinfo);//4:2:0 sampling factors for YCbCr
 		cinfo.num_components = 3;
 		//cinfo.data_precision = 4;
 		cinfo.dct_method = JDCT_FLOAT;
-		jpeg_set_quality(&cinfo, outputlowRes ? 40 : 80, TRUE);//TODO: a bit low quality
+		jpeg_set_quality(&cinfo, quality, TRUE);
+		if (restartEachMCURow)
+			cinfo.restart_in_rows = 1;
+
+		//color conversion & downsampling are done by us, libjpeg only does DCT & entropy coding
+		cinfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+		//libjpeg 7+ would otherwise use 16x16 DCT on full resolution chroma instead of 4:2:0 planes
+		cinfo.do_fancy_downsampling = FALSE;
+#endif
+
+		//libjpeg consumes one MCU row (16 luma rows, 8 chroma rows) per call. Planes are padded to whole blocks
+		const uint32_t lumaStride = (width + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE * JPEG_MCU_SIZE;
+		const uint32_t chromaStride = lumaStride / 2;
+		const uint32_t chromaWidth = (width + 1) / 2;
+		const size_t srcStride = (size_t)width * numChannels;
+		auto planes = makePooledData(JPEG_MCU_SIZE * lumaStride + JPEG_MCU_SIZE * chromaStride);
+
+		JSAMPROW yRows[JPEG_MCU_SIZE], cbRows[DCTSIZE], crRows[DCTSIZE];
+		JSAMPARRAY mcuRows[3] = { yRows, cbRows, crRows };
+		for (int i = 0; i < JPEG_MCU_SIZE; ++i)
+			yRows[i] = planes->data() + i * lumaStride;
+		for (int i = 0; i < DCTSIZE; ++i) {
+			cbRows[i] = yRows[0] + JPEG_MCU_SIZE * lumaStride + i * chromaStride;
+			crRows[i] = cbRows[0] + DCTSIZE * chromaStride + i * chromaStride;
+		}
 
 		/* Now do the compression .. */
 		jpeg_start_compress(&cinfo, TRUE);
-		/* like reading a file, this time write one row at a time */
-		if (flip)
+		while (cinfo.next_scanline < cinfo.image_height)
 		{
-			while (cinfo.next_scanline < cinfo.image_height)
-			{
-				row_pointer[0] = (unsigned char*)&src->data()[(cinfo.image_height - cinfo.next_scanline - 1) * cinfo.image_width * cinfo.input_components];
-				jpeg_write_scanlines(&cinfo, row_pointer, 1);
+			for (uint32_t i = 0; i < DCTSIZE; ++i) {
+				//rows past the bottom edge replicate the last row
+				uint32_t y0 = MIN(firstRow + cinfo.next_scanline + 2 * i, height - 1);
+				uint32_t y1 = MIN(firstRow + cinfo.next_scanline + 2 * i + 1, height - 1);
+				//flipping is done by picking source rows in reversed order
+				if (flip) {
+					y0 = height - 1 - y0;
+					y1 = height - 1 - y1;
+				}
+
+				convertRGBToYCbCr420(src + y0 * srcStride, src + y1 * srcStride, numChannels, width,
+									 yRows[2 * i], yRows[2 * i + 1], cbRows[i], crRows[i]);
+
+				//right edge padding replicates the last column
+				memset(yRows[2 * i] + width, yRows[2 * i][width - 1], lumaStride - width);
+				memset(yRows[2 * i + 1] + width, yRows[2 * i + 1][width - 1], lumaStride - width);
+				memset(cbRows[i] + chromaWidth, cbRows[i][chromaWidth - 1], chromaStride - chromaWidth);
+				memset(crRows[i] + chromaWidth, crRows[i][chromaWidth - 1], chromaStride - chromaWidth);
 			}
-		}//flip
-		else {
-			while (cinfo.next_scanline < cinfo.image_height)
-			{
-				row_pointer[0] = (unsigned char*)&src->data()[cinfo.next_scanline * cinfo.image_width * cinfo.input_components];
-				jpeg_write_scanlines(&cinfo, row_pointer, 1);
+
+			if (detailMask) {
+				const uint32_t numMCUCols = lumaStride / JPEG_MCU_SIZE;
+				const uint32_t mcuRow = (firstRow + cinfo.next_scanline) / JPEG_MCU_SIZE;
+				reduceMCURowDetail(yRows, numMCUCols, detailMask + mcuRow * numMCUCols);
 			}
-		}//flip
+
+			jpeg_write_raw_data(&cinfo, mcuRows, JPEG_MCU_SIZE);
+		}
 		/* similar to read file, clean up after we're done compressing */
 		jpeg_finish_compress(&cinfo);
 		jpeg_destroy_compress(&cinfo);
 
 		//TODO: error checking
+	}
+
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip) {
+		return convertToJpeg(src, width, height, numChannels, outputlowRes, flip, 0);
+	}
 
-		if (compressedFrameData != NULL) {
-			return std::make_shared<CData>(
-				compressedFrameData,
-				compressedFrameSize,
-				[](unsigned char*data) {
-				free(data);
-			});
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  const std::vector<FrameRect>* regionsOfInterest)
+	{
+		if (outputlowRes)
+			src = downscaleToLowRes(src, width, height, numChannels);
+		if (quality <= 0)
+			quality = DEFAULT_JPEG_QUALITY;
+
+		std::vector<unsigned char> detailMask;
+		if (regionsOfInterest && regionsOfInterest->size() && !outputlowRes)
+			detailMask = makeDetailMask(width, height, flip, *regionsOfInterest);
+
+		auto compressedFrame = std::make_shared<HeadroomData>(FRAME_EVENT_HEADROOM);
+		encodeJpegRows(src->data(), width, height, numChannels, quality, flip, 0, height, false,
+					   detailMask.size() ? detailMask.data() : nullptr, compressedFrame.get());
+
+		return compressedFrame;
+	}
+
+	/*------------- slice parallel encoding -----------*/
+	//return offset of entropy coded data following SOS marker. <sofOffset> receives offset of SOFn marker. Return 0 if not found
+	static size_t findJpegScanData(const unsigned char* data, size_t size, size_t& sofOffset) {
+		size_t offset = 2;//skip SOI
+		sofOffset = 0;
+		while (offset + 4 <= size && data[offset] == 0xff) {
+			auto marker = data[offset + 1];
+			size_t length = (data[offset + 2] << 8) | data[offset + 3];
+
+			if (marker >= 0xc0 && marker <= 0xc2)
+				sofOffset = offset;
+
+			offset += 2 + length;
+			if (marker == 0xda)//SOS
+				return offset <= size ? offset : 0;
+		}
+
+		return 0;
+	}
+
+	//append entropy coded data of a band, its restart markers are renumbered to continue from <firstMCURow>
+	static void appendJpegScanData(HeadroomData& output, const unsigned char* data, size_t size, uint32_t firstMCURow) {
+		auto offset = output.size();
+		output.push_back(data, size);
+
+		auto scan = output.data() + offset;
+		for (size_t i = 0; i + 1 < size; ++i) {
+			//0xff in entropy coded data is either stuffed with 0x00 or part of a marker
+			if (scan[i] == 0xff && scan[i + 1] >= 0xd0 && scan[i + 1] <= 0xd7) {
+				scan[i + 1] = 0xd0 + (scan[i + 1] - 0xd0 + firstMCURow) % 8;
+				i++;
+			}
+		}
+	}
+
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  unsigned int numSlices, const std::function<void(std::function<void()>&&)>& runAsync,
+						  const std::vector<FrameRect>* regionsOfInterest)
+	{
+		if (outputlowRes) {
+			src = downscaleToLowRes(src, width, height, numChannels);
+			outputlowRes = false;
+			regionsOfInterest = nullptr;
+		}
+
+		//split at MCU rows boundaries, so that each band ends exactly where a restart marker would be
+		const uint32_t numMCURows = (height + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE;
+		numSlices = MIN(numSlices, numMCURows);
+		if (numSlices <= 1 || !runAsync)
+			return convertToJpeg(src, width, height, numChannels, outputlowRes, flip, quality, regionsOfInterest);
+
+		if (quality <= 0)
+			quality = DEFAULT_JPEG_QUALITY;
+
+		std::vector<unsigned char> detailMask;
+		if (regionsOfInterest && regionsOfInterest->size())
+			detailMask = makeDetailMask(width, height, flip, *regionsOfInterest);
+		const unsigned char* detailMaskData = detailMask.size() ? detailMask.data() : nullptr;
+
+		//first band is written to the final output, the others are appended to it after being encoded by other threads
+		std::vector<std::shared_ptr<HeadroomData> > bands(numSlices);
+		std::vector<uint32_t> firstMCURows(numSlices + 1);
+		for (unsigned int i = 0; i <= numSlices; ++i)
+			firstMCURows[i] = (uint32_t)((uint64_t)numMCURows * i / numSlices);
+
+		try {
+			for (unsigned int i = 0; i < numSlices; ++i)
+				bands[i] = std::make_shared<HeadroomData>(i == 0 ? FRAME_EVENT_HEADROOM : 0);
 		}
+		catch (...) {
+			return nullptr;
+		}
+
+		std::mutex lock;
+		std::condition_variable cv;
+		unsigned int numPendingSlices = 0;
+		bool ok = true;
+
+		auto encodeBand = [&](unsigned int i) {
+			auto firstRow = firstMCURows[i] * JPEG_MCU_SIZE;
+			auto numRows = (MIN(firstMCURows[i + 1] * JPEG_MCU_SIZE, height)) - firstRow;
+			try {
+				encodeJpegRows(src->data(), width, height, numChannels, quality, flip, firstRow, numRows, true, detailMaskData, bands[i].get());
+				return true;
+			}
+			catch (...) {
+				return false;
+			}
+		};
+
+		for (unsigned int i = 1; i < numSlices; ++i) {
+			std::unique_lock<std::mutex> lk(lock);
+			numPendingSlices++;
+			lk.unlock();
+
+			try {
+				runAsync([&, i] {
+					bool bandOk = encodeBand(i);
+
+					std::lock_guard<std::mutex> lg(lock);
+					ok = ok && bandOk;
+					if (--numPendingSlices == 0)
+						cv.notify_all();
+				});
+			}
+			catch (...) {
+				lk.lock();
+				numPendingSlices--;
+				ok = false;
+				break;
+			}
+		}
+
+		//calling thread encodes the first band
+		bool firstBandOk = encodeBand(0);
+
+		{
+			//scheduled tasks refer to local variables, wait for all of them
+			std::unique_lock<std::mutex> lk(lock);
+			cv.wait(lk, [&] { return numPendingSlices == 0; });
+			if (!ok || !firstBandOk)
+				return nullptr;
+		}
+
+		//stitch the bands: headers of first band with the whole image's height, then each band's entropy coded data separated by restart markers
+		auto& output = bands[0];
+		size_t sofOffset;
+		auto scanOffset = findJpegScanData(output->data(), output->size(), sofOffset);
+		if (scanOffset == 0 || sofOffset == 0 || output->size() < scanOffset + 2)
+			return nullptr;
+
+		output->data()[sofOffset + 5] = (unsigned char)(height >> 8);
+		output->data()[sofOffset + 6] = (unsigned char)(height & 0xff);
+		output->resize(output->size() - 2);//strip EOI
+
+		for (unsigned int i = 1; i < numSlices; ++i) {
+			auto& band = bands[i];
+			size_t bandSofOffset;
+			auto bandScanOffset = findJpegScanData(band->data(), band->size(), bandSofOffset);
+			if (bandScanOffset == 0 || band->size() < bandScanOffset + 2)
+				return nullptr;
+
+			const unsigned char restartMarker[] = { 0xff, (unsigned char)(0xd0 + (firstMCURows[i] - 1) % 8) };
+			output->push_back(restartMarker, sizeof(restartMarker));
+			appendJpegScanData(*output, band->data() + bandScanOffset, band->size() - bandScanOffset - 2, firstMCURows[i]);
+		}
+
+		const unsigned char eoi[] = { 0xff, 0xd9 };
+		output->push_back(eoi, sizeof(eoi));
 
-		return nullptr;
+		return output;
 	}
 }
\ No newline at end of file
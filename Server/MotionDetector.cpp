@@ -0,0 +1,218 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "MotionDetector.h"
+#include "../TileCache.h"
+
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#define MIN_SCROLL_LINES 16//shorter bands are cheaper to send as tiles
+#define MIN_SCROLL_VOTES 4
+
+namespace HQRemote {
+	static inline uint64_t mixPixel(uint64_t h, uint32_t pixel) {
+		h ^= pixel * 0x9E3779B97F4A7C15ull;
+		return ((h << 29) | (h >> 35)) * 0xC2B2AE3D27D4EB4Full;
+	}
+
+	//hash each row segment [x0, x1) of rows [y0, y1)
+	static void hashRows(const unsigned char* frame, size_t stride, unsigned int numChannels, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1,
+						 std::vector<uint64_t>& hashes)
+	{
+		hashes.resize(y1 - y0);
+		for (uint32_t y = y0; y < y1; ++y)
+			hashes[y - y0] = hashTile(frame + y * stride + (size_t)x0 * numChannels, stride, x1 - x0, 1, numChannels);
+	}
+
+	//hash each column segment [y0, y1) of columns [x0, x1). Rows are visited in order so that memory is read sequentially
+	static void hashColumns(const unsigned char* frame, size_t stride, unsigned int numChannels, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1,
+							std::vector<uint64_t>& hashes)
+	{
+		hashes.assign(x1 - x0, 0);
+		for (uint32_t y = y0; y < y1; ++y) {
+			auto pixel = frame + y * stride + (size_t)x0 * numChannels;
+			for (uint32_t x = x0; x < x1; ++x, pixel += numChannels) {
+				uint32_t value = 0;
+				memcpy(&value, pixel, numChannels < 4 ? numChannels : 4);
+				hashes[x - x0] = mixPixel(hashes[x - x0], value);
+			}
+		}
+	}
+
+	//find offset <d> such that line <i> of <lines> equals line <i - d> of <refLines> for most lines, then the longest run of such lines.
+	//<lines>[0] is line <firstLine> of the frame, <refLines> covers all lines of the frame
+	static bool findShift(const std::vector<uint64_t>& lines, const std::vector<uint64_t>& refLines, uint32_t firstLine, uint32_t maxShift,
+						  int32_t& shift, uint32_t& runStart, uint32_t& runLength)
+	{
+		//lines repeated in reference frame (i.e. blank ones) can't tell the offset
+		std::unordered_map<uint64_t, int64_t> uniqueRefLines;
+		uniqueRefLines.reserve(refLines.size());
+		for (size_t i = 0; i < refLines.size(); ++i) {
+			auto result = uniqueRefLines.insert(std::make_pair(refLines[i], (int64_t)i));
+			if (!result.second)
+				result.first->second = -1;
+		}
+
+		std::vector<uint32_t> votes(2 * maxShift + 1, 0);
+		for (size_t i = 0; i < lines.size(); ++i) {
+			auto ite = uniqueRefLines.find(lines[i]);
+			if (ite == uniqueRefLines.end() || ite->second < 0)
+				continue;
+			auto d = (int64_t)(firstLine + i) - ite->second;
+			if (d != 0 && d >= -(int64_t)maxShift && d <= (int64_t)maxShift)
+				votes[(size_t)(d + maxShift)]++;
+		}
+
+		uint32_t bestVotes = 0;
+		for (size_t i = 0; i < votes.size(); ++i) {
+			if (votes[i] > bestVotes) {
+				bestVotes = votes[i];
+				shift = (int32_t)i - (int32_t)maxShift;
+			}
+		}
+
+		if (bestVotes < MIN_SCROLL_VOTES)
+			return false;
+
+		//longest run of lines matching at this offset, repeated lines included
+		runLength = 0;
+		uint32_t curRunStart = 0, curRunLength = 0;
+		for (uint32_t i = 0; i < lines.size(); ++i) {
+			auto refLine = (int64_t)(firstLine + i) - shift;
+			if (refLine >= 0 && refLine < (int64_t)refLines.size() && lines[i] == refLines[(size_t)refLine]) {
+				if (curRunLength++ == 0)
+					curRunStart = firstLine + i;
+				if (curRunLength > runLength) {
+					runLength = curRunLength;
+					runStart = curRunStart;
+				}
+			}
+			else
+				curRunLength = 0;
+		}
+
+		return runLength >= MIN_SCROLL_LINES;
+	}
+
+	//shrink <region> to the bounding box of pixels differing between both frames. Static content beside a scrolled area
+	//(i.e. a side bar or margins) must be excluded, otherwise lines would never match
+	static bool findDifferingBounds(const unsigned char* frame, const unsigned char* refFrame, size_t stride, unsigned int numChannels, FrameRect& region) {
+		const size_t rowSize = (size_t)region.width * numChannels;
+		size_t minByte = rowSize, maxByte = 0;
+		uint32_t minY = region.y + region.height, maxY = 0;
+
+		for (uint32_t y = region.y; y < region.y + region.height; ++y) {
+			auto row = frame + y * stride + (size_t)region.x * numChannels;
+			auto refRow = refFrame + y * stride + (size_t)region.x * numChannels;
+
+			size_t first = 0;
+			while (first < rowSize && row[first] == refRow[first])
+				++first;
+			if (first == rowSize)
+				continue;
+
+			size_t last = rowSize - 1;
+			while (row[last] == refRow[last])
+				--last;
+
+			minByte = first < minByte ? first : minByte;
+			maxByte = last > maxByte ? last : maxByte;
+			minY = y < minY ? y : minY;
+			maxY = y;
+		}
+
+		if (minByte > maxByte)
+			return false;
+
+		auto x = region.x + (uint32_t)(minByte / numChannels);
+		region.width = region.x + (uint32_t)(maxByte / numChannels) + 1 - x;
+		region.x = x;
+		region.height = maxY + 1 - minY;
+		region.y = minY;
+
+		return true;
+	}
+
+	//hash collisions are unlikely but copying wrong pixels would stick until next key frame
+	static bool verifyCopy(const unsigned char* frame, const unsigned char* refFrame, size_t stride, unsigned int numChannels, const CopyRectCommand& copy) {
+		const size_t rowSize = (size_t)copy.rect.width * numChannels;
+		for (uint32_t y = 0; y < copy.rect.height; ++y) {
+			if (memcmp(frame + (copy.rect.y + y) * stride + (size_t)copy.rect.x * numChannels,
+					   refFrame + (copy.srcY + y) * stride + (size_t)copy.srcX * numChannels, rowSize))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool HQ_FASTCALL detectScroll(const unsigned char* frame, const unsigned char* refFrame, uint32_t width, uint32_t height,
+								  unsigned int numChannels, const FrameRect& searchRegion, uint32_t maxShift, CopyRectCommand& copy)
+	{
+		auto region = searchRegion;
+		if (region.width == 0 || region.height == 0 || region.x + region.width > width || region.y + region.height > height
+			|| !findDifferingBounds(frame, refFrame, (size_t)width * numChannels, numChannels, region))
+			return false;
+
+		maxShift = maxShift < width ? maxShift : width;
+		maxShift = maxShift < height ? maxShift : height;
+
+		const size_t stride = (size_t)width * numChannels;
+		const uint32_t x0 = region.x, x1 = region.x + region.width;
+		const uint32_t y0 = region.y, y1 = region.y + region.height;
+		std::vector<uint64_t> lines, refLines;
+		int32_t shift;
+		uint32_t runStart, runLength;
+
+		//vertical scroll is by far the most common, rows are hashed across the region's span only, since content beside it
+		//(i.e. a side bar) doesn't move
+		hashRows(frame, stride, numChannels, x0, x1, y0, y1, lines);
+		hashRows(refFrame, stride, numChannels, x0, x1, 0, height, refLines);
+
+		if (findShift(lines, refLines, y0, maxShift, shift, runStart, runLength)) {
+			copy.rect.x = x0;
+			copy.rect.y = runStart;
+			copy.rect.width = region.width;
+			copy.rect.height = runLength;
+			copy.srcX = x0;
+			copy.srcY = runStart - shift;
+
+			if (verifyCopy(frame, refFrame, stride, numChannels, copy))
+				return true;
+		}
+
+		hashColumns(frame, stride, numChannels, x0, x1, y0, y1, lines);
+		hashColumns(refFrame, stride, numChannels, 0, width, y0, y1, refLines);
+
+		if (findShift(lines, refLines, x0, maxShift, shift, runStart, runLength)) {
+			copy.rect.x = runStart;
+			copy.rect.y = y0;
+			copy.rect.width = runLength;
+			copy.rect.height = region.height;
+			copy.srcX = runStart - shift;
+			copy.srcY = y0;
+
+			if (verifyCopy(frame, refFrame, stride, numChannels, copy))
+				return true;
+		}
+
+		return false;
+	}
+}
@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_MOTION_DETECTOR_H
+#define HQREMOTE_MOTION_DETECTOR_H
+
+#include "../Common.h"
+#include "../PartialFrame.h"
+
+#include <stdint.h>
+
+namespace HQRemote {
+	//find the dominant scroll inside <searchRegion> of <frame> compared to <refFrame>: the largest band of differing pixels whose content is
+	//the same as <refFrame>'s moved vertically or horizontally by at most <maxShift> pixels. Lines (rows or columns) of both frames are
+	//hashed, lines matching a unique line of <refFrame> vote for their offset, then the longest run of matching lines at the winning
+	//offset is verified pixel by pixel. Return false if no band worth copying is found
+	HQREMOTE_API bool HQ_FASTCALL detectScroll(const unsigned char* frame, const unsigned char* refFrame, uint32_t width, uint32_t height,
+											   unsigned int numChannels, const FrameRect& searchRegion, uint32_t maxShift, CopyRectCommand& copy);
+}
+
+#endif
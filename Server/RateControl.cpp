@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "RateControl.h"
+
+#include <math.h>
+
+#ifndef MIN
+#	define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#	define MAX(a,b) ((a) > (b) ? (a) : (b))
+#endif
+
+//how compressed size changes with quality. Measured on screen content: ~0.5 for text, ~0.85 for natural images
+#define JPEG_QUALITY_SIZE_EXPONENT 0.65
+#define JPEG_COMPLEXITY_SMOOTHING 0.25
+#define MAX_JPEG_QUALITY_STEP 10
+
+#define DEFAULT_INITIAL_BANDWIDTH (1024.f * 1024.f)
+#define HEAVY_LOSS_RATE 0.1f
+#define LIGHT_LOSS_RATE 0.02f
+#define CONGESTION_BACKOFF_FACTOR 0.85f
+#define PROBING_INCREASE_FACTOR 1.08f
+#define RTT_INFLATION_RATIO 1.5
+#define RTT_INFLATION_MARGIN 0.025//seconds
+#define MIN_RTT_FORGET_INTERVAL 20//reports
+
+namespace HQRemote {
+	/*--------------- JpegQualityController -------------*/
+	JpegQualityController::JpegQualityController(int minQuality, int maxQuality)
+		: m_minQuality(minQuality), m_maxQuality(maxQuality), m_targetFrameSize(0), m_framePixels(0), m_complexity(0), m_lastQuality(-1)
+	{
+	}
+
+	void JpegQualityController::setTarget(float bytesPerSecond, float framesPerSecond) {
+		std::lock_guard<std::mutex> lg(m_lock);
+		if (bytesPerSecond > 0 && framesPerSecond > 0)
+			m_targetFrameSize = bytesPerSecond / framesPerSecond;
+		else
+			m_targetFrameSize = 0;
+	}
+
+	bool JpegQualityController::enabled() const {
+		std::lock_guard<std::mutex> lg(m_lock);
+		return m_targetFrameSize > 0;
+	}
+
+	double JpegQualityController::sizeFactor(int quality) {
+		//libjpeg's scaling of quantization tables in percents
+		double scale = quality < 50 ? 5000.0 / quality : 200.0 - 2 * quality;
+		return pow(100.0 / scale, JPEG_QUALITY_SIZE_EXPONENT);
+	}
+
+	int JpegQualityController::pickQuality(size_t numPixels, int defaultQuality) {
+		std::lock_guard<std::mutex> lg(m_lock);
+		if (m_targetFrameSize <= 0)
+			return defaultQuality;
+
+		if (numPixels > m_framePixels)
+			m_framePixels = numPixels;
+		if (m_lastQuality < 0)
+			m_lastQuality = MAX(m_minQuality, MIN(m_maxQuality, defaultQuality));
+		if (m_complexity <= 0 || m_framePixels == 0)//nothing to predict from yet
+			return m_lastQuality;
+
+		//invert the model to find the quality whose predicted size matches the budget
+		double budgetPerPixel = m_targetFrameSize / m_framePixels;
+		double scale = 100.0 / pow(budgetPerPixel / m_complexity, 1.0 / JPEG_QUALITY_SIZE_EXPONENT);
+		double quality = scale <= 100.0 ? (200.0 - scale) / 2 : 5000.0 / scale;
+
+		//limit the change per frame, so a single unusual frame doesn't cause visible quality jumps
+		int newQuality = (int)quality;
+		newQuality = MAX(m_lastQuality - MAX_JPEG_QUALITY_STEP, MIN(m_lastQuality + MAX_JPEG_QUALITY_STEP, newQuality));
+		newQuality = MAX(m_minQuality, MIN(m_maxQuality, newQuality));
+
+		m_lastQuality = newQuality;
+
+		return newQuality;
+	}
+
+	void JpegQualityController::onCompressed(int quality, size_t numPixels, size_t compressedSize) {
+		if (numPixels == 0 || compressedSize == 0 || quality <= 0)
+			return;
+
+		double complexity = (double)compressedSize / numPixels / sizeFactor(quality);
+
+		std::lock_guard<std::mutex> lg(m_lock);
+		if (m_complexity <= 0 || m_framePixels == 0)
+			m_complexity = complexity;
+		else {
+			//small regions of partial frames have less say
+			double weight = JPEG_COMPLEXITY_SMOOTHING * MIN(1.0, (double)numPixels / m_framePixels);
+			m_complexity += weight * (complexity - m_complexity);
+		}
+	}
+
+	/*--------------- BandwidthEstimator -------------*/
+	BandwidthEstimator::BandwidthEstimator(float minBytesPerSec, float maxBytesPerSec) {
+		reset(minBytesPerSec, maxBytesPerSec);
+	}
+
+	void BandwidthEstimator::reset(float minBytesPerSec, float maxBytesPerSec) {
+		m_minRate = minBytesPerSec;
+		m_maxRate = MAX(minBytesPerSec, maxBytesPerSec);
+		m_target = MAX(m_minRate, MIN(m_maxRate, DEFAULT_INITIAL_BANDWIDTH));
+		m_minRtt = -1;
+		m_numReports = 0;
+	}
+
+	float BandwidthEstimator::onReceiverReport(float receivedBytesPerSec, float lossRate, double rtt) {
+		m_numReports++;
+
+		bool rttInflated = false;
+		if (rtt >= 0) {
+			if (m_minRtt < 0 || rtt < m_minRtt)
+				m_minRtt = rtt;
+			else if (m_numReports % MIN_RTT_FORGET_INTERVAL == 0)//route might have changed
+				m_minRtt += 0.1 * (rtt - m_minRtt);
+
+			rttInflated = rtt > m_minRtt * RTT_INFLATION_RATIO + RTT_INFLATION_MARGIN;
+		}
+
+		//when congested, what the receiver actually got is a better estimate than our target
+		float base = (receivedBytesPerSec > 0 && receivedBytesPerSec < m_target) ? receivedBytesPerSec : m_target;
+
+		if (lossRate > HEAVY_LOSS_RATE)
+			m_target = base * (1.f - 0.5f * MIN(lossRate, 1.f));
+		else if (lossRate > LIGHT_LOSS_RATE || rttInflated)
+			m_target = base * CONGESTION_BACKOFF_FACTOR;
+		else if (receivedBytesPerSec >= 0.5f * m_target)//only probe when the budget is actually used
+			m_target *= PROBING_INCREASE_FACTOR;
+
+		m_target = MAX(m_minRate, MIN(m_maxRate, m_target));
+
+		return m_target;
+	}
+
+	float BandwidthEstimator::onFeedbackTimeout() {
+		m_target = MAX(m_minRate, 0.5f * m_target);
+
+		return m_target;
+	}
+}
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_RATE_CONTROL_H
+#define HQREMOTE_RATE_CONTROL_H
+
+#include "../Common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	//picks JPEG quality of each frame so that compressed frames fit a target bitrate.
+	//Compressed size is predicted from previous frames using the model: bytes per pixel = c * (100 / scale(quality)) ^ alpha,
+	//where scale() is libjpeg's quality to quantization table scaling and c tracks the frames' content complexity.
+	//Thread safe, frames can be compressed concurrently
+	class HQREMOTE_API JpegQualityController {
+	public:
+		JpegQualityController(int minQuality = 10, int maxQuality = 90);
+
+		//<bytesPerSecond> = 0 disables rate control
+		void setTarget(float bytesPerSecond, float framesPerSecond);
+		bool enabled() const;
+
+		//quality to compress an image of <numPixels> pixels with. A partial frame's region gets the same quality as a whole frame would.
+		//Return <defaultQuality> if rate control is disabled
+		int pickQuality(size_t numPixels, int defaultQuality);
+		//feed the real compressed size back to the predictor
+		void onCompressed(int quality, size_t numPixels, size_t compressedSize);
+	private:
+		static double sizeFactor(int quality);
+
+		mutable std::mutex m_lock;
+		const int m_minQuality, m_maxQuality;
+		float m_targetFrameSize;
+		size_t m_framePixels;//largest image seen, assumed to be the whole frame
+		double m_complexity;//c in the model above, 0 until first frame is compressed
+		int m_lastQuality;
+	};
+
+	//estimates the bitrate the link can carry from receiver reports (see RECEIVER_REPORT event).
+	//Backs off on loss or when round trip time grows above its minimum (queues building up along the path),
+	//otherwise probes slowly upward
+	class HQREMOTE_API BandwidthEstimator {
+	public:
+		BandwidthEstimator(float minBytesPerSec, float maxBytesPerSec);
+
+		void reset(float minBytesPerSec, float maxBytesPerSec);
+
+		//<receivedBytesPerSec> & <lossRate> are measured by receiver. <rtt> is in seconds, pass negative value if not available.
+		//Return the new target
+		float onReceiverReport(float receivedBytesPerSec, float lossRate, double rtt);
+		//no report arrived for a while although frames were sent, e.g. none of the frames got through. Return the new target
+		float onFeedbackTimeout();
+		float getTarget() const { return m_target; }
+		float getMinTarget() const { return m_minRate; }
+		float getMaxTarget() const { return m_maxRate; }
+	private:
+		float m_minRate, m_maxRate;
+		float m_target;
+		double m_minRtt;
+		uint32_t m_numReports;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
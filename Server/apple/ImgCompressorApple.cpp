@@ -60,7 +60,9 @@ namespace HQRemote {
 		CFMutableDataRef cfData;
 	};
 	
-	DataRef convertToImgType(const CFStringRef outputType, ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip) {
+	//<quality> is in (0, 1] for lossy formats, ignored if not positive
+	DataRef convertToImgType(const CFStringRef outputType, ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip,
+							 float quality = 0) {
 		auto dstRef = std::make_shared<CFDataWrapper>(0);
 		
 		auto srcDataProvider = CGDataProviderCreateWithData(NULL,
@@ -98,18 +100,29 @@ namespace HQRemote {
 															   NULL);
 			
 			if (dstCreator) {
+				if (quality > 0) {
+					auto qualityNumber = CFNumberCreate(NULL, kCFNumberFloatType, &quality);
+					if (qualityNumber) {
+						const void* keys[] = { kCGImageDestinationLossyCompressionQuality };
+						const void* values[] = { qualityNumber };
+						auto properties = CFDictionaryCreate(NULL, keys, values, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+						if (properties) {
+							CGImageDestinationSetProperties(dstCreator, properties);
+							CFRelease(properties);
+						}
+						CFRelease(qualityNumber);
+					}
+				}
+
 				if (outputlowRes || flip)
 				{
 					//resize the image to lower resolution
 					int outputWidth, outputHeight;
 					
 					if (outputlowRes) {
-						float widthRatio = 200.f / width;
-						float heightRatio = 400.f / height;
-						
-						float ratio = MIN(widthRatio, heightRatio);
-						int lowres_width = (int)(width * ratio);
-						int lowres_height = (int)(height * ratio);
+						//same dimensions as other platforms
+						uint32_t lowres_width, lowres_height;
+						getLowResDimensions(width, height, lowres_width, lowres_height);
 						
 						outputWidth = lowres_width;
 						outputHeight = lowres_height;
@@ -175,6 +188,23 @@ namespace HQRemote {
 		return convertToImgType(kUTTypeJPEG, src, width, height, numChannels, outputlowRes, flip);
 	}
 	
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  const std::vector<FrameRect>* regionsOfInterest)
+	{
+		//ImageIO has no control over detail of parts of the image, regions of interest are ignored
+		if (quality <= 0)
+			return convertToJpeg(src, width, height, numChannels, outputlowRes, flip);
+		return convertToImgType(kUTTypeJPEG, src, width, height, numChannels, outputlowRes, flip, MIN(quality, 100) / 100.f);
+	}
+	
+	DataRef convertToJpeg(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip, int quality,
+						  unsigned int numSlices, const std::function<void(std::function<void()>&&)>& runAsync,
+						  const std::vector<FrameRect>* regionsOfInterest)
+	{
+		//TODO: ImageIO cannot encode restart markers, slices are not supported
+		return convertToJpeg(src, width, height, numChannels, outputlowRes, flip, quality, regionsOfInterest);
+	}
+	
 	DataRef convertToPng(ConstDataRef src, uint32_t width, uint32_t height, unsigned int numChannels, bool outputlowRes, bool flip)
 	{
 		return convertToImgType(kUTTypePNG, src, width, height, numChannels, outputlowRes, flip);
@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "TileCache.h"
+
+#include <string.h>
+
+namespace HQRemote {
+	/*------------ hashTile -----------*/
+	static inline uint64_t hashMix(uint64_t h, uint64_t word) {
+		h ^= word * 0x9E3779B97F4A7C15ull;
+		h = (h << 31) | (h >> 33);
+		return h * 0xC2B2AE3D27D4EB4Full;
+	}
+
+	uint64_t HQ_FASTCALL hashTile(const unsigned char* data, size_t stride, uint32_t width, uint32_t height, unsigned int numChannels) {
+		const size_t rowSize = (size_t)width * numChannels;
+		//2 independent lanes so that the multiplications overlap
+		uint64_t h0 = hashMix(0x27D4EB2F165667C5ull, ((uint64_t)width << 32) | height);
+		uint64_t h1 = hashMix(0x165667B19E3779F9ull, numChannels);
+
+		for (uint32_t y = 0; y < height; ++y) {
+			auto row = data + y * stride;
+			size_t i = 0;
+			for (; i + 16 <= rowSize; i += 16) {
+				uint64_t w0, w1;
+				memcpy(&w0, row + i, sizeof(w0));
+				memcpy(&w1, row + i + 8, sizeof(w1));
+				h0 = hashMix(h0, w0);
+				h1 = hashMix(h1, w1);
+			}
+
+			if (i < rowSize) {
+				uint64_t tail[2] = { 0, 0 };
+				memcpy(tail, row + i, rowSize - i);
+				h0 = hashMix(h0, tail[0]);
+				h1 = hashMix(h1, tail[1]);
+			}
+		}
+
+		//final avalanche
+		uint64_t h = h0 ^ (h1 * 0x9E3779B97F4A7C15ull);
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+	/*------------ TileCacheMirror -----------*/
+	TileCacheMirror::TileCacheMirror(uint32_t numSlots)
+		: m_slots(numSlots > 0 ? (numSlots < MAX_TILE_CACHE_SLOTS ? numSlots : MAX_TILE_CACHE_SLOTS) : 1)
+	{
+		clear();
+	}
+
+	void TileCacheMirror::clear() {
+		m_lru.clear();
+		m_slotOfHash.clear();
+
+		for (uint32_t i = 0; i < m_slots.size(); ++i) {
+			auto& slot = m_slots[i];
+			slot.hash = 0;
+			slot.storeFrameId = 0;
+			slot.used = false;
+			slot.lruIte = m_lru.insert(m_lru.end(), i);
+		}
+	}
+
+	bool TileCacheMirror::find(uint64_t hash, uint64_t ackedFrameId, uint32_t& slotIdx, uint64_t& storeFrameId) {
+		auto ite = m_slotOfHash.find(hash);
+		if (ite == m_slotOfHash.end())
+			return false;
+
+		auto& slot = m_slots[ite->second];
+		if (slot.storeFrameId > ackedFrameId)
+			return false;
+
+		//most recently used
+		m_lru.splice(m_lru.end(), m_lru, slot.lruIte);
+
+		slotIdx = ite->second;
+		storeFrameId = slot.storeFrameId;
+
+		return true;
+	}
+
+	uint32_t TileCacheMirror::insert(uint64_t hash, uint64_t frameId) {
+		auto slotIdx = m_lru.front();
+		auto& slot = m_slots[slotIdx];
+
+		if (slot.used) {
+			auto ite = m_slotOfHash.find(slot.hash);
+			if (ite != m_slotOfHash.end() && ite->second == slotIdx)
+				m_slotOfHash.erase(ite);
+		}
+
+		slot.hash = hash;
+		slot.storeFrameId = frameId;
+		slot.used = true;
+		m_lru.splice(m_lru.end(), m_lru, slot.lruIte);
+
+		m_slotOfHash[hash] = slotIdx;
+
+		return slotIdx;
+	}
+
+	void TileCacheMirror::forgetStores(uint64_t firstFrameId, uint64_t lastFrameId) {
+		for (uint32_t i = 0; i < m_slots.size(); ++i) {
+			auto& slot = m_slots[i];
+			if (!slot.used || slot.storeFrameId < firstFrameId || slot.storeFrameId > lastFrameId)
+				continue;
+
+			auto ite = m_slotOfHash.find(slot.hash);
+			if (ite != m_slotOfHash.end() && ite->second == i)
+				m_slotOfHash.erase(ite);
+
+			slot.hash = 0;
+			slot.storeFrameId = 0;
+			slot.used = false;
+			m_lru.splice(m_lru.begin(), m_lru, slot.lruIte);
+		}
+	}
+}
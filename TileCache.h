@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HQREMOTE_TILE_CACHE_H
+#define HQREMOTE_TILE_CACHE_H
+
+#include "Common.h"
+#include "Data.h"
+
+#include <stdint.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(push)
+#	pragma warning(disable:4251)
+#endif
+
+namespace HQRemote {
+	//upper limit of cache slots a client has to keep
+	const uint32_t MAX_TILE_CACHE_SLOTS = 4096;
+
+	//64 bits content hash of a <width> x <height> pixels tile, its dimensions are part of the hash.
+	//<stride> is the distance in bytes between 2 rows
+	HQREMOTE_API uint64_t HQ_FASTCALL hashTile(const unsigned char* data, size_t stride, uint32_t width, uint32_t height, unsigned int numChannels);
+
+	//host side mirror of client's tile cache (see FrameCompositor). It remembers which content each slot holds & which frame stored it,
+	//the client keeps the decoded pixels. Slots are reused in least recently used order.
+	//NOTE: not thread safe
+	class HQREMOTE_API TileCacheMirror {
+	public:
+		TileCacheMirror(uint32_t numSlots);
+
+		uint32_t getNumSlots() const { return (uint32_t)m_slots.size(); }
+
+		//find the slot holding tile <hash>. Only slots stored by frames up to <ackedFrameId> are returned, later ones may not have
+		//reached the client yet. Return false if there is no such slot.
+		//NOTE: acknowledging a frame id doesn't prove every earlier frame arrived, see forgetStores()
+		bool find(uint64_t hash, uint64_t ackedFrameId, uint32_t& slot, uint64_t& storeFrameId);
+		//true if tile <hash> is stored, acknowledged or not
+		bool contains(uint64_t hash) const { return m_slotOfHash.find(hash) != m_slotOfHash.end(); }
+
+		//store tile <hash> in least recently used slot, the store command is sent in frame <frameId>. Return the slot
+		uint32_t insert(uint64_t hash, uint64_t frameId);
+		//forget tiles stored by frames <firstFrameId> to <lastFrameId>, the client reported them lost. Their slots are reused first
+		void forgetStores(uint64_t firstFrameId, uint64_t lastFrameId);
+
+		void clear();
+	private:
+		struct Slot {
+			uint64_t hash;
+			uint64_t storeFrameId;
+			bool used;
+			std::list<uint32_t>::iterator lruIte;
+		};
+
+		std::vector<Slot> m_slots;
+		std::list<uint32_t> m_lru;//least recently used slot first
+		std::unordered_map<uint64_t, uint32_t> m_slotOfHash;
+	};
+}
+
+#if defined WIN32 || defined _MSC_VER
+#	pragma warning(pop)
+#endif
+
+#endif
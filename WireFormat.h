@@ -0,0 +1,207 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HQREMOTE_WIRE_FORMAT_H
+#define HQREMOTE_WIRE_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+//helpers for byte order independent compact encoding: varints & little endian fixed size values
+namespace HQRemote {
+	static const size_t MAX_VARINT32_SIZE = 5;
+	static const size_t MAX_VARINT64_SIZE = 10;
+
+	static inline size_t varintSize(uint64_t value) {
+		size_t size = 1;
+		while (value >= 0x80) {
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	static inline uint32_t zigzagEncode(int32_t value) {
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	}
+
+	static inline int32_t zigzagDecode(uint32_t value) {
+		return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	}
+
+	//sequential writer. Caller must make sure the destination is large enough
+	class WireWriter {
+	public:
+		WireWriter(void* dst)
+			: m_begin((unsigned char*)dst), m_ptr((unsigned char*)dst)
+		{}
+
+		size_t size() const { return m_ptr - m_begin; }
+
+		void writeVarint(uint64_t value) {
+			while (value >= 0x80) {
+				*m_ptr++ = (unsigned char)(value | 0x80);
+				value >>= 7;
+			}
+			*m_ptr++ = (unsigned char)value;
+		}
+
+		void writeU8(uint8_t value) { *m_ptr++ = value; }
+
+		void writeU16(uint16_t value) {
+			m_ptr[0] = (unsigned char)value;
+			m_ptr[1] = (unsigned char)(value >> 8);
+			m_ptr += 2;
+		}
+
+		void writeU32(uint32_t value) {
+			for (int i = 0; i < 4; ++i)
+				*m_ptr++ = (unsigned char)(value >> (8 * i));
+		}
+
+		void writeU64(uint64_t value) {
+			for (int i = 0; i < 8; ++i)
+				*m_ptr++ = (unsigned char)(value >> (8 * i));
+		}
+
+		void writeFloat(float value) {
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			writeU32(bits);
+		}
+
+		void writeDouble(double value) {
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			writeU64(bits);
+		}
+
+		void writeBytes(const void* data, size_t size) {
+			memcpy(m_ptr, data, size);
+			m_ptr += size;
+		}
+	private:
+		unsigned char* m_begin;
+		unsigned char* m_ptr;
+	};
+
+	//sequential reader. Reading past the end sets failed flag & returns zeros
+	class WireReader {
+	public:
+		WireReader(const void* src, size_t size)
+			: m_begin((const unsigned char*)src), m_ptr((const unsigned char*)src), m_end((const unsigned char*)src + size), m_failed(false)
+		{}
+
+		bool failed() const { return m_failed; }
+		size_t position() const { return m_ptr - m_begin; }
+		size_t remainSize() const { return m_end - m_ptr; }
+		const unsigned char* current() const { return m_ptr; }
+
+		uint64_t readVarint() {
+			uint64_t value = 0;
+			for (unsigned int shift = 0; shift < 64; shift += 7) {
+				if (m_ptr == m_end)
+					break;
+				auto byte = *m_ptr++;
+				value |= (uint64_t)(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return value;
+			}
+
+			m_failed = true;
+			return 0;
+		}
+
+		uint8_t readU8() {
+			if (!require(1))
+				return 0;
+			return *m_ptr++;
+		}
+
+		uint16_t readU16() {
+			if (!require(2))
+				return 0;
+			uint16_t value = (uint16_t)(m_ptr[0] | (m_ptr[1] << 8));
+			m_ptr += 2;
+			return value;
+		}
+
+		uint32_t readU32() {
+			if (!require(4))
+				return 0;
+			uint32_t value = 0;
+			for (int i = 0; i < 4; ++i)
+				value |= (uint32_t)(*m_ptr++) << (8 * i);
+			return value;
+		}
+
+		uint64_t readU64() {
+			if (!require(8))
+				return 0;
+			uint64_t value = 0;
+			for (int i = 0; i < 8; ++i)
+				value |= (uint64_t)(*m_ptr++) << (8 * i);
+			return value;
+		}
+
+		float readFloat() {
+			auto bits = readU32();
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		double readDouble() {
+			auto bits = readU64();
+			double value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		bool readBytes(void* dst, size_t size) {
+			if (!require(size))
+				return false;
+			memcpy(dst, m_ptr, size);
+			m_ptr += size;
+			return true;
+		}
+
+		bool skip(size_t size) {
+			if (!require(size))
+				return false;
+			m_ptr += size;
+			return true;
+		}
+	private:
+		bool require(size_t size) {
+			if (m_failed || (size_t)(m_end - m_ptr) < size)
+			{
+				m_failed = true;
+				return false;
+			}
+			return true;
+		}
+
+		const unsigned char* m_begin;
+		const unsigned char* m_ptr;
+		const unsigned char* m_end;
+		bool m_failed;
+	};
+}
+
+#endif
@@ -17,6 +17,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "ZlibUtils.h"
+#include "BufferPool.h"
 #include "Common.h"
 
 #include <zlib.h>
@@ -24,88 +25,556 @@
 #include <assert.h>
 #include <string>
 #include <limits>
+#include <mutex>
+#include <vector>
 
 #ifdef max
 #	undef max
 #endif
 
-#define COMPRESS_CHUNK_SIZE (256 * 1024)
+#define ZLIB_MAX_IDLE_CONTEXTS 4 //per direction, a deflate state at default level takes ~256KB
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 //last bytes of a block are always literals
+#define LZ4_MF_LIMIT 12 //last match must start at least this many bytes before end of block
+#define LZ4_HASH_LOG 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_SKIP_TRIGGER 6 //speed up on incompressible data
 
 namespace HQRemote {
-	void HQ_FASTCALL zlibCompress(const IData& uncompressedData, int level, GrowableData& dst) {
-		zlibCompress(uncompressedData.data(), uncompressedData.size(), level, dst);
-	}
+	/*----------- reusable zlib contexts -----------*/
+	//deflate & inflate states are kept in small pools and reset instead of being reallocated for every call
+	struct ZlibDeflateContext {
+		~ZlibDeflateContext() {
+			if (initialized)
+				deflateEnd(&stream);
+		}
+
+		z_stream* acquire(int level) {
+			if (initialized && level == this->level)
+			{
+				if (deflateReset(&stream) == Z_OK)
+					return &stream;
+			}
+
+			if (initialized)
+				deflateEnd(&stream);
+			memset(&stream, 0, sizeof(stream));
+			initialized = deflateInit(&stream, level) == Z_OK;
+			this->level = level;
+			if (!initialized)
+				throw std::runtime_error("deflateInit failed");
+
+			return &stream;
+		}
+
+		z_stream stream;
+		int level = 0;
+		bool initialized = false;
+	};
+
+	struct ZlibInflateContext {
+		~ZlibInflateContext() {
+			if (initialized)
+				inflateEnd(&stream);
+		}
+
+		z_stream* acquire() {
+			if (initialized && inflateReset(&stream) == Z_OK)
+				return &stream;
+
+			if (initialized)
+				inflateEnd(&stream);
+			memset(&stream, 0, sizeof(stream));
+			initialized = inflateInit(&stream) == Z_OK;
+			if (!initialized)
+				throw std::runtime_error("inflateInit failed");
+
+			return &stream;
+		}
+
+		z_stream stream;
+		bool initialized = false;
+	};
+
+	//NOTE: not thread_local, VS2013 & the Android NDK toolchains we ship with don't support it
+	template <class Context>
+	class ZlibContextPool {
+	public:
+		~ZlibContextPool() {
+			for (auto context : m_idleContexts)
+				delete context;
+		}
+
+		Context* take() {
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				if (m_idleContexts.size())
+				{
+					auto context = m_idleContexts.back();
+					m_idleContexts.pop_back();
+					return context;
+				}
+			}
+
+			return new Context();
+		}
+
+		void giveBack(Context* context) {
+			{
+				std::lock_guard<std::mutex> lg(m_lock);
+				if (m_idleContexts.size() < ZLIB_MAX_IDLE_CONTEXTS)
+				{
+					m_idleContexts.push_back(context);
+					return;
+				}
+			}
+
+			delete context;
+		}
+
+	private:
+		std::mutex m_lock;
+		std::vector<Context*> m_idleContexts;
+	};
+
+	//borrow a context from <pool> for the current scope
+	template <class Context>
+	class ZlibContextHolder {
+	public:
+		ZlibContextHolder(ZlibContextPool<Context>& pool)
+			: m_pool(pool), m_context(pool.take())
+		{}
+		~ZlibContextHolder() {
+			m_pool.giveBack(m_context);
+		}
+
+		Context* operator->() { return m_context; }
+	private:
+		ZlibContextHolder(const ZlibContextHolder&) = delete;
+		ZlibContextHolder& operator=(const ZlibContextHolder&) = delete;
+
+		ZlibContextPool<Context>& m_pool;
+		Context* m_context;
+	};
+
+	static ZlibContextPool<ZlibDeflateContext> g_deflateContexts;
+	static ZlibContextPool<ZlibInflateContext> g_inflateContexts;
 
-	void HQ_FASTCALL zlibCompress(const void* uncompressedData, size_t size, int level, GrowableData& dst) {
+	static inline int toZlibLevel(int level) {
 		if (level == 0)
-			level = Z_DEFAULT_COMPRESSION;
+			return Z_DEFAULT_COMPRESSION;
 		else if (level == -1)
-			level = 0;
+			return 0;
+		return level;
+	}
+
+	//inflate <src> into <dst>, the output must fill <dst> exactly
+	static bool zlibInflate(z_stream* sz, const unsigned char* src, size_t size, unsigned char* dst, size_t dstSize, const ZlibDictionary* dictionary, int flush) {
+		if (size > std::numeric_limits<uInt>::max() || dstSize > std::numeric_limits<uInt>::max())
+			return false;
+
+		sz->next_in = (Bytef*)src;
+		sz->avail_in = (uInt)size;
+		sz->next_out = dst;
+		sz->avail_out = (uInt)dstSize;
 
-		z_stream sz;
-		memset(&sz, 0, sizeof(sz));
+		int re;
+		while ((re = inflate(sz, flush)) == Z_NEED_DICT) {
+			//dictionary is identified by its adler32 checksum
+			if (dictionary == nullptr || sz->adler != dictionary->id() ||
+				inflateSetDictionary(sz, dictionary->data(), (uInt)dictionary->size()) != Z_OK)
+				return false;
+		}
 
-		//placeholder for uncompressed size
+		if (flush == Z_FINISH)
+			return re == Z_STREAM_END && sz->avail_out == 0;
+
+		//inflate stops as soon as the output is full, the end of block & sync flush marker may still be left in the input
+		if (re == Z_OK && sz->avail_in != 0 && sz->avail_out == 0)
+			re = inflate(sz, flush);
+		return re == Z_OK && sz->avail_in == 0 && sz->avail_out == 0;
+	}
+
+	/*----------- ZlibDictionary -----------*/
+	ZlibDictionary::ZlibDictionary(ConstDataRef data)
+		: m_data(data)
+	{
+		m_id = (uint32_t)adler32(adler32(0, Z_NULL, 0), m_data->data(), (uInt)m_data->size());
+	}
+
+	/*----------- zlib -----------*/
+	void HQ_FASTCALL zlibCompress(const IData& uncompressedData, int level, GrowableData& dst, const ZlibDictionary* dictionary) {
+		zlibCompress(uncompressedData.data(), uncompressedData.size(), level, dst, dictionary);
+	}
+
+	void HQ_FASTCALL zlibCompress(const void* uncompressedData, size_t size, int level, GrowableData& dst, const ZlibDictionary* dictionary) {
+		if (size > std::numeric_limits<uint32_t>::max())
+			throw std::runtime_error("uncompressed data too big");
+
+		ZlibContextHolder<ZlibDeflateContext> context(g_deflateContexts);
+		auto sz = context->acquire(toZlibLevel(level));
+		if (dictionary && deflateSetDictionary(sz, dictionary->data(), (uInt)dictionary->size()) != Z_OK)
+			throw std::runtime_error("deflateSetDictionary failed");
+
+		//uncompressed size | compressed data
 		auto uncompressedSizeOff = dst.size();
 		assert(uncompressedSizeOff % sizeof(uint64_t) == 0);
 
-		dst.expand(sizeof(uint64_t));
+		uint64_t uncompressedSize = size;
+		dst.push_back(&uncompressedSize, sizeof(uncompressedSize));
+
+		//compress directly into destination, deflateBound() guarantees a single call is enough
+		auto compressedDataOff = dst.size();
+		auto maxCompressedSize = deflateBound(sz, (uLong)size);
+		dst.resize(compressedDataOff + maxCompressedSize);
+
+		sz->next_in = (Bytef*)uncompressedData;
+		sz->avail_in = (uInt)size;
+		sz->next_out = dst.data() + compressedDataOff;
+		sz->avail_out = (uInt)maxCompressedSize;
+
+		auto re = deflate(sz, Z_FINISH);
+
+		dst.resize(compressedDataOff + (maxCompressedSize - sz->avail_out));
+
+		if (re != Z_STREAM_END)
+		{
+			throw std::runtime_error("compression failed");
+		}
+	}
+
+	DataRef HQ_FASTCALL zlibDecompress(const IData& src, const ZlibDictionary* dictionary) {
+		return zlibDecompress(src.data(), src.size(), dictionary);
+	}
 
-		//compress the data
-		if (deflateInit(&sz, level) != Z_OK)
-		//if (deflateInit2(&sz, level, Z_DEFLATED, 15, 8, Z_DEFAULT_COMPRESSION) != Z_OK)
+	DataRef HQ_FASTCALL zlibDecompress(const void* src, size_t size, const ZlibDictionary* dictionary) {
+		uint64_t uncompressedSize;
+		if (size < sizeof(uncompressedSize))
+			throw  std::runtime_error("Size is too small for decompression");
+		memcpy(&uncompressedSize, src, sizeof(uncompressedSize));
+
+		auto compressedData = (const unsigned char*)src + sizeof(uncompressedSize);
+		auto compressedSize = size - sizeof(uncompressedSize);
+
+		auto decompressedData = makePooledData((size_t)uncompressedSize);
+		ZlibContextHolder<ZlibInflateContext> context(g_inflateContexts);
+		auto sz = context->acquire();
+		if (!zlibInflate(sz, compressedData, compressedSize, decompressedData->data(), decompressedData->size(), dictionary, Z_FINISH)) {
+			throw  std::runtime_error("Decompression failed");
+		}
+
+		return decompressedData;
+	}
+
+	/*----------- ZlibStreamCompressor -----------*/
+	ZlibStreamCompressor::ZlibStreamCompressor(int level, const ZlibDictionary* dictionary)
+		: m_stream(new z_stream())
+	{
+		memset(m_stream, 0, sizeof(*m_stream));
+		if (deflateInit(m_stream, toZlibLevel(level)) != Z_OK)
+		{
+			delete m_stream;
 			throw std::runtime_error("deflateInit failed");
+		}
+
+		if (dictionary)
+			deflateSetDictionary(m_stream, dictionary->data(), (uInt)dictionary->size());
+	}
+
+	ZlibStreamCompressor::~ZlibStreamCompressor() {
+		deflateEnd(m_stream);
+		delete m_stream;
+	}
+
+	void ZlibStreamCompressor::compress(const void* src, size_t size, GrowableData& dst) {
 		if (size > std::numeric_limits<uint32_t>::max())
 			throw std::runtime_error("uncompressed data too big");
 
-		int re;
-		unsigned char buffer[COMPRESS_CHUNK_SIZE];
-		sz.next_in = (unsigned char*)uncompressedData;
-		assert(size <= std::numeric_limits<uint32_t>::max());
-		sz.avail_in = (uint32_t)size;
-		sz.next_out = buffer;
-		sz.avail_out = sizeof(buffer);
+		auto uncompressedSizeOff = dst.size();
+		assert(uncompressedSizeOff % sizeof(uint64_t) == 0);
 
-		while ((re = deflate(&sz, Z_FINISH)) != Z_STREAM_END && re == Z_OK) {
-			dst.push_back(buffer, sizeof(buffer) - sz.avail_out);
+		uint64_t uncompressedSize = size;
+		dst.push_back(&uncompressedSize, sizeof(uncompressedSize));
 
-			sz.next_out = buffer;
-			sz.avail_out = sizeof(buffer);
-		}
+		//sync flush adds a few bytes on top of deflateBound()
+		auto compressedDataOff = dst.size();
+		auto maxCompressedSize = deflateBound(m_stream, (uLong)size) + 16;
+		dst.resize(compressedDataOff + maxCompressedSize);
 
-		dst.push_back(buffer, sizeof(buffer) - sz.avail_out);
+		m_stream->next_in = (Bytef*)src;
+		m_stream->avail_in = (uInt)size;
+		m_stream->next_out = dst.data() + compressedDataOff;
+		m_stream->avail_out = (uInt)maxCompressedSize;
 
-		//finalize
-		deflateEnd(&sz);
-		uint64_t& uncompressedSize = *(uint64_t*)(dst.data() + uncompressedSizeOff);
+		auto re = deflate(m_stream, Z_SYNC_FLUSH);
 
-		uncompressedSize = size;
+		dst.resize(compressedDataOff + (maxCompressedSize - m_stream->avail_out));
 
-		if (re != Z_STREAM_END)
+		if (re != Z_OK || m_stream->avail_in != 0)
 		{
 			throw std::runtime_error("compression failed");
 		}
 	}
 
-	DataRef HQ_FASTCALL zlibDecompress(const IData& src) {
-		return zlibDecompress(src.data(), src.size());
+	/*----------- ZlibStreamDecompressor -----------*/
+	ZlibStreamDecompressor::ZlibStreamDecompressor(const ZlibDictionary* dictionary)
+		: m_stream(new z_stream()), m_dictionary(dictionary)
+	{
+		memset(m_stream, 0, sizeof(*m_stream));
+		if (inflateInit(m_stream) != Z_OK)
+		{
+			delete m_stream;
+			throw std::runtime_error("inflateInit failed");
+		}
+	}
+
+	ZlibStreamDecompressor::~ZlibStreamDecompressor() {
+		inflateEnd(m_stream);
+		delete m_stream;
 	}
 
-	DataRef HQ_FASTCALL zlibDecompress(const void* src, size_t size) {
-		const uint64_t& uncompressedSize = *(const uint64_t*)(src);
-		const unsigned char* compressedData = (const unsigned char*)(&uncompressedSize + 1);
-		_ssize_t compressedSize = (_ssize_t)size - sizeof(uncompressedSize);
-		if (compressedSize < 0)
+	DataRef ZlibStreamDecompressor::decompress(const void* src, size_t size) {
+		uint64_t uncompressedSize;
+		if (size < sizeof(uncompressedSize))
 			throw  std::runtime_error("Size is too small for decompression");
+		memcpy(&uncompressedSize, src, sizeof(uncompressedSize));
 
-		auto decompressedData = std::make_shared<CData>((size_t)uncompressedSize);
-		uLongf decompressedSize = decompressedData->size();
-		int re;
-		if ((re = uncompress(decompressedData->data(), &decompressedSize, compressedData, compressedSize)) != Z_OK
-			|| decompressedSize != uncompressedSize) {
+		auto decompressedData = makePooledData((size_t)uncompressedSize);
+		if (!zlibInflate(m_stream, (const unsigned char*)src + sizeof(uncompressedSize), size - sizeof(uncompressedSize),
+			decompressedData->data(), decompressedData->size(), m_dictionary, Z_SYNC_FLUSH)) {
 			throw  std::runtime_error("Decompression failed");
 		}
 
 		return decompressedData;
 	}
+
+	/*----------- LZ4 block format -----------*/
+	static inline uint32_t lz4Read32(const unsigned char* p) {
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static inline uint32_t lz4Hash(uint32_t sequence) {
+		return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+	}
+
+	static inline size_t lz4CompressBound(size_t size) {
+		return size + size / 255 + 16;
+	}
+
+	static inline void lz4WriteLength(unsigned char* &op, size_t length) {
+		while (length >= 255) {
+			*op++ = 255;
+			length -= 255;
+		}
+		*op++ = (unsigned char)length;
+	}
+
+	static inline void lz4WriteLiterals(unsigned char* &op, unsigned char* token, const unsigned char* literals, size_t length) {
+		*token = (unsigned char)((length >= 15 ? 15 : length) << 4);
+		if (length >= 15)
+			lz4WriteLength(op, length - 15);
+		if (length)
+			memcpy(op, literals, length);
+		op += length;
+	}
+
+	//greedy single pass compressor. <dst> must have at least lz4CompressBound(size) bytes
+	static size_t lz4CompressBlock(const unsigned char* src, size_t size, unsigned char* dst) {
+		auto op = dst;
+		auto ip = src;
+		auto anchor = src;
+		auto iend = src + size;
+
+		if (size > LZ4_MF_LIMIT) {
+			auto mflimit = iend - LZ4_MF_LIMIT;
+			auto matchlimit = iend - LZ4_LAST_LITERALS;
+			uint32_t hashTable[1 << LZ4_HASH_LOG];
+			memset(hashTable, 0, sizeof(hashTable));
+
+			while (ip < mflimit) {
+				auto sequence = lz4Read32(ip);
+				auto hash = lz4Hash(sequence);
+				auto ref = src + hashTable[hash];
+				hashTable[hash] = (uint32_t)(ip - src);
+
+				if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || lz4Read32(ref) != sequence) {
+					ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+					continue;
+				}
+
+				//extend the match backward then forward
+				while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+					ip--;
+					ref--;
+				}
+
+				auto matchEnd = ip + LZ4_MIN_MATCH;
+				auto refEnd = ref + LZ4_MIN_MATCH;
+				while (matchEnd < matchlimit && *matchEnd == *refEnd) {
+					matchEnd++;
+					refEnd++;
+				}
+
+				//sequence = token | literals | offset | match length
+				auto token = op++;
+				lz4WriteLiterals(op, token, anchor, ip - anchor);
+
+				auto offset = (uint16_t)(ip - ref);
+				*op++ = (unsigned char)offset;
+				*op++ = (unsigned char)(offset >> 8);
+
+				size_t matchLength = matchEnd - ip - LZ4_MIN_MATCH;
+				*token |= (unsigned char)(matchLength >= 15 ? 15 : matchLength);
+				if (matchLength >= 15)
+					lz4WriteLength(op, matchLength - 15);
+
+				ip = anchor = matchEnd;
+				if (ip < mflimit)
+					hashTable[lz4Hash(lz4Read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+			}//while (ip < mflimit)
+		}//if (size > LZ4_MF_LIMIT)
+
+		//last literals
+		auto token = op++;
+		lz4WriteLiterals(op, token, anchor, iend - anchor);
+
+		return op - dst;
+	}
+
+	static inline bool lz4ReadLength(const unsigned char* &ip, const unsigned char* iend, size_t& length) {
+		unsigned char byte;
+		do {
+			if (ip >= iend)
+				return false;
+			byte = *ip++;
+			length += byte;
+		} while (byte == 255);
+
+		return true;
+	}
+
+	//return false if the data is malformed or its decompressed size is not <dstSize>
+	static bool lz4DecompressBlock(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize) {
+		auto ip = src;
+		auto iend = src + srcSize;
+		auto op = dst;
+		auto oend = dst + dstSize;
+
+		while (ip < iend) {
+			auto token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !lz4ReadLength(ip, iend, literalLength))
+				return false;
+			if (literalLength > (size_t)(iend - ip) || literalLength > (size_t)(oend - op))
+				return false;
+
+			memcpy(op, ip, literalLength);
+			ip += literalLength;
+			op += literalLength;
+
+			if (ip == iend)
+				break;//last sequence has no match
+
+			if (iend - ip < 2)
+				return false;
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > (size_t)(op - dst))
+				return false;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !lz4ReadLength(ip, iend, matchLength))
+				return false;
+			matchLength += LZ4_MIN_MATCH;
+			if (matchLength > (size_t)(oend - op))
+				return false;
+
+			auto match = op - offset;
+			if (offset >= matchLength)
+				memcpy(op, match, matchLength);
+			else {
+				//overlapped copy
+				for (size_t i = 0; i < matchLength; ++i)
+					op[i] = match[i];
+			}
+			op += matchLength;
+		}
+
+		return op == oend;
+	}
+
+	/*----------- generic codec -----------*/
+	void HQ_FASTCALL compressData(CompressionCodec codec, const void* src, size_t size, int level, GrowableData& dst, const ZlibDictionary* dictionary) {
+		switch (codec) {
+		case COMPRESSION_CODEC_ZLIB:
+			zlibCompress(src, size, level, dst, dictionary);
+			return;
+		case COMPRESSION_CODEC_STORED:
+		case COMPRESSION_CODEC_LZ4:
+			break;
+		default:
+			throw std::runtime_error("unknown compression codec");
+		}
+
+		if (size > std::numeric_limits<uint32_t>::max())
+			throw std::runtime_error("uncompressed data too big");
+
+		auto uncompressedSizeOff = dst.size();
+		assert(uncompressedSizeOff % sizeof(uint64_t) == 0);
+
+		uint64_t uncompressedSize = size;
+		dst.push_back(&uncompressedSize, sizeof(uncompressedSize));
+
+		if (codec == COMPRESSION_CODEC_STORED)
+		{
+			dst.push_back(src, size);
+			return;
+		}
+
+		auto compressedDataOff = dst.size();
+		dst.resize(compressedDataOff + lz4CompressBound(size));
+
+		auto compressedSize = lz4CompressBlock((const unsigned char*)src, size, dst.data() + compressedDataOff);
+
+		dst.resize(compressedDataOff + compressedSize);
+	}
+
+	DataRef HQ_FASTCALL decompressData(CompressionCodec codec, const void* src, size_t size, const ZlibDictionary* dictionary) {
+		if (codec == COMPRESSION_CODEC_ZLIB)
+			return zlibDecompress(src, size, dictionary);
+
+		uint64_t uncompressedSize;
+		if (size < sizeof(uncompressedSize))
+			throw  std::runtime_error("Size is too small for decompression");
+		memcpy(&uncompressedSize, src, sizeof(uncompressedSize));
+
+		auto compressedData = (const unsigned char*)src + sizeof(uncompressedSize);
+		auto compressedSize = size - sizeof(uncompressedSize);
+
+		switch (codec) {
+		case COMPRESSION_CODEC_STORED:
+			if (compressedSize != uncompressedSize)
+				throw  std::runtime_error("Decompression failed");
+
+			return makePooledData(compressedData, compressedSize);
+		case COMPRESSION_CODEC_LZ4:
+		{
+			//LZ4 cannot expand data more than 255 times
+			if (uncompressedSize / 255 > compressedSize || uncompressedSize > std::numeric_limits<size_t>::max())
+				throw  std::runtime_error("Decompression failed");
+
+			auto decompressedData = makePooledData((size_t)uncompressedSize);
+			if (!lz4DecompressBlock(compressedData, compressedSize, decompressedData->data(), decompressedData->size()))
+				throw  std::runtime_error("Decompression failed");
+
+			return decompressedData;
+		}
+		default:
+			throw std::runtime_error("unknown compression codec");
+		}
+	}
 }
@@ -21,13 +21,75 @@
 
 #include "Data.h"
 
+struct z_stream_s;
+
 namespace HQRemote {
+	enum CompressionCodec : uint32_t {
+		COMPRESSION_CODEC_ZLIB,
+		COMPRESSION_CODEC_STORED,//no compression, data is copied as is
+		COMPRESSION_CODEC_LZ4,//LZ4 block format, much faster than zlib but lower ratio
+
+		NUM_COMPRESSION_CODECS
+	};
+
+	//preset dictionary for zlib codec, both sides must use the same dictionary.
+	//Small messages such as event bundles compress much better with it
+	class HQREMOTE_API ZlibDictionary {
+	public:
+		ZlibDictionary(ConstDataRef data);
+
+		const unsigned char* data() const { return m_data->data(); }
+		size_t size() const { return m_data->size(); }
+		//adler32 checksum of the dictionary, zlib stores it in the compressed stream
+		uint32_t id() const { return m_id; }
+	private:
+		ConstDataRef m_data;
+		uint32_t m_id;
+	};
+
 	//pass <level>=0 to use default compression level. <level>=-1 to use no compression at all
-	//<dst>'s current size must be multiple of 64 bits
-	HQREMOTE_API void HQ_FASTCALL zlibCompress(const IData& src, int level, GrowableData& dst);
-	HQREMOTE_API void HQ_FASTCALL zlibCompress(const void* src, size_t size, int level, GrowableData& dst);
-	HQREMOTE_API DataRef HQ_FASTCALL zlibDecompress(const IData& src);
-	HQREMOTE_API DataRef HQ_FASTCALL zlibDecompress(const void* src, size_t size);
+	//<dst>'s current size must be multiple of 64 bits.
+	//zlib states are pooled so repeated calls don't reallocate them
+	HQREMOTE_API void HQ_FASTCALL zlibCompress(const IData& src, int level, GrowableData& dst, const ZlibDictionary* dictionary = nullptr);
+	HQREMOTE_API void HQ_FASTCALL zlibCompress(const void* src, size_t size, int level, GrowableData& dst, const ZlibDictionary* dictionary = nullptr);
+	HQREMOTE_API DataRef HQ_FASTCALL zlibDecompress(const IData& src, const ZlibDictionary* dictionary = nullptr);
+	HQREMOTE_API DataRef HQ_FASTCALL zlibDecompress(const void* src, size_t size, const ZlibDictionary* dictionary = nullptr);
+
+	//generic version of the above functions. Output layout is the same for all codecs: uncompressed size (64 bit) | compressed data.
+	//<level> & <dictionary> are only used by zlib codec. NOTE: remote side only knows codecs other than zlib since protocol version 4
+	HQREMOTE_API void HQ_FASTCALL compressData(CompressionCodec codec, const void* src, size_t size, int level, GrowableData& dst, const ZlibDictionary* dictionary = nullptr);
+	HQREMOTE_API DataRef HQ_FASTCALL decompressData(CompressionCodec codec, const void* src, size_t size, const ZlibDictionary* dictionary = nullptr);
+
+	//persistent zlib stream, each message is terminated by a sync flush so it can be decompressed as soon as it arrives.
+	//Later messages refer to earlier ones, so this is only usable on an ordered & reliable channel, every message must
+	//be passed to the matching ZlibStreamDecompressor in the same order. Output layout is the same as zlibCompress()
+	class HQREMOTE_API ZlibStreamCompressor {
+	public:
+		ZlibStreamCompressor(int level = 0, const ZlibDictionary* dictionary = nullptr);
+		~ZlibStreamCompressor();
+
+		void compress(const void* src, size_t size, GrowableData& dst);
+	private:
+		ZlibStreamCompressor(const ZlibStreamCompressor&) = delete;
+		ZlibStreamCompressor& operator=(const ZlibStreamCompressor&) = delete;
+
+		::z_stream_s* m_stream;
+	};
+
+	class HQREMOTE_API ZlibStreamDecompressor {
+	public:
+		//<dictionary> must outlive this object
+		ZlibStreamDecompressor(const ZlibDictionary* dictionary = nullptr);
+		~ZlibStreamDecompressor();
+
+		DataRef decompress(const void* src, size_t size);
+	private:
+		ZlibStreamDecompressor(const ZlibStreamDecompressor&) = delete;
+		ZlibStreamDecompressor& operator=(const ZlibStreamDecompressor&) = delete;
+
+		::z_stream_s* m_stream;
+		const ZlibDictionary* m_dictionary;
+	};
 }
 
 #endif
\ No newline at end of file
@@ -66,17 +66,28 @@ LOCAL_SRC_FILES := 	ZlibUtils.cpp \
 					BaseEngine.cpp \
 					ConnectionHandler.cpp \
 					Event.cpp \
+					TileCache.cpp \
+					PartialFrame.cpp \
+					BufferPool.cpp \
 					android/JniUtils.cpp \
 					android/ConnectionHandlerAndroid.cpp \
 					unix/ConnectionHandlerUnix.cpp \
 					linux/ConnectionHandlerLinux.cpp \
 					linux/TimerLinux.cpp \
 					Client/Client.cpp \
+					Client/FrameCompositor.cpp \
 					Server/Engine.cpp \
 					Server/ImgCompressor.cpp \
 					Server/JpegCompressor.cpp \
 					Server/PngCompressor.cpp \
 					Server/FrameCapturer.cpp \
+					Server/FrameBufferPool.cpp \
+					Server/HybridCompressor.cpp \
+					Server/MotionDetector.cpp \
+					Server/DeltaCompressor.cpp \
+					Server/ImageScaler.cpp \
+					Server/RateControl.cpp \
+					Server/ColorConversion.cpp \
 					Server/android/EngineAndroid.cpp \
 
 LOCAL_SRC_FILES += $(JPEG_SRC_FILES)
@@ -0,0 +1,264 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2016-2018 Le Hoang Quyen
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//		http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+//round trip & malformed input tests of the compression codecs (see ZlibUtils.h).
+//Build from repo root, i.e.: g++ -std=c++11 -include string.h -I. tests/CompressionCodecTest.cpp ZlibUtils.cpp BufferPool.cpp -lz -o codec_test
+
+#include "../ZlibUtils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <vector>
+
+using namespace HQRemote;
+
+static int g_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			g_failures++; \
+		} \
+	} while (0)
+
+static const char* codecName(CompressionCodec codec) {
+	switch (codec) {
+	case COMPRESSION_CODEC_ZLIB: return "zlib";
+	case COMPRESSION_CODEC_STORED: return "stored";
+	case COMPRESSION_CODEC_LZ4: return "lz4";
+	default: return "unknown";
+	}
+}
+
+static bool tryDecompress(CompressionCodec codec, const void* src, size_t size, DataRef& result) {
+	try {
+		result = decompressData(codec, src, size);
+		return true;
+	}
+	catch (...) {
+		result = nullptr;
+		return false;
+	}
+}
+
+//uncompressed size (64 bit) | LZ4 block
+static std::vector<unsigned char> makeLz4Data(uint64_t uncompressedSize, const std::vector<unsigned char>& block) {
+	std::vector<unsigned char> data(sizeof(uncompressedSize));
+	memcpy(data.data(), &uncompressedSize, sizeof(uncompressedSize));
+	data.insert(data.end(), block.begin(), block.end());
+	return data;
+}
+
+static bool lz4Rejects(uint64_t uncompressedSize, const std::vector<unsigned char>& block) {
+	auto data = makeLz4Data(uncompressedSize, block);
+	DataRef result;
+	return !tryDecompress(COMPRESSION_CODEC_LZ4, data.data(), data.size(), result);
+}
+
+static void testRoundTrip(CompressionCodec codec, const std::vector<unsigned char>& src) {
+	GrowableData compressed;
+	compressData(codec, src.data(), src.size(), 0, compressed);
+
+	DataRef decompressed;
+	bool ok = tryDecompress(codec, compressed.data(), compressed.size(), decompressed);
+	CHECK(ok);
+	if (!ok)
+		return;
+	CHECK(decompressed->size() == src.size());
+	if (decompressed->size() == src.size() && src.size() && memcmp(decompressed->data(), src.data(), src.size()) != 0) {
+		fprintf(stderr, "%s: round trip of %zu bytes mismatched\n", codecName(codec), src.size());
+		g_failures++;
+	}
+}
+
+static void testRoundTrips() {
+	uint32_t seed = 12345;
+	auto random = [&seed] { seed = seed * 1103515245 + 12345; return (unsigned char)(seed >> 16); };
+
+	std::vector<std::vector<unsigned char> > inputs;
+	for (size_t size = 0; size <= 32; ++size) {
+		std::vector<unsigned char> small(size);
+		for (auto& byte : small)
+			byte = random() & 3;
+		inputs.push_back(small);
+	}
+
+	std::vector<unsigned char> zeros(1 << 20, 0);
+	inputs.push_back(zeros);
+
+	std::vector<unsigned char> noise(300 * 1000);
+	for (auto& byte : noise)
+		byte = random();
+	inputs.push_back(noise);
+
+	//repeated text with short & long matches, plus overlapped matches (runs)
+	std::vector<unsigned char> text;
+	const char* words[] = { "frame ", "event ", "touch ", "partial ", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "\n" };
+	while (text.size() < 200 * 1000) {
+		auto word = words[random() % 6];
+		text.insert(text.end(), word, word + strlen(word));
+	}
+	inputs.push_back(text);
+
+	const CompressionCodec codecs[] = { COMPRESSION_CODEC_ZLIB, COMPRESSION_CODEC_STORED, COMPRESSION_CODEC_LZ4 };
+	for (auto codec : codecs) {
+		for (auto& input : inputs)
+			testRoundTrip(codec, input);
+	}
+}
+
+static void testLz4TruncatedInput() {
+	std::vector<unsigned char> src;
+	for (int i = 0; i < 4000; ++i)
+		src.push_back((unsigned char)("0123456789abcdef"[(i * 7) % 16] + (i / 500)));
+
+	GrowableData compressed;
+	compressData(COMPRESSION_CODEC_LZ4, src.data(), src.size(), 0, compressed);
+
+	//every shorter prefix must be rejected
+	for (size_t size = 0; size < compressed.size(); ++size) {
+		DataRef result;
+		if (tryDecompress(COMPRESSION_CODEC_LZ4, compressed.data(), size, result)) {
+			fprintf(stderr, "lz4: truncated input of %zu/%zu bytes accepted\n", size, compressed.size());
+			g_failures++;
+		}
+	}
+}
+
+static void testLz4MalformedInput() {
+	//valid: 1 literal then a match of 4 bytes at offset 1
+	CHECK(!lz4Rejects(5, { 0x10, 'a', 0x01, 0x00 }));
+
+	//match offset reaching before the start of output
+	CHECK(lz4Rejects(6, { 0x10, 'a', 0x02, 0x00 }));
+	CHECK(lz4Rejects(5, { 0x00, 0x01, 0x00 }));
+	CHECK(lz4Rejects(0x10000 + 5, { 0x10, 'a', 0xff, 0xff }));
+
+	//zero offset
+	CHECK(lz4Rejects(5, { 0x10, 'a', 0x00, 0x00 }));
+
+	//offset cut in the middle
+	CHECK(lz4Rejects(5, { 0x10, 'a', 0x01 }));
+
+	//literal length bigger than the remaining input
+	CHECK(lz4Rejects(20, { 0x50, 'a', 'b' }));
+	//literal length bigger than the remaining output
+	CHECK(lz4Rejects(2, { 0x30, 'a', 'b', 'c' }));
+	//extended literal length running past the end of input, and one of the size of the address space
+	CHECK(lz4Rejects(1000, { 0xf0, 0xff, 0xff, 0xff }));
+	std::vector<unsigned char> hugeLiteral(1, 0xf0);
+	hugeLiteral.insert(hugeLiteral.end(), 4096, 0xff);
+	hugeLiteral.push_back(0x00);
+	CHECK(lz4Rejects(1000000, hugeLiteral));
+
+	//match running past the end of output
+	CHECK(lz4Rejects(6, { 0x1f, 'a', 0x01, 0x00, 0x10 }));
+
+	//decoded size differing from the declared one
+	CHECK(lz4Rejects(10, { 0x30, 'a', 'b', 'c' }));
+	CHECK(lz4Rejects(2, { 0x30, 'a', 'b', 'c' }));
+
+	//declared size LZ4 can't expand the input to, must be rejected before allocating
+	CHECK(lz4Rejects(0xffffffffffffull, { 0x1f, 'a', 0x01, 0x00, 0xff, 0xff }));
+	CHECK(lz4Rejects(~0ull, {}));
+
+	//missing size header
+	DataRef result;
+	const unsigned char tooShort[4] = { 0 };
+	CHECK(!tryDecompress(COMPRESSION_CODEC_LZ4, tooShort, sizeof(tooShort), result));
+	CHECK(!tryDecompress(COMPRESSION_CODEC_STORED, tooShort, sizeof(tooShort), result));
+
+	//stored data whose size differs from the declared one
+	auto stored = makeLz4Data(5, { 'a', 'b' });
+	CHECK(!tryDecompress(COMPRESSION_CODEC_STORED, stored.data(), stored.size(), result));
+}
+
+static void testZlibStream(const ZlibDictionary* dictionary) {
+	ZlibStreamCompressor compressor(0, dictionary);
+	ZlibStreamDecompressor decompressor(dictionary);
+
+	//similar messages, later ones should get smaller thanks to the shared history
+	size_t firstCompressedSize = 0, lastCompressedSize = 0;
+	for (unsigned int i = 0; i < 64; ++i) {
+		std::vector<unsigned char> message(20 + (i % 7) * 13);
+		for (size_t j = 0; j < message.size(); ++j)
+			message[j] = (unsigned char)(j % 10 + (i % 3));
+
+		GrowableData compressed;
+		compressor.compress(message.data(), message.size(), compressed);
+		if (i == 0)
+			firstCompressedSize = compressed.size();
+		lastCompressedSize = compressed.size();
+
+		DataRef decompressed;
+		try {
+			decompressed = decompressor.decompress(compressed.data(), compressed.size());
+		}
+		catch (...) {
+		}
+
+		CHECK(decompressed != nullptr && decompressed->size() == message.size() &&
+			memcmp(decompressed->data(), message.data(), message.size()) == 0);
+	}
+
+	CHECK(lastCompressedSize < firstCompressedSize);
+
+	//a message skipped by the receiver makes the following ones undecodable
+	ZlibStreamDecompressor lateDecompressor(dictionary);
+	std::vector<unsigned char> message(200, 'a');
+	GrowableData first, second;
+	ZlibStreamCompressor compressor2(0, dictionary);
+	compressor2.compress(message.data(), message.size(), first);
+	compressor2.compress(message.data(), message.size(), second);
+
+	bool rejected = false;
+	try {
+		lateDecompressor.decompress(second.data(), second.size());
+	}
+	catch (...) {
+		rejected = true;
+	}
+	CHECK(rejected);
+}
+
+int main() {
+	testRoundTrips();
+	testLz4TruncatedInput();
+	testLz4MalformedInput();
+
+	std::vector<unsigned char> dictionaryData(256);
+	for (size_t i = 0; i < dictionaryData.size(); ++i)
+		dictionaryData[i] = (unsigned char)(i % 10);
+	auto dictionaryRef = std::make_shared<CData>(dictionaryData.size());
+	memcpy(dictionaryRef->data(), dictionaryData.data(), dictionaryData.size());
+	ZlibDictionary dictionary(dictionaryRef);
+
+	testZlibStream(nullptr);
+	testZlibStream(&dictionary);
+
+	if (g_failures) {
+		fprintf(stderr, "%d check(s) failed\n", g_failures);
+		return 1;
+	}
+
+	printf("all compression codec tests passed\n");
+	return 0;
+}